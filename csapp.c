@@ -17,6 +17,8 @@
 #include <stdlib.h>     /* abort() */
 #include <string.h>     /* memset() */
 #include <sys/socket.h> /* struct sockaddr */
+#include <sys/stat.h>   /* lstat() */
+#include <sys/un.h>     /* struct sockaddr_un */
 #include <sys/types.h>  /* struct sockaddr */
 #include <unistd.h>     /* STDIN_FILENO */
 
@@ -51,6 +53,9 @@ handler_t *Signal(int signum, handler_t *handler) {
  * functions that are safe for signal handlers.
  *************************************************************/
 
+/* Number of write calls issued by the sio routines */
+unsigned long sio_write_count = 0;
+
 /* Private sio functions */
 
 /* sio_reverse - Reverse a string (from K&R) */
@@ -359,6 +364,7 @@ ssize_t sio_vdprintf(int fileno, const char *fmt, va_list argp) {
 
         // Write output
         if (data.len > 0) {
+            sio_write_count++;
             ssize_t ret = rio_writen(fileno, (const void *)data.str, data.len);
             if (ret < 0 || (size_t)ret != data.len) {
                 return -1;
@@ -583,25 +589,20 @@ int open_clientfd(const char *hostname, const char *port) {
 }
 
 /*
- * open_listenfd - Open and return a listening socket on port. This
- *     function is reentrant and protocol-independent.
- *
- *     On error, returns:
- *       -2 for getaddrinfo error
- *       -1 with errno set for other errors.
+ * listen_on - Open and return a listening socket on host and port, with
+ *     the given getaddrinfo flags. Returns as open_listenfd does.
  */
-int open_listenfd(const char *port) {
+static int listen_on(const char *host, const char *port, int flags) {
     struct addrinfo hints, *listp, *p;
     int listenfd = -1, rc, optval = 1;
 
     /* Get a list of potential server addresses */
     memset(&hints, 0, sizeof(struct addrinfo));
-    hints.ai_socktype = SOCK_STREAM;             /* Accept connections */
-    hints.ai_flags = AI_PASSIVE | AI_ADDRCONFIG; /* ... on any IP address */
-    hints.ai_flags |= AI_NUMERICSERV;            /* ... using port number */
-    if ((rc = getaddrinfo(NULL, port, &hints, &listp)) != 0) {
-        fprintf(stderr, "getaddrinfo failed (port %s): %s\n", port,
-                gai_strerror(rc));
+    hints.ai_socktype = SOCK_STREAM;          /* Accept connections */
+    hints.ai_flags = flags | AI_NUMERICSERV; /* ... using port number */
+    if ((rc = getaddrinfo(host, port, &hints, &listp)) != 0) {
+        fprintf(stderr, "getaddrinfo failed (%s port %s): %s\n",
+                host ? host : "any", port, gai_strerror(rc));
         return -2;
     }
 
@@ -642,3 +643,105 @@ int open_listenfd(const char *port) {
     }
     return listenfd;
 }
+
+/*
+ * open_listenfd - Open and return a listening socket on port, on any IP
+ *     address. This function is reentrant and protocol-independent.
+ *
+ *     On error, returns:
+ *       -2 for getaddrinfo error
+ *       -1 with errno set for other errors.
+ */
+int open_listenfd(const char *port) {
+    return listen_on(NULL, port, AI_PASSIVE | AI_ADDRCONFIG);
+}
+
+/*
+ * open_host_listenfd - Open and return a listening socket on port, on the
+ *     addresses of host only, or on the IPv4 loopback address if host is
+ *     NULL (clients of "localhost" fall back to it). Returns as
+ *     open_listenfd does.
+ */
+int open_host_listenfd(const char *host, const char *port) {
+    return listen_on(host ? host : "127.0.0.1", port, 0);
+}
+
+/*
+ * unix_sockaddr - Fill in a sockaddr_un for path. Returns -1 with errno
+ *     set to ENAMETOOLONG if the path does not fit.
+ */
+static int unix_sockaddr(struct sockaddr_un *addr, const char *path) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+/*
+ * open_unix_clientfd - Open connection to the Unix domain socket at path
+ *     and return a socket descriptor ready for reading and writing.
+ *
+ *     On error, returns -1 with errno set.
+ */
+int open_unix_clientfd(const char *path) {
+    struct sockaddr_un addr;
+    int clientfd;
+
+    if (unix_sockaddr(&addr, path) < 0) {
+        return -1;
+    }
+    if ((clientfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        return -1;
+    }
+    if (connect(clientfd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        int olderrno = errno;
+        close(clientfd);
+        errno = olderrno;
+        return -1;
+    }
+    return clientfd;
+}
+
+/*
+ * open_unix_listenfd - Open and return a listening Unix domain socket
+ *     bound to path. A stale socket file at path is removed first; any
+ *     other file there is left alone and the call fails with EEXIST.
+ *
+ *     On error, returns -1 with errno set.
+ */
+int open_unix_listenfd(const char *path) {
+    struct sockaddr_un addr;
+    struct stat st;
+    int listenfd;
+
+    if (unix_sockaddr(&addr, path) < 0) {
+        return -1;
+    }
+    if ((listenfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        return -1;
+    }
+
+    /* Eliminates "Address already in use" error from bind, but only
+       removes a stale socket, never a file that happens to be at path */
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            close(listenfd);
+            errno = EEXIST;
+            return -1;
+        }
+        unlink(path);
+    }
+
+    if (bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(listenfd, LISTENQ) < 0) {
+        int olderrno = errno;
+        close(listenfd);
+        errno = olderrno;
+        return -1;
+    }
+    return listenfd;
+}
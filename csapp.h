@@ -77,6 +77,9 @@ ssize_t sio_eprintf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
 ssize_t sio_vdprintf(int fileno, const char *fmt, va_list argp)
     __attribute__((format(printf, 2, 0)));
 
+/* Number of write calls issued by the sio routines */
+extern unsigned long sio_write_count;
+
 #define sio_assert(expr)                                                       \
     ((expr) ? (void)0 : __sio_assert_fail(#expr, __FILE__, __LINE__, __func__))
 
@@ -94,5 +97,8 @@ ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
 /* Reentrant protocol-independent client/server helpers */
 int open_clientfd(const char *hostname, const char *port);
 int open_listenfd(const char *port);
+int open_host_listenfd(const char *host, const char *port);
+int open_unix_clientfd(const char *path);
+int open_unix_listenfd(const char *path);
 
 #endif /* CSAPP_H */
@@ -8,7 +8,30 @@
  */
 
 #include "csapp.h"
+#include "tsh.h"
+#include "tsh_admit.h"
+#include "tsh_cgroup.h"
+#include "tsh_coord.h"
+#include "tsh_dag.h"
+#include "tsh_dedup.h"
+#include "tsh_env.h"
+#include "tsh_glob.h"
 #include "tsh_helper.h"
+#include "tsh_incr.h"
+#include "tsh_kill.h"
+#include "tsh_loop.h"
+#include "tsh_memo.h"
+#include "tsh_output.h"
+#include "tsh_reaper.h"
+#include "tsh_script.h"
+#include "tsh_serve.h"
+#include "tsh_spawn.h"
+#include "tsh_stats.h"
+#include "tsh_status.h"
+#include "tsh_supervise.h"
+#include "tsh_timeout.h"
+#include "tsh_trigger.h"
+#include "tsh_wait.h"
 
 #include <assert.h>
 #include <ctype.h>
@@ -19,7 +42,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 /*
@@ -39,22 +64,30 @@
 #define dbg_ensures(...)
 #endif
 
-/* Function prototypes */
-void eval(const char *cmdline);
+/* Delays between fork retries (see fork_backoff) */
+#define FORK_BACKOFF_BASE_NS 1000000ull  // First delay: 1ms
+#define FORK_BACKOFF_MAX_NS 256000000ull // Longest delay: 256ms
 
+/* Function prototypes */
 void sigchld_handler(int sig);
 void sigtstp_handler(int sig);
 void sigint_handler(int sig);
 void sigquit_handler(int sig);
 void cleanup(void);
 
+static jid_t run_job(jid_t jid, const struct cmdline_tokens *token,
+                     const char *cmdline, job_state state);
 void wait_SIGCHLD(void);
+void wait_stdin(void);
 int to_FG(jid_t job);
 int to_BG(jid_t job);
 
 /* Global Variables*/
-volatile sig_atomic_t flag; // Global flag
+volatile sig_atomic_t flag;        // Global flag
+volatile sig_atomic_t last_status; // Exit code of the last FG job, as `$?`
+bool stdin_readable;               // Set by the event loop when stdin is ready
 
+#ifndef TSH_LIBRARY
 /**
  * @brief Initialize global varaibles, job list and parse
  * parameters.
@@ -65,8 +98,38 @@ volatile sig_atomic_t flag; // Global flag
  */
 int main(int argc, char **argv) {
     char c;
-    char cmdline[MAXLINE_TSH]; // Cmdline for fgets
-    bool emit_prompt = true;   // Emit prompt (default)
+    char cmdline[MAXLINE_TSH];      // Cmdline read from stdin
+    rio_t rio;                      // Buffered reader for stdin
+    bool emit_prompt = true;        // Emit prompt (default)
+    const char *status_path = NULL; // Status page file, if any
+    const char *serve_spec = NULL;  // Server mode address, if any
+    const char *coord_spec = NULL;  // Coordinator mode workers, if any
+    bool use_cgroup = true;         // Give jobs cgroups, if possible
+    int spawners = 0;               // Spawner threads, if any
+    const char *script_path = NULL; // Script file to run, if any
+
+    // Long options; their values start past the range of short options
+    enum {
+        OPT_STATUS_PAGE = 256,
+        OPT_SERVE,
+        OPT_MAX_JOBS,
+        OPT_COORDINATE,
+        OPT_SUBREAPER,
+        OPT_NO_CGROUP,
+        OPT_SPAWNERS,
+        OPT_DEDUP
+    };
+    static const struct option long_opts[] = {
+        {"status-page", required_argument, NULL, OPT_STATUS_PAGE},
+        {"serve", required_argument, NULL, OPT_SERVE},
+        {"max-jobs", required_argument, NULL, OPT_MAX_JOBS},
+        {"coordinate", required_argument, NULL, OPT_COORDINATE},
+        {"subreaper", no_argument, NULL, OPT_SUBREAPER},
+        {"no-cgroup", no_argument, NULL, OPT_NO_CGROUP},
+        {"spawners", required_argument, NULL, OPT_SPAWNERS},
+        {"dedup", no_argument, NULL, OPT_DEDUP},
+        {NULL, 0, NULL, 0},
+    };
 
     // Redirect stderr to stdout (so that driver will get all output
     // on the pipe connected to stdout)
@@ -76,7 +139,56 @@ int main(int argc, char **argv) {
     }
 
     // Parse the command line
-    while ((c = getopt(argc, argv, "hvp")) != EOF) {
+    int opt;
+    while ((opt = getopt_long(argc, argv, "hvpf:", long_opts, NULL)) != EOF) {
+        c = (char)opt;
+        if (opt == OPT_STATUS_PAGE) {
+            status_path = optarg;
+            continue;
+        }
+        if (opt == OPT_SERVE) {
+            serve_spec = optarg;
+            continue;
+        }
+        if (opt == OPT_MAX_JOBS) {
+            int max_jobs = atoi(optarg);
+            if (max_jobs < 1 || max_jobs > MAXJOBS) {
+                fprintf(stderr, "--max-jobs must be between 1 and %d\n",
+                        MAXJOBS);
+                exit(1);
+            }
+            serve_set_max_jobs(max_jobs);
+            continue;
+        }
+        if (opt == OPT_COORDINATE) {
+            coord_spec = optarg;
+            continue;
+        }
+        if (opt == OPT_SUBREAPER) {
+            // Before any job is started, so that no orphan escapes
+            if (!reaper_enable()) {
+                perror("--subreaper");
+                exit(1);
+            }
+            continue;
+        }
+        if (opt == OPT_NO_CGROUP) {
+            use_cgroup = false;
+            continue;
+        }
+        if (opt == OPT_SPAWNERS) {
+            spawners = atoi(optarg);
+            if (spawners < 1 || spawners > MAXSPAWNERS) {
+                fprintf(stderr, "--spawners must be between 1 and %d\n",
+                        MAXSPAWNERS);
+                exit(1);
+            }
+            continue;
+        }
+        if (opt == OPT_DEDUP) {
+            dedup_enable();
+            continue;
+        }
         switch (c) {
         case 'h': // Prints help message
             usage();
@@ -87,6 +199,9 @@ int main(int argc, char **argv) {
         case 'p': // Disables prompt printing
             emit_prompt = false;
             break;
+        case 'f': // Runs a script file instead of reading stdin
+            script_path = optarg;
+            break;
         default:
             usage();
         }
@@ -98,6 +213,12 @@ int main(int argc, char **argv) {
         exit(1);
     }
 
+    // From now on the shell owns its environment, which jobs inherit
+    if (!env_init()) {
+        perror("env_init error");
+        exit(1);
+    }
+
     // Set buffering mode of stdout to line buffering.
     // This prevents lines from being printed in the wrong order.
     if (setvbuf(stdout, NULL, _IOLBF, 0) < 0) {
@@ -105,9 +226,32 @@ int main(int argc, char **argv) {
         exit(1);
     }
 
+    // Map the status page before any job can be published to it
+    if (status_path != NULL && !status_page_open(status_path)) {
+        perror(status_path);
+        exit(1);
+    }
+
     // Initialize the job list
     init_job_list();
 
+    // Start the event loop that carries child events and job output
+    if (!loop_init()) {
+        perror("loop_init error");
+        exit(1);
+    }
+
+    // Background jobs are handed to the spawner threads from now on
+    if (spawners > 0 && !spawn_init(spawners)) {
+        perror("spawn_init error");
+        exit(1);
+    }
+
+    // Without cgroup v2, jobs are stopped and continued with signals
+    if (use_cgroup && !cgroup_init() && verbose) {
+        fprintf(stderr, "cgroup v2 unavailable, jobs get no cgroups\n");
+    }
+
     // Register a function to clean up the job list on program termination.
     // The function may not run in the case of abnormal termination (e.g. when
     // using exit or terminating due to a signal handler), so in those cases,
@@ -127,22 +271,45 @@ int main(int argc, char **argv) {
 
     Signal(SIGQUIT, sigquit_handler);
 
+    // In server mode, commands come from clients instead of stdin
+    if (serve_spec != NULL) {
+        serve_run(serve_spec);
+    }
+    if (coord_spec != NULL) {
+        coord_run(coord_spec, emit_prompt);
+    }
+
+    // A script runs to its end, then the shell exits with its status
+    if (script_path != NULL) {
+        exit(script_file(script_path) ? last_status : EXIT_FAILURE);
+    }
+
     // Execute the shell's read/eval loop
+    rio_readinitb(&rio, STDIN_FILENO);
     while (true) {
         if (emit_prompt) {
-            printf("%s", prompt);
+            printf("%s", script_pending() ? "> " : prompt);
 
             // We must flush stdout since we are not printing a full line.
             fflush(stdout);
         }
 
-        if ((fgets(cmdline, MAXLINE_TSH, stdin) == NULL) && ferror(stdin)) {
-            perror("fgets error");
+        // Keep the event loop running until a line can be read
+        if (rio.rio_cnt <= 0) {
+            wait_stdin();
+        }
+
+        ssize_t nread = rio_readlineb(&rio, cmdline, MAXLINE_TSH);
+        if (nread < 0) {
+            perror("read error");
             exit(1);
         }
 
-        if (feof(stdin)) {
+        if (nread == 0) {
             // End of file (Ctrl-D)
+            if (script_pending()) {
+                printf("syntax error: unexpected end of file\n");
+            }
             printf("\n");
             return 0;
         }
@@ -153,12 +320,15 @@ int main(int argc, char **argv) {
             *newline = '\0';
         }
 
-        // Evaluate the command line
-        eval(cmdline);
+        // Evaluate the command line, unless it is part of a compound command
+        if (!script_feed(cmdline)) {
+            eval(cmdline);
+        }
     }
 
     return -1; // control never reaches here
 }
+#endif /* TSH_LIBRARY */
 
 /**
  * @brief Evaluate one command line
@@ -173,114 +343,39 @@ int main(int argc, char **argv) {
 void eval(const char *cmdline) {
     parseline_return parse_result;
     struct cmdline_tokens token;
+    uint64_t start_ns;
+    char expanded[MAXLINE_TSH];
 
     // Parse command line
+    start_ns = stats_now_ns();
+    cmdline = script_subst(cmdline, expanded, sizeof(expanded));
     parse_result = parseline(cmdline, &token);
+    stats_record(HIST_PARSE_NS, stats_now_ns() - start_ns);
 
     if (parse_result == PARSELINE_ERROR || parse_result == PARSELINE_EMPTY) {
+        stats_inc(STAT_EVAL);
         return;
     }
+    eval_tokens(&token, cmdline, parse_result);
+}
 
-    pid_t pid;
-    sigset_t mask_all, mask_one, mask_prev;
-    int in_fd, out_fd;
-
-    in_fd = STDIN_FILENO;
-    out_fd = STDOUT_FILENO;
-
-    sigfillset(&mask_all);
-    sigemptyset(&mask_one);
-    sigaddset(&mask_one, SIGCHLD);
+/**
+ * @brief Evaluate one parsed command line
+ *
+ * Runs the builtin or launches the job. Compound commands call this
+ * directly with their precompiled commands.
+ */
+void eval_tokens(struct cmdline_tokens *token, const char *cmdline,
+                 parseline_return parse_result) {
+    stats_inc(STAT_EVAL);
 
-    if (token.builtin == BUILTIN_NONE) {
+    if (token->builtin == BUILTIN_NONE) {
         // Not a builtin command
-        // Block SIGCHLD to prevent race
-        sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
-
-        // Create child process to run user job
-        pid = fork();
-        if (pid < 0) {
-            perror("Fork Error");
-            strerror(errno);
-        }
-
-        if (pid == 0) {
-            // Child process
-            setpgid(0, 0);
-            // Unblock all masks before pexecute cmd
-            sigprocmask(SIG_SETMASK, &mask_prev, NULL);
-            // Try to open and redirect to input output FD
-            if (token.infile) {
-                in_fd = open(token.infile, O_RDONLY);
-                if (in_fd < 0) {
-                    perror(token.infile);
-                    strerror(errno);
-                    exit(EXIT_FAILURE);
-                }
-                if (dup2(in_fd, STDIN_FILENO) < 0) {
-                    perror("Redirect Error");
-                    strerror(errno);
-                    exit(EXIT_FAILURE);
-                }
-            }
-
-            // Try to open and redirect to FD
-            if (token.outfile) {
-                out_fd = open(token.outfile, O_WRONLY | O_TRUNC | O_CREAT,
-                              S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-                if (out_fd < 0) {
-                    perror(token.outfile);
-                    strerror(errno);
-                    exit(EXIT_FAILURE);
-                }
-                if (dup2(out_fd, STDOUT_FILENO) < 0) {
-                    perror("Redirect Error");
-                    strerror(errno);
-                    exit(EXIT_FAILURE);
-                }
-            }
-
-            // Exectue command
-            if (execvp(token.argv[0], token.argv) < 0) {
-                if (token.infile)
-                    close(in_fd);
-                if (token.outfile)
-                    close(out_fd);
-                perror(cmdline);
-                strerror(errno);
-                exit(EXIT_FAILURE);
-            }
-            // Clear redirection and exit
-            if (token.infile)
-                close(in_fd);
-            if (token.outfile)
-                close(out_fd);
-            exit(EXIT_SUCCESS);
-        } else {
-            // Parent Process
-            // Block all signals to add job list
-            sigprocmask(SIG_BLOCK, &mask_all, NULL);
-            // Add process to job list
-            if (parse_result == PARSELINE_FG) {
-                add_job(pid, FG, cmdline);
-            }
-            if (parse_result == PARSELINE_BG) {
-                add_job(pid, BG, cmdline);
-            }
-            // Unblock SIGCHLD
-            sigprocmask(SIG_SETMASK, &mask_one, NULL);
-
-            // Wait if FG
-            if (parse_result == PARSELINE_BG) {
-                sigprocmask(SIG_BLOCK, &mask_all, NULL);
-                printf("[%d] (%d) %s\n", job_from_pid(pid), pid, cmdline);
-                sigprocmask(SIG_SETMASK, &mask_prev, NULL);
-            } else {
-                wait_SIGCHLD();
-            }
-            // Unblock signals
-            sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+        if (env_assign_only(token->argv)) {
+            return;
         }
+        incr_launch(token, cmdline, parse_result == PARSELINE_BG ? BG : FG,
+                    NULL);
     } else {
         // Built-in commands
         sigset_t mask_all, mask_prev;
@@ -289,36 +384,135 @@ void eval(const char *cmdline) {
         pid_t pid;
 
         sigfillset(&mask_all);
-        if (token.builtin == BUILTIN_QUIT) {
+        if (token->builtin == BUILTIN_QUIT) {
             exit(EXIT_SUCCESS);
         }
 
-        if (token.builtin == BUILTIN_JOBS) {
-            sigprocmask(SIG_SETMASK, &mask_all, &mask_prev);
+        if (token->builtin == BUILTIN_JOBS) {
+            stats_sigprocmask(SIG_SETMASK, &mask_all, &mask_prev);
 
-            if (token.outfile) {
-                if ((out_fd = open(token.outfile, O_WRONLY | O_TRUNC | O_CREAT,
+            if (token->outfile) {
+                if ((out_fd = open(token->outfile, O_WRONLY | O_TRUNC | O_CREAT,
                                    S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) <
                     0) {
-                    perror(token.outfile);
+                    perror(token->outfile);
                     strerror(errno);
-                    sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+                    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
                     return;
                 }
             }
-            if (!list_jobs(out_fd)) {
+            if (token->argv[1] && strcmp(token->argv[1], "--done") == 0) {
+                if (!list_done(out_fd)) {
+                    perror("List job failed");
+                    strerror(errno);
+                }
+            } else if (!list_jobs(out_fd)) {
                 perror("List job failed");
                 strerror(errno);
             }
-            if (token.outfile) {
+            if (token->outfile) {
                 close(out_fd);
             }
-            sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+            stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+        }
+
+        if (token->builtin == BUILTIN_STATS) {
+            stats_sigprocmask(SIG_SETMASK, &mask_all, &mask_prev);
+
+            if (token->argv[1] && strcmp(token->argv[1], "--reset") == 0) {
+                stats_reset();
+            } else if (token->argv[1]) {
+                sio_printf("stats: unknown option %s\n", token->argv[1]);
+            } else {
+                if (token->outfile) {
+                    if ((out_fd = open(token->outfile,
+                                       O_WRONLY | O_TRUNC | O_CREAT,
+                                       S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) <
+                        0) {
+                        perror(token->outfile);
+                        strerror(errno);
+                        stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+                        return;
+                    }
+                }
+                if (!stats_print(out_fd)) {
+                    perror("Print stats failed");
+                    strerror(errno);
+                }
+                if (token->outfile) {
+                    close(out_fd);
+                }
+            }
+            stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+        }
+
+        if (token->builtin == BUILTIN_CAPTURE) {
+            output_builtin_capture(token->argv);
         }
 
-        if (token.builtin == BUILTIN_FG || token.builtin == BUILTIN_BG) {
-            if (!token.argv[1]) {
-                if (token.builtin == BUILTIN_FG)
+        if (token->builtin == BUILTIN_OUTPUT) {
+            output_builtin_output(token->argv);
+        }
+
+        if (token->builtin == BUILTIN_AFTER) {
+            dag_builtin_after(cmdline, token->argv);
+        }
+
+        if (token->builtin == BUILTIN_DAG) {
+            dag_builtin_dag(token->argv);
+        }
+
+        if (token->builtin == BUILTIN_TIMEOUT) {
+            timeout_builtin(cmdline, token->argv);
+        }
+
+        if (token->builtin == BUILTIN_SUPERVISE) {
+            supervise_builtin(cmdline, token->argv);
+        }
+
+        if (token->builtin == BUILTIN_WAIT) {
+            last_status = wait_builtin(token->argv);
+        }
+
+        if (token->builtin == BUILTIN_KILL) {
+            last_status = kill_builtin(token->argv);
+        }
+
+        if (token->builtin == BUILTIN_EXPORT) {
+            last_status = env_builtin_export(token->argv);
+        }
+
+        if (token->builtin == BUILTIN_UNSET) {
+            last_status = env_builtin_unset(token->argv);
+        }
+
+        if (token->builtin == BUILTIN_ADMIT) {
+            admit_builtin(token->argv);
+        }
+
+        if (token->builtin == BUILTIN_INCREMENTAL) {
+            incr_builtin(token->argv);
+        }
+
+        if (token->builtin == BUILTIN_NEEDS) {
+            incr_builtin_needs(cmdline, token->argv);
+        }
+
+        if (token->builtin == BUILTIN_CACHE) {
+            memo_builtin(cmdline, token->argv);
+        }
+
+        if (token->builtin == BUILTIN_DEDUP) {
+            dedup_builtin(token->argv);
+        }
+
+        if (token->builtin == BUILTIN_ON_CHANGE) {
+            trigger_builtin(cmdline, token->argv);
+        }
+
+        if (token->builtin == BUILTIN_FG || token->builtin == BUILTIN_BG) {
+            if (!token->argv[1]) {
+                if (token->builtin == BUILTIN_FG)
                     sio_printf("fg");
                 else
                     sio_printf("bg");
@@ -326,33 +520,33 @@ void eval(const char *cmdline) {
                 sio_printf(" command requires PID or %%jobid argument\n");
                 return;
             }
-            sigprocmask(SIG_SETMASK, &mask_all, &mask_prev);
-            if (token.argv[1][0] == '%') {
+            stats_sigprocmask(SIG_SETMASK, &mask_all, &mask_prev);
+            if (token->argv[1][0] == '%') {
                 // JID
-                jid = atoi(token.argv[1] + 1);
+                jid = atoi(token->argv[1] + 1);
                 if (!job_exists(jid)) {
-                    printf("%s: No such job\n", token.argv[1]);
-                    sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+                    printf("%s: No such job\n", token->argv[1]);
+                    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
                     return;
                 }
             } else {
                 // PID
-                pid = atoi(token.argv[1]);
+                pid = atoi(token->argv[1]);
                 jid = job_from_pid(pid);
                 if (!jid) {
-                    if (token.builtin == BUILTIN_BG)
+                    if (token->builtin == BUILTIN_BG)
                         sio_printf("bg");
                     else
                         sio_printf("fg");
                     fflush(stdout);
                     sio_printf(": argument must be a PID or %%jobid\n");
-                    sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+                    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
                     return;
                 }
             }
-            sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+            stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
 
-            if (token.builtin == BUILTIN_FG) {
+            if (token->builtin == BUILTIN_FG) {
                 if (!to_FG(jid)) {
                     printf("Command Failed\n");
                     return;
@@ -368,10 +562,312 @@ void eval(const char *cmdline) {
     return;
 }
 
+/**
+ * @brief Launch a parsed command line as a new job
+ *
+ * Forks a child in its own process group, sets up its IO redirections and
+ * executes the command. The parent adds the child to the job list, then
+ * either reports the background job or waits for the foreground one.
+ *
+ * @return The job ID of the new job, or 0 if it could not be started
+ */
+jid_t launch_job(const struct cmdline_tokens *token, const char *cmdline,
+                 job_state state) {
+    jid_t jid;
+    if (dedup_attach(&jid, token, state)) {
+        return jid;
+    }
+    return run_job(0, token, cmdline, state);
+}
+
+/**
+ * @brief Start a waiting job in the background
+ */
+jid_t start_waiting_job(jid_t jid, const struct cmdline_tokens *token,
+                        const char *cmdline) {
+    return run_job(jid, token, cmdline, BG);
+}
+
+/**
+ * @brief Wait before retrying a fork that failed
+ *
+ * Async-signal-safe and thread-safe (nanosleep), for the spawner threads.
+ */
+bool fork_backoff(int error, int attempt) {
+    if ((error != EAGAIN && error != ENOMEM) || attempt >= FORK_RETRIES) {
+        return false;
+    }
+    uint64_t delay = FORK_BACKOFF_BASE_NS << attempt;
+    if (delay > FORK_BACKOFF_MAX_NS) {
+        delay = FORK_BACKOFF_MAX_NS;
+    }
+    struct timespec ts = {delay / 1000000000u, delay % 1000000000u};
+    // Interrupted by any signal, e.g. SIGCHLD once a child has exited
+    nanosleep(&ts, NULL);
+    return true;
+}
+
+/**
+ * @brief Fork and execute a job
+ *
+ * If `jid` is 0, the child is added to the job list as a new job; otherwise
+ * it becomes the process of the existing (waiting) job `jid`.
+ */
+static jid_t run_job(jid_t jid, const struct cmdline_tokens *token,
+                     const char *cmdline, job_state state) {
+    pid_t pid;
+    sigset_t mask_all, mask_one, mask_prev;
+    uint64_t start_ns;
+
+    // Background jobs may have to wait for their turn
+    if (state == BG && admit_hold(&jid, token, cmdline)) {
+        dedup_add(jid, token);
+        return jid;
+    }
+
+    struct capture *cap = output_prepare(state);
+    struct jobcg *cg = cgroup_prepare();
+    char **argv = glob_expand(token);
+
+    if (state == BG && spawn_active()) {
+        jid = spawn_job(jid, token, argv != NULL ? argv : (char **)token->argv,
+                        cmdline, cap, cg);
+        dedup_add(jid, token);
+        glob_free(argv);
+        return jid;
+    }
+
+    sigfillset(&mask_all);
+    sigemptyset(&mask_one);
+    sigaddset(&mask_one, SIGCHLD);
+
+    // Block SIGCHLD to prevent race
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+
+    // Create child process to run user job
+    start_ns = stats_now_ns();
+    for (int attempt = 0; (pid = fork()) < 0; attempt++) {
+        int error = errno;
+        // Let exited children be reaped meanwhile, and end the delay early
+        stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+        if (!fork_backoff(error, attempt)) {
+            errno = error;
+            perror("Fork Error");
+            stats_inc(STAT_FORK_FAIL);
+            output_attach(cap, 0);
+            cgroup_attach(cg, 0, 0);
+            glob_free(argv);
+            return 0;
+        }
+        stats_inc(STAT_FORK_RETRY);
+        stats_sigprocmask(SIG_BLOCK, &mask_all, NULL);
+    }
+    if (pid > 0) {
+        stats_inc(STAT_FORK);
+        // Also set the group here, so that the job can be signalled as a
+        // group before the child has run
+        setpgid(pid, pid);
+    }
+
+    if (pid == 0) {
+        // Child process
+        setpgid(0, 0);
+        cgroup_child(cg);
+        // Unblock all masks before pexecute cmd. Not just back to
+        // mask_prev: jobs started from loop handlers (e.g. DAG nodes or
+        // held jobs started during `wait`) are forked with all signals
+        // blocked
+        sigemptyset(&mask_one);
+        stats_sigprocmask(SIG_SETMASK, &mask_one, NULL);
+        output_child(cap);
+        exec_job(token, argv != NULL ? argv : (char **)token->argv, cmdline);
+    }
+    glob_free(argv);
+
+    // Parent Process
+    // Block all signals to add job list
+    stats_sigprocmask(SIG_BLOCK, &mask_all, NULL);
+    // Add process to job list
+    if (jid == 0) {
+        jid = add_job(pid, state, cmdline);
+    } else {
+        job_set_pid(jid, pid);
+        job_set_state(jid, state);
+    }
+    cgroup_attach(cg, jid, pid);
+    if (jid != 0) {
+        timeout_job_started(jid, state);
+    }
+    stats_record(HIST_FORK_TO_JOB_NS, stats_now_ns() - start_ns);
+    output_attach(cap, jid);
+    dedup_add(jid, token);
+    // Unblock SIGCHLD
+    stats_sigprocmask(SIG_SETMASK, &mask_one, NULL);
+
+    // Wait if FG
+    if (state == BG) {
+        stats_sigprocmask(SIG_BLOCK, &mask_all, NULL);
+        printf("[%d] (%d) %s\n", jid, pid, cmdline);
+        stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+    } else {
+        wait_SIGCHLD();
+    }
+    // Unblock signals
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+    return jid;
+}
+
+/**
+ * @brief Set up the IO redirections of a job and execute it
+ *
+ * Runs in the child process after fork and never returns.
+ */
+void exec_job(const struct cmdline_tokens *token, char **argv,
+              const char *cmdline) {
+    int in_fd = STDIN_FILENO;
+    int out_fd = STDOUT_FILENO;
+
+    argv = env_overlay(argv);
+
+    // Try to open and redirect to input output FD
+    if (token->infile) {
+        in_fd = open(token->infile, O_RDONLY);
+        if (in_fd < 0) {
+            perror(token->infile);
+            strerror(errno);
+            exit(EXIT_FAILURE);
+        }
+        if (dup2(in_fd, STDIN_FILENO) < 0) {
+            perror("Redirect Error");
+            strerror(errno);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Try to open and redirect to FD
+    if (token->outfile) {
+        out_fd = open(token->outfile, O_WRONLY | O_TRUNC | O_CREAT,
+                      S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        if (out_fd < 0) {
+            perror(token->outfile);
+            strerror(errno);
+            exit(EXIT_FAILURE);
+        }
+        if (dup2(out_fd, STDOUT_FILENO) < 0) {
+            perror("Redirect Error");
+            strerror(errno);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Nothing to execute after the assignments
+    if (argv[0] == NULL) {
+        exit(EXIT_SUCCESS);
+    }
+
+    // Exectue command
+    if (execvp(argv[0], argv) < 0) {
+        if (token->infile)
+            close(in_fd);
+        if (token->outfile)
+            close(out_fd);
+        perror(cmdline);
+        strerror(errno);
+        // Exit with 127 so the parent can count exec failures
+        exit(EXIT_EXEC_FAILURE);
+    }
+    // Clear redirection and exit
+    if (token->infile)
+        close(in_fd);
+    if (token->outfile)
+        close(out_fd);
+    exit(EXIT_SUCCESS);
+}
+
 /*****************
  * Signal handlers
  *****************/
 
+/**
+ * @brief Report a child that has ended
+ *
+ * Wakes up the main process if it was the foreground job, and deletes its
+ * job, unless the job is to be restarted. In subreaper mode this is called
+ * once the job's whole process tree has ended, with the status of its
+ * initial process. Signals must be blocked.
+ */
+void child_ended(jid_t jid, pid_t pid, int status) {
+    unsigned long serial = jid ? job_get_serial(jid) : 0;
+
+    if (fg_job() > 0 && jid == fg_job()) {
+        flag = 1;
+        last_status = wait_exit_code(status);
+    }
+    loop_post_child(jid, serial, pid, status);
+    if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_EXEC_FAILURE)
+        stats_inc(STAT_EXEC_FAIL);
+    bool timed_out = jid && timeout_expired(jid, serial);
+    if (WIFSIGNALED(status))
+        sio_printf("Job [%d] (%d) terminated by signal %d%s\n", jid, pid,
+                   WTERMSIG(status), timed_out ? " (timed out)" : "");
+    else if (timed_out)
+        sio_printf("Job [%d] (%d) timed out, exited with status %d\n", jid,
+                   pid, WEXITSTATUS(status));
+    if (jid) {
+        job_record_exit(jid, status);
+    }
+    if (jid && supervise_wants_restart(jid, serial, status)) {
+        // Keep the job ID; the supervisor restarts it later
+        job_set_pid(jid, 0);
+        job_set_state(jid, WT);
+    } else {
+        delete_job(jid);
+    }
+}
+
+/**
+ * @brief Handle a child that has been reaped, or has stopped
+ *
+ * Finds its job and reports it. Returns whether the child was reaped (as
+ * opposed to stopped). Signals must be blocked.
+ */
+bool child_reaped(pid_t pid, pid_t pgid, int status,
+                  const struct rusage *usage) {
+    jid_t jid = job_from_pid(pid);
+
+    if (jid == 0 && pgid > 0) {
+        // Subreaper mode: an orphan, which belongs to the job that
+        // leads its process group, if any
+        stats_inc(STAT_DESCENDANTS);
+        if ((jid = job_from_pid(pgid)) != 0) {
+            job_add_usage(jid, usage);
+            if (reaper_tree_done(jid, job_get_serial(jid), pgid, &status)) {
+                child_ended(jid, pgid, status);
+            }
+        }
+    } else if (WIFSTOPPED(status)) {
+        if (fg_job() > 0 && jid == fg_job()) {
+            flag = 1;
+            last_status = wait_exit_code(status);
+        }
+        loop_post_child(jid, jid ? job_get_serial(jid) : 0, pid, status);
+        job_set_state(jid, ST);
+        sio_printf("Job [%d] (%d) stopped by signal %d\n", jid, pid,
+                   WSTOPSIG(status));
+        return false;
+    } else {
+        if (jid) {
+            job_add_usage(jid, usage);
+        }
+        // The rest of the job's process group may still be running
+        if (!(jid &&
+              reaper_linger(jid, job_get_serial(jid), pid, status))) {
+            child_ended(jid, pid, status);
+        }
+    }
+    return true;
+}
+
 /**
  * @brief Child process end signal handler
  *
@@ -381,30 +877,27 @@ void eval(const char *cmdline) {
 void sigchld_handler(int sig) {
     int olderrno = errno;
     sigset_t mask_all, mask_prev;
-    pid_t pid;
-    jid_t jid;
+    pid_t pid, pgid;
     int status;
+    struct rusage usage;
+    unsigned long reaped = 0;
 
     sigfillset(&mask_all);
-
-    while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED)) > 0) {
-        sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
-        if (fg_job() > 0 && pid == job_get_pid(fg_job())) {
-            flag = 1;
+    stats_inc(STAT_SIGCHLD);
+
+    while ((pid = reaper_wait(&status, &usage, &pgid)) > 0) {
+        stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+        if (job_from_pid(pid) == 0 &&
+            spawn_hold(pid, pgid, status, &usage)) {
+            // Launched by a spawner thread, and not in the job list yet
+            reaped += !WIFSTOPPED(status);
+        } else if (child_reaped(pid, pgid, status, &usage)) {
+            reaped++;
         }
-        jid = job_from_pid(pid);
-        if (WIFSTOPPED(status)) {
-            job_set_state(jid, ST);
-            sio_printf("Job [%d] (%d) stopped by signal %d\n", jid, pid,
-                       WSTOPSIG(status));
-        } else {
-            if (WIFSIGNALED(status))
-                sio_printf("Job [%d] (%d) terminated by signal %d\n", jid, pid,
-                           WTERMSIG(status));
-            delete_job(jid);
-        }
-        sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+        stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
     }
+    stats_add(STAT_REAPED, reaped);
+    stats_record(HIST_REAPED, reaped);
 
     errno = olderrno;
 }
@@ -423,16 +916,22 @@ void sigint_handler(int sig) {
 
     sigfillset(&mask_all);
 
-    sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
     jid = fg_job();
     if (jid)
         pid = job_get_pid(jid);
 
     if (pid) {
+        script_interrupt();
         kill(-pid, SIGINT);
     } else {
+        // No foreground job: Ctrl-C stops `output --follow`, `wait` and
+        // loops
+        output_cancel_follow();
+        wait_cancel();
+        script_interrupt();
     }
-    sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
     errno = olderrno;
     return;
 }
@@ -449,18 +948,26 @@ void sigtstp_handler(int sig) {
     pid_t pid = 0;
     jid_t jid = 0;
     sigfillset(&mask_all);
-    sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
 
     jid = fg_job();
     if (jid)
         pid = job_get_pid(jid);
 
-    if (pid) {
+    if (pid && cgroup_freeze(jid, job_get_serial(jid))) {
+        // A frozen job is not stopped by a signal, so sigchld_handler never
+        // hears of it; do its part here
+        int status = W_STOPCODE(SIGTSTP);
+        flag = 1;
+        last_status = wait_exit_code(status);
+        loop_post_child(jid, job_get_serial(jid), pid, status);
+        job_set_state(jid, ST);
+        sio_printf("Job [%d] (%d) stopped by signal %d\n", jid, pid, SIGTSTP);
+    } else if (pid) {
         kill(-pid, SIGTSTP);
-    } else {
     }
 
-    sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
     errno = olderrno;
     return;
 }
@@ -468,7 +975,9 @@ void sigtstp_handler(int sig) {
 /**
  * @brief Block main process
  *
- * Block main process until further signals arrives.
+ * Block main process until further signals arrives. The event loop keeps
+ * running meanwhile, so background work (output capture, ...) continues
+ * while a foreground job runs.
  */
 void wait_SIGCHLD(void) {
     sigset_t mask;
@@ -476,11 +985,39 @@ void wait_SIGCHLD(void) {
     flag = 0;
 
     while (flag == 0) {
-        sigsuspend(&mask);
+        loop_wait(-1, &mask);
     }
     return;
 }
 
+/**
+ * @brief Event loop handler for stdin
+ */
+static void stdin_ready(int fd, uint32_t events, void *arg) {
+    stdin_readable = true;
+}
+
+/**
+ * @brief Run the event loop until stdin is readable
+ *
+ * Regular files cannot be watched by epoll, but they are always readable,
+ * so for those the loop only dispatches pending events.
+ */
+void wait_stdin(void) {
+    static bool pollable = true;
+
+    stdin_readable = false;
+    if (pollable && loop_add(STDIN_FILENO, EPOLLIN, stdin_ready, NULL)) {
+        while (!stdin_readable) {
+            loop_run_once(-1);
+        }
+        loop_remove(STDIN_FILENO);
+    } else {
+        pollable = false;
+        loop_run_once(0);
+    }
+}
+
 /**
  * @brief Send Stopped jobs and background jobs to foreground
  */
@@ -491,7 +1028,7 @@ int to_FG(jid_t jid) {
     sigfillset(&mask_all);
     sigaddset(&mask_one, SIGCHLD);
 
-    sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
 
     pid = job_get_pid(jid);
     state = job_get_state(jid);
@@ -499,21 +1036,25 @@ int to_FG(jid_t jid) {
     case FG:
     case UNDEF:
         perror("JOB STATE INVALID");
-        sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+        stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+        return 0;
+    case WT:
+        sio_printf("[%d] is waiting for its dependencies\n", jid);
+        stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
         return 0;
     case BG:
     case ST:
     default:
         job_set_state(jid, FG);
-        if (state == ST) {
+        if (state == ST && !cgroup_thaw(jid, job_get_serial(jid))) {
             kill(-pid, SIGCONT);
         }
-        sigprocmask(SIG_SETMASK, &mask_one, NULL);
+        stats_sigprocmask(SIG_SETMASK, &mask_one, NULL);
         wait_SIGCHLD();
         break;
     }
 
-    sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
     return 1;
 }
 
@@ -527,14 +1068,16 @@ int to_BG(jid_t jid) {
     sigfillset(&mask_all);
     sigaddset(&mask_one, SIGCHLD);
 
-    sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
 
     pid = job_get_pid(jid);
     state = job_get_state(jid);
     switch (state) {
     case ST:
         job_set_state(jid, BG);
-        kill(-pid, SIGCONT);
+        if (!cgroup_thaw(jid, job_get_serial(jid))) {
+            kill(-pid, SIGCONT);
+        }
         sio_printf("[%d] (%d) %s \n", jid, pid, job_get_cmdline(jid));
         break;
     case BG:
@@ -542,13 +1085,13 @@ int to_BG(jid_t jid) {
     case UNDEF:
     case FG:
         perror("JOB STATE INVALID");
-        sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+        stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
         return 0;
     default:
         break;
     }
 
-    sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
     return 1;
 }
 
@@ -564,5 +1107,7 @@ void cleanup(void) {
     Signal(SIGTSTP, SIG_DFL); // Handles Ctrl-Z
     Signal(SIGCHLD, SIG_DFL); // Handles terminated or stopped child
 
+    cgroup_cleanup();
     destroy_job_list();
+    status_page_close();
 }
@@ -0,0 +1,151 @@
+/**
+ * @file tsh.h
+ * @brief Interfaces exported by tsh.c to the shell's other modules
+ *
+ * The shell's modules (server mode, schedulers, ...) launch jobs through the
+ * same machinery as the read/eval loop. These routines are not
+ * async-signal-safe and must be called from the main program.
+ */
+
+#ifndef TSH_H
+#define TSH_H
+
+#include <signal.h>
+
+#include "tsh_helper.h"
+
+/* Exit status of a child that could not exec its command */
+#define EXIT_EXEC_FAILURE 127
+
+/* Retries of a fork that failed for lack of processes or memory */
+#define FORK_RETRIES 10
+
+/* This variable is externally defined in tsh.c. */
+extern volatile sig_atomic_t last_status; ///< Exit code, as `$?`
+
+/**
+ * @brief Evaluates one command line, exactly as typed at the prompt.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void eval(const char *cmdline);
+
+/**
+ * @brief Evaluates a command line that has already been parsed.
+ *
+ * @param[in] token         The parsed command line.
+ * @param[in] cmdline       The command line, as recorded in the job list
+ *                          and reparsed by builtins that run commands.
+ * @param[in] parse_result  What `parseline` returned for it (foreground or
+ *                          background).
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void eval_tokens(struct cmdline_tokens *token, const char *cmdline,
+                 parseline_return parse_result);
+
+/**
+ * @brief Launches a parsed, non-builtin command line as a new job.
+ *
+ * A foreground job is waited for before this function returns; a
+ * background job is announced on stdout. In single-flight mode (see
+ * tsh_dedup.h), a duplicate of a live job is attached to it instead.
+ *
+ * @param[in] token    The parsed command line.
+ * @param[in] cmdline  The command line, as recorded in the job list.
+ * @param[in] state    `FG` or `BG`.
+ *
+ * @return The job ID of the new job (or of the job it was attached to), or
+ *         0 if it could not be started
+ *
+ * @pre Signals must not be blocked.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+jid_t launch_job(const struct cmdline_tokens *token, const char *cmdline,
+                 job_state state);
+
+/**
+ * @brief Starts a waiting (`WT`) job in the background.
+ *
+ * Forks the job's process and moves the job to the `BG` state, keeping its
+ * job ID. The job is announced on stdout.
+ *
+ * @param[in] jid      The waiting job.
+ * @param[in] token    The parsed command line to run.
+ * @param[in] cmdline  The command line to run, for error messages.
+ *
+ * @return `jid`, or 0 if the job could not be started
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+jid_t start_waiting_job(jid_t jid, const struct cmdline_tokens *token,
+                        const char *cmdline);
+
+/**
+ * @brief Waits before retrying a fork (or posix_spawn) that failed.
+ *
+ * Only EAGAIN and ENOMEM are retried, up to `FORK_RETRIES` times. The delay
+ * starts at 1ms and doubles with every attempt, up to 256ms, so that a
+ * burst of jobs under process or memory pressure slows down instead of
+ * failing. A signal, e.g. SIGCHLD for a child that has exited and freed its
+ * slot, ends the delay early.
+ *
+ * @param[in] error    The error of the failed attempt.
+ * @param[in] attempt  The number of retries so far.
+ *
+ * @return true once the delay has passed, false if the launch is to fail
+ *
+ * @remark Async-signal-safety: Async-signal-safe; also thread-safe.
+ */
+bool fork_backoff(int error, int attempt);
+
+/**
+ * @brief Reports a job whose process (or, in subreaper mode, whose whole
+ *        process tree) has ended, and deletes it unless it is restarted.
+ *
+ * @param[in] jid     The job, or 0 for a child that is not a job.
+ * @param[in] pid     The process.
+ * @param[in] status  The raw status from waitpid.
+ *
+ * @pre Signals must be blocked.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void child_ended(jid_t jid, pid_t pid, int status);
+
+/**
+ * @brief Handles a child that has been reaped, or has stopped, as
+ *        `sigchld_handler` does for each child.
+ *
+ * @param[in] pid     The child.
+ * @param[in] pgid    Its process group in subreaper mode, or 0.
+ * @param[in] status  The raw status from waitpid.
+ * @param[in] usage   The resources it used.
+ *
+ * @return true if the child was reaped, false if it stopped
+ *
+ * @pre Signals must be blocked.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool child_reaped(pid_t pid, pid_t pgid, int status,
+                  const struct rusage *usage);
+
+/**
+ * @brief Reaps children and updates the job list. Installed for SIGCHLD.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void sigchld_handler(int sig);
+
+/**
+ * @brief Sets up the IO redirections of a job and executes it.
+ *
+ * To be called in a freshly forked child; never returns.
+ *
+ * @param[in] token    The parsed command line, for its redirections.
+ * @param[in] argv     Its arguments, after glob expansion.
+ * @param[in] cmdline  The command line, for error messages.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void exec_job(const struct cmdline_tokens *token, char **argv,
+              const char *cmdline) __attribute__((noreturn));
+
+#endif /* TSH_H */
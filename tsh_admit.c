@@ -0,0 +1,523 @@
+/**
+ * @file tsh_admit.c
+ * @brief Admission control for background jobs.
+ *
+ * For documentation related to usage, see the corresponding header file at
+ * tsh_admit.h.
+ */
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "csapp.h"
+#include "tsh.h"
+#include "tsh_admit.h"
+#include "tsh_helper.h"
+#include "tsh_loop.h"
+#include "tsh_stats.h"
+#include "tsh_timeout.h"
+#include "tsh_timer.h"
+
+#define SAMPLE_NS 100000000ull  // How often pressure and load are read
+#define MIN_DELAY_NS 1000000ull // Shortest wait for a token
+#define NRESOURCES 3            // Resources with a pressure file
+
+// What a job is held back by
+enum reason { REASON_NONE = 0, REASON_RATE, REASON_PRESSURE, REASON_LOAD };
+
+// Struct used to store a held job, indexed by job ID
+struct held_job {
+    unsigned long serial;         // Serial number of the job, 0 if unused
+    unsigned long seq;            // Order of submission
+    struct cmdline_tokens *token; // Its parsed command line (a copy)
+    char *cmdline;                // Its command line
+    volatile sig_atomic_t reason; // What it is held back by; read by `jobs`
+};
+
+static const char *const resources[NRESOURCES] = {"cpu", "memory", "io"};
+static const char *const reasons[] = {[REASON_NONE] = NULL,
+                                      [REASON_RATE] = "rate",
+                                      [REASON_PRESSURE] = "pressure",
+                                      [REASON_LOAD] = "load"};
+
+/* Static variables */
+static double rate = 0;                    // Tokens per second, 0 for none
+static double burst = 0;                   // Most tokens that accumulate
+static double tokens = 0;                  // Tokens available
+static uint64_t refill_ns = 0;             // When tokens were last added
+static double max_pressure[NRESOURCES] = {-1, -1, -1}; // Percent, or -1
+static double max_load = -1;               // Load average limit, or -1
+static double pressure[NRESOURCES];        // Last pressure readings
+static double load;                        // Last load average reading
+static uint64_t sampled_ns = 0;            // When they were read, 0 for never
+static struct held_job holds[MAXJOBS + 1]; // Indexed by job ID
+static int nholds = 0;                     // Number of held jobs
+static unsigned long next_seq = 1;         // Order of the next held job
+static struct timer *timer = NULL;         // Pending release, or NULL
+static bool releasing = false;             // Starting a held job
+
+/*
+ * limited - Whether any limit is set
+ */
+static bool limited(void) {
+    if (rate > 0 || max_load >= 0) {
+        return true;
+    }
+    for (int i = 0; i < NRESOURCES; i++) {
+        if (max_pressure[i] >= 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * read_pressure - Read the `some avg10` pressure of a resource; returns -1
+ * if the kernel does not report it
+ */
+static double read_pressure(const char *resource) {
+    char path[64], buf[256];
+    double avg10;
+
+    snprintf(path, sizeof(path), "/proc/pressure/%s", resource);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) {
+        return -1;
+    }
+    buf[n] = '\0';
+    if (sscanf(buf, "some avg10=%lf", &avg10) != 1) {
+        return -1;
+    }
+    return avg10;
+}
+
+/*
+ * sample - Read the pressure and load that have limits, unless they were
+ * read recently
+ */
+static void sample(uint64_t now) {
+    if (sampled_ns != 0 && now - sampled_ns < SAMPLE_NS) {
+        return;
+    }
+    sampled_ns = now;
+    for (int i = 0; i < NRESOURCES; i++) {
+        if (max_pressure[i] >= 0) {
+            pressure[i] = read_pressure(resources[i]);
+        }
+    }
+    if (max_load >= 0 && getloadavg(&load, 1) != 1) {
+        load = -1;
+    }
+}
+
+/*
+ * check - Whether a job may start now, taking a token if so
+ */
+static enum reason check(void) {
+    uint64_t now = stats_now_ns();
+
+    if (!limited()) {
+        return REASON_NONE;
+    }
+    sample(now);
+    for (int i = 0; i < NRESOURCES; i++) {
+        if (max_pressure[i] >= 0 && pressure[i] > max_pressure[i]) {
+            return REASON_PRESSURE;
+        }
+    }
+    if (max_load >= 0 && load > max_load) {
+        return REASON_LOAD;
+    }
+    if (rate > 0) {
+        tokens += (double)(now - refill_ns) * rate / 1e9;
+        if (tokens > burst) {
+            tokens = burst;
+        }
+        refill_ns = now;
+        if (tokens < 1) {
+            return REASON_RATE;
+        }
+        tokens -= 1;
+    }
+    return REASON_NONE;
+}
+
+/*
+ * next_delay - How long to wait before checking again
+ */
+static uint64_t next_delay(enum reason reason) {
+    if (reason != REASON_RATE) {
+        return SAMPLE_NS;
+    }
+    uint64_t delay = (uint64_t)((1 - tokens) / rate * 1e9);
+    return delay < MIN_DELAY_NS ? MIN_DELAY_NS : delay;
+}
+
+/*
+ * forget - Free a held job's record
+ */
+static void forget(struct held_job *h) {
+    free(h->token);
+    free(h->cmdline);
+    memset(h, 0, sizeof(*h));
+    nholds--;
+}
+
+/*
+ * oldest - The held job that was submitted first, or 0 if there is none
+ */
+static jid_t oldest(void) {
+    jid_t best = 0;
+    for (jid_t jid = 1; jid <= MAXJOBS; jid++) {
+        if (holds[jid].serial != 0 &&
+            (best == 0 || holds[jid].seq < holds[best].seq)) {
+            best = jid;
+        }
+    }
+    return best;
+}
+
+/*
+ * still_held - Whether a held job is still in the job list, waiting
+ */
+static bool still_held(jid_t jid) {
+    sigset_t mask_all, mask_prev;
+    bool waiting;
+
+    sigfillset(&mask_all);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+    waiting = job_exists(jid) && job_get_serial(jid) == holds[jid].serial &&
+              job_get_state(jid) == WT;
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+    return waiting;
+}
+
+/*
+ * drop_job - Delete a held job that could not be started
+ *
+ * Child listeners are told that the job was terminated, as if its process
+ * had been killed.
+ */
+static void drop_job(jid_t jid) {
+    sigset_t mask_all, mask_prev;
+
+    sigfillset(&mask_all);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+    loop_post_child(jid, job_get_serial(jid), 0, W_EXITCODE(0, SIGTERM));
+    delete_job(jid);
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+}
+
+static void release(void *arg);
+
+/*
+ * schedule - Check again for the held jobs after a delay
+ */
+static void schedule(uint64_t delay_ns) {
+    if (timer != NULL) {
+        return;
+    }
+    if ((timer = timer_add(delay_ns, release, NULL)) == NULL) {
+        perror("admit");
+    }
+}
+
+/*
+ * release - Timer callback: start held jobs, oldest first, for as long as
+ * they are admitted
+ */
+static void release(void *arg) {
+    jid_t jid;
+
+    timer = NULL;
+    while ((jid = oldest()) != 0) {
+        struct held_job *h = &holds[jid];
+        if (!still_held(jid)) {
+            // Dropped meanwhile, e.g. by `supervise --stop`
+            forget(h);
+            continue;
+        }
+        enum reason reason = check();
+        if (reason != REASON_NONE) {
+            for (jid_t i = 1; i <= MAXJOBS; i++) {
+                holds[i].reason = holds[i].serial != 0 ? reason : 0;
+            }
+            schedule(next_delay(reason));
+            return;
+        }
+
+        struct cmdline_tokens *token = h->token;
+        char *cmdline = h->cmdline;
+        h->token = NULL;
+        h->cmdline = NULL;
+        forget(h);
+        releasing = true;
+        if (start_waiting_job(jid, token, cmdline) == 0) {
+            drop_job(jid);
+        }
+        releasing = false;
+        free(token);
+        free(cmdline);
+    }
+}
+
+/*
+ * copy_string - Copy a string into the backing buffer of a token struct
+ */
+static bool copy_string(struct cmdline_tokens *token, size_t *used,
+                        char **dst, const char *src) {
+    if (src == NULL) {
+        *dst = NULL;
+        return true;
+    }
+    size_t len = strlen(src) + 1;
+    if (*used + len > sizeof(token->_buf)) {
+        return false;
+    }
+    *dst = memcpy(token->_buf + *used, src, len);
+    *used += len;
+    return true;
+}
+
+/*
+ * copy_tokens - Copy a parsed command line, whose arguments may point
+ * anywhere (e.g. into a script), into one allocation
+ */
+static struct cmdline_tokens *copy_tokens(const struct cmdline_tokens *src) {
+    struct cmdline_tokens *token = malloc(sizeof(*token));
+    size_t used = 0;
+    bool ok = token != NULL;
+
+    for (int i = 0; ok && i < src->argc; i++) {
+        ok = copy_string(token, &used, &token->argv[i], src->argv[i]);
+    }
+    ok = ok && copy_string(token, &used, &token->infile, src->infile) &&
+         copy_string(token, &used, &token->outfile, src->outfile);
+    if (!ok) {
+        free(token);
+        return NULL;
+    }
+    token->argc = src->argc;
+    token->argv[src->argc] = NULL;
+    memcpy(token->quoted, src->quoted, sizeof(token->quoted));
+    token->builtin = src->builtin;
+    return token;
+}
+
+/*
+ * admit_hold - Hold a background job back, unless it may start now
+ */
+bool admit_hold(jid_t *jid, const struct cmdline_tokens *token,
+                const char *cmdline) {
+    sigset_t mask_all, mask_prev;
+    jid_t first;
+    enum reason reason;
+
+    if (releasing || !limited()) {
+        return false;
+    }
+    // Jobs are started in order, so a new one queues behind held ones
+    if ((first = oldest()) != 0) {
+        reason = holds[first].reason;
+    } else if ((reason = check()) == REASON_NONE) {
+        return false;
+    }
+
+    struct cmdline_tokens *copy = copy_tokens(token);
+    char *cmdline_copy = strdup(cmdline);
+    if (copy == NULL || cmdline_copy == NULL) {
+        // Better late than never: start it now
+        free(copy);
+        free(cmdline_copy);
+        return false;
+    }
+
+    sigfillset(&mask_all);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+    if (*jid == 0 && (*jid = add_job(0, WT, cmdline)) == 0) {
+        stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+        free(copy);
+        free(cmdline_copy);
+        return false;
+    }
+    struct held_job *h = &holds[*jid];
+    h->serial = job_get_serial(*jid);
+    h->seq = next_seq++;
+    h->token = copy;
+    h->cmdline = cmdline_copy;
+    h->reason = reason;
+    nholds++;
+    timeout_job_held(*jid);
+    stats_inc(reason == REASON_RATE ? STAT_HELD_RATE : STAT_HELD_LOAD);
+    printf("[%d] (held: %s) %s\n", *jid, reasons[reason], cmdline);
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+
+    schedule(next_delay(reason));
+    return true;
+}
+
+/*
+ * admit_reason - What a job is held back by
+ * Async-signal-safe
+ */
+const char *admit_reason(jid_t jid, unsigned long serial) {
+    if (jid <= 0 || jid > MAXJOBS || holds[jid].serial != serial) {
+        return NULL;
+    }
+    return reasons[holds[jid].reason];
+}
+
+/*
+ * show - Print the limits, readings and held jobs
+ */
+static void show(void) {
+    if (!limited()) {
+        printf("admit: no limits\n");
+        return;
+    }
+    sampled_ns = 0;
+    sample(stats_now_ns());
+    if (rate > 0) {
+        printf("rate: %g/s, burst %g (%.1f tokens)\n", rate, burst, tokens);
+    }
+    for (int i = 0; i < NRESOURCES; i++) {
+        if (max_pressure[i] >= 0) {
+            printf("pressure: %s > %g%% (now %.2f%%)\n", resources[i],
+                   max_pressure[i], pressure[i]);
+        }
+    }
+    if (max_load >= 0) {
+        printf("load: > %g (now %.2f)\n", max_load, load);
+    }
+    printf("held: %d\n", nholds);
+}
+
+/*
+ * parse_pressure - Parse RES=PCT[,RES=PCT...] into `limits`
+ */
+static bool parse_pressure(char *spec, double *limits) {
+    char *save = NULL;
+
+    for (char *item = strtok_r(spec, ",", &save); item != NULL;
+         item = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(item, '=');
+        char *end;
+        int i;
+        if (eq == NULL) {
+            return false;
+        }
+        *eq = '\0';
+        i = 0;
+        while (i < NRESOURCES && strcmp(item, resources[i]) != 0) {
+            i++;
+        }
+        if (i == NRESOURCES) {
+            printf("admit: unknown resource %s\n", item);
+            return false;
+        }
+        limits[i] = strtod(eq + 1, &end);
+        if (*end != '\0' || eq[1] == '\0' || limits[i] < 0 ||
+            limits[i] > 100) {
+            return false;
+        }
+        if (read_pressure(resources[i]) < 0) {
+            printf("admit: /proc/pressure/%s is not available\n",
+                   resources[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * admit_usage - Print the usage of the `admit` builtin
+ */
+static void admit_usage(void) {
+    printf("admit: usage: admit [--rate RATE[,BURST]] "
+           "[--pressure RES=PCT[,...]] [--load LOAD] | admit off\n");
+}
+
+/*
+ * admit_builtin - The `admit` builtin
+ */
+void admit_builtin(char **argv) {
+    double new_rate = rate, new_burst = burst, new_load = max_load;
+    double limits[NRESOURCES];
+    char *end;
+
+    memcpy(limits, max_pressure, sizeof(limits));
+    if (argv[1] == NULL) {
+        show();
+        return;
+    }
+    if (strcmp(argv[1], "off") == 0 && argv[2] == NULL) {
+        new_rate = 0;
+        new_load = -1;
+        for (int i = 0; i < NRESOURCES; i++) {
+            limits[i] = -1;
+        }
+    } else {
+        for (int i = 1; argv[i] != NULL; i += 2) {
+            char *value = argv[i + 1];
+            if (value == NULL) {
+                admit_usage();
+                return;
+            }
+            if (strcmp(argv[i], "--rate") == 0) {
+                new_rate = strtod(value, &end);
+                new_burst = new_rate < 1 ? 1 : new_rate;
+                if (*end == ',') {
+                    new_burst = strtod(end + 1, &end);
+                }
+                if (*end != '\0' || new_rate <= 0 || new_burst < 1) {
+                    printf("admit: invalid rate %s\n", value);
+                    return;
+                }
+            } else if (strcmp(argv[i], "--pressure") == 0) {
+                char spec[MAXLINE_TSH];
+                snprintf(spec, sizeof(spec), "%s", value);
+                if (!parse_pressure(spec, limits)) {
+                    printf("admit: invalid pressure limit %s\n", value);
+                    return;
+                }
+            } else if (strcmp(argv[i], "--load") == 0) {
+                new_load = strtod(value, &end);
+                if (*end != '\0' || value[0] == '\0' || new_load < 0) {
+                    printf("admit: invalid load %s\n", value);
+                    return;
+                }
+            } else {
+                admit_usage();
+                return;
+            }
+        }
+    }
+
+    // A new rate starts with a full bucket
+    if (new_rate != rate || new_burst != burst) {
+        tokens = new_burst;
+        refill_ns = stats_now_ns();
+    }
+    rate = new_rate;
+    burst = new_burst;
+    max_load = new_load;
+    memcpy(max_pressure, limits, sizeof(limits));
+    sampled_ns = 0;
+
+    // Held jobs may be admitted under the new limits
+    timer_cancel(timer);
+    timer = NULL;
+    release(NULL);
+}
@@ -0,0 +1,83 @@
+/**
+ * @file tsh_admit.h
+ * @brief Admission control for background jobs: launch rate limit and
+ *        system pressure gating
+ *
+ * Once a limit is set, a new background job is only started if the system
+ * is not saturated and a token is available. Otherwise it is added to the
+ * job list as `Waiting`, and `jobs` shows what it is held back by. Held
+ * jobs are started in the order they were submitted, from a timer, as soon
+ * as tokens come back and the pressure drops. Foreground jobs are never
+ * held.
+ *
+ * Tokens accumulate at the given rate, up to the burst size, so a burst of
+ * submissions starts at most BURST jobs at once and the rest at RATE per
+ * second. Pressure is the `some avg10` figure of `/proc/pressure/cpu`,
+ * `memory` and `io` (the share of the last 10 seconds in which some task
+ * was stalled on the resource); load is the 1-minute load average. Both
+ * are sampled at most every 100ms while jobs are launched or held.
+ *
+ * Builtins:
+ *
+ *     admit [--rate RATE[,BURST]] [--pressure RES=PCT[,RES=PCT...]]
+ *           [--load LOAD]
+ *         Set limits: RATE jobs per second (BURST defaults to RATE, and at
+ *         least 1), and hold jobs while the pressure on RES (`cpu`,
+ *         `memory` or `io`) exceeds PCT percent, or while the load average
+ *         exceeds LOAD
+ *     admit off
+ *         Remove all limits; held jobs are started right away
+ *     admit
+ *         Show the limits, the current readings and the number of held jobs
+ *
+ * The timeout of a held job (see tsh_timeout.h) starts when the job does.
+ */
+
+#ifndef TSH_ADMIT_H
+#define TSH_ADMIT_H
+
+#include <stdbool.h>
+
+#include "tsh_helper.h"
+
+/**
+ * @brief Implements the `admit` builtin.
+ *
+ * @param[in] argv  The parsed arguments.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void admit_builtin(char **argv);
+
+/**
+ * @brief Decides whether a background job may start now, or holds it.
+ *
+ * A held job is added to the job list as `WT` (if `*jid` is 0) and
+ * announced; it is started later with `start_waiting_job`.
+ *
+ * @param[in,out] jid      0 for a new job, or an existing waiting job;
+ *                         receives the job ID of a new job that is held.
+ * @param[in]     token    The parsed command line; it is copied.
+ * @param[in]     cmdline  The command line, as recorded in the job list.
+ *
+ * @return true if the job is held, false if it is to be started now
+ *
+ * @pre Signals must not be blocked.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool admit_hold(jid_t *jid, const struct cmdline_tokens *token,
+                const char *cmdline);
+
+/**
+ * @brief Returns what a job is held back by, for `jobs`.
+ *
+ * @param[in] jid     The job.
+ * @param[in] serial  The job's serial number.
+ *
+ * @return "rate", "pressure" or "load", or NULL if the job is not held
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+const char *admit_reason(jid_t jid, unsigned long serial);
+
+#endif /* TSH_ADMIT_H */
@@ -0,0 +1,361 @@
+/**
+ * @file tsh_cgroup.c
+ * @brief Per-job cgroups, frozen and thawed instead of SIGTSTP/SIGCONT.
+ *
+ * For documentation related to usage, see the corresponding header file at
+ * tsh_cgroup.h.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "csapp.h"
+#include "tsh_cgroup.h"
+#include "tsh_helper.h"
+#include "tsh_loop.h"
+#include "tsh_stats.h"
+
+// Struct used to store the cgroup of a job
+struct jobcg {
+    char name[32];      // Directory name, below the shell's cgroup
+    int procs_fd;       // Its cgroup.procs, until the job is attached
+    int freeze_fd;      // Its cgroup.freeze
+    struct jobcg *next; // Next cgroup that could not be removed yet
+};
+
+// Struct used to store the cgroup bound to a job, indexed by job ID
+struct job_cgroup {
+    unsigned long serial;         // Serial number of the job, 0 if unused
+    struct jobcg *cg;             // The job's cgroup
+    volatile sig_atomic_t frozen; // Frozen by the shell
+};
+
+/* Static variables */
+static int base_fd = -1;                    // The shell's cgroup directory
+static char base_name[32];                  // Its name in its parent
+static int parent_fd = -1;                  // The directory containing it
+static unsigned long nextcg = 1;            // Number of the next cgroup
+static struct job_cgroup jobs[MAXJOBS + 1]; // Indexed by job ID
+static struct jobcg *stale = NULL;          // Cgroups still populated
+static bool listening = false;              // Child listener registered
+
+/*
+ * find_mount - Find where the cgroup v2 hierarchy is mounted
+ */
+static bool find_mount(char *mount, size_t size) {
+    FILE *fp = fopen("/proc/self/mountinfo", "r");
+    char line[1024];
+    bool found = false;
+
+    if (fp == NULL) {
+        return false;
+    }
+    // Fields: ID PARENT MAJ:MIN ROOT MOUNTPOINT OPTIONS... - FSTYPE ...
+    while (!found && fgets(line, sizeof(line), fp) != NULL) {
+        char point[PATH_MAX];
+        char *sep = strstr(line, " - ");
+        if (sep == NULL || strncmp(sep + 3, "cgroup2 ", 8) != 0) {
+            continue;
+        }
+        if (sscanf(line, "%*s %*s %*s %*s %4095s", point) == 1 &&
+            strlen(point) < size) {
+            strcpy(mount, point);
+            found = true;
+        }
+    }
+    fclose(fp);
+    return found;
+}
+
+/*
+ * find_own - Find the shell's own cgroup in the cgroup v2 hierarchy
+ */
+static bool find_own(char *path, size_t size) {
+    FILE *fp = fopen("/proc/self/cgroup", "r");
+    char line[PATH_MAX];
+    bool found = false;
+
+    if (fp == NULL) {
+        return false;
+    }
+    // The cgroup v2 line is "0::PATH"
+    while (!found && fgets(line, sizeof(line), fp) != NULL) {
+        if (strncmp(line, "0::", 3) != 0) {
+            continue;
+        }
+        line[strcspn(line, "\n")] = '\0';
+        if (strlen(line + 3) < size) {
+            strcpy(path, line + 3);
+            found = true;
+        }
+    }
+    fclose(fp);
+    return found;
+}
+
+/*
+ * cgroup_init - Create the shell's cgroup
+ */
+bool cgroup_init(void) {
+    char mount[PATH_MAX], own[PATH_MAX], path[2 * PATH_MAX];
+
+    if (!find_mount(mount, sizeof(mount)) || !find_own(own, sizeof(own))) {
+        return false;
+    }
+    snprintf(path, sizeof(path), "%s%s", mount, own);
+    if ((parent_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+        return false;
+    }
+
+    snprintf(base_name, sizeof(base_name), "tsh-%d", (int)getpid());
+    if ((mkdirat(parent_fd, base_name, 0755) < 0 && errno != EEXIST) ||
+        (base_fd = openat(parent_fd, base_name,
+                          O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+        close(parent_fd);
+        parent_fd = -1;
+        return false;
+    }
+
+    // cgroup.freeze only exists in non-root cgroups, since Linux 5.2
+    if (faccessat(base_fd, "cgroup.freeze", W_OK, 0) < 0) {
+        close(base_fd);
+        base_fd = -1;
+        unlinkat(parent_fd, base_name, AT_REMOVEDIR);
+        close(parent_fd);
+        parent_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+/*
+ * release - Remove a job's cgroup, or keep it for later if it is still
+ * populated
+ */
+static void release(struct jobcg *cg) {
+    if (cg->freeze_fd >= 0) {
+        close(cg->freeze_fd);
+        cg->freeze_fd = -1;
+    }
+    if (unlinkat(base_fd, cg->name, AT_REMOVEDIR) < 0 && errno == EBUSY) {
+        cg->next = stale;
+        stale = cg;
+        return;
+    }
+    free(cg);
+}
+
+/*
+ * sweep - Retry removing the cgroups that were still populated
+ */
+static void sweep(void) {
+    struct jobcg *cg = stale;
+    stale = NULL;
+    while (cg != NULL) {
+        struct jobcg *next = cg->next;
+        release(cg);
+        cg = next;
+    }
+}
+
+/*
+ * unbind - Forget the cgroup bound to a job, and remove it
+ * Signals must be blocked
+ */
+static void unbind(jid_t jid) {
+    struct job_cgroup *j = &jobs[jid];
+    if (j->cg == NULL) {
+        return;
+    }
+    if (j->frozen) {
+        // Processes left in the cgroup must not stay frozen for good
+        ssize_t ret = write(j->cg->freeze_fd, "0", 1);
+        (void)ret;
+    }
+    release(j->cg);
+    j->cg = NULL;
+    j->serial = 0;
+    j->frozen = 0;
+}
+
+/*
+ * cgroup_child_event - Child listener: remove the cgroup of a job that ended
+ */
+static void cgroup_child_event(const struct child_event *event, void *arg) {
+    if (event->jid <= 0 || event->jid > MAXJOBS || WIFSTOPPED(event->status)) {
+        return;
+    }
+    sigset_t mask_all, mask_prev;
+    sigfillset(&mask_all);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+    if (jobs[event->jid].serial == event->serial) {
+        unbind(event->jid);
+    }
+    sweep();
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+}
+
+/*
+ * cgroup_lost - Lost-event task: remove the cgroups of jobs
+ * whose events were dropped
+ */
+static void cgroup_lost(void) {
+    struct child_event event;
+
+    for (jid_t jid = 1; jid <= MAXJOBS; jid++) {
+        if (jobs[jid].serial != 0 &&
+            loop_lost_event(jid, jobs[jid].serial, &event)) {
+            cgroup_child_event(&event, NULL);
+        }
+    }
+}
+
+/*
+ * cgroup_prepare - Create the cgroup of a job about to be forked
+ */
+struct jobcg *cgroup_prepare(void) {
+    if (base_fd < 0) {
+        return NULL;
+    }
+    if (!listening) {
+        if (!loop_on_child(cgroup_child_event, NULL) ||
+            !loop_on_lost(cgroup_lost)) {
+            return NULL;
+        }
+        listening = true;
+    }
+
+    struct jobcg *cg = calloc(1, sizeof(*cg));
+    char file[64];
+    if (cg == NULL) {
+        perror("cgroup");
+        return NULL;
+    }
+    snprintf(cg->name, sizeof(cg->name), "job%lu", nextcg++);
+    cg->procs_fd = cg->freeze_fd = -1;
+    if (mkdirat(base_fd, cg->name, 0755) < 0) {
+        perror("cgroup");
+        free(cg);
+        return NULL;
+    }
+    snprintf(file, sizeof(file), "%s/cgroup.procs", cg->name);
+    cg->procs_fd = openat(base_fd, file, O_WRONLY | O_CLOEXEC);
+    snprintf(file, sizeof(file), "%s/cgroup.freeze", cg->name);
+    cg->freeze_fd = openat(base_fd, file, O_WRONLY | O_CLOEXEC);
+    if (cg->procs_fd < 0 || cg->freeze_fd < 0) {
+        perror("cgroup");
+        if (cg->procs_fd >= 0) {
+            close(cg->procs_fd);
+        }
+        release(cg);
+        return NULL;
+    }
+    return cg;
+}
+
+/*
+ * cgroup_child - Move the calling process into a prepared cgroup
+ * Async-signal-safe
+ */
+void cgroup_child(struct jobcg *cg) {
+    if (cg != NULL) {
+        // "0" stands for the writing process
+        ssize_t ret = write(cg->procs_fd, "0", 1);
+        (void)ret;
+    }
+}
+
+/*
+ * cgroup_enter - Move a process into a prepared cgroup
+ */
+void cgroup_enter(struct jobcg *cg, pid_t pid) {
+    if (cg != NULL && pid > 0) {
+        char buf[16];
+        int len = snprintf(buf, sizeof(buf), "%d", (int)pid);
+        ssize_t ret = write(cg->procs_fd, buf, (size_t)len);
+        (void)ret;
+    }
+}
+
+/*
+ * cgroup_attach - Bind a prepared cgroup to its job
+ */
+void cgroup_attach(struct jobcg *cg, jid_t jid, pid_t pid) {
+    if (cg == NULL) {
+        return;
+    }
+    // Like setpgid, done by both processes so that neither has to wait
+    cgroup_enter(cg, pid);
+    close(cg->procs_fd);
+    cg->procs_fd = -1;
+    if (jid == 0) {
+        release(cg);
+        return;
+    }
+
+    // A restarted job gets a new cgroup; the old one may still be bound
+    unbind(jid);
+    jobs[jid].serial = job_get_serial(jid);
+    jobs[jid].cg = cg;
+    jobs[jid].frozen = 0;
+}
+
+/*
+ * cgroup_freeze - Freeze the cgroup of a job
+ * Async-signal-safe
+ */
+bool cgroup_freeze(jid_t jid, unsigned long serial) {
+    if (jid <= 0 || jid > MAXJOBS || jobs[jid].cg == NULL ||
+        jobs[jid].serial != serial) {
+        return false;
+    }
+    if (write(jobs[jid].cg->freeze_fd, "1", 1) != 1) {
+        return false;
+    }
+    jobs[jid].frozen = 1;
+    return true;
+}
+
+/*
+ * cgroup_thaw - Thaw the cgroup of a job, if it was frozen
+ * Async-signal-safe
+ */
+bool cgroup_thaw(jid_t jid, unsigned long serial) {
+    if (jid <= 0 || jid > MAXJOBS || jobs[jid].cg == NULL ||
+        jobs[jid].serial != serial || !jobs[jid].frozen) {
+        return false;
+    }
+    if (write(jobs[jid].cg->freeze_fd, "0", 1) != 1) {
+        return false;
+    }
+    jobs[jid].frozen = 0;
+    return true;
+}
+
+/*
+ * cgroup_cleanup - Remove the shell's cgroups
+ */
+void cgroup_cleanup(void) {
+    if (base_fd < 0) {
+        return;
+    }
+    for (jid_t jid = 1; jid <= MAXJOBS; jid++) {
+        unbind(jid);
+    }
+    sweep();
+    close(base_fd);
+    base_fd = -1;
+    // Fails if jobs are still running in their cgroups; they keep them
+    unlinkat(parent_fd, base_name, AT_REMOVEDIR);
+    close(parent_fd);
+    parent_fd = -1;
+}
@@ -0,0 +1,118 @@
+/**
+ * @file tsh_cgroup.h
+ * @brief Per-job cgroups, frozen and thawed instead of SIGTSTP/SIGCONT
+ *
+ * When cgroup v2 is mounted and the shell may create cgroups below its own
+ * (e.g. as root, or in a delegated subtree), every job is started in a
+ * cgroup of its own, `tsh-<shell PID>/job<N>`. The child moves itself there
+ * before it executes the command, so all of its descendants are in it too,
+ * whatever process group or session they end up in.
+ *
+ * Ctrl-Z then freezes the job's cgroup through `cgroup.freeze` instead of
+ * sending SIGTSTP to its process group, and `fg`/`bg` thaw it instead of
+ * sending SIGCONT. The kernel freezes the whole tree at once, processes
+ * cannot catch or ignore it, and a frozen job does not race to fork new
+ * children while the shell stops the old ones. A job stopped by a real
+ * signal (e.g. `kill -STOP`) is still continued with SIGCONT.
+ *
+ * Without cgroup v2, or with `--no-cgroup`, jobs are stopped and continued
+ * with signals as before. A job's cgroup is removed once the job has ended
+ * and its cgroup is empty.
+ */
+
+#ifndef TSH_CGROUP_H
+#define TSH_CGROUP_H
+
+#include <stdbool.h>
+
+#include "tsh_helper.h"
+
+/** @brief Opaque cgroup of one job */
+struct jobcg;
+
+/**
+ * @brief Finds the cgroup v2 hierarchy and creates the shell's cgroup.
+ *
+ * @return true if jobs will get cgroups, false if cgroup v2 is unavailable
+ *         or cgroups cannot be created
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool cgroup_init(void);
+
+/**
+ * @brief Removes the shell's cgroups, thawing any frozen jobs first.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void cgroup_cleanup(void);
+
+/**
+ * @brief Creates the cgroup for a job that is about to be forked.
+ *
+ * @return The new cgroup, or NULL if jobs do not get cgroups or it could not
+ *         be created
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+struct jobcg *cgroup_prepare(void);
+
+/**
+ * @brief Moves the calling process into a prepared cgroup.
+ *
+ * To be called in the child after fork. Does nothing if `cg` is NULL.
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void cgroup_child(struct jobcg *cg);
+
+/**
+ * @brief Moves a process into a prepared cgroup, from the parent side.
+ *
+ * For launchers that cannot run code in the child (see tsh_spawn.h); only
+ * writes to the cgroup's own file, so it may be called from any thread
+ * until `cgroup_attach`. Does nothing if `cg` is NULL.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void cgroup_enter(struct jobcg *cg, pid_t pid);
+
+/**
+ * @brief Binds a prepared cgroup to its job.
+ *
+ * To be called in the parent after fork, with the job's PID (0 if fork
+ * failed), which is moved into the cgroup as well so that the job can be
+ * frozen right away. If the job could not be added (`jid` is 0), the
+ * cgroup is discarded. Does nothing if `cg` is NULL.
+ *
+ * @pre Any signals that could modify the job list must be blocked.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void cgroup_attach(struct jobcg *cg, jid_t jid, pid_t pid);
+
+/**
+ * @brief Freezes the cgroup of a job.
+ *
+ * @param[in] jid     The job.
+ * @param[in] serial  The job's serial number.
+ *
+ * @return true if the job was frozen, false if it has no cgroup (it must
+ *         then be stopped with a signal)
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool cgroup_freeze(jid_t jid, unsigned long serial);
+
+/**
+ * @brief Thaws the cgroup of a job, if it was frozen.
+ *
+ * @param[in] jid     The job.
+ * @param[in] serial  The job's serial number.
+ *
+ * @return true if the job was frozen and has been thawed, false otherwise
+ *         (it must then be continued with a signal)
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool cgroup_thaw(jid_t jid, unsigned long serial);
+
+#endif /* TSH_CGROUP_H */
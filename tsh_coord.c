@@ -0,0 +1,609 @@
+/**
+ * @file tsh_coord.c
+ * @brief Coordinator mode: work distribution across tsh workers.
+ *
+ * For documentation related to usage, see the corresponding header file at
+ * tsh_coord.h.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "csapp.h"
+#include "tsh_coord.h"
+#include "tsh_helper.h"
+#include "tsh_loop.h"
+
+// States of a remote job
+typedef enum rjob_state {
+    RJ_QUEUED,   // In a worker's deque
+    RJ_STARTING, // Sent to a worker, waiting for its job ID
+    RJ_RUNNING,  // Running on a worker
+    RJ_DONE,     // Finished on a worker
+    RJ_LOST      // Its worker went away
+} rjob_state;
+
+struct worker;
+
+// Struct used to store remote jobs
+struct rjob {
+    int id;                // Coordinator job ID, printed as R<id>
+    char *cmdline;         // Command line
+    rjob_state state;      // See rjob_state
+    struct worker *worker; // Worker that queues or runs the job
+    jid_t remote_jid;      // Job ID on the worker, once running
+    int status;            // Raw exit status, once done
+    bool stolen;           // Whether the job was stolen from another worker
+    struct rjob *prev;     // Deque or reply-queue links
+    struct rjob *next;
+};
+
+// Struct used to store worker connections
+struct worker {
+    char *addr;              // Address as given on the command line
+    int fd;                  // Connected socket, or -1 once disconnected
+    char in[MAXLINE];        // Partial reply line
+    size_t inlen;            // Bytes used in `in`
+    int slots;               // Job limit reported by the worker, 0 if unknown
+    int running;             // Jobs started or starting on the worker
+    bool busy;               // Worker refused a job; wait for an exit
+    int pending_ctl;         // Replies expected to hello/watch requests
+    struct rjob *head;       // Front of the deque of queued jobs
+    struct rjob *tail;       // Back of the deque of queued jobs
+    int nqueued;             // Length of the deque
+    struct rjob *await_head; // Jobs waiting for a reply to "run"
+    struct rjob *await_tail;
+};
+
+/* Static variables */
+static struct worker *workers = NULL; // All workers
+static int nworkers = 0;              // Number of workers
+static struct rjob **rjobs = NULL;    // All remote jobs, indexed by id - 1
+static int nrjobs = 0;                // Number of remote jobs
+static int nactive = 0;               // Remote jobs not yet done or lost
+static bool input_done = false;       // stdin reached EOF
+static bool prompt_enabled = true;    // Print a prompt after each read
+
+/*******************
+ * Deque operations
+ *******************/
+
+static void push_back(struct worker *w, struct rjob *j) {
+    j->worker = w;
+    j->next = NULL;
+    j->prev = w->tail;
+    if (w->tail) {
+        w->tail->next = j;
+    } else {
+        w->head = j;
+    }
+    w->tail = j;
+    w->nqueued++;
+}
+
+static void push_front(struct worker *w, struct rjob *j) {
+    j->worker = w;
+    j->prev = NULL;
+    j->next = w->head;
+    if (w->head) {
+        w->head->prev = j;
+    } else {
+        w->tail = j;
+    }
+    w->head = j;
+    w->nqueued++;
+}
+
+static struct rjob *pop_front(struct worker *w) {
+    struct rjob *j = w->head;
+    if (j == NULL) {
+        return NULL;
+    }
+    w->head = j->next;
+    if (w->head) {
+        w->head->prev = NULL;
+    } else {
+        w->tail = NULL;
+    }
+    w->nqueued--;
+    j->next = j->prev = NULL;
+    return j;
+}
+
+static struct rjob *pop_back(struct worker *w) {
+    struct rjob *j = w->tail;
+    if (j == NULL) {
+        return NULL;
+    }
+    w->tail = j->prev;
+    if (w->tail) {
+        w->tail->next = NULL;
+    } else {
+        w->head = NULL;
+    }
+    w->nqueued--;
+    j->next = j->prev = NULL;
+    return j;
+}
+
+/***********************
+ * Scheduling and steals
+ ***********************/
+
+/*
+ * least_loaded - Connected worker with the fewest queued and running jobs
+ */
+static struct worker *least_loaded(void) {
+    struct worker *best = NULL;
+    for (int i = 0; i < nworkers; i++) {
+        struct worker *w = &workers[i];
+        if (w->fd < 0) {
+            continue;
+        }
+        if (best == NULL ||
+            w->running + w->nqueued < best->running + best->nqueued) {
+            best = w;
+        }
+    }
+    return best;
+}
+
+/*
+ * steal - Take the newest queued job of the worker with the longest deque
+ */
+static struct rjob *steal(struct worker *thief) {
+    struct worker *victim = NULL;
+    for (int i = 0; i < nworkers; i++) {
+        struct worker *w = &workers[i];
+        if (w != thief && w->nqueued > 0 &&
+            (victim == NULL || w->nqueued > victim->nqueued)) {
+            victim = w;
+        }
+    }
+    if (victim == NULL) {
+        return NULL;
+    }
+
+    struct rjob *j = pop_back(victim);
+    j->stolen = true;
+    if (verbose) {
+        fprintf(stderr, "coord: %s stole [R%d] from %s\n", thief->addr, j->id,
+                victim->addr);
+    }
+    return j;
+}
+
+static void worker_lost(struct worker *w);
+
+/*
+ * worker_send - Write a request to a worker; false if it is gone. A worker
+ * that went away must not kill the coordinator with SIGPIPE
+ */
+static bool worker_send(struct worker *w, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(w->fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return false;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+/*
+ * schedule - Start queued or stolen jobs while the worker has free slots
+ */
+static void schedule(struct worker *w) {
+    while (w->fd >= 0 && !w->busy && w->slots > 0 && w->running < w->slots) {
+        struct rjob *j = pop_front(w);
+        if (j == NULL && (j = steal(w)) == NULL) {
+            return;
+        }
+
+        char line[MAXLINE];
+        int len = snprintf(line, sizeof(line), "run %s\n", j->cmdline);
+        j->worker = w;
+        j->state = RJ_STARTING;
+        j->next = NULL;
+        if (w->await_tail) {
+            w->await_tail->next = j;
+        } else {
+            w->await_head = j;
+        }
+        w->await_tail = j;
+        w->running++;
+        if (!worker_send(w, line, (size_t)len)) {
+            worker_lost(w);
+            return;
+        }
+    }
+}
+
+/*
+ * schedule_all - Give every worker a chance to start or steal jobs
+ */
+static void schedule_all(void) {
+    for (int i = 0; i < nworkers; i++) {
+        schedule(&workers[i]);
+    }
+}
+
+/*
+ * finish - Mark a remote job as finished
+ */
+static void finish(struct rjob *j, rjob_state state) {
+    j->state = state;
+    nactive--;
+}
+
+/*
+ * submit - Queue a command line on the least loaded worker
+ */
+static void submit(const char *cmdline) {
+    struct worker *w = least_loaded();
+    if (w == NULL) {
+        printf("No workers available\n");
+        return;
+    }
+
+    struct rjob **r = realloc(rjobs, sizeof(*r) * (size_t)(nrjobs + 1));
+    struct rjob *j = calloc(1, sizeof(*j));
+    if (r == NULL || j == NULL || (j->cmdline = strdup(cmdline)) == NULL) {
+        perror("submit");
+        free(j);
+        if (r != NULL) {
+            rjobs = r;
+        }
+        return;
+    }
+    rjobs = r;
+    rjobs[nrjobs++] = j;
+    j->id = nrjobs;
+    j->state = RJ_QUEUED;
+    nactive++;
+
+    push_back(w, j);
+    printf("[R%d] queued on %s %s\n", j->id, w->addr, cmdline);
+    schedule_all();
+}
+
+/*********************
+ * Worker connections
+ *********************/
+
+/*
+ * worker_lost - Handle a worker disconnect: its running jobs are lost and
+ * its queued jobs move to the remaining workers
+ */
+static void worker_lost(struct worker *w) {
+    printf("Worker %s disconnected\n", w->addr);
+    loop_remove(w->fd);
+    close(w->fd);
+    w->fd = -1;
+
+    for (int i = 0; i < nrjobs; i++) {
+        struct rjob *j = rjobs[i];
+        if (j->worker == w &&
+            (j->state == RJ_STARTING || j->state == RJ_RUNNING)) {
+            printf("[R%d] lost on %s %s\n", j->id, w->addr, j->cmdline);
+            finish(j, RJ_LOST);
+        }
+    }
+    w->running = 0;
+    w->await_head = w->await_tail = NULL;
+
+    struct rjob *j;
+    while ((j = pop_front(w)) != NULL) {
+        struct worker *to = least_loaded();
+        if (to == NULL) {
+            printf("[R%d] lost: no workers left %s\n", j->id, j->cmdline);
+            finish(j, RJ_LOST);
+        } else {
+            push_back(to, j);
+        }
+    }
+    schedule_all();
+}
+
+/*
+ * find_running - Find the job running on a worker under a remote job ID
+ */
+static struct rjob *find_running(struct worker *w, jid_t jid) {
+    for (int i = 0; i < nrjobs; i++) {
+        struct rjob *j = rjobs[i];
+        if (j->worker == w && j->state == RJ_RUNNING && j->remote_jid == jid) {
+            return j;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * handle_reply - Process one line received from a worker
+ */
+static void handle_reply(struct worker *w, char *line) {
+    int jid, pid, value;
+
+    if (sscanf(line, "exit %d %d %d", &jid, &pid, &value) == 3 ||
+        sscanf(line, "signal %d %d %d", &jid, &pid, &value) == 3) {
+        struct rjob *j = find_running(w, jid);
+        if (j == NULL) {
+            return; // Not one of ours
+        }
+        if (line[0] == 'e') {
+            j->status = value << 8;
+            printf("[R%d] (%s job %d) exited with status %d\n", j->id,
+                   w->addr, jid, value);
+        } else {
+            j->status = value;
+            printf("[R%d] (%s job %d) terminated by signal %d\n", j->id,
+                   w->addr, jid, value);
+        }
+        finish(j, RJ_DONE);
+        w->running--;
+        w->busy = false;
+        schedule_all();
+        return;
+    }
+    if (strncmp(line, "stopped ", 8) == 0) {
+        return;
+    }
+
+    if (w->pending_ctl > 0) {
+        // Replies to hello and watch, in that order
+        w->pending_ctl--;
+        if (sscanf(line, "ok slots %d", &value) == 1) {
+            w->slots = value > 0 ? value : 1;
+        }
+        if (w->pending_ctl == 0) {
+            schedule_all();
+        }
+        return;
+    }
+
+    struct rjob *j = w->await_head;
+    if (j == NULL) {
+        return;
+    }
+    w->await_head = j->next;
+    if (w->await_head == NULL) {
+        w->await_tail = NULL;
+    }
+    j->next = NULL;
+
+    if (sscanf(line, "ok %d", &jid) == 1) {
+        j->state = RJ_RUNNING;
+        j->remote_jid = jid;
+    } else if (strcmp(line, "err busy") == 0) {
+        // The worker is full with other clients' jobs; retry after its
+        // next exit notification
+        w->running--;
+        w->busy = true;
+        j->state = RJ_QUEUED;
+        push_front(w, j);
+    } else {
+        w->running--;
+        printf("[R%d] rejected by %s: %s\n", j->id, w->addr, line);
+        j->status = EXIT_FAILURE << 8;
+        finish(j, RJ_DONE);
+        schedule_all();
+    }
+}
+
+/*
+ * worker_ready - Read and process replies from a worker
+ */
+static void worker_ready(int fd, uint32_t events, void *arg) {
+    struct worker *w = arg;
+    char buf[MAXLINE];
+    ssize_t n = read(fd, buf, sizeof(buf));
+
+    if (n < 0 && errno == EINTR) {
+        return;
+    }
+    if (n <= 0) {
+        worker_lost(w);
+        return;
+    }
+    for (ssize_t i = 0; i < n; i++) {
+        if (buf[i] == '\n') {
+            w->in[w->inlen] = '\0';
+            handle_reply(w, w->in);
+            w->inlen = 0;
+        } else if (w->inlen < sizeof(w->in) - 1) {
+            w->in[w->inlen++] = buf[i];
+        }
+    }
+    fflush(stdout);
+}
+
+/*
+ * worker_connect - Connect to a worker and subscribe to its exit events
+ */
+static bool worker_connect(struct worker *w) {
+    static const char hello[] = "hello\nwatch\n";
+
+    if (strncmp(w->addr, "unix:", 5) == 0) {
+        w->fd = open_unix_clientfd(w->addr + 5);
+    } else {
+        char *colon = strrchr(w->addr, ':');
+        if (colon == NULL) {
+            fprintf(stderr, "%s: expected HOST:PORT or unix:PATH\n", w->addr);
+            return false;
+        }
+        *colon = '\0';
+        w->fd = open_clientfd(w->addr, colon + 1);
+        *colon = ':';
+    }
+    if (w->fd < 0) {
+        perror(w->addr);
+        w->fd = -1;
+        return false;
+    }
+
+    w->pending_ctl = 2;
+    if (!worker_send(w, hello, sizeof(hello) - 1) ||
+        !loop_add(w->fd, EPOLLIN, worker_ready, w)) {
+        perror(w->addr);
+        close(w->fd);
+        w->fd = -1;
+        return false;
+    }
+    return true;
+}
+
+/******************
+ * Command input
+ ******************/
+
+/*
+ * list_rjobs - The coordinator's `jobs` builtin
+ */
+static void list_rjobs(void) {
+    for (int i = 0; i < nrjobs; i++) {
+        struct rjob *j = rjobs[i];
+        switch (j->state) {
+        case RJ_QUEUED:
+            printf("[R%d] Queued     %s %s\n", j->id, j->worker->addr,
+                   j->cmdline);
+            break;
+        case RJ_STARTING:
+        case RJ_RUNNING:
+            printf("[R%d] Running    %s%s %s\n", j->id, j->worker->addr,
+                   j->stolen ? " (stolen)" : "", j->cmdline);
+            break;
+        case RJ_DONE:
+        case RJ_LOST:
+            break;
+        }
+    }
+}
+
+/*
+ * coord_eval - Evaluate one command line in coordinator mode
+ */
+static void coord_eval(const char *cmdline) {
+    struct cmdline_tokens token;
+    parseline_return parse_result = parseline(cmdline, &token);
+
+    if (parse_result == PARSELINE_ERROR || parse_result == PARSELINE_EMPTY) {
+        return;
+    }
+    switch (token.builtin) {
+    case BUILTIN_NONE:
+        submit(cmdline);
+        break;
+    case BUILTIN_QUIT:
+        exit(EXIT_SUCCESS);
+    case BUILTIN_JOBS:
+        list_rjobs();
+        break;
+    default:
+        printf("%s: not supported in coordinator mode\n", token.argv[0]);
+        break;
+    }
+}
+
+/*
+ * read_input - Read and evaluate available command lines from stdin
+ */
+static void read_input(int fd, uint32_t events, void *arg) {
+    static char line[MAXLINE_TSH];
+    static size_t len = 0;
+    char buf[MAXLINE];
+    ssize_t n = read(fd, buf, sizeof(buf));
+
+    if (n < 0 && errno == EINTR) {
+        return;
+    }
+    if (n <= 0) {
+        if (len > 0) {
+            line[len] = '\0';
+            coord_eval(line);
+            len = 0;
+        }
+        input_done = true;
+        loop_remove(fd);
+        return;
+    }
+    for (ssize_t i = 0; i < n; i++) {
+        if (buf[i] == '\n') {
+            line[len] = '\0';
+            coord_eval(line);
+            len = 0;
+        } else if (len < sizeof(line) - 1) {
+            line[len++] = buf[i];
+        }
+    }
+    if (prompt_enabled) {
+        printf("%s", prompt);
+    }
+    fflush(stdout);
+}
+
+/*
+ * coord_run - Connect to the workers and distribute commands forever
+ */
+void coord_run(const char *spec, bool emit_prompt) {
+    char *list = strdup(spec);
+    int connected = 0;
+
+    prompt_enabled = emit_prompt;
+    if (list == NULL || !loop_init()) {
+        perror("coord_run");
+        exit(1);
+    }
+
+    for (char *p = list; *p != '\0'; p += strcspn(p, ",")) {
+        p += strspn(p, ",");
+        if (*p != '\0') {
+            nworkers++;
+        }
+    }
+    if ((workers = calloc((size_t)nworkers, sizeof(*workers))) == NULL) {
+        perror("coord_run");
+        exit(1);
+    }
+    int i = 0;
+    for (char *addr = strtok(list, ","); addr; addr = strtok(NULL, ",")) {
+        workers[i].addr = addr;
+        workers[i].fd = -1;
+        if (worker_connect(&workers[i])) {
+            connected++;
+        }
+        i++;
+    }
+    if (connected == 0) {
+        fprintf(stderr, "coord: no workers could be reached\n");
+        exit(1);
+    }
+
+    if (prompt_enabled) {
+        printf("%s", prompt);
+        fflush(stdout);
+    }
+    if (!loop_add(STDIN_FILENO, EPOLLIN, read_input, NULL)) {
+        // Regular files cannot be polled; they are always readable
+        while (!input_done) {
+            read_input(STDIN_FILENO, EPOLLIN, NULL);
+        }
+    }
+
+    while (!input_done || nactive > 0) {
+        loop_run_once(-1);
+    }
+    if (prompt_enabled) {
+        printf("\n");
+    }
+    exit(EXIT_SUCCESS);
+}
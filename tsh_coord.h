@@ -0,0 +1,38 @@
+/**
+ * @file tsh_coord.h
+ * @brief Coordinator mode: work distribution across tsh workers
+ *
+ * With `--coordinate ADDR[,ADDR...]` the shell reads command lines as
+ * usual, but runs them on a set of worker shells started with
+ * `tsh --serve ADDR [--max-jobs N]`. Each ADDR is `HOST:PORT` or
+ * `unix:PATH`, so a whole cluster can be tested on loopback.
+ *
+ * Each worker keeps its own job table and job limit. The coordinator keeps
+ * one deque of queued commands per worker: new commands go to the least
+ * loaded worker, a worker takes work from the front of its own deque as
+ * slots free up, and a worker whose deque runs dry steals from the back of
+ * the longest deque. Exit notifications flow back from the workers into
+ * the coordinator's list of remote jobs, which the `jobs` builtin prints.
+ *
+ * The coordinator exits once its input is exhausted and every remote job
+ * has finished.
+ */
+
+#ifndef TSH_COORD_H
+#define TSH_COORD_H
+
+#include <stdbool.h>
+
+/**
+ * @brief Runs the shell as a coordinator. Never returns.
+ *
+ * @param[in] workers      Comma-separated list of worker addresses.
+ * @param[in] emit_prompt  Whether to print a prompt before each line.
+ *
+ * @pre The job list must be initialized and the signal handlers installed.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void coord_run(const char *workers, bool emit_prompt)
+    __attribute__((noreturn));
+
+#endif /* TSH_COORD_H */
@@ -0,0 +1,431 @@
+/**
+ * @file tsh_dag.c
+ * @brief Job dependencies: deferred jobs and job graphs.
+ *
+ * For documentation related to usage, see the corresponding header file at
+ * tsh_dag.h.
+ */
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "csapp.h"
+#include "tsh.h"
+#include "tsh_dag.h"
+#include "tsh_helper.h"
+#include "tsh_loop.h"
+#include "tsh_stats.h"
+
+#define DAG_NAME_MAX 64 // Longest node name in a graph file
+
+// Struct used to store a waiting job
+struct dag_node {
+    jid_t jid;                   // The WT job standing in for the node
+    unsigned long serial;        // Serial number of that job
+    char *cmd;                   // Command to run
+    unsigned long deps[MAXJOBS]; // Serials of unfinished prerequisites
+    int ndeps;                   // Number of entries in deps
+    bool ok_only;                // Cancel if a prerequisite fails
+    struct dag_node *next;       // Next waiting job
+};
+
+// Struct used to store one line of a graph file while it is parsed
+struct dag_entry {
+    char name[DAG_NAME_MAX]; // Node name
+    int deps[MAXJOBS];       // Indices of prerequisite entries
+    int ndeps;               // Number of entries in deps
+    char *cmd;               // Command to run
+    struct dag_node *node;   // The node, once submitted
+};
+
+/* Static variables */
+static struct dag_node *nodes = NULL; // All waiting jobs
+static bool listening = false;        // Child listener registered
+
+static void resolve(unsigned long serial, bool ok);
+
+/*
+ * check_command - Whether a command can be deferred, printing why if not
+ */
+static bool check_command(const char *who, const char *cmd) {
+    struct cmdline_tokens token;
+    parseline_return ret = parseline(cmd, &token);
+
+    if (ret == PARSELINE_ERROR || ret == PARSELINE_EMPTY) {
+        printf("%s: missing or invalid command\n", who);
+        return false;
+    }
+    if (token.builtin != BUILTIN_NONE) {
+        printf("%s: cannot defer builtin %s\n", who, token.argv[0]);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * dag_child - Child listener: resolve the dependencies on a finished job
+ */
+static void dag_child(const struct child_event *event, void *arg) {
+    sigset_t mask_all, mask_prev;
+    bool alive;
+
+    if (event->serial == 0 || WIFSTOPPED(event->status)) {
+        return;
+    }
+    // A job that is still in the job list (e.g. a supervised job about to
+    // be restarted) has not finished yet
+    sigfillset(&mask_all);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+    alive = job_exists(event->jid) &&
+            job_get_serial(event->jid) == event->serial;
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+    if (alive) {
+        return;
+    }
+    resolve(event->serial,
+            WIFEXITED(event->status) && WEXITSTATUS(event->status) == 0);
+}
+
+/*
+ * dag_lost - Lost-event task: resolve the prerequisites that ended while
+ * their events were dropped
+ */
+static void dag_lost(void) {
+    struct child_event event;
+    struct dag_node *node = nodes;
+
+    while (node != NULL) {
+        int i = 0;
+        while (i < node->ndeps &&
+               !loop_lost_event(0, node->deps[i], &event)) {
+            i++;
+        }
+        if (i == node->ndeps) {
+            node = node->next;
+            continue;
+        }
+        // Resolving may change the list; the serial is gone from it after
+        dag_child(&event, NULL);
+        node = nodes;
+    }
+}
+
+/*
+ * node_add - Add a waiting job to the job list and to the waiting nodes
+ */
+static struct dag_node *node_add(const char *who, const char *cmd,
+                                 const char *display, bool ok_only) {
+    sigset_t mask_all, mask_prev;
+    struct dag_node *node;
+
+    if (!listening) {
+        if (!loop_on_child(dag_child, NULL) || !loop_on_lost(dag_lost)) {
+            printf("%s: cannot track job completions\n", who);
+            return NULL;
+        }
+        listening = true;
+    }
+    if ((node = calloc(1, sizeof(*node))) == NULL ||
+        (node->cmd = strdup(cmd)) == NULL) {
+        perror(who);
+        free(node);
+        return NULL;
+    }
+    node->ok_only = ok_only;
+
+    sigfillset(&mask_all);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+    node->jid = add_job(0, WT, display);
+    if (node->jid != 0) {
+        node->serial = job_get_serial(node->jid);
+    }
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+
+    if (node->jid == 0) {
+        printf("%s: too many jobs\n", who);
+        free(node->cmd);
+        free(node);
+        return NULL;
+    }
+    node->next = nodes;
+    nodes = node;
+    return node;
+}
+
+/*
+ * node_unlink - Remove a node from the waiting nodes
+ */
+static void node_unlink(struct dag_node *node) {
+    for (struct dag_node **pp = &nodes; *pp != NULL; pp = &(*pp)->next) {
+        if (*pp == node) {
+            *pp = node->next;
+            return;
+        }
+    }
+}
+
+/*
+ * node_drop - Remove a waiting job from the job list and free its node
+ */
+static void node_drop(struct dag_node *node) {
+    sigset_t mask_all, mask_prev;
+
+    node_unlink(node);
+    sigfillset(&mask_all);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+    delete_job(node->jid);
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+    free(node->cmd);
+    free(node);
+}
+
+/*
+ * node_cancel - Drop a waiting job that cannot run, and then everything
+ * that depends on it
+ */
+static void node_cancel(struct dag_node *node, const char *why) {
+    unsigned long serial = node->serial;
+
+    printf("[%d] cancelled: %s\n", node->jid, why);
+    node_drop(node);
+    resolve(serial, false);
+}
+
+/*
+ * node_start - Start a waiting job whose prerequisites have all finished
+ */
+static void node_start(struct dag_node *node) {
+    struct cmdline_tokens token;
+
+    // The command was checked when the node was added
+    parseline(node->cmd, &token);
+    if (start_waiting_job(node->jid, &token, node->cmd) == 0) {
+        node_cancel(node, "could not start");
+        return;
+    }
+    node_unlink(node);
+    free(node->cmd);
+    free(node);
+}
+
+/*
+ * resolve - Record that the job with a serial number has finished
+ */
+static void resolve(unsigned long serial, bool ok) {
+    struct dag_node *node = nodes;
+
+    while (node != NULL) {
+        int i = 0;
+        while (i < node->ndeps && node->deps[i] != serial) {
+            i++;
+        }
+        if (i == node->ndeps) {
+            node = node->next;
+            continue;
+        }
+
+        node->deps[i] = node->deps[--node->ndeps];
+        if (!ok && node->ok_only) {
+            node_cancel(node, "a prerequisite failed");
+        } else if (node->ndeps == 0) {
+            node_start(node);
+        } else {
+            node = node->next;
+            continue;
+        }
+        // The list has changed under us; every node already visited has
+        // dropped this serial, so starting over is safe
+        node = nodes;
+    }
+}
+
+/*
+ * dag_builtin_after - The `after` builtin
+ */
+void dag_builtin_after(const char *cmdline, char **argv) {
+    sigset_t mask_all, mask_prev;
+    unsigned long deps[MAXJOBS];
+    int ndeps = 0;
+    bool ok_only = false;
+    int i = 1;
+
+    if (argv[i] != NULL && strcmp(argv[i], "--ok") == 0) {
+        ok_only = true;
+        i++;
+    }
+
+    sigfillset(&mask_all);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+    for (; argv[i] != NULL && argv[i][0] == '%'; i++) {
+        jid_t jid = atoi(argv[i] + 1);
+        if (!job_exists(jid)) {
+            stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+            printf("%s: No such job\n", argv[i]);
+            return;
+        }
+        // A repeated prerequisite is only waited for once: `resolve` drops
+        // one entry per completion
+        unsigned long serial = job_get_serial(jid);
+        int d = 0;
+        while (d < ndeps && deps[d] != serial) {
+            d++;
+        }
+        if (d == ndeps && ndeps < MAXJOBS) {
+            deps[ndeps++] = serial;
+        }
+    }
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+
+    if (ndeps == 0 || argv[i] == NULL) {
+        printf("after: usage: after [--ok] %%N... COMMAND [&]\n");
+        return;
+    }
+
+    const char *cmd = skip_args(cmdline, i);
+    if (!check_command("after", cmd)) {
+        return;
+    }
+    struct dag_node *node = node_add("after", cmd, cmdline, ok_only);
+    if (node == NULL) {
+        return;
+    }
+    memcpy(node->deps, deps, sizeof(deps[0]) * (size_t)ndeps);
+    node->ndeps = ndeps;
+    printf("[%d] (0) %s\n", node->jid, cmdline);
+}
+
+/*
+ * parse_entry - Parse one line of a graph file into an entry
+ */
+static bool parse_entry(const char *path, int lineno, char *line,
+                        struct dag_entry *entries, int nentries) {
+    struct dag_entry *e = &entries[nentries];
+    const char delims[] = " \t\r\n";
+    char *colon = strchr(line, ':');
+
+    if (colon == NULL) {
+        printf("dag: %s:%d: missing ':'\n", path, lineno);
+        return false;
+    }
+    *colon = '\0';
+    e->cmd = colon + 1;
+    e->ndeps = 0;
+    e->node = NULL;
+
+    char *save = NULL;
+    char *word = strtok_r(line, delims, &save);
+    if (word == NULL || strlen(word) >= DAG_NAME_MAX) {
+        printf("dag: %s:%d: missing or invalid node name\n", path, lineno);
+        return false;
+    }
+    strcpy(e->name, word);
+
+    while ((word = strtok_r(NULL, delims, &save)) != NULL) {
+        int dep = 0;
+        while (dep < nentries && strcmp(entries[dep].name, word) != 0) {
+            dep++;
+        }
+        if (dep == nentries) {
+            printf("dag: %s:%d: %s is not defined on an earlier line\n", path,
+                   lineno, word);
+            return false;
+        }
+        // As for `after`, a repeated prerequisite counts once
+        int d = 0;
+        while (d < e->ndeps && e->deps[d] != dep) {
+            d++;
+        }
+        if (d == e->ndeps) {
+            e->deps[e->ndeps++] = dep;
+        }
+    }
+    return check_command("dag", e->cmd);
+}
+
+/*
+ * dag_builtin_dag - The `dag` builtin
+ */
+void dag_builtin_dag(char **argv) {
+    bool ok_only = false;
+    int i = 1;
+
+    if (argv[i] != NULL && strcmp(argv[i], "--ok") == 0) {
+        ok_only = true;
+        i++;
+    }
+    if (argv[i] == NULL || argv[i + 1] != NULL) {
+        printf("dag: usage: dag [--ok] FILE\n");
+        return;
+    }
+
+    const char *path = argv[i];
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        perror(path);
+        return;
+    }
+
+    // Parse the whole file before submitting anything
+    struct dag_entry *entries = calloc(MAXJOBS, sizeof(*entries));
+    char (*lines)[MAXLINE_TSH] = calloc(MAXJOBS, sizeof(*lines));
+    int nentries = 0;
+    int lineno = 0;
+    bool ok = entries != NULL && lines != NULL;
+    if (!ok) {
+        perror("dag");
+    }
+    while (ok && fgets(lines[nentries], MAXLINE_TSH, fp) != NULL) {
+        char *line = lines[nentries];
+        lineno++;
+        line[strcspn(line, "\n")] = '\0';
+        const char *start = line + strspn(line, " \t\r");
+        if (*start == '\0' || *start == '#') {
+            continue;
+        }
+        if (nentries == MAXJOBS) {
+            printf("dag: %s: more than %d nodes\n", path, MAXJOBS);
+            ok = false;
+            break;
+        }
+        ok = parse_entry(path, lineno, line, entries, nentries);
+        nentries++;
+    }
+    fclose(fp);
+
+    // Add every node as a waiting job, then start those without
+    // prerequisites; none of them can be reaped before we return
+    for (int n = 0; ok && n < nentries; n++) {
+        struct dag_entry *e = &entries[n];
+        const char *cmd = e->cmd + strspn(e->cmd, " \t");
+        if ((e->node = node_add("dag", cmd, cmd, ok_only)) == NULL) {
+            ok = false;
+            break;
+        }
+        for (int d = 0; d < e->ndeps; d++) {
+            e->node->deps[d] = entries[e->deps[d]].node->serial;
+        }
+        e->node->ndeps = e->ndeps;
+    }
+    struct dag_node *ready[MAXJOBS];
+    int nready = 0;
+    for (int n = 0; n < nentries; n++) {
+        struct dag_node *node = entries[n].node;
+        if (node != NULL && !ok) {
+            // Submission failed part way: take back what was added
+            node_drop(node);
+        } else if (node != NULL && node->ndeps == 0) {
+            ready[nready++] = node;
+        }
+    }
+    // Starting a node can cancel its dependents, but never another root
+    for (int n = 0; n < nready; n++) {
+        node_start(ready[n]);
+    }
+
+    free(lines);
+    free(entries);
+}
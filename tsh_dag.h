@@ -0,0 +1,49 @@
+/**
+ * @file tsh_dag.h
+ * @brief Job dependencies: deferred jobs and job graphs
+ *
+ * A deferred job is added to the job list right away, in the `WT`
+ * (Waiting) state and without a process. The shell starts it in the
+ * background once all the jobs it depends on have finished. Completions are
+ * picked up from the child events that `sigchld_handler` posts to the event
+ * loop, so independent jobs run side by side and each job starts as soon as
+ * its last prerequisite is reaped.
+ *
+ * Builtins:
+ *
+ *     after [--ok] %N... COMMAND [&]   Run COMMAND once jobs %N... finish
+ *     dag [--ok] FILE                  Submit the job graph in FILE
+ *
+ * With `--ok`, a job only runs if all its prerequisites exited with status
+ * 0; otherwise it is cancelled, and so are the jobs that depend on it.
+ *
+ * A graph file has one node per line, in the form
+ *
+ *     NAME [DEP...] : COMMAND
+ *
+ * where each DEP names a node defined on an earlier line (so every file
+ * describes an acyclic graph). Empty lines and lines starting with `#` are
+ * ignored.
+ */
+
+#ifndef TSH_DAG_H
+#define TSH_DAG_H
+
+/**
+ * @brief Implements the `after` builtin.
+ *
+ * @param[in] cmdline  The full command line, from which the deferred
+ *                     command is taken verbatim.
+ * @param[in] argv     The parsed arguments.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void dag_builtin_after(const char *cmdline, char **argv);
+
+/**
+ * @brief Implements the `dag` builtin.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void dag_builtin_dag(char **argv);
+
+#endif /* TSH_DAG_H */
@@ -0,0 +1,232 @@
+/**
+ * @file tsh_dedup.c
+ * @brief Single-flight jobs: attach to an identical job instead of forking.
+ *
+ * For documentation related to usage, see the corresponding header file at
+ * tsh_dedup.h.
+ */
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tsh.h"
+#include "tsh_dedup.h"
+#include "tsh_helper.h"
+#include "tsh_incr.h"
+#include "tsh_output.h"
+#include "tsh_stats.h"
+#include "tsh_wait.h"
+
+#define NBUCKETS 128 // Buckets of the index, a power of two
+
+// Struct used to store an indexed job, indexed by job ID
+struct flight {
+    unsigned long serial; // Serial number of the job, 0 if unused
+    uint64_t hash;        // Hash of key
+    char *key;            // Arguments and redirections, NUL-separated
+    size_t len;           // Length of key
+    jid_t next;           // Next job in the same bucket, or 0
+};
+
+/* Static variables */
+static bool enabled = false;               // Single-flight mode is on
+static jid_t buckets[NBUCKETS];            // First job of each bucket, or 0
+static struct flight flights[MAXJOBS + 1]; // Indexed by job ID
+static int nflights = 0;                   // Number of indexed jobs
+
+/*
+ * make_key - Serialize the arguments and redirections of a command line;
+ * returns the length of the key, or 0 if it does not fit
+ */
+static size_t make_key(const struct cmdline_tokens *token, char *buf,
+                       size_t size) {
+    size_t len = 0;
+
+    for (int i = 0; i <= token->argc + 1; i++) {
+        // The arguments, then `<` and `>` (a missing file is left empty)
+        const char *s = i < token->argc    ? token->argv[i]
+                        : i == token->argc ? token->infile
+                                           : token->outfile;
+        size_t n = s != NULL ? strlen(s) : 0;
+        if (i >= token->argc) {
+            if (len + 1 > size) {
+                return 0;
+            }
+            buf[len++] = s != NULL ? (i == token->argc ? '<' : '>') : '-';
+        }
+        if (len + n + 1 > size) {
+            return 0;
+        }
+        memcpy(buf + len, s != NULL ? s : "", n);
+        len += n;
+        buf[len++] = '\0';
+    }
+    return len;
+}
+
+/*
+ * unindex - Remove a job from the index
+ */
+static void unindex(jid_t jid) {
+    struct flight *f = &flights[jid];
+    jid_t *link = &buckets[f->hash & (NBUCKETS - 1)];
+
+    while (*link != 0 && *link != jid) {
+        link = &flights[*link].next;
+    }
+    if (*link == jid) {
+        *link = f->next;
+    }
+    free(f->key);
+    memset(f, 0, sizeof(*f));
+    nflights--;
+}
+
+/*
+ * live - Whether an indexed job is still the one in the job list.
+ * Signals must be blocked.
+ */
+static bool live(jid_t jid) {
+    return job_exists(jid) && job_get_serial(jid) == flights[jid].serial;
+}
+
+/*
+ * lookup - Find the live job with a key, dropping dead jobs on the way.
+ * Signals must be blocked.
+ */
+static jid_t lookup(uint64_t hash, const char *key, size_t len) {
+    jid_t jid = buckets[hash & (NBUCKETS - 1)];
+
+    while (jid != 0) {
+        struct flight *f = &flights[jid];
+        jid_t next = f->next;
+        if (!live(jid)) {
+            unindex(jid);
+        } else if (f->hash == hash && f->len == len &&
+                   memcmp(f->key, key, len) == 0) {
+            return jid;
+        }
+        jid = next;
+    }
+    return 0;
+}
+
+/*
+ * dedup_attach - Attach a command to an identical live job
+ */
+bool dedup_attach(jid_t *jid, const struct cmdline_tokens *token,
+                  job_state state) {
+    char key[MAXLINE_TSH + 3];
+    sigset_t mask_all, mask_prev;
+    unsigned long serial = 0;
+    int status;
+
+    if (!enabled || nflights == 0) {
+        return false;
+    }
+    size_t len = make_key(token, key, sizeof(key));
+    if (len == 0) {
+        return false;
+    }
+    uint64_t hash = incr_hash(INCR_HASH_SEED, key, len);
+
+    sigfillset(&mask_all);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+    *jid = lookup(hash, key, len);
+    if (*jid != 0 && job_get_state(*jid) == ST) {
+        *jid = 0;
+    }
+    if (*jid != 0) {
+        serial = job_get_serial(*jid);
+        stats_inc(STAT_DEDUP);
+        if (state == BG) {
+            printf("[%d] (attached) %s\n", *jid, job_get_cmdline(*jid));
+        }
+    }
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+    if (*jid == 0) {
+        return false;
+    }
+
+    // A foreground duplicate behaves as if it had run the job itself
+    if (state == FG && output_follow(*jid) &&
+        wait_job(*jid, serial, &status)) {
+        last_status = wait_exit_code(status);
+    }
+    return true;
+}
+
+/*
+ * dedup_add - Index a job that was just added to the job list
+ */
+void dedup_add(jid_t jid, const struct cmdline_tokens *token) {
+    char key[MAXLINE_TSH + 3];
+    sigset_t mask_all, mask_prev;
+
+    if (!enabled || jid <= 0 || jid > MAXJOBS) {
+        return;
+    }
+    size_t len = make_key(token, key, sizeof(key));
+    char *copy = len != 0 ? malloc(len) : NULL;
+    if (copy == NULL) {
+        return;
+    }
+    memcpy(copy, key, len);
+
+    sigfillset(&mask_all);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+    unsigned long serial = job_get_serial(jid);
+    if (flights[jid].serial == serial) {
+        // A waiting job that was indexed when it was held
+        free(copy);
+    } else {
+        struct flight *f = &flights[jid];
+        if (f->serial != 0) {
+            unindex(jid);
+        }
+        f->serial = serial;
+        f->hash = incr_hash(INCR_HASH_SEED, key, len);
+        f->key = copy;
+        f->len = len;
+        f->next = buckets[f->hash & (NBUCKETS - 1)];
+        buckets[f->hash & (NBUCKETS - 1)] = jid;
+        nflights++;
+    }
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+}
+
+/*
+ * dedup_enable - Turn single-flight mode on
+ */
+void dedup_enable(void) {
+    enabled = true;
+}
+
+/*
+ * dedup_builtin - The `dedup` builtin
+ */
+void dedup_builtin(char **argv) {
+    sigset_t mask_all, mask_prev;
+    int n = 0;
+
+    if (argv[1] == NULL) {
+        sigfillset(&mask_all);
+        stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+        for (jid_t jid = 1; jid <= MAXJOBS; jid++) {
+            n += flights[jid].serial != 0 && live(jid);
+        }
+        stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+        printf("dedup: %s, %d live jobs indexed\n", enabled ? "on" : "off",
+               n);
+    } else if (strcmp(argv[1], "on") == 0 && argv[2] == NULL) {
+        enabled = true;
+    } else if (strcmp(argv[1], "off") == 0 && argv[2] == NULL) {
+        enabled = false;
+    } else {
+        printf("dedup: usage: dedup [on | off]\n");
+    }
+}
@@ -0,0 +1,86 @@
+/**
+ * @file tsh_dedup.h
+ * @brief Single-flight jobs: attach to an identical job instead of forking
+ *
+ * In single-flight mode (`dedup on`), a command is not launched if an
+ * identical job is still live, i.e. running or waiting to start. Two jobs
+ * are identical if they have the same arguments (before glob expansion,
+ * including `NAME=VALUE` prefixes) and the same redirections; spacing and
+ * quoting that do not change the arguments do not matter.
+ *
+ * A duplicate attaches to the live job instead. In the background, it is
+ * announced as `[N] (attached) CMDLINE` with the job ID of the live job, so
+ * `wait %N`, `fg %N` and the exit notifications of `--serve` clients all
+ * refer to the one job; `--serve` replies `ok N`. In the foreground, the
+ * shell follows the job's captured output (see tsh_output.h), if any, then
+ * waits for the job to finish, and its exit code becomes `$?`. Ctrl-C stops
+ * waiting but leaves the job running.
+ *
+ * Live jobs are indexed by a hash of their arguments and redirections, so
+ * a lookup does not scan the job list. Only jobs launched while the mode is
+ * on are indexed. Stopped jobs are not attached to. In server mode, where
+ * builtins cannot be submitted, the mode is turned on with `--dedup`.
+ *
+ * Builtins:
+ *
+ *     dedup on
+ *         Attach duplicates of live jobs to them
+ *     dedup off
+ *         Launch every command (the default)
+ *     dedup
+ *         Show the mode and the number of indexed jobs
+ *
+ * `stats` counts the jobs de-duplicated.
+ */
+
+#ifndef TSH_DEDUP_H
+#define TSH_DEDUP_H
+
+#include <stdbool.h>
+
+#include "tsh_helper.h"
+
+/**
+ * @brief Attaches a command to an identical live job, if there is one.
+ *
+ * @param[out] jid    Receives the job ID of the live job.
+ * @param[in]  token  The parsed command line.
+ * @param[in]  state  `FG` or `BG`; a foreground command waits for the job.
+ *
+ * @return true if the command was attached, false if it is to be launched
+ *
+ * @pre Signals must not be blocked.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool dedup_attach(jid_t *jid, const struct cmdline_tokens *token,
+                  job_state state);
+
+/**
+ * @brief Indexes a job that was just added to the job list.
+ *
+ * Does nothing if single-flight mode is off, `jid` is 0, or the job is
+ * already indexed.
+ *
+ * @param[in] jid    The job.
+ * @param[in] token  Its parsed command line.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void dedup_add(jid_t jid, const struct cmdline_tokens *token);
+
+/**
+ * @brief Turns single-flight mode on, as `dedup on` does; for `--dedup`.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void dedup_enable(void);
+
+/**
+ * @brief Implements the `dedup` builtin.
+ *
+ * @param[in] argv  The parsed arguments.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void dedup_builtin(char **argv);
+
+#endif /* TSH_DEDUP_H */
@@ -0,0 +1,394 @@
+/**
+ * @file tsh_env.c
+ * @brief The shell's environment: `export`, `unset` and `VAR=val cmd`.
+ *
+ * For documentation related to usage, see the corresponding header file at
+ * tsh_env.h.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tsh_env.h"
+#include "tsh_helper.h"
+
+extern char **environ;
+
+/* Static variables */
+static char **table = NULL; // NAME=VALUE strings sorted by name, then NULL
+static size_t count = 0;    // Number of variables in the table
+static size_t cap = 0;      // Number of entries allocated
+
+/*
+ * name_len - Length of the name of a NAME=VALUE string (or of a bare name)
+ * Async-signal-safe
+ */
+static size_t name_len(const char *s) {
+    size_t len = 0;
+    while (s[len] != '\0' && s[len] != '=') {
+        len++;
+    }
+    return len;
+}
+
+/*
+ * name_cmp - Compare the names of two NAME=VALUE strings (or bare names)
+ * Async-signal-safe
+ */
+static int name_cmp(const char *a, const char *b) {
+    size_t alen = name_len(a);
+    size_t blen = name_len(b);
+    int cmp = memcmp(a, b, alen < blen ? alen : blen);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return alen < blen ? -1 : alen > blen;
+}
+
+/*
+ * key_cmp - Compare the name of a NAME=VALUE string with a name of known
+ * length, in one pass; orders as name_cmp does
+ * Async-signal-safe
+ */
+static int key_cmp(const char *entry, const char *name, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        unsigned char a = entry[i] == '=' ? '\0' : (unsigned char)entry[i];
+        unsigned char b = (unsigned char)name[i];
+        if (a != b) {
+            return a < b ? -1 : 1;
+        }
+    }
+    return entry[len] == '=' || entry[len] == '\0' ? 0 : 1;
+}
+
+/*
+ * lookup - Find the position of a name in the table; `found` tells whether
+ * it is there, or only where it would be inserted
+ * Async-signal-safe
+ */
+static size_t lookup(const char *name, bool *found) {
+    size_t len = name_len(name);
+    size_t lo = 0;
+    size_t hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = key_cmp(table[mid], name, len);
+        if (cmp == 0) {
+            *found = true;
+            return mid;
+        }
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *found = false;
+    return lo;
+}
+
+/*
+ * valid_name - Whether a bare name (up to '=' if any) is a valid name
+ * Async-signal-safe
+ */
+static bool valid_name(const char *s) {
+    size_t len = name_len(s);
+    if (len == 0 || (s[0] >= '0' && s[0] <= '9')) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        char c = s[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+              (c >= '0' && c <= '9') || c == '_')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * env_is_assignment - Whether a word is NAME=VALUE
+ * Async-signal-safe
+ */
+bool env_is_assignment(const char *word) {
+    return valid_name(word) && word[name_len(word)] == '=';
+}
+
+/*
+ * env_is_name - Whether a word is a valid name
+ * Async-signal-safe
+ */
+bool env_is_name(const char *word) {
+    return valid_name(word) && word[name_len(word)] == '\0';
+}
+
+/*
+ * env_get - Look a variable up in the sorted table
+ * Async-signal-safe
+ */
+const char *env_get(const char *name) {
+    bool found;
+    size_t i = lookup(name, &found);
+    return found ? table[i] + name_len(table[i]) + 1 : NULL;
+}
+
+/*
+ * set - Add or replace a variable, taking ownership of a malloc'ed string
+ */
+static bool set(char *assignment) {
+    bool found;
+    size_t i = lookup(assignment, &found);
+
+    if (found) {
+        free(table[i]);
+        table[i] = assignment;
+        return true;
+    }
+    // Keep room for the overlays of a whole command line
+    if (count + 1 + MAXARGS + 1 > cap) {
+        size_t newcap = 2 * cap + MAXARGS + 2;
+        char **newtable = realloc(table, newcap * sizeof(*newtable));
+        if (newtable == NULL) {
+            return false;
+        }
+        table = newtable;
+        cap = newcap;
+        environ = table;
+    }
+    memmove(&table[i + 1], &table[i], (count - i + 1) * sizeof(*table));
+    table[i] = assignment;
+    count++;
+    return true;
+}
+
+/*
+ * set_word - Add or replace a variable from a NAME=VALUE word
+ */
+static bool set_word(const char *word) {
+    bool found;
+    size_t i = lookup(word, &found);
+    if (found && strcmp(table[i], word) == 0) {
+        return true;
+    }
+    char *copy = strdup(word);
+    if (copy == NULL || !set(copy)) {
+        free(copy);
+        perror("export");
+        return false;
+    }
+    return true;
+}
+
+/*
+ * env_set - Set a variable from its name and value
+ */
+bool env_set(const char *name, const char *value) {
+    size_t nlen = strlen(name);
+    size_t vlen = strlen(value);
+    bool found;
+    size_t i = lookup(name, &found);
+
+    // Loops set the same value over and over; keep the string then
+    if (found && strncmp(table[i] + nlen + 1, value, vlen + 1) == 0) {
+        return true;
+    }
+    char *assignment = malloc(nlen + 1 + vlen + 1);
+    if (assignment == NULL) {
+        perror("env");
+        return false;
+    }
+    memcpy(assignment, name, nlen);
+    assignment[nlen] = '=';
+    memcpy(assignment + nlen + 1, value, vlen + 1);
+    if (!set(assignment)) {
+        free(assignment);
+        perror("env");
+        return false;
+    }
+    return true;
+}
+
+/*
+ * env_init - Copy the environment into the shell's table
+ */
+bool env_init(void) {
+    char **inherited = environ;
+
+    // Already taken over, e.g. by an earlier libtsh context
+    if (table != NULL && environ == table) {
+        return true;
+    }
+    cap = MAXARGS + 2;
+    if ((table = calloc(cap, sizeof(*table))) == NULL) {
+        return false;
+    }
+    // Only the first definition of a name counts, as with getenv
+    for (char **ep = inherited; ep != NULL && *ep != NULL; ep++) {
+        bool found;
+        if (strchr(*ep, '=') == NULL) {
+            continue;
+        }
+        lookup(*ep, &found);
+        if (found) {
+            continue;
+        }
+        char *copy = strdup(*ep);
+        if (copy == NULL || !set(copy)) {
+            free(copy);
+            for (size_t i = 0; i < count; i++) {
+                free(table[i]);
+            }
+            free(table);
+            table = NULL;
+            count = 0;
+            return false;
+        }
+    }
+    environ = table;
+    return true;
+}
+
+/*
+ * env_assign_only - Set the variables of a line made only of assignments
+ */
+bool env_assign_only(char **argv) {
+    for (int i = 0; argv[i] != NULL; i++) {
+        if (!env_is_assignment(argv[i])) {
+            return false;
+        }
+    }
+    for (int i = 0; argv[i] != NULL; i++) {
+        set_word(argv[i]);
+    }
+    return true;
+}
+
+/*
+ * env_overlay - Apply the assignments in front of a command, in the child
+ * Async-signal-safe
+ */
+char **env_overlay(char **argv) {
+    size_t extra = 0;
+    int i;
+
+    for (i = 0; argv[i] != NULL && env_is_assignment(argv[i]); i++) {
+        bool found;
+        size_t pos = lookup(argv[i], &found);
+        if (!found) {
+            // Appended overlays are past the sorted part; look there too
+            for (pos = count; pos < count + extra; pos++) {
+                if (name_cmp(table[pos], argv[i]) == 0) {
+                    break;
+                }
+            }
+            if (pos == count + extra) {
+                extra++;
+                table[count + extra] = NULL;
+            }
+        }
+        table[pos] = argv[i];
+    }
+    return &argv[i];
+}
+
+/*
+ * env_copy - Copy the environment, with the assignments in front of a
+ * command applied, into one block
+ */
+char **env_copy(char **argv) {
+    size_t n = 0;
+    size_t extra = 0;
+    size_t size = 0;
+
+    while (argv[n] != NULL && env_is_assignment(argv[n])) {
+        n++;
+    }
+    const char **entries = malloc((count + n + 1) * sizeof(*entries));
+    if (entries == NULL) {
+        return NULL;
+    }
+    memcpy(entries, table, count * sizeof(*entries));
+    for (size_t i = 0; i < n; i++) {
+        bool found;
+        size_t pos = lookup(argv[i], &found);
+        if (!found) {
+            // As in env_overlay
+            for (pos = count; pos < count + extra; pos++) {
+                if (name_cmp(entries[pos], argv[i]) == 0) {
+                    break;
+                }
+            }
+            if (pos == count + extra) {
+                extra++;
+            }
+        }
+        entries[pos] = argv[i];
+    }
+
+    size_t total = count + extra;
+    for (size_t i = 0; i < total; i++) {
+        size += strlen(entries[i]) + 1;
+    }
+    char **env = malloc((total + 1) * sizeof(*env) + size);
+    if (env != NULL) {
+        char *p = (char *)(env + total + 1);
+        for (size_t i = 0; i < total; i++) {
+            size_t len = strlen(entries[i]) + 1;
+            env[i] = memcpy(p, entries[i], len);
+            p += len;
+        }
+        env[total] = NULL;
+    }
+    free(entries);
+    return env;
+}
+
+/*
+ * env_builtin_export - The `export` builtin
+ */
+int env_builtin_export(char **argv) {
+    int code = 0;
+
+    if (argv[1] == NULL) {
+        for (size_t i = 0; i < count; i++) {
+            printf("export %s\n", table[i]);
+        }
+        return 0;
+    }
+    for (int i = 1; argv[i] != NULL; i++) {
+        if (!valid_name(argv[i])) {
+            printf("export: %s: not a valid identifier\n", argv[i]);
+            code = 1;
+        } else if (argv[i][name_len(argv[i])] == '=' && !set_word(argv[i])) {
+            code = 1;
+        }
+    }
+    return code;
+}
+
+/*
+ * env_builtin_unset - The `unset` builtin
+ */
+int env_builtin_unset(char **argv) {
+    int code = 0;
+
+    for (int i = 1; argv[i] != NULL; i++) {
+        bool found;
+        if (!valid_name(argv[i]) || argv[i][name_len(argv[i])] == '=') {
+            printf("unset: %s: not a valid identifier\n", argv[i]);
+            code = 1;
+            continue;
+        }
+        size_t pos = lookup(argv[i], &found);
+        if (found) {
+            free(table[pos]);
+            memmove(&table[pos], &table[pos + 1],
+                    (count - pos) * sizeof(*table));
+            count--;
+        }
+    }
+    return code;
+}
@@ -0,0 +1,148 @@
+/**
+ * @file tsh_env.h
+ * @brief The shell's environment: `export`, `unset` and `VAR=val cmd`
+ *
+ * The shell owns its environment as a table of `NAME=VALUE` strings, kept
+ * sorted by name in a NULL-terminated array that `environ` points to. The
+ * array is only changed by `export` and `unset`, in place, so it is always
+ * ready to be passed on: a job inherits it through fork with no per-launch
+ * work, however large it is.
+ *
+ * Builtins:
+ *
+ *     export [NAME=VALUE | NAME ...]
+ *         Set variables, or list them all without arguments
+ *     unset NAME ...
+ *         Remove variables
+ *
+ * Every variable is exported; `export NAME` only checks that NAME is a
+ * valid name. A command line made only of assignments sets them as well.
+ *
+ * Assignments in front of a command (`A=1 B=2 cmd args`) only apply to
+ * that command. They are overlaid in the child after fork, by pointing
+ * entries of the array at the words of the command line: the array always
+ * has room for `MAXARGS` more entries, so nothing is allocated or copied,
+ * and only the pages of the array that are written are copied by the
+ * kernel. Builtins ignore such assignments, since they do not fork.
+ */
+
+#ifndef TSH_ENV_H
+#define TSH_ENV_H
+
+#include <stdbool.h>
+
+/**
+ * @brief Takes over the environment the shell was started with.
+ *
+ * Copies `environ` into the shell's table, and points `environ` at it.
+ * `putenv` and `setenv` must not be used afterwards. Does nothing if the
+ * environment has already been taken over.
+ *
+ * @return true on success, false if out of memory
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool env_init(void);
+
+/**
+ * @brief Returns whether a word is an assignment, i.e. `NAME=VALUE` where
+ *        NAME is made of letters, digits and underscores and does not start
+ *        with a digit.
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool env_is_assignment(const char *word);
+
+/**
+ * @brief Returns whether a word is a valid variable name.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool env_is_name(const char *word);
+
+/**
+ * @brief Looks a variable up, like `getenv` but in logarithmic time.
+ *
+ * @param[in] name  The variable's name.
+ *
+ * @return Its value, or NULL if it is not set
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+const char *env_get(const char *name);
+
+/**
+ * @brief Sets a variable.
+ *
+ * @param[in] name   The variable's name, which must be valid.
+ * @param[in] value  Its value.
+ *
+ * @return true on success, false if out of memory
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool env_set(const char *name, const char *value);
+
+/**
+ * @brief Handles a command line made only of assignments.
+ *
+ * @param[in] argv  The parsed arguments.
+ *
+ * @return true if every word was an assignment, and they have been set;
+ *         false if there is a command to launch
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool env_assign_only(char **argv);
+
+/**
+ * @brief Applies the assignments in front of a command to the environment.
+ *
+ * To be called in the child after fork, before the command is executed.
+ * The environment keeps pointing at the words of `argv`.
+ *
+ * @param[in] argv  The parsed arguments.
+ *
+ * @return The arguments past the assignments, i.e. the command to execute
+ *         (whose first element is NULL if there is none)
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+char **env_overlay(char **argv);
+
+/**
+ * @brief Copies the environment, with the assignments in front of a
+ *        command applied as by `env_overlay`.
+ *
+ * The copy is one block, which stays valid whatever the shell does to its
+ * own environment afterwards, so that a command can be launched from
+ * another thread (see tsh_spawn.h).
+ *
+ * @param[in] argv  The parsed arguments.
+ *
+ * @return The NULL-terminated environment, to be released with `free`, or
+ *         NULL if out of memory
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+char **env_copy(char **argv);
+
+/**
+ * @brief Implements the `export` builtin.
+ *
+ * @param[in] argv  The parsed arguments.
+ *
+ * @return The exit code to store in `$?`
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+int env_builtin_export(char **argv);
+
+/**
+ * @brief Implements the `unset` builtin.
+ *
+ * @param[in] argv  The parsed arguments.
+ *
+ * @return The exit code to store in `$?`
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+int env_builtin_unset(char **argv);
+
+#endif /* TSH_ENV_H */
@@ -0,0 +1,571 @@
+/**
+ * @file tsh_glob.c
+ * @brief Glob expansion of command arguments, with a directory cache.
+ *
+ * For documentation related to usage, see the corresponding header file at
+ * tsh_glob.h.
+ */
+
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tsh_env.h"
+#include "tsh_glob.h"
+#include "tsh_helper.h"
+#include "tsh_stats.h"
+
+/* Directory listings kept in the cache */
+#define MAXDIRS 256
+
+/* Buckets of the cache's hash table */
+#define NBUCKETS 64
+
+// Struct used to store the cached listing of a directory
+struct listing {
+    char *path;             // Directory, as named in patterns
+    dev_t dev;              // Its device
+    ino_t ino;              // Its inode
+    struct timespec mtime;  // Its modification time when it was read
+    bool racy;              // Read too soon after a change to be trusted
+    size_t n;               // Number of entries
+    char **names;           // Entry names, pointing into `pool`
+    unsigned char *types;   // Entry types (d_type)
+    char *pool;             // Backing buffer of the names
+    unsigned long used;     // Last use, for eviction
+    int pins;               // Expansions currently walking the listing
+    struct listing *next;   // Next listing in the same bucket
+};
+
+// Struct used to store a growing list of words
+struct words {
+    char **v;   // The words, each malloc'ed
+    size_t n;   // Number of words
+    size_t cap; // Number of words allocated
+};
+
+/* Static variables */
+static struct listing *buckets[NBUCKETS]; // Cached listings, by path hash
+static size_t ndirs = 0;                  // Number of cached listings
+static unsigned long uses = 0;            // Clock for `used`
+
+/*
+ * has_magic - Whether a word contains glob characters
+ */
+static bool has_magic(const char *word) {
+    return strpbrk(word, "*?[") != NULL;
+}
+
+/*
+ * match_set - Match a character against a [...] set starting at `p`;
+ * returns 1 or 0, and where the set ends, or -1 if it is not closed
+ */
+static int match_set(const char *p, char c, const char **end) {
+    const char *q = p + 1;
+    bool negate = false;
+    bool matched = false;
+
+    if (*q == '!' || *q == '^') {
+        negate = true;
+        q++;
+    }
+    // A ']' right after the opening bracket is part of the set
+    for (bool first = true; *q != '\0' && (*q != ']' || first);
+         first = false) {
+        if (q[1] == '-' && q[2] != '\0' && q[2] != ']') {
+            if ((unsigned char)q[0] <= (unsigned char)c &&
+                (unsigned char)c <= (unsigned char)q[2]) {
+                matched = true;
+            }
+            q += 3;
+        } else {
+            if (*q == c) {
+                matched = true;
+            }
+            q++;
+        }
+    }
+    if (*q != ']') {
+        return -1;
+    }
+    *end = q + 1;
+    return matched != negate;
+}
+
+/*
+ * match - Match a name against a pattern component, in linear time but for
+ * backtracking to the last star
+ */
+static bool match(const char *p, const char *s) {
+    const char *star_p = NULL;
+    const char *star_s = NULL;
+
+    // Hidden names must be matched by a leading dot
+    if (*s == '.' && *p != '.') {
+        return false;
+    }
+    while (*s != '\0') {
+        const char *end;
+        int set;
+        if (*p == '*') {
+            while (*p == '*') {
+                p++;
+            }
+            if (*p == '\0') {
+                return true;
+            }
+            star_p = p;
+            star_s = s;
+            continue;
+        }
+        if (*p == '?') {
+            p++;
+            s++;
+            continue;
+        }
+        if (*p == '[' && (set = match_set(p, *s, &end)) >= 0) {
+            if (set) {
+                p = end;
+                s++;
+                continue;
+            }
+        } else if (*p == *s) {
+            // Including an unclosed '['
+            p++;
+            s++;
+            continue;
+        }
+        if (star_p == NULL) {
+            return false;
+        }
+        // Let the last star swallow one more character
+        p = star_p;
+        s = ++star_s;
+    }
+    while (*p == '*') {
+        p++;
+    }
+    return *p == '\0';
+}
+
+/*
+ * hash - Hash a path (FNV-1a)
+ */
+static size_t hash(const char *path) {
+    unsigned long h = 2166136261UL;
+    for (; *path != '\0'; path++) {
+        h = (h ^ (unsigned char)*path) * 16777619UL;
+    }
+    return h % NBUCKETS;
+}
+
+/*
+ * clear - Free the entries of a listing
+ */
+static void clear(struct listing *l) {
+    free(l->names);
+    free(l->types);
+    free(l->pool);
+    l->names = NULL;
+    l->types = NULL;
+    l->pool = NULL;
+    l->n = 0;
+}
+
+/*
+ * evict - Drop the least recently used listing that is not being walked
+ */
+static void evict(void) {
+    struct listing **victim = NULL;
+    for (size_t b = 0; b < NBUCKETS; b++) {
+        for (struct listing **lp = &buckets[b]; *lp != NULL;
+             lp = &(*lp)->next) {
+            if ((*lp)->pins == 0 &&
+                (victim == NULL || (*lp)->used < (*victim)->used)) {
+                victim = lp;
+            }
+        }
+    }
+    if (victim != NULL) {
+        struct listing *l = *victim;
+        *victim = l->next;
+        clear(l);
+        free(l->path);
+        free(l);
+        ndirs--;
+    }
+}
+
+/*
+ * read_listing - Read a directory into a listing
+ */
+static bool read_listing(struct listing *l) {
+    DIR *dir = opendir(l->path[0] == '\0' ? "." : l->path);
+    struct stat st;
+    struct timespec now;
+    size_t poolsize = 0, poolcap = 4096, cap = 64, *offsets;
+    struct dirent *de = NULL;
+
+    if (dir == NULL) {
+        return false;
+    }
+    // Taken before reading: a change made while reading shows up next time
+    if (fstat(dirfd(dir), &st) < 0) {
+        closedir(dir);
+        return false;
+    }
+    clock_gettime(CLOCK_REALTIME, &now);
+    l->dev = st.st_dev;
+    l->ino = st.st_ino;
+    l->mtime = st.st_mtim;
+    l->racy = st.st_mtim.tv_sec + 1 >= now.tv_sec;
+
+    clear(l);
+    offsets = malloc(cap * sizeof(*offsets));
+    l->types = malloc(cap);
+    l->pool = malloc(poolcap);
+    while (offsets != NULL && l->types != NULL && l->pool != NULL &&
+           (de = readdir(dir)) != NULL) {
+        size_t len = strlen(de->d_name) + 1;
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) {
+            continue;
+        }
+        if (l->n == cap) {
+            cap *= 2;
+            size_t *newoffsets = realloc(offsets, cap * sizeof(*offsets));
+            unsigned char *newtypes = realloc(l->types, cap);
+            offsets = newoffsets != NULL ? newoffsets : offsets;
+            l->types = newtypes != NULL ? newtypes : l->types;
+            if (newoffsets == NULL || newtypes == NULL) {
+                break;
+            }
+        }
+        if (poolsize + len > poolcap) {
+            poolcap = 2 * poolcap + len;
+            char *newpool = realloc(l->pool, poolcap);
+            if (newpool == NULL) {
+                break;
+            }
+            l->pool = newpool;
+        }
+        memcpy(l->pool + poolsize, de->d_name, len);
+        offsets[l->n] = poolsize;
+        l->types[l->n++] = de->d_type;
+        poolsize += len;
+    }
+    closedir(dir);
+
+    // The pool may have moved while growing; point into it only now. A
+    // listing cut short by a failed allocation is not kept.
+    if (de == NULL && offsets != NULL && l->types != NULL &&
+        l->pool != NULL &&
+        (l->names = malloc((l->n + 1) * sizeof(*l->names))) != NULL) {
+        for (size_t i = 0; i < l->n; i++) {
+            l->names[i] = l->pool + offsets[i];
+        }
+        free(offsets);
+        stats_inc(STAT_GLOB_READ);
+        return true;
+    }
+    free(offsets);
+    clear(l);
+    return false;
+}
+
+/*
+ * get_listing - Get the listing of a directory, from the cache if it is
+ * still valid
+ */
+static struct listing *get_listing(const char *path) {
+    size_t b = hash(path);
+    struct listing *l;
+    struct stat st;
+
+    if (stat(path[0] == '\0' ? "." : path, &st) < 0 || !S_ISDIR(st.st_mode)) {
+        return NULL;
+    }
+    for (l = buckets[b]; l != NULL; l = l->next) {
+        if (strcmp(l->path, path) == 0) {
+            break;
+        }
+    }
+    if (l != NULL) {
+        l->used = ++uses;
+        if (l->pins > 0 ||
+            (!l->racy && l->dev == st.st_dev && l->ino == st.st_ino &&
+             l->mtime.tv_sec == st.st_mtim.tv_sec &&
+             l->mtime.tv_nsec == st.st_mtim.tv_nsec)) {
+            stats_inc(STAT_GLOB_CACHED);
+            return l;
+        }
+        return read_listing(l) ? l : NULL;
+    }
+
+    if (ndirs >= MAXDIRS) {
+        evict();
+    }
+    if ((l = calloc(1, sizeof(*l))) == NULL ||
+        (l->path = strdup(path)) == NULL) {
+        free(l);
+        return NULL;
+    }
+    if (!read_listing(l)) {
+        free(l->path);
+        free(l);
+        return NULL;
+    }
+    l->used = ++uses;
+    l->next = buckets[b];
+    buckets[b] = l;
+    ndirs++;
+    return l;
+}
+
+/*
+ * grow - Make room for one more word (or the terminating NULL) in a list
+ */
+static bool grow(struct words *w) {
+    if (w->n < w->cap) {
+        return true;
+    }
+    size_t newcap = 2 * w->cap + 16;
+    char **newv = realloc(w->v, newcap * sizeof(*newv));
+    if (newv == NULL) {
+        return false;
+    }
+    w->v = newv;
+    w->cap = newcap;
+    return true;
+}
+
+/*
+ * push - Add a malloc'ed word to a list, freeing it on failure
+ */
+static bool push(struct words *w, char *word) {
+    if (word == NULL || !grow(w)) {
+        free(word);
+        return false;
+    }
+    w->v[w->n++] = word;
+    return true;
+}
+
+/*
+ * join - Append a name to a directory path
+ */
+static char *join(const char *prefix, const char *name) {
+    size_t plen = strlen(prefix);
+    size_t nlen = strlen(name);
+    bool slash = plen > 0 && prefix[plen - 1] != '/';
+    char *path = malloc(plen + slash + nlen + 1);
+
+    if (path != NULL) {
+        memcpy(path, prefix, plen);
+        if (slash) {
+            path[plen] = '/';
+        }
+        memcpy(path + plen + slash, name, nlen + 1);
+    }
+    return path;
+}
+
+/*
+ * is_dir - Whether an entry is a directory; `follow` follows symlinks
+ */
+static bool is_dir(const char *path, unsigned char type, bool follow) {
+    struct stat st;
+    if (type == DT_DIR) {
+        return true;
+    }
+    if (type != DT_UNKNOWN && (type != DT_LNK || !follow)) {
+        return false;
+    }
+    if ((follow ? stat(path, &st) : lstat(path, &st)) < 0) {
+        return false;
+    }
+    return S_ISDIR(st.st_mode);
+}
+
+/*
+ * expand - Add the paths below `prefix` that match components `i` to `n`
+ * of a pattern
+ */
+static bool expand(const char *prefix, char **comps, int i, int n,
+                   struct words *out) {
+    const char *comp = comps[i];
+    bool last = i == n - 1;
+    bool ok = true;
+
+    if (!has_magic(comp)) {
+        char *path = join(prefix, comp);
+        struct stat st;
+        if (path == NULL) {
+            return false;
+        }
+        if (!last) {
+            ok = expand(path, comps, i + 1, n, out);
+        } else if (lstat(path, &st) == 0) {
+            return push(out, path);
+        }
+        free(path);
+        return ok;
+    }
+
+    bool globstar = strcmp(comp, "**") == 0;
+    if (globstar && !last && !expand(prefix, comps, i + 1, n, out)) {
+        return false;
+    }
+    struct listing *l = get_listing(prefix);
+    if (l == NULL) {
+        return true;
+    }
+    l->pins++;
+    for (size_t e = 0; ok && e < l->n; e++) {
+        const char *name = l->names[e];
+        if (globstar ? name[0] == '.' : !match(comp, name)) {
+            continue;
+        }
+        char *path = join(prefix, name);
+        if (path == NULL) {
+            ok = false;
+        } else if (globstar) {
+            // Descend into real directories only, so links cannot loop
+            bool dir = is_dir(path, l->types[e], false);
+            if (dir) {
+                ok = expand(path, comps, i, n, out);
+            }
+            if (ok && last) {
+                ok = push(out, path);
+            } else {
+                free(path);
+            }
+        } else if (last) {
+            ok = push(out, path);
+        } else {
+            if (is_dir(path, l->types[e], true)) {
+                ok = expand(path, comps, i + 1, n, out);
+            }
+            free(path);
+        }
+    }
+    l->pins--;
+    return ok;
+}
+
+/*
+ * compare - qsort comparator for words
+ */
+static int compare(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+ * expand_word - Add the paths that match a pattern, sorted; returns false
+ * if out of memory
+ */
+static bool expand_word(const char *word, struct words *out) {
+    char *copy = strdup(word);
+    char **comps = malloc((strlen(word) + 1) * sizeof(*comps));
+    const char *prefix = "";
+    size_t first = out->n;
+    int n = 0;
+    bool ok = copy != NULL && comps != NULL;
+
+    if (ok) {
+        char *p = copy;
+        if (*p == '/') {
+            prefix = "/";
+            p += strspn(p, "/");
+        }
+        // "a//b" has an empty component, and so does "a/"
+        comps[n++] = p;
+        while ((p = strchr(p, '/')) != NULL) {
+            *p++ = '\0';
+            if (comps[n - 1][0] != '\0' || n == 1) {
+                comps[n++] = p;
+            } else {
+                comps[n - 1] = p;
+            }
+        }
+        ok = expand(prefix, comps, 0, n, out);
+    }
+    free(copy);
+    free(comps);
+    if (!ok) {
+        return false;
+    }
+
+    // Sort this pattern's paths, and drop those found twice through "**"
+    qsort(&out->v[first], out->n - first, sizeof(*out->v), compare);
+    size_t kept = first;
+    for (size_t j = first; j < out->n; j++) {
+        if (kept > first && strcmp(out->v[kept - 1], out->v[j]) == 0) {
+            free(out->v[j]);
+        } else {
+            out->v[kept++] = out->v[j];
+        }
+    }
+    out->n = kept;
+    return true;
+}
+
+/*
+ * glob_expand - Expand the glob patterns in the arguments of a command
+ */
+char **glob_expand(const struct cmdline_tokens *token) {
+    struct words out = {NULL, 0, 0};
+    int start = 0;
+    int i;
+    bool any = false;
+
+    // Assignments in front of the command are not expanded
+    while (start < token->argc && env_is_assignment(token->argv[start])) {
+        start++;
+    }
+    for (i = start; i < token->argc && !any; i++) {
+        any = !token->quoted[i] && has_magic(token->argv[i]);
+    }
+    if (!any) {
+        return NULL;
+    }
+
+    for (i = 0; i < token->argc; i++) {
+        size_t first = out.n;
+        if (i >= start && !token->quoted[i] && has_magic(token->argv[i]) &&
+            !expand_word(token->argv[i], &out)) {
+            break;
+        }
+        // A pattern that matches nothing stands for itself
+        if (out.n == first && !push(&out, strdup(token->argv[i]))) {
+            break;
+        }
+    }
+    if (i < token->argc || !grow(&out)) {
+        perror("glob");
+        for (size_t j = 0; j < out.n; j++) {
+            free(out.v[j]);
+        }
+        free(out.v);
+        return NULL;
+    }
+    out.v[out.n] = NULL;
+    return out.v;
+}
+
+/*
+ * glob_free - Free an expanded argument list
+ */
+void glob_free(char **argv) {
+    if (argv == NULL) {
+        return;
+    }
+    for (char **ap = argv; *ap != NULL; ap++) {
+        free(*ap);
+    }
+    free(argv);
+}
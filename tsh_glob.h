@@ -0,0 +1,56 @@
+/**
+ * @file tsh_glob.h
+ * @brief Glob expansion of command arguments, with a directory cache
+ *
+ * Unquoted arguments of a job that contain `*`, `?` or `[` are expanded
+ * into the sorted list of matching paths before the job is forked, as
+ * `sh -c` would, so commands need not be wrapped in a shell to get
+ * globbing:
+ *
+ *     *        any string, including the empty one
+ *     ?        any single character
+ *     [...]    any character of the set; `[!...]` or `[^...]` any character
+ *              not in it; `a-z` is a range
+ *     **       as a whole path component: any number of directories,
+ *              including none (hidden and symlinked directories are not
+ *              descended into)
+ *
+ * Hidden names only match a component that starts with `.`, and `.` and
+ * `..` never match. An argument that matches nothing is passed on as is.
+ * Assignments in front of the command and redirection files are not
+ * expanded.
+ *
+ * Directory listings are cached, so that expanding over a big directory
+ * again does not read it again: a cached listing is used as long as a
+ * `stat` of the directory shows the same inode and modification time. A
+ * listing read while the directory's modification time was within the
+ * last second may miss a change made in the same clock tick; it is read
+ * again next time, until it settles. `stats` counts the listings read and
+ * those served from the cache.
+ */
+
+#ifndef TSH_GLOB_H
+#define TSH_GLOB_H
+
+#include "tsh_helper.h"
+
+/**
+ * @brief Expands the glob patterns in the arguments of a command.
+ *
+ * @param[in] token  The parsed command line.
+ *
+ * @return A new NULL-terminated argument list, to be freed with
+ *         `glob_free`; or NULL if no argument is a pattern (or out of
+ *         memory), in which case `token->argv` is to be used as is
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+char **glob_expand(const struct cmdline_tokens *token);
+
+/**
+ * @brief Frees an argument list returned by `glob_expand`.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void glob_free(char **argv);
+
+#endif /* TSH_GLOB_H */
@@ -11,17 +11,42 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "csapp.h"
+#include "tsh_admit.h"
 #include "tsh_helper.h"
+#include "tsh_stats.h"
+#include "tsh_status.h"
+#include "tsh_supervise.h"
+
+/* Length of the command lines kept for completed jobs */
+#define MAXLINE_DONE 128
 
 // Struct used to store jobs
 struct job_t {
-    pid_t pid;       // Job PID
-    jid_t jid;       // Job ID [1, 2, ...] defined in tsh_helper.c
-    job_state state; // UNDEF, BG, FG, or ST
-    char *cmdline;   // Command line
+    pid_t pid;            // Job PID, or 0 for a WT job
+    jid_t jid;            // Job ID [1, 2, ...] defined in tsh_helper.c
+    job_state state;      // UNDEF, BG, FG, ST or WT
+    unsigned long serial; // Serial number, never reused
+    int pidfd;            // pidfd of the process, or -1
+    unsigned long cpu_ms; // CPU time used by its reaped processes
+    unsigned long rss_kb; // Peak RSS of its largest reaped process
+    char *cmdline;        // Command line
+};
+
+// Struct used to store the exit status of a completed job
+struct done_t {
+    jid_t jid;                  // Job ID the job had
+    pid_t pid;                  // Job PID
+    unsigned long serial;       // Serial number of the job
+    int status;                 // Raw status from waitpid
+    unsigned long cpu_ms;       // CPU time used by its processes
+    unsigned long rss_kb;       // Peak RSS of its largest process
+    char cmdline[MAXLINE_DONE]; // Command line, possibly truncated
 };
 
 // Parsing states, used internally in parseline
@@ -33,8 +58,11 @@ bool verbose = false;          // If true, prints additional output
 
 /* Static variables */
 static bool check_block = true; // If true, check that signals are blocked
-static struct job_t job_list[MAXJOBS]; // The job list
-static jid_t nextjid = 1;              // Next job ID to allocate
+static struct job_t job_list[MAXJOBS];   // The job list
+static jid_t nextjid = 1;                // Next job ID to allocate
+static unsigned long nextserial = 1;     // Next serial number to allocate
+static struct done_t done_list[MAXDONE]; // Ring of completed jobs
+static unsigned long ndone = 0;          // Completed jobs recorded so far
 
 static bool init = false;
 
@@ -47,6 +75,7 @@ parseline_return parseline(const char *cmdline, struct cmdline_tokens *token) {
     char *buf;                       // ptr that traverses command line
     char *next;                      // ptr to the end of the current arg
     char *endbuf;                    // ptr to end of cmdline string
+    bool quoted;                     // whether the current arg is quoted
 
     parse_state parsing_state; // indicates if the next token is the
                                // input or output file
@@ -77,6 +106,7 @@ parseline_return parseline(const char *cmdline, struct cmdline_tokens *token) {
         buf += strspn(buf, delims);
         if (buf >= endbuf)
             break;
+        quoted = false;
 
         /* Check for I/O redirection specifiers */
         if (*buf == '<') {
@@ -101,6 +131,7 @@ parseline_return parseline(const char *cmdline, struct cmdline_tokens *token) {
             continue;
         } else if (*buf == '\'' || *buf == '\"') {
             /* Detect quoted tokens */
+            quoted = true;
             buf++;
             next = strchr(buf, *(buf - 1));
         } else {
@@ -124,6 +155,7 @@ parseline_return parseline(const char *cmdline, struct cmdline_tokens *token) {
         switch (parsing_state) {
         case ST_NORMAL:
             token->argv[token->argc] = buf;
+            token->quoted[token->argc] = quoted;
             token->argc = token->argc + 1;
             break;
         case ST_INFILE:
@@ -165,6 +197,41 @@ parseline_return parseline(const char *cmdline, struct cmdline_tokens *token) {
         token->builtin = BUILTIN_BG;
     } else if ((strcmp(token->argv[0], "fg")) == 0) { /* fg command */
         token->builtin = BUILTIN_FG;
+    } else if ((strcmp(token->argv[0], "stats")) == 0) { /* stats command */
+        token->builtin = BUILTIN_STATS;
+    } else if ((strcmp(token->argv[0], "capture")) == 0) { /* capture */
+        token->builtin = BUILTIN_CAPTURE;
+    } else if ((strcmp(token->argv[0], "output")) == 0) { /* output */
+        token->builtin = BUILTIN_OUTPUT;
+    } else if ((strcmp(token->argv[0], "after")) == 0) { /* after */
+        token->builtin = BUILTIN_AFTER;
+    } else if ((strcmp(token->argv[0], "dag")) == 0) { /* dag */
+        token->builtin = BUILTIN_DAG;
+    } else if ((strcmp(token->argv[0], "timeout")) == 0) { /* timeout */
+        token->builtin = BUILTIN_TIMEOUT;
+    } else if ((strcmp(token->argv[0], "supervise")) == 0 ||
+               (strcmp(token->argv[0], "retry")) == 0) { /* supervise */
+        token->builtin = BUILTIN_SUPERVISE;
+    } else if ((strcmp(token->argv[0], "wait")) == 0) { /* wait */
+        token->builtin = BUILTIN_WAIT;
+    } else if ((strcmp(token->argv[0], "kill")) == 0) { /* kill */
+        token->builtin = BUILTIN_KILL;
+    } else if ((strcmp(token->argv[0], "export")) == 0) { /* export */
+        token->builtin = BUILTIN_EXPORT;
+    } else if ((strcmp(token->argv[0], "unset")) == 0) { /* unset */
+        token->builtin = BUILTIN_UNSET;
+    } else if ((strcmp(token->argv[0], "admit")) == 0) { /* admit */
+        token->builtin = BUILTIN_ADMIT;
+    } else if ((strcmp(token->argv[0], "incremental")) == 0) { /* incr. */
+        token->builtin = BUILTIN_INCREMENTAL;
+    } else if ((strcmp(token->argv[0], "needs")) == 0) { /* needs */
+        token->builtin = BUILTIN_NEEDS;
+    } else if ((strcmp(token->argv[0], "cache")) == 0) { /* cache */
+        token->builtin = BUILTIN_CACHE;
+    } else if ((strcmp(token->argv[0], "dedup")) == 0) { /* dedup */
+        token->builtin = BUILTIN_DEDUP;
+    } else if ((strcmp(token->argv[0], "on-change")) == 0) { /* on-change */
+        token->builtin = BUILTIN_ON_CHANGE;
     } else {
         token->builtin = BUILTIN_NONE;
     }
@@ -182,6 +249,20 @@ parseline_return parseline(const char *cmdline, struct cmdline_tokens *token) {
     }
 }
 
+/*
+ * skip_args - Skip the first n arguments of a command line
+ * Async-signal-safe
+ */
+const char *skip_args(const char *cmdline, int n) {
+    const char delims[] = " \t\r\n"; // argument delimiters (white-space)
+
+    while (n-- > 0) {
+        cmdline += strspn(cmdline, delims);
+        cmdline += strcspn(cmdline, delims);
+    }
+    return cmdline + strspn(cmdline, delims);
+}
+
 /*****************
  * Signal handlers
  *****************/
@@ -214,7 +295,7 @@ static void check_blocked(void) {
     // Ensure the current signal set contains SIGCHLD, SIGINT, SIGTSTP
     // Printing output should cause the trace to fail
     sigset_t currmask;
-    sigprocmask(SIG_SETMASK, NULL, &currmask);
+    stats_sigprocmask(SIG_SETMASK, NULL, &currmask);
 
     bool sigchld_unblocked = sigismember(&currmask, SIGCHLD) <= 0;
     bool sigint_unblocked = sigismember(&currmask, SIGINT) <= 0;
@@ -250,6 +331,27 @@ static void clearjob(struct job_t *job) {
     job->pid = 0;
     job->jid = 0;
     job->state = UNDEF;
+    job->serial = 0;
+    job->cpu_ms = 0;
+    job->rss_kb = 0;
+}
+
+/*
+ * set_pidfd - Replace the pidfd of a job with one for a new process
+ * Async-signal-safe
+ */
+static void set_pidfd(struct job_t *job, pid_t pid) {
+    if (job->pidfd >= 0) {
+        close(job->pidfd);
+    }
+    job->pidfd = -1;
+#ifdef SYS_pidfd_open
+    // The process cannot have been reaped yet, so this cannot refer to a
+    // recycled PID. Old kernels fail with ENOSYS, leaving no pidfd.
+    if (pid > 0) {
+        job->pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+    }
+#endif
 }
 
 /*
@@ -261,6 +363,7 @@ void init_job_list(void) {
     for (jid_t jid = 1; jid <= MAXJOBS; jid++) {
         struct job_t *job = get_job(jid);
         clearjob(job);
+        job->pidfd = -1;
         job->cmdline = NULL;
     }
     nextjid = 1;
@@ -274,6 +377,7 @@ void destroy_job_list(void) {
     for (jid_t jid = 1; jid <= MAXJOBS; jid++) {
         struct job_t *job = get_job(jid);
         clearjob(job);
+        set_pidfd(job, 0);
         free(job->cmdline);
         job->cmdline = NULL;
     }
@@ -317,7 +421,7 @@ static void require_job_exists(char *func, jid_t jid) {
 }
 
 static void require_valid_state(char *func, jid_t jid, job_state state) {
-    if (state != FG && state != BG && state != ST) {
+    if (state != FG && state != BG && state != ST && state != WT) {
         sio_eprintf("FATAL: job_set_state: invalid job state: %d\n", state);
         sio_eprintf("This means you have a bug in your code, and you need to "
                     "fix it.\n");
@@ -339,7 +443,8 @@ static void require_valid_state(char *func, jid_t jid, job_state state) {
  */
 jid_t add_job(pid_t pid, job_state state, const char *cmdline) {
     check_blocked();
-    if (!((state == FG && fg_job() == 0) || state == BG || state == ST)) {
+    if (!((state == FG && fg_job() == 0) || state == BG || state == ST ||
+          state == WT)) {
         if (state == FG) {
             sio_eprintf("add_job: foreground job already exists\n");
             abort();
@@ -347,7 +452,7 @@ jid_t add_job(pid_t pid, job_state state, const char *cmdline) {
         sio_eprintf("add_job: invalid job state\n");
         abort();
     }
-    if (pid <= 0) {
+    if (pid < 0 || (pid == 0 && state != WT)) {
         sio_eprintf("add_job: invalid pid\n");
         abort();
     }
@@ -371,6 +476,8 @@ jid_t add_job(pid_t pid, job_state state, const char *cmdline) {
     job->jid = nextjid;
     job->pid = pid;
     job->state = state;
+    job->serial = nextserial++;
+    set_pidfd(job, pid);
 
     /* Realloc new buffer for cmdline */
     job->cmdline = realloc(job->cmdline, strlen(cmdline) + 1);
@@ -379,6 +486,7 @@ jid_t add_job(pid_t pid, job_state state, const char *cmdline) {
         _exit(1);
     }
     strcpy(job->cmdline, cmdline);
+    status_page_update_job(job->jid, pid, state, cmdline);
 
     if (verbose) {
         fprintf(stderr, "add_job: Added job [%d] %d %s\n", (int)job->jid,
@@ -408,6 +516,8 @@ bool delete_job(jid_t jid) {
 
     struct job_t *job = get_job(jid);
     clearjob(job);
+    set_pidfd(job, 0);
+    status_page_update_job(jid, 0, UNDEF, NULL);
 
     nextjid = maxjid() + 1;
     sio_assert(nextjid > 0);
@@ -484,6 +594,7 @@ void job_set_state(jid_t jid, job_state state) {
 
     struct job_t *jobp = get_job(jid);
     jobp->state = state;
+    status_page_update_job(jid, jobp->pid, state, NULL);
 }
 
 /*
@@ -498,6 +609,44 @@ pid_t job_get_pid(jid_t jid) {
     return jobp->pid;
 }
 
+/*
+ * job_set_pid - Sets the process ID of a job
+ * Async-signal-safe
+ */
+void job_set_pid(jid_t jid, pid_t pid) {
+    check_blocked();
+    require_job_exists("job_set_pid", jid);
+
+    struct job_t *jobp = get_job(jid);
+    jobp->pid = pid;
+    set_pidfd(jobp, pid);
+    status_page_update_job(jid, pid, jobp->state, NULL);
+}
+
+/*
+ * job_get_serial - Gets the serial number of a job
+ * Async-signal-safe
+ */
+unsigned long job_get_serial(jid_t jid) {
+    check_blocked();
+    require_job_exists("job_get_serial", jid);
+
+    struct job_t *jobp = get_job(jid);
+    return jobp->serial;
+}
+
+/*
+ * job_get_pidfd - Gets the pidfd of a job's process, or -1
+ * Async-signal-safe
+ */
+int job_get_pidfd(jid_t jid) {
+    check_blocked();
+    require_job_exists("job_get_pidfd", jid);
+
+    struct job_t *jobp = get_job(jid);
+    return jobp->pidfd;
+}
+
 /*
  * job_get_cmdline - Gets the cmdline of a job
  * Async-signal-safe
@@ -538,13 +687,29 @@ bool list_jobs(int output_fd) {
         case ST:
             status = "Stopped    ";
             break;
+        case WT:
+            status = "Waiting    ";
+            break;
         default:
             sio_eprintf("Invalid job state\n");
             abort();
         }
 
-        ssize_t res = sio_dprintf(output_fd, "[%d] (%d) %s%s\n", jobp->jid,
+        // Supervised jobs also show how often they were restarted, and
+        // held jobs what they are held back by
+        int restarts = supervise_restarts(jid, jobp->serial);
+        const char *held = admit_reason(jid, jobp->serial);
+        ssize_t res = sio_dprintf(output_fd, "[%d] (%d) %s%s", jobp->jid,
                                   jobp->pid, status, jobp->cmdline);
+        if (res >= 0 && restarts > 0) {
+            res = sio_dprintf(output_fd, " (restarts: %d)", restarts);
+        }
+        if (res >= 0 && held != NULL) {
+            res = sio_dprintf(output_fd, " (held: %s)", held);
+        }
+        if (res >= 0) {
+            res = sio_dprintf(output_fd, "\n");
+        }
         if (res < 0) {
             sio_eprintf("list_jobs: Error writing to output_fd: %d\n",
                         output_fd);
@@ -554,6 +719,107 @@ bool list_jobs(int output_fd) {
 
     return true;
 }
+/*
+ * job_record_exit - Record the exit status of a job in the completed ring
+ * Async-signal-safe
+ */
+void job_record_exit(jid_t jid, int status) {
+    check_blocked();
+    require_job_exists("job_record_exit", jid);
+
+    struct job_t *jobp = get_job(jid);
+    struct done_t *done = &done_list[ndone++ % MAXDONE];
+    done->jid = jid;
+    done->pid = jobp->pid;
+    done->serial = jobp->serial;
+    done->status = status;
+    done->cpu_ms = jobp->cpu_ms;
+    done->rss_kb = jobp->rss_kb;
+    strncpy(done->cmdline, jobp->cmdline, MAXLINE_DONE - 1);
+    done->cmdline[MAXLINE_DONE - 1] = '\0';
+}
+
+/*
+ * job_add_usage - Add the resources used by a reaped process to its job
+ * Async-signal-safe
+ */
+void job_add_usage(jid_t jid, const struct rusage *usage) {
+    check_blocked();
+    require_job_exists("job_add_usage", jid);
+
+    struct job_t *jobp = get_job(jid);
+    long sec = usage->ru_utime.tv_sec + usage->ru_stime.tv_sec;
+    long usec = usage->ru_utime.tv_usec + usage->ru_stime.tv_usec;
+    jobp->cpu_ms += (unsigned long)(sec * 1000 + usec / 1000);
+    if ((unsigned long)usage->ru_maxrss > jobp->rss_kb) {
+        jobp->rss_kb = (unsigned long)usage->ru_maxrss;
+    }
+}
+
+/*
+ * job_find_exit - Find the most recent exit status of a completed job
+ * Async-signal-safe
+ */
+bool job_find_exit(jid_t jid, unsigned long serial, unsigned long *serialp,
+                   int *statusp) {
+    check_blocked();
+
+    unsigned long oldest = ndone > MAXDONE ? ndone - MAXDONE : 0;
+    for (unsigned long i = ndone; i > oldest; i--) {
+        struct done_t *done = &done_list[(i - 1) % MAXDONE];
+        if (done->jid == jid && (serial == 0 || done->serial == serial)) {
+            if (serialp != NULL) {
+                *serialp = done->serial;
+            }
+            if (statusp != NULL) {
+                *statusp = done->status;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * list_done - Print the completed jobs to a file descriptor, oldest first
+ * Async-signal-safe
+ */
+bool list_done(int output_fd) {
+    check_blocked();
+    if (output_fd < 0) {
+        sio_eprintf("list_done: invalid file descriptor\n");
+        abort();
+    }
+
+    unsigned long oldest = ndone > MAXDONE ? ndone - MAXDONE : 0;
+    for (unsigned long i = oldest; i < ndone; i++) {
+        struct done_t *done = &done_list[i % MAXDONE];
+        ssize_t res;
+        if (WIFSIGNALED(done->status)) {
+            res = sio_dprintf(output_fd,
+                              "[%d] (%d) Terminated %s (signal %d, ",
+                              done->jid, done->pid, done->cmdline,
+                              WTERMSIG(done->status));
+        } else {
+            res = sio_dprintf(output_fd,
+                              "[%d] (%d) Done       %s (status %d, ",
+                              done->jid, done->pid, done->cmdline,
+                              WEXITSTATUS(done->status));
+        }
+        if (res >= 0) {
+            res = sio_dprintf(output_fd, "cpu %lums, rss %luKB)\n",
+                              done->cpu_ms, done->rss_kb);
+        }
+        if (res < 0) {
+            sio_eprintf("list_done: Error writing to output_fd: %d\n",
+                        output_fd);
+            return false;
+        }
+    }
+
+    return true;
+}
+
 /******************************
  * end job list helper routines
  ******************************/
@@ -562,14 +828,73 @@ bool list_jobs(int output_fd) {
  * Other helper routines
  ***********************/
 
+/*
+ * parse_signal - Parse a signal name (TERM, SIGTERM) or number
+ * Async-signal-safe
+ */
+int parse_signal(const char *str) {
+    static const struct {
+        const char *name;
+        int sig;
+    } names[] = {
+        {"HUP", SIGHUP},   {"INT", SIGINT},   {"QUIT", SIGQUIT},
+        {"KILL", SIGKILL}, {"USR1", SIGUSR1}, {"USR2", SIGUSR2},
+        {"PIPE", SIGPIPE}, {"ALRM", SIGALRM}, {"TERM", SIGTERM},
+        {"CHLD", SIGCHLD}, {"CONT", SIGCONT}, {"STOP", SIGSTOP},
+        {"TSTP", SIGTSTP}, {"TTIN", SIGTTIN}, {"TTOU", SIGTTOU},
+        {"WINCH", SIGWINCH},
+    };
+
+    if (strncmp(str, "SIG", 3) == 0) {
+        str += 3;
+    }
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcmp(str, names[i].name) == 0) {
+            return names[i].sig;
+        }
+    }
+    if (*str < '0' || *str > '9') {
+        return -1;
+    }
+    int sig = 0;
+    for (; *str >= '0' && *str <= '9' && sig < NSIG; str++) {
+        sig = sig * 10 + (*str - '0');
+    }
+    return *str == '\0' && sig < NSIG ? sig : -1;
+}
+
 /*
  * usage - Print the usage of the tiny shell
  * Not async-signal-safe
  */
 void usage(void) {
-    printf("Usage: shell [-hvp]\n");
+    printf("Usage: shell [-hvp] [-f FILE] [--status-page FILE] "
+           "[--serve [HOST:]PORT|unix:PATH [--max-jobs N]]\n"
+           "             [--coordinate ADDR[,ADDR...]] [--subreaper] "
+           "[--no-cgroup]\n"
+           "             [--spawners N] [--dedup]\n");
     printf("   -h   print this message\n");
     printf("   -v   print additional diagnostic information\n");
     printf("   -p   do not emit a command prompt\n");
+    printf("   -f FILE\n");
+    printf("        run the script FILE, compiled once and cached\n");
+    printf("   --status-page FILE\n");
+    printf("        publish the job table and counters in FILE (mmap)\n");
+    printf("   --serve [HOST:]PORT|unix:PATH\n");
+    printf("        accept job submissions from clients instead of stdin;\n");
+    printf("        unauthenticated: anyone who can connect runs commands,\n");
+    printf("        so a bare PORT listens on loopback only\n");
+    printf("   --max-jobs N\n");
+    printf("        in server mode, run at most N jobs at once\n");
+    printf("   --coordinate ADDR[,ADDR...]\n");
+    printf("        run commands on tsh workers (HOST:PORT or unix:PATH)\n");
+    printf("   --subreaper\n");
+    printf("        reap orphaned descendants; a job ends with its last one\n");
+    printf("   --no-cgroup\n");
+    printf("        stop jobs with signals instead of the cgroup freezer\n");
+    printf("   --spawners N\n");
+    printf("        launch background jobs from N threads with posix_spawn\n");
+    printf("   --dedup\n");
+    printf("        attach duplicates of live jobs to them (`dedup on`)\n");
     exit(EXIT_FAILURE);
 }
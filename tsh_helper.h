@@ -24,6 +24,7 @@
 #define TSH_HELPER_H
 
 #include <stdbool.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -31,6 +32,7 @@
 #define MAXLINE_TSH 1024 /**< Max line size */
 #define MAXARGS 128      /**< Max args on a command line */
 #define MAXJOBS 64       /**< Max jobs at any point in time */
+#define MAXDONE 64       /**< Completed jobs whose status is retained */
 
 /** @brief Integer type used for job IDs */
 typedef int jid_t;
@@ -43,14 +45,17 @@ typedef int jid_t;
  *   - ST -> FG  : fg command
  *   - ST -> BG  : bg command
  *   - BG -> FG  : fg command
+ *   - WT -> BG  : the job's dependencies have finished
  *
- * At most 1 job can be in the FG state.
+ * At most 1 job can be in the FG state. A WT job has no process yet, and
+ * its PID is 0 until it is started.
  */
 typedef enum job_state {
     UNDEF = 0, ///< Undefined (do not use)
     FG = 1,    ///< Foreground job
     BG = 2,    ///< Background job
     ST = 3,    ///< Stopped job
+    WT = 4,    ///< Waiting job (not started yet)
 } job_state;
 
 /**
@@ -67,11 +72,28 @@ typedef enum parseline_return {
  * @brief Types of builtins that can be executed by the shell
  */
 typedef enum builtin_state {
-    BUILTIN_NONE = 8,  ///< Not a builtin command
-    BUILTIN_QUIT = 9,  ///< `quit` (exit the shell)
-    BUILTIN_JOBS = 10, ///< `jobs` (list running jobs)
-    BUILTIN_BG = 11,   ///< `bg` (run job in background)
-    BUILTIN_FG = 12    ///< `fg` (run job in foreground)
+    BUILTIN_NONE = 8,         ///< Not a builtin command
+    BUILTIN_QUIT = 9,         ///< `quit` (exit the shell)
+    BUILTIN_JOBS = 10,        ///< `jobs` (list running jobs)
+    BUILTIN_BG = 11,          ///< `bg` (run job in background)
+    BUILTIN_FG = 12,          ///< `fg` (run job in foreground)
+    BUILTIN_STATS = 13,       ///< `stats` (print shell-internals counters)
+    BUILTIN_CAPTURE = 14,     ///< `capture` (configure output capture)
+    BUILTIN_OUTPUT = 15,      ///< `output` (print captured job output)
+    BUILTIN_AFTER = 16,       ///< `after` (run a job after other jobs)
+    BUILTIN_DAG = 17,         ///< `dag` (submit a graph of dependent jobs)
+    BUILTIN_TIMEOUT = 18,     ///< `timeout` (run a job with a deadline)
+    BUILTIN_SUPERVISE = 19,   ///< `supervise`, `retry` (restart a job)
+    BUILTIN_WAIT = 20,        ///< `wait` (wait for jobs to finish)
+    BUILTIN_KILL = 21,        ///< `kill` (signal jobs)
+    BUILTIN_EXPORT = 22,      ///< `export` (set environment variables)
+    BUILTIN_UNSET = 23,       ///< `unset` (remove environment variables)
+    BUILTIN_ADMIT = 24,       ///< `admit` (limit background job launches)
+    BUILTIN_INCREMENTAL = 25, ///< `incremental` (skip up-to-date commands)
+    BUILTIN_NEEDS = 26,       ///< `needs` (run a command with prerequisites)
+    BUILTIN_CACHE = 27,       ///< `cache` (replay the output of a command)
+    BUILTIN_DEDUP = 28,       ///< `dedup` (attach duplicates to live jobs)
+    BUILTIN_ON_CHANGE = 29    ///< `on-change` (run a command on changes)
 } builtin_state;
 
 /**
@@ -80,6 +102,7 @@ typedef enum builtin_state {
 struct cmdline_tokens {
     int argc;               ///< Number of arguments passed
     char *argv[MAXARGS];    ///< The arguments list
+    bool quoted[MAXARGS];   ///< Whether each argument was quoted
     char *infile;           ///< The filename for input redirection, or NULL
     char *outfile;          ///< The filename for output redirection, or NULL
     builtin_state builtin;  ///< Indicates if argv[0] is a builtin command
@@ -99,7 +122,8 @@ extern bool verbose;        ///< If true, prints additional output
  * command line used as a backing buffer for the other fields.
  *
  * Characters enclosed in single or double quotes are treated as a single
- * argument. The maximum number of arguments that will be parsed is `MAXARGS`.
+ * argument, which is marked in `quoted` so that it is not glob-expanded. The
+ * maximum number of arguments that will be parsed is `MAXARGS`.
  *
  * Only the first `MAXLINE_TSH - 1` characters of the command line will be
  * parsed. The command line is in the form:
@@ -123,6 +147,23 @@ extern bool verbose;        ///< If true, prints additional output
  */
 parseline_return parseline(const char *cmdline, struct cmdline_tokens *token);
 
+/**
+ * @brief Skips the first arguments of a command line.
+ *
+ * Used by builtins that run another command line, such as `after %1 CMD`:
+ * the remaining text can be handed to `parseline` as is, so that quoting
+ * and redirections in it are preserved.
+ *
+ * @param[in] cmdline  The command line.
+ * @param[in] n        The number of arguments to skip, which must not
+ *                     contain quotes or whitespace.
+ *
+ * @return A pointer into `cmdline`, to the start of argument `n`
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+const char *skip_args(const char *cmdline, int n);
+
 /**
  * @brief Initializes the job list.
  *
@@ -157,7 +198,8 @@ void destroy_job_list(void);
  * job, and writing the job to the job list with the given parameters. This
  * allows the job to be tracked by the functions provided in the job list.
  *
- * @param[in] pid: The process ID of the main process of the job.
+ * @param[in] pid: The process ID of the main process of the job, or 0 for
+ *                 a `WT` job.
  * @param[in] state: The initial state of the job (should not be UNDEF).
  * @param[in] cmdline: The command line used to start the job.
  *
@@ -170,6 +212,7 @@ void destroy_job_list(void);
  * @pre `state` must represent a valid job state other than `UNDEF`.
  * @pre If `state` is equal to `FG`, then there must currently be no
  *      other foreground job in the job list.
+ * @pre `pid` must be positive, unless `state` is `WT`.
  *
  * @remark Async-signal-safety: Not async-signal-safe.
  */
@@ -253,6 +296,53 @@ jid_t job_from_pid(pid_t pid);
  */
 pid_t job_get_pid(jid_t jid);
 
+/**
+ * @brief Sets the process ID of a job, once a waiting job has been started
+ *
+ * @param[in] jid  The job ID to modify
+ * @param[in] pid  The PID of the initial process in the job
+ *
+ * @pre Any signals that could modify the job list must be blocked.
+ * @pre `jid` must be a valid job ID
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void job_set_pid(jid_t jid, pid_t pid);
+
+/**
+ * @brief Gets the serial number of a job
+ *
+ * Every job added to the job list gets a new serial number. Unlike job IDs,
+ * serial numbers are never reused, so they identify a job even after it
+ * has been deleted.
+ *
+ * @param[in] jid The job ID to look up
+ * @return The serial number of the job, which is never 0
+ *
+ * @pre Any signals that could modify the job list must be blocked.
+ * @pre `jid` must be a valid job ID
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+unsigned long job_get_serial(jid_t jid);
+
+/**
+ * @brief Gets a pidfd for the process of a job
+ *
+ * The job list opens a pidfd (see pidfd_open(2)) for the process of each
+ * job when the job is added or its PID is set, and closes it when the job
+ * is deleted or gets another process. It becomes readable when the process
+ * exits. The descriptor is owned by the job list; callers that need it for
+ * longer than the signals are blocked must duplicate it.
+ *
+ * @param[in] jid The job ID to look up
+ * @return The pidfd, or -1 for a `WT` job or if the kernel does not
+ *         support pidfds
+ *
+ * @pre Any signals that could modify the job list must be blocked.
+ * @pre `jid` must be a valid job ID
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+int job_get_pidfd(jid_t jid);
+
 /**
  * @brief Gets the command line of a job
  *
@@ -309,6 +399,81 @@ void job_set_state(jid_t jid, job_state state);
  */
 bool list_jobs(int output_fd);
 
+/**
+ * @brief Records the exit status of a job whose process has ended.
+ *
+ * The statuses of the last `MAXDONE` job processes that ended are kept in
+ * a ring, so that they can still be looked up once the job is deleted.
+ * This should be called before the job is deleted.
+ *
+ * @param[in] jid     The job ID of the job.
+ * @param[in] status  The raw status from waitpid.
+ *
+ * @pre Any signals that could modify the job list must be blocked.
+ * @pre `jid` must be a valid job ID
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void job_record_exit(jid_t jid, int status);
+
+/**
+ * @brief Adds the resources used by a reaped process to its job.
+ *
+ * The CPU time is summed and the peak RSS is the largest seen; both are
+ * recorded with the job's exit status.
+ *
+ * @param[in] jid    The job ID of the job.
+ * @param[in] usage  The resources used, as reported by wait4.
+ *
+ * @pre Any signals that could modify the job list must be blocked.
+ * @pre `jid` must be a valid job ID
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void job_add_usage(jid_t jid, const struct rusage *usage);
+
+/**
+ * @brief Looks up the most recent recorded exit status of a job.
+ *
+ * @param[in]  jid      The job ID the job had.
+ * @param[in]  serial   The serial number of the job, or 0 for the most
+ *                      recent job with this job ID.
+ * @param[out] serialp  If not NULL, receives the serial number of the job.
+ * @param[out] statusp  If not NULL, receives the raw status from waitpid.
+ *
+ * @return true if a matching job was found in the completed ring
+ * @return false otherwise
+ *
+ * @pre Any signals that could modify the job list must be blocked.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool job_find_exit(jid_t jid, unsigned long serial, unsigned long *serialp,
+                   int *statusp);
+
+/**
+ * @brief Writes the completed ring to a file descriptor, oldest first.
+ *
+ * @param[in] output_fd: The file descriptor to write to.
+ * @return true if the function succeeded
+ * @return false if an error occurred while writing to the file descriptor
+ *
+ * @pre Any signals that could modify the job list must be blocked.
+ * @pre `output_fd` must be a valid file descriptor open for writing.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool list_done(int output_fd);
+
+/**
+ * @brief Parses a signal name or number.
+ *
+ * Accepts the common signal names, with or without the `SIG` prefix (e.g.
+ * `TERM` or `SIGTERM`), and signal numbers, including 0.
+ *
+ * @param[in] str  The string to parse.
+ * @return The signal number, or -1 if `str` is not a valid signal
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+int parse_signal(const char *str);
+
 /**
  * @brief Prints usage instructions for the tiny shell.
  * @remark Async-signal-safety: Not async-signal-safe.
@@ -0,0 +1,477 @@
+/**
+ * @file tsh_incr.c
+ * @brief Incremental execution: skip commands whose output is up to date.
+ *
+ * For documentation related to usage, see the corresponding header file at
+ * tsh_incr.h.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "csapp.h"
+#include "tsh.h"
+#include "tsh_helper.h"
+#include "tsh_incr.h"
+#include "tsh_loop.h"
+#include "tsh_stats.h"
+
+#define DEFAULT_DB ".tsh-hashes"  // Hash database, in the current directory
+#define HASH_CHUNK (1024 * 1024)  // Bytes read at a time when hashing
+
+// Struct used to store an entry of the hash database
+struct entry {
+    uint64_t in;  // Hash of the command line and its prerequisites
+    uint64_t out; // Hash of the target's contents
+    char *path;   // Absolute path of the target
+};
+
+// Struct used to store a command that is running, indexed by job ID
+struct run {
+    unsigned long serial; // Serial number of the job, 0 if unused
+    char *target;         // Absolute path of its target
+    uint64_t in;          // Its input hash, in hash mode
+    bool hashed;          // Whether it ran in hash mode
+};
+
+/* Static variables */
+static bool enabled = false;          // Incremental mode is on
+static bool hashing = false;          // Contents, not mtimes, decide
+static char db_path[PATH_MAX];        // Hash database
+static struct entry *entries = NULL;  // Its entries
+static int nentries = 0;              // Number of entries
+static bool loaded = false;           // Whether the database was read
+static struct run runs[MAXJOBS + 1];  // Indexed by job ID
+static bool listening = false;        // Child listener registered
+
+/*
+ * incr_hash - Add bytes to a hash, eight at a time
+ */
+uint64_t incr_hash(uint64_t h, const void *data, size_t len) {
+    uint64_t w;
+    size_t i;
+
+    h ^= len;
+    for (i = 0; i + 8 <= len; i += 8) {
+        memcpy(&w, (const char *)data + i, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    w = 0;
+    memcpy(&w, (const char *)data + i, len - i);
+    h = (h ^ w) * 0xc4ceb9fe1a85ec53ULL;
+    return h ^ (h >> 29);
+}
+
+/*
+ * incr_hash_file - Add the contents of a file to a hash
+ */
+bool incr_hash_file(const char *path, uint64_t *h) {
+    static char *buf = NULL;
+    ssize_t n;
+
+    if (buf == NULL && (buf = malloc(HASH_CHUNK)) == NULL) {
+        return false;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    while ((n = read(fd, buf, HASH_CHUNK)) > 0) {
+        *h = incr_hash(*h, buf, (size_t)n);
+    }
+    close(fd);
+    stats_inc(STAT_FILES_HASHED);
+    return n == 0;
+}
+
+/*
+ * absolute - Make a path absolute, relative to the current directory
+ */
+static bool absolute(const char *path, char *buf, size_t size) {
+    char cwd[PATH_MAX];
+
+    if (path[0] == '/') {
+        return (size_t)snprintf(buf, size, "%s", path) < size;
+    }
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        return false;
+    }
+    return (size_t)snprintf(buf, size, "%s/%s", cwd, path) < size;
+}
+
+/*
+ * db_find - Index of a target in the hash database, or -1
+ */
+static int db_find(const char *path) {
+    for (int i = 0; i < nentries; i++) {
+        if (strcmp(entries[i].path, path) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * db_load - Read the hash database, once
+ *
+ * Each line is `IN OUT PATH`, with the hashes in hex.
+ */
+static void db_load(void) {
+    char line[PATH_MAX + 64];
+    unsigned long long in, out;
+    int off;
+
+    if (loaded) {
+        return;
+    }
+    loaded = true;
+    FILE *fp = fopen(db_path, "r");
+    if (fp == NULL) {
+        return;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        if (sscanf(line, "%llx %llx %n", &in, &out, &off) != 2 ||
+            db_find(line + off) >= 0) {
+            continue;
+        }
+        struct entry *grown =
+            realloc(entries, (nentries + 1) * sizeof(*entries));
+        char *path = strdup(line + off);
+        if (grown == NULL || path == NULL) {
+            entries = grown != NULL ? grown : entries;
+            free(path);
+            break;
+        }
+        entries = grown;
+        entries[nentries++] = (struct entry){in, out, path};
+    }
+    fclose(fp);
+}
+
+/*
+ * db_save - Write the hash database, replacing it atomically
+ */
+static void db_save(void) {
+    char tmp[PATH_MAX + 32];
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp.%d", db_path, (int)getpid());
+    FILE *fp = fopen(tmp, "w");
+    if (fp == NULL) {
+        perror(tmp);
+        return;
+    }
+    for (int i = 0; i < nentries; i++) {
+        fprintf(fp, "%016llx %016llx %s\n", (unsigned long long)entries[i].in,
+                (unsigned long long)entries[i].out, entries[i].path);
+    }
+    if (fclose(fp) != 0 || rename(tmp, db_path) < 0) {
+        perror(db_path);
+        unlink(tmp);
+    }
+}
+
+/*
+ * db_set - Record a target's hashes, or forget it if `keep` is false
+ */
+static void db_set(const char *path, uint64_t in, uint64_t out, bool keep) {
+    int i = db_find(path);
+
+    if (!keep) {
+        if (i < 0) {
+            return;
+        }
+        free(entries[i].path);
+        entries[i] = entries[--nentries];
+    } else if (i >= 0) {
+        entries[i].in = in;
+        entries[i].out = out;
+    } else {
+        struct entry *grown =
+            realloc(entries, (nentries + 1) * sizeof(*entries));
+        char *copy = strdup(path);
+        if (grown == NULL || copy == NULL) {
+            entries = grown != NULL ? grown : entries;
+            free(copy);
+            return;
+        }
+        entries = grown;
+        entries[nentries++] = (struct entry){in, out, copy};
+    }
+    db_save();
+}
+
+/*
+ * newer - Whether the target is at least as new as every prerequisite
+ */
+static bool newer(const char *target, const char **prereqs, int n) {
+    struct stat st;
+
+    if (stat(target, &st) < 0) {
+        return false;
+    }
+    struct timespec t = st.st_mtim;
+    for (int i = 0; i < n; i++) {
+        if (stat(prereqs[i], &st) < 0 || st.st_mtim.tv_sec > t.tv_sec ||
+            (st.st_mtim.tv_sec == t.tv_sec &&
+             st.st_mtim.tv_nsec > t.tv_nsec)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * input_hash - Hash of a command line and the contents of its
+ * prerequisites
+ */
+static bool input_hash(const char *cmdline, const char **prereqs, int n,
+                       uint64_t *h) {
+    *h = incr_hash(INCR_HASH_SEED, cmdline, strlen(cmdline));
+    for (int i = 0; i < n; i++) {
+        *h = incr_hash(*h, prereqs[i], strlen(prereqs[i]));
+        if (!incr_hash_file(prereqs[i], h)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * finish - Record how a command ended
+ *
+ * A target that failed is made older than anything, so that it is not up
+ * to date the next time.
+ */
+static void finish(const char *target, uint64_t in, bool hashed, int status) {
+    uint64_t out = INCR_HASH_SEED;
+    bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+    if (!ok) {
+        struct timespec epoch[2] = {{0, 0}, {0, 0}};
+        utimensat(AT_FDCWD, target, epoch, 0);
+    }
+    if (hashed) {
+        bool keep = ok && incr_hash_file(target, &out);
+        db_set(target, in, out, keep);
+    }
+}
+
+/*
+ * incr_child - Child listener: record how a command that was running
+ * ended
+ */
+static void incr_child(const struct child_event *event, void *arg) {
+    if (event->jid <= 0 || event->jid > MAXJOBS ||
+        WIFSTOPPED(event->status)) {
+        return;
+    }
+    struct run *r = &runs[event->jid];
+    if (r->serial == 0 || r->serial != event->serial) {
+        return;
+    }
+    finish(r->target, r->in, r->hashed, event->status);
+    free(r->target);
+    memset(r, 0, sizeof(*r));
+}
+
+/*
+ * incr_lost - Lost-event task: record how the commands whose
+ * events were dropped ended
+ */
+static void incr_lost(void) {
+    struct child_event event;
+
+    for (jid_t jid = 1; jid <= MAXJOBS; jid++) {
+        if (runs[jid].serial != 0 &&
+            loop_lost_event(jid, runs[jid].serial, &event)) {
+            incr_child(&event, NULL);
+        }
+    }
+}
+
+/*
+ * incr_launch - Launch a job, unless it is up to date
+ */
+jid_t incr_launch(const struct cmdline_tokens *token, const char *cmdline,
+                  job_state state, char **deps) {
+    const char *prereqs[MAXARGS + 1];
+    char target[PATH_MAX];
+    sigset_t mask_all, mask_prev;
+    unsigned long serial = 0;
+    uint64_t in = 0;
+    int status;
+    int n = 0;
+
+    if (!enabled || token->outfile == NULL) {
+        return launch_job(token, cmdline, state);
+    }
+    if (token->infile != NULL) {
+        prereqs[n++] = token->infile;
+    }
+    for (int i = 0; deps != NULL && deps[i] != NULL && n < MAXARGS; i++) {
+        prereqs[n++] = deps[i];
+    }
+    if (n == 0 || !absolute(token->outfile, target, sizeof(target))) {
+        return launch_job(token, cmdline, state);
+    }
+
+    // Up to date?
+    bool hashed = hashing && input_hash(cmdline, prereqs, n, &in);
+    bool skip;
+    if (hashed) {
+        uint64_t out = INCR_HASH_SEED;
+        int i = db_find(target);
+        skip = i >= 0 && entries[i].in == in &&
+               incr_hash_file(target, &out) && entries[i].out == out;
+    } else {
+        skip = !hashing && newer(target, prereqs, n);
+    }
+    if (skip) {
+        stats_inc(STAT_UP_TO_DATE);
+        if (verbose) {
+            printf("Up to date: %s\n", cmdline);
+        }
+        last_status = 0;
+        return 0;
+    }
+
+    if (!listening) {
+        if (!loop_on_child(incr_child, NULL) || !loop_on_lost(incr_lost)) {
+            printf("incremental: cannot track job completions\n");
+            return launch_job(token, cmdline, state);
+        }
+        listening = true;
+    }
+    jid_t jid = launch_job(token, cmdline, state);
+    if (jid == 0) {
+        return 0;
+    }
+
+    // A job that is still there is recorded when it ends; a foreground job
+    // has usually ended already
+    sigfillset(&mask_all);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+    bool running = job_exists(jid);
+    if (running) {
+        serial = job_get_serial(jid);
+    } else if (!job_find_exit(jid, 0, NULL, &status)) {
+        status = W_EXITCODE(0, SIGTERM);
+    }
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+
+    if (!running) {
+        finish(target, in, hashed, status);
+        return jid;
+    }
+    struct run *r = &runs[jid];
+    free(r->target);
+    r->serial = serial;
+    r->target = strdup(target);
+    r->in = in;
+    r->hashed = hashed;
+    if (r->target == NULL) {
+        r->serial = 0;
+    }
+    return jid;
+}
+
+/*
+ * incr_builtin - The `incremental` builtin
+ */
+void incr_builtin(char **argv) {
+    const char *db = DEFAULT_DB;
+    bool hash = false;
+
+    if (argv[1] == NULL) {
+        if (!enabled) {
+            printf("incremental: off\n");
+        } else if (hashing) {
+            printf("incremental: on, hashing into %s (%d targets)\n",
+                   db_path, nentries);
+        } else {
+            printf("incremental: on, by modification time\n");
+        }
+        return;
+    }
+    if (strcmp(argv[1], "off") == 0 && argv[2] == NULL) {
+        enabled = false;
+        return;
+    }
+    if (strcmp(argv[1], "on") != 0) {
+        printf("incremental: usage: incremental on [--hash] [--db FILE] | "
+               "incremental off\n");
+        return;
+    }
+    for (int i = 2; argv[i] != NULL; i++) {
+        if (strcmp(argv[i], "--hash") == 0) {
+            hash = true;
+        } else if (strcmp(argv[i], "--db") == 0 && argv[i + 1] != NULL) {
+            db = argv[++i];
+            hash = true;
+        } else {
+            printf("incremental: unknown option %s\n", argv[i]);
+            return;
+        }
+    }
+
+    if (hash) {
+        char path[PATH_MAX];
+        if (!absolute(db, path, sizeof(path))) {
+            printf("incremental: %s: %s\n", db, strerror(errno));
+            return;
+        }
+        // Another database: forget the entries of the old one
+        if (strcmp(path, db_path) != 0) {
+            for (int i = 0; i < nentries; i++) {
+                free(entries[i].path);
+            }
+            nentries = 0;
+            loaded = false;
+            strcpy(db_path, path);
+        }
+        db_load();
+    }
+    enabled = true;
+    hashing = hash;
+}
+
+/*
+ * incr_builtin_needs - The `needs` builtin
+ */
+void incr_builtin_needs(const char *cmdline, char **argv) {
+    char *deps[MAXARGS];
+    int i, n = 0;
+
+    for (i = 1; argv[i] != NULL && strcmp(argv[i], "--") != 0; i++) {
+        deps[n++] = argv[i];
+    }
+    if (n == 0 || argv[i] == NULL || argv[i + 1] == NULL) {
+        printf("needs: usage: needs FILE... -- COMMAND [&]\n");
+        return;
+    }
+    deps[n] = NULL;
+
+    struct cmdline_tokens token;
+    const char *cmd = skip_args(cmdline, i + 1);
+    parseline_return ret = parseline(cmd, &token);
+    if (ret == PARSELINE_ERROR || ret == PARSELINE_EMPTY) {
+        return;
+    }
+    if (token.builtin != BUILTIN_NONE) {
+        printf("needs: cannot run builtin %s\n", token.argv[0]);
+        return;
+    }
+    incr_launch(&token, cmdline, ret == PARSELINE_BG ? BG : FG, deps);
+}
@@ -0,0 +1,111 @@
+/**
+ * @file tsh_incr.h
+ * @brief Incremental execution: skip commands whose output is up to date
+ *
+ * In incremental mode, a command with an output redirection (`> FILE`) is
+ * treated like a make rule: FILE is its target, and its prerequisites are
+ * its input redirection (`< FILE`) and the files declared with `needs`. If
+ * the target is up to date, the command is skipped without forking and `$?`
+ * is 0. A command without prerequisites always runs.
+ *
+ * By default, a target is up to date if it is at least as new as every
+ * prerequisite. With `--hash`, modification times are not trusted: the
+ * shell keeps a small database (`.tsh-hashes` in the current directory by
+ * default) that maps each target to a hash of the command line and the
+ * contents of its prerequisites, and to a hash of the target's own
+ * contents, as of the last successful run. The command is skipped if both
+ * still match.
+ *
+ * A command that fails must run again: its target's modification time is
+ * set back to the epoch, and its database entry is removed.
+ *
+ * Builtins:
+ *
+ *     incremental on [--hash] [--db FILE]
+ *         Skip commands whose output is up to date
+ *     incremental off
+ *         Run every command (the default)
+ *     incremental
+ *         Show the mode
+ *     needs FILE... -- COMMAND [&]
+ *         Run COMMAND with FILE... as extra prerequisites
+ *
+ * `stats` counts the commands skipped and the files hashed.
+ */
+
+#ifndef TSH_INCR_H
+#define TSH_INCR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tsh_helper.h"
+
+/** Initial value of a hash, for `incr_hash` and `incr_hash_file` */
+#define INCR_HASH_SEED 0x9e3779b97f4a7c15ULL
+
+/**
+ * @brief Launches a parsed command line as a new job, unless incremental
+ *        mode is on and its output is up to date.
+ *
+ * @param[in] token    The parsed command line.
+ * @param[in] cmdline  The command line, as recorded in the job list.
+ * @param[in] state    `FG` or `BG`.
+ * @param[in] deps     NULL-terminated extra prerequisites, or NULL.
+ *
+ * @return The job ID of the new job, or 0 if it was skipped or could not
+ *         be started
+ *
+ * @pre Signals must not be blocked.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+jid_t incr_launch(const struct cmdline_tokens *token, const char *cmdline,
+                  job_state state, char **deps);
+
+/**
+ * @brief Adds bytes to a 64-bit hash (not cryptographic), eight at a time.
+ *
+ * @param[in] h     The hash so far, `INCR_HASH_SEED` to start with.
+ * @param[in] data  The bytes.
+ * @param[in] len   Their number.
+ *
+ * @return The new hash
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+uint64_t incr_hash(uint64_t h, const void *data, size_t len);
+
+/**
+ * @brief Adds the contents of a file to a hash, as `incr_hash` does.
+ *
+ * @param[in]     path  The file.
+ * @param[in,out] h     The hash.
+ *
+ * @return true on success, false if the file could not be read
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool incr_hash_file(const char *path, uint64_t *h);
+
+/**
+ * @brief Implements the `incremental` builtin.
+ *
+ * @param[in] argv  The parsed arguments.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void incr_builtin(char **argv);
+
+/**
+ * @brief Implements the `needs` builtin.
+ *
+ * @param[in] cmdline  The full command line; the command to run is taken
+ *                     from it verbatim.
+ * @param[in] argv     The parsed arguments.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void incr_builtin_needs(const char *cmdline, char **argv);
+
+#endif /* TSH_INCR_H */
@@ -0,0 +1,293 @@
+/**
+ * @file tsh_kill.c
+ * @brief The `kill` builtin.
+ *
+ * For documentation related to usage, see the corresponding header file at
+ * tsh_kill.h.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "csapp.h"
+#include "tsh_helper.h"
+#include "tsh_kill.h"
+#include "tsh_stats.h"
+
+#ifndef PIDFD_SIGNAL_PROCESS_GROUP
+#define PIDFD_SIGNAL_PROCESS_GROUP (1U << 2) // Linux 6.9, <linux/pidfd.h>
+#endif
+
+// Struct used to store a process found in /proc
+struct proc {
+    pid_t pid;  // Process ID
+    pid_t ppid; // Parent process ID
+    pid_t pgid; // Process group ID
+    int pidfd;  // pidfd, once opened and checked, or -1
+};
+
+/*
+ * open_pidfd - pidfd_open(2), which glibc may not wrap
+ */
+static int open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/*
+ * send_pidfd - pidfd_send_signal(2), which glibc may not wrap
+ */
+static int send_pidfd(int pidfd, int sig, unsigned int flags) {
+#ifdef SYS_pidfd_send_signal
+    return (int)syscall(SYS_pidfd_send_signal, pidfd, sig, NULL, flags);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/*
+ * read_stat - Read the parent and process group of a process from /proc
+ */
+static bool read_stat(pid_t pid, pid_t *ppid, pid_t *pgid) {
+    char path[64];
+    char buf[512];
+    int fd;
+    ssize_t n;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        return false;
+    }
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) {
+        return false;
+    }
+    buf[n] = '\0';
+
+    // The command name is in parentheses and may itself contain any
+    // character, so the fields after it are found from the last ')'
+    char *p = strrchr(buf, ')');
+    char state;
+    int pp, pg;
+    if (p == NULL || sscanf(p + 1, " %c %d %d", &state, &pp, &pg) != 3) {
+        return false;
+    }
+    *ppid = pp;
+    *pgid = pg;
+    return true;
+}
+
+/*
+ * scan_procs - List every process on the system
+ */
+static struct proc *scan_procs(int *nprocs) {
+    DIR *dir = opendir("/proc");
+    struct dirent *entry;
+    struct proc *procs = NULL;
+    int n = 0, cap = 0;
+
+    if (dir == NULL) {
+        return NULL;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] < '0' || entry->d_name[0] > '9') {
+            continue;
+        }
+        if (n == cap) {
+            cap = cap ? 2 * cap : 256;
+            struct proc *p = realloc(procs, sizeof(*p) * (size_t)cap);
+            if (p == NULL) {
+                break;
+            }
+            procs = p;
+        }
+        struct proc *proc = &procs[n];
+        proc->pid = atoi(entry->d_name);
+        proc->pidfd = -1;
+        if (read_stat(proc->pid, &proc->ppid, &proc->pgid)) {
+            n++;
+        }
+    }
+    closedir(dir);
+    *nprocs = n;
+    return procs;
+}
+
+/*
+ * open_tree - Open pidfds for the descendants of a process, outside of the
+ * process group `group`
+ *
+ * Descendants are moved to the front of `procs`. Each one is checked to
+ * still have the parent it was listed with once its pidfd is open, so that
+ * the pidfd cannot refer to a process that reused its PID.
+ */
+static void open_tree(struct proc *procs, int nprocs, pid_t root,
+                      pid_t group) {
+    int ntree = 0;
+
+    // Breadth-first: procs[0, ntree) are the descendants found so far, and
+    // procs[next] is the one whose children are looked for
+    for (int next = -1; next < ntree; next++) {
+        pid_t parent = next < 0 ? root : procs[next].pid;
+        for (int i = ntree; i < nprocs; i++) {
+            if (procs[i].ppid == parent) {
+                struct proc tmp = procs[ntree];
+                procs[ntree++] = procs[i];
+                procs[i] = tmp;
+            }
+        }
+    }
+    for (int i = 0; i < ntree; i++) {
+        struct proc *proc = &procs[i];
+        pid_t ppid, pgid;
+        if (group > 0 && proc->pgid == group) {
+            continue;
+        }
+        if ((proc->pidfd = open_pidfd(proc->pid)) < 0) {
+            continue;
+        }
+        if (!read_stat(proc->pid, &ppid, &pgid) || ppid != proc->ppid) {
+            close(proc->pidfd);
+            proc->pidfd = -1;
+        }
+    }
+}
+
+/*
+ * signal_tree - Signal and close the pidfds opened by open_tree
+ */
+static void signal_tree(struct proc *procs, int nprocs, int sig) {
+    for (int i = 0; i < nprocs; i++) {
+        if (procs[i].pidfd >= 0) {
+            send_pidfd(procs[i].pidfd, sig, 0);
+            close(procs[i].pidfd);
+            procs[i].pidfd = -1;
+        }
+    }
+}
+
+/*
+ * signal_group - Signal the process group of a job, through the pidfd of
+ * its leader where the kernel allows it
+ * Signals must be blocked
+ */
+static int signal_group(jid_t jid, pid_t pid, int sig) {
+    int pidfd = job_get_pidfd(jid);
+
+    if (pidfd >= 0 &&
+        send_pidfd(pidfd, sig, PIDFD_SIGNAL_PROCESS_GROUP) == 0) {
+        return 0;
+    }
+    // EINVAL or ENOSYS: the kernel is too old. ESRCH: the leader has been
+    // reaped while the job lingers (see tsh_reaper.h), and only its PID is
+    // left to go by
+    if (pidfd >= 0 && errno != EINVAL && errno != ENOSYS && errno != ESRCH) {
+        return -1;
+    }
+    return kill(-pid, sig);
+}
+
+/*
+ * kill_target - Signal one job or process; returns whether it was found
+ * Signals must be blocked
+ */
+static bool kill_target(const char *arg, int sig, bool tree) {
+    jid_t jid = 0;
+    pid_t pid = 0;
+
+    if (arg[0] == '%') {
+        jid = atoi(arg + 1);
+        if (!job_exists(jid)) {
+            printf("%s: No such job\n", arg);
+            return false;
+        }
+    } else {
+        pid = atoi(arg);
+        if (pid <= 0) {
+            printf("kill: %s: argument must be a PID or %%jobid\n", arg);
+            return false;
+        }
+        jid = job_from_pid(pid);
+    }
+    if (jid != 0) {
+        if (job_get_state(jid) == WT) {
+            printf("[%d] is waiting for its dependencies\n", jid);
+            return false;
+        }
+        pid = job_get_pid(jid);
+    }
+
+    // Open the descendants before signalling anything: once their parent
+    // dies they are reparented, and could no longer be checked
+    struct proc *procs = NULL;
+    int nprocs = 0;
+    if (tree && (procs = scan_procs(&nprocs)) != NULL) {
+        open_tree(procs, nprocs, pid, jid != 0 ? pid : 0);
+    }
+
+    bool ok = (jid != 0 ? signal_group(jid, pid, sig) : kill(pid, sig)) == 0;
+    if (!ok) {
+        printf("kill: %s: %s\n", arg, strerror(errno));
+    }
+    if (procs != NULL) {
+        signal_tree(procs, nprocs, sig);
+        free(procs);
+    }
+    return ok;
+}
+
+/*
+ * kill_builtin - The `kill` builtin
+ */
+int kill_builtin(char **argv) {
+    int sig = SIGTERM;
+    bool tree = false;
+    int i = 1;
+
+    for (; argv[i] != NULL && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        } else if (strcmp(argv[i], "-t") == 0) {
+            tree = true;
+        } else if (strcmp(argv[i], "-s") == 0 && argv[i + 1] != NULL) {
+            if ((sig = parse_signal(argv[++i])) < 0) {
+                printf("kill: invalid signal %s\n", argv[i]);
+                return 1;
+            }
+        } else if ((sig = parse_signal(argv[i] + 1)) < 0) {
+            printf("kill: invalid signal %s\n", argv[i] + 1);
+            return 1;
+        }
+    }
+    if (argv[i] == NULL) {
+        printf("kill: usage: kill [-SIG | -s SIG] [-t] %%N|PID ...\n");
+        return 1;
+    }
+
+    sigset_t mask_all, mask_prev;
+    int code = 0;
+    sigfillset(&mask_all);
+    for (; argv[i] != NULL; i++) {
+        stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+        if (!kill_target(argv[i], sig, tree)) {
+            code = 1;
+        }
+        stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+    }
+    return code;
+}
@@ -0,0 +1,45 @@
+/**
+ * @file tsh_kill.h
+ * @brief The `kill` builtin
+ *
+ * Signals jobs without forking /bin/kill. A job is signalled as a process
+ * group, as `sigint_handler` does, through the pidfd the job list holds for
+ * its leader (pidfd_send_signal with PIDFD_SIGNAL_PROCESS_GROUP), so the
+ * signal can only reach the job's own group. Kernels before Linux 6.9 lack
+ * that flag; the group is then signalled by ID, with SIGCHLD blocked so the
+ * leader cannot be reaped, and its PID reused, in the meantime. Neither
+ * protects a job whose leader was already reaped while the job lingers for
+ * the rest of its processes (`--subreaper`, see tsh_reaper.h): it is
+ * signalled by group ID, which is only safe while some process is left in
+ * the group.
+ *
+ * Builtins:
+ *
+ *     kill [-SIG | -s SIG] [-t] %N|PID ...
+ *         Send SIG (SIGTERM by default) to each job or process
+ *
+ * With `-t`, every descendant of each job is signalled too, including those
+ * that have left the job's process group (e.g. daemons that called
+ * setsid). Descendants are found in /proc; each one is opened as a pidfd
+ * and checked to still be the child of the same parent before it is
+ * signalled through the pidfd, so a PID reused in the meantime is never hit.
+ *
+ * A PID that does not belong to a job is signalled as a single process. The
+ * exit code is 0 if every target was signalled, and 1 otherwise.
+ */
+
+#ifndef TSH_KILL_H
+#define TSH_KILL_H
+
+/**
+ * @brief Implements the `kill` builtin.
+ *
+ * @param[in] argv  The parsed arguments.
+ *
+ * @return The exit code to store in `$?`
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+int kill_builtin(char **argv);
+
+#endif /* TSH_KILL_H */
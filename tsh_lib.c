@@ -0,0 +1,294 @@
+/**
+ * @file tsh_lib.c
+ * @brief libtsh: the job-control engine, embedded in a host program.
+ *
+ * For documentation related to usage, see the corresponding header file at
+ * tsh_lib.h.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "csapp.h"
+#include "tsh.h"
+#include "tsh_cgroup.h"
+#include "tsh_env.h"
+#include "tsh_helper.h"
+#include "tsh_lib.h"
+#include "tsh_loop.h"
+#include "tsh_reaper.h"
+#include "tsh_script.h"
+#include "tsh_stats.h"
+#include "tsh_wait.h"
+
+// Struct used to store the state of the context
+struct tsh_ctx {
+    struct tsh_options options; // Options it was opened with
+    bool open;                  // Between tsh_open and tsh_close
+    tsh_exit_fn *on_exit;       // Exit callback, or NULL
+    void *on_exit_arg;          // Passed to on_exit
+};
+
+/* Static variables */
+static struct tsh_ctx context;   // The context; SIGCHLD allows only one
+static bool listening = false;   // Whether job_ended is registered
+
+/*
+ * valid - Whether `ctx` is the open context; sets errno to EBADF if not
+ * Async-signal-safe
+ */
+static bool valid(const tsh_ctx *ctx) {
+    if (ctx != &context || !ctx->open) {
+        errno = EBADF;
+        return false;
+    }
+    return true;
+}
+
+/*
+ * job_ended - Child listener that calls the exit callback
+ */
+static void job_ended(const struct child_event *event, void *arg) {
+    struct tsh_ctx *ctx = arg;
+    if (ctx->open && ctx->on_exit != NULL && event->jid != 0 &&
+        !WIFSTOPPED(event->status)) {
+        struct tsh_job job = {event->jid, event->serial};
+        ctx->on_exit(&job, event->status, ctx->on_exit_arg);
+    }
+}
+
+/*
+ * tsh_open - Create the context
+ */
+tsh_ctx *tsh_open(const struct tsh_options *options) {
+    struct tsh_ctx *ctx = &context;
+
+    if (ctx->open) {
+        errno = EBUSY;
+        return NULL;
+    }
+    memset(ctx, 0, sizeof(*ctx));
+    if (options != NULL) {
+        ctx->options = *options;
+    }
+    verbose = ctx->options.verbose;
+    if (ctx->options.subreaper && !reaper_enable()) {
+        return NULL;
+    }
+    if (!env_init() || !loop_init()) {
+        return NULL;
+    }
+    if (!listening && !loop_on_child(job_ended, ctx)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    listening = true;
+    init_job_list();
+    if (!ctx->options.no_cgroup && !cgroup_init() && verbose) {
+        fprintf(stderr, "cgroup v2 unavailable, jobs get no cgroups\n");
+    }
+    Signal(SIGCHLD, sigchld_handler);
+    ctx->open = true;
+    return ctx;
+}
+
+/*
+ * tsh_close - Destroy the context
+ */
+void tsh_close(tsh_ctx *ctx) {
+    if (ctx != &context || !ctx->open) {
+        return;
+    }
+    // The handler needs to be removed before destroying the job list
+    Signal(SIGCHLD, SIG_DFL);
+    cgroup_cleanup();
+    destroy_job_list();
+    ctx->open = false;
+}
+
+/*
+ * tsh_fd - The file descriptor to poll
+ * Async-signal-safe
+ */
+int tsh_fd(tsh_ctx *ctx) {
+    return valid(ctx) ? loop_fd() : -1;
+}
+
+/*
+ * tsh_dispatch - Dispatch pending events
+ */
+void tsh_dispatch(tsh_ctx *ctx) {
+    if (valid(ctx)) {
+        loop_run_once(0);
+    }
+}
+
+/*
+ * tsh_on_exit - Set the exit callback
+ */
+void tsh_on_exit(tsh_ctx *ctx, tsh_exit_fn *fn, void *arg) {
+    if (!valid(ctx)) {
+        return;
+    }
+    ctx->on_exit = fn;
+    ctx->on_exit_arg = arg;
+}
+
+/*
+ * count_jobs - Number of jobs in the job list
+ * Signals must be blocked
+ */
+static int count_jobs(void) {
+    int n = 0;
+    for (jid_t jid = 1; jid <= MAXJOBS; jid++) {
+        if (job_exists(jid)) {
+            n++;
+        }
+    }
+    return n;
+}
+
+/*
+ * launch - Parse a command line and launch it as a job; returns its job
+ * ID, or 0 with errno set
+ */
+static jid_t launch(const char *cmdline, job_state state) {
+    struct cmdline_tokens token;
+    char expanded[MAXLINE_TSH];
+    sigset_t mask_all, mask_prev;
+    int n;
+
+    cmdline = script_subst(cmdline, expanded, sizeof(expanded));
+    parseline_return parse_result = parseline(cmdline, &token);
+    if (parse_result == PARSELINE_ERROR || parse_result == PARSELINE_EMPTY ||
+        token.builtin != BUILTIN_NONE) {
+        errno = EINVAL;
+        return 0;
+    }
+
+    sigfillset(&mask_all);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+    n = count_jobs();
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+    if (n >= MAXJOBS) {
+        errno = EAGAIN;
+        return 0;
+    }
+
+    stats_inc(STAT_EVAL);
+    jid_t jid = launch_job(&token, cmdline, state);
+    if (jid == 0 && errno == 0) {
+        errno = EAGAIN;
+    }
+    return jid;
+}
+
+/*
+ * tsh_run - Run a command line in the foreground
+ */
+int tsh_run(tsh_ctx *ctx, const char *cmdline) {
+    if (!valid(ctx)) {
+        return -1;
+    }
+    errno = 0;
+    return launch(cmdline, FG) != 0 ? last_status : -1;
+}
+
+/*
+ * tsh_submit - Start a command line in the background
+ */
+bool tsh_submit(tsh_ctx *ctx, const char *cmdline, struct tsh_job *job) {
+    sigset_t mask_all, mask_prev;
+    jid_t jid;
+
+    if (!valid(ctx)) {
+        return false;
+    }
+    errno = 0;
+    if ((jid = launch(cmdline, BG)) == 0) {
+        return false;
+    }
+    if (job != NULL) {
+        sigfillset(&mask_all);
+        stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+        job->jid = jid;
+        // The job may already be gone; its serial is then in the ring
+        if (job_exists(jid)) {
+            job->serial = job_get_serial(jid);
+        } else if (!job_find_exit(jid, 0, &job->serial, NULL)) {
+            job->serial = 0;
+        }
+        stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+    }
+    return true;
+}
+
+/*
+ * tsh_wait - Wait for a job to finish
+ */
+bool tsh_wait(tsh_ctx *ctx, const struct tsh_job *job, int *status) {
+    if (!valid(ctx)) {
+        return false;
+    }
+    return wait_job(job->jid, job->serial, status);
+}
+
+/*
+ * tsh_signal - Signal a job's process group
+ */
+bool tsh_signal(tsh_ctx *ctx, const struct tsh_job *job, int sig) {
+    sigset_t mask_all, mask_prev;
+    pid_t pid = 0;
+
+    if (!valid(ctx)) {
+        return false;
+    }
+    sigfillset(&mask_all);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+    if (job_exists(job->jid) && job_get_serial(job->jid) == job->serial) {
+        pid = job_get_pid(job->jid);
+    }
+    bool ok = pid > 0 && kill(-pid, sig) == 0;
+    if (pid <= 0) {
+        errno = ESRCH;
+    }
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+    return ok;
+}
+
+/*
+ * tsh_list - List the jobs in the job list
+ */
+int tsh_list(tsh_ctx *ctx, struct tsh_job_info *jobs, int max) {
+    static const char states[] = {[FG] = 'F', [BG] = 'B', [ST] = 'S',
+                                  [WT] = 'W'};
+    sigset_t mask_all, mask_prev;
+    int n = 0;
+
+    if (!valid(ctx)) {
+        return -1;
+    }
+    sigfillset(&mask_all);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+    for (jid_t jid = 1; jid <= MAXJOBS; jid++) {
+        if (!job_exists(jid)) {
+            continue;
+        }
+        if (n < max) {
+            struct tsh_job_info *info = &jobs[n];
+            info->job.jid = jid;
+            info->job.serial = job_get_serial(jid);
+            info->pid = job_get_pid(jid);
+            info->state = states[job_get_state(jid)];
+            snprintf(info->cmdline, sizeof(info->cmdline), "%s",
+                     job_get_cmdline(jid));
+        }
+        n++;
+    }
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+    return n;
+}
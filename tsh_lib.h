@@ -0,0 +1,190 @@
+/**
+ * @file tsh_lib.h
+ * @brief libtsh: the shell's job-control engine, embedded in a host program
+ *
+ * The `tsh` static and shared libraries (built by CMakeLists.txt) contain
+ * the same parser, launcher and job list as the shell, without its
+ * read/eval loop. A host program launches commands through them directly,
+ * with no `/bin/sh -c` in between, and tracks them as jobs:
+ *
+ *     tsh_ctx *ctx = tsh_open(NULL);
+ *     struct tsh_job job;
+ *     tsh_submit(ctx, "make -j8 > build.log", &job);
+ *     ...
+ *     struct pollfd pfd = {tsh_fd(ctx), POLLIN, 0};
+ *     poll(&pfd, 1, -1);
+ *     tsh_dispatch(ctx);        // calls the tsh_on_exit callback
+ *
+ * Command lines are those of the shell: arguments, quotes, `< FILE`,
+ * `> FILE`, `$NAME` substitution, globbing and `NAME=VALUE` prefixes.
+ * Builtins are not available. Every job gets its own process group (and
+ * cgroup, if enabled), exactly as in the shell.
+ *
+ * Child processes are reaped by the shell's SIGCHLD handler, which
+ * `tsh_open` installs, so the job list and the signal handler are process
+ * wide: there can only be one context at a time, and the host must leave
+ * SIGCHLD and the reaping of its children to it. The context also adopts
+ * the process environment (see tsh_env.h). Calls are not thread-safe; the
+ * host should make them all from one thread, with SIGCHLD blocked in the
+ * others. As in the shell, a job that is stopped or killed by a signal is
+ * reported on stdout.
+ *
+ * Every function taking a context fails with errno set to EBADF if it is
+ * not the open context, e.g. after `tsh_close`.
+ */
+
+#ifndef TSH_LIB_H
+#define TSH_LIB_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/** @brief A libtsh context (opaque) */
+typedef struct tsh_ctx tsh_ctx;
+
+/**
+ * @brief Options for `tsh_open`
+ */
+struct tsh_options {
+    bool verbose;    ///< Print diagnostic information, like `tsh -v`
+    bool no_cgroup;  ///< Stop jobs with signals, like `tsh --no-cgroup`
+    bool subreaper;  ///< Account for orphans, like `tsh --subreaper`
+};
+
+/**
+ * @brief A job, as submitted; stays valid after the job has ended
+ */
+struct tsh_job {
+    int jid;              ///< Job ID, reused once the job has ended
+    unsigned long serial; ///< Serial number, never reused
+};
+
+/**
+ * @brief A job in the job list, as listed by `tsh_list`
+ */
+struct tsh_job_info {
+    struct tsh_job job; ///< The job
+    pid_t pid;          ///< PID of its process (group), or 0
+    char state;         ///< 'F'oreground, 'B'ackground, 'S'topped, 'W'aiting
+    char cmdline[128];  ///< Its command line, truncated
+};
+
+/**
+ * @brief Called when a job's process has ended.
+ *
+ * @param[in] job     The job.
+ * @param[in] status  The raw status from waitpid.
+ * @param[in] arg     As given to `tsh_on_exit`.
+ */
+typedef void tsh_exit_fn(const struct tsh_job *job, int status, void *arg);
+
+/**
+ * @brief Creates the context: the job list, event loop and SIGCHLD handler.
+ *
+ * @param[in] options  The options, or NULL for the defaults.
+ *
+ * @return The context, or NULL on error with errno set (EBUSY if a context
+ *         is already open)
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+tsh_ctx *tsh_open(const struct tsh_options *options);
+
+/**
+ * @brief Destroys the context and restores the default SIGCHLD action.
+ *
+ * Jobs that are still running are left alone, but no longer tracked. The
+ * environment stays with the shell's table; a later `tsh_open` keeps it.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void tsh_close(tsh_ctx *ctx);
+
+/**
+ * @brief Returns a file descriptor that becomes readable whenever the
+ *        context has events to dispatch, e.g. jobs that have ended.
+ *
+ * @return The file descriptor, or -1 with errno set
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+int tsh_fd(tsh_ctx *ctx);
+
+/**
+ * @brief Dispatches pending events, without blocking.
+ *
+ * Exit callbacks are called from here, and from any call that waits.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void tsh_dispatch(tsh_ctx *ctx);
+
+/**
+ * @brief Sets the function called whenever a job's process has ended.
+ *
+ * @param[in] fn   The callback, or NULL for none.
+ * @param[in] arg  Passed to the callback.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void tsh_on_exit(tsh_ctx *ctx, tsh_exit_fn *fn, void *arg);
+
+/**
+ * @brief Runs a command line as a foreground job and waits for it.
+ *
+ * @return Its exit code, as `$?` in the shell, or -1 if it could not be
+ *         started, with errno set (EINVAL for a syntax error, a builtin or
+ *         an empty command line)
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+int tsh_run(tsh_ctx *ctx, const char *cmdline);
+
+/**
+ * @brief Starts a command line as a background job.
+ *
+ * @param[out] job  If not NULL, receives the job.
+ *
+ * @return true on success, false if it could not be started, with errno
+ *         set as for `tsh_run`, or EAGAIN if the job list is full
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool tsh_submit(tsh_ctx *ctx, const char *cmdline, struct tsh_job *job);
+
+/**
+ * @brief Waits for a job to finish, dispatching events meanwhile.
+ *
+ * @param[out] status  If not NULL, receives the raw status from waitpid.
+ *
+ * @return true once the job has finished, false if it is unknown (or ended
+ *         too long ago to be remembered) or the context is invalid
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool tsh_wait(tsh_ctx *ctx, const struct tsh_job *job, int *status);
+
+/**
+ * @brief Sends a signal to a job's process group.
+ *
+ * @return true on success, false with errno set (ESRCH if the job has
+ *         ended or has not started yet)
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool tsh_signal(tsh_ctx *ctx, const struct tsh_job *job, int sig);
+
+/**
+ * @brief Lists the jobs in the job list.
+ *
+ * @param[out] jobs  Receives up to `max` jobs, in job ID order.
+ * @param[in]  max   The size of `jobs`.
+ *
+ * @return The number of jobs in the job list, which may exceed `max`, or -1
+ *         with errno set
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+int tsh_list(tsh_ctx *ctx, struct tsh_job_info *jobs, int max);
+
+#endif /* TSH_LIB_H */
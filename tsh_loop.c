@@ -0,0 +1,326 @@
+/**
+ * @file tsh_loop.c
+ * @brief The shell's epoll-based event loop.
+ *
+ * For documentation related to usage, see the corresponding header file at
+ * tsh_loop.h.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "tsh_loop.h"
+#include "tsh_stats.h"
+
+#define MAX_LISTENERS 16          // Max child listeners
+#define MAX_DEFERRED 16           // Max pending deferred tasks
+#define MAX_READY 64              // Max events dispatched per epoll_wait
+#define EVENT_PIPE_SIZE (1 << 20) // Requested self-pipe capacity
+
+// Struct used to store fd registrations, indexed by fd
+struct loop_reg {
+    loop_handler *handler; // NULL if the fd is not registered
+    void *arg;             // Argument for the handler
+};
+
+// Struct used to store child listeners
+struct loop_listener {
+    child_listener *listener;
+    void *arg;
+};
+
+/* Static variables */
+static int epoll_fd = -1;            // The epoll instance
+static int event_pipe[2] = {-1, -1}; // Self-pipe for child events
+static struct loop_reg *regs = NULL; // Registrations, indexed by fd
+static int nregs = 0;                // Size of regs
+static struct loop_listener listeners[MAX_LISTENERS];
+static int nlisteners = 0;
+static loop_task *recoverers[MAX_LISTENERS]; // Run after events were lost
+static int nrecoverers = 0;
+static volatile sig_atomic_t events_lost = 0; // The self-pipe was full
+static loop_task *deferred[MAX_DEFERRED]; // Tasks for the end of the batch
+static int ndeferred = 0;
+
+/*
+ * drain_child_events - Read the self-pipe and notify listeners
+ * Not async-signal-safe
+ */
+static void drain_child_events(int fd) {
+    struct child_event buf[MAX_READY];
+    ssize_t n;
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        size_t count = (size_t)n / sizeof(struct child_event);
+        for (size_t i = 0; i < count; i++) {
+            for (int l = 0; l < nlisteners; l++) {
+                listeners[l].listener(&buf[i], listeners[l].arg);
+            }
+        }
+    }
+}
+
+/*
+ * dispatch_child_events - Drain the self-pipe, then let the recoverers
+ * catch up if events were dropped
+ * Not async-signal-safe
+ */
+static void dispatch_child_events(int fd, uint32_t events, void *arg) {
+    sigset_t mask_all, mask_prev;
+
+    drain_child_events(fd);
+    if (!events_lost) {
+        return;
+    }
+    // With signals blocked nothing more is posted, so once the pipe is
+    // empty, every job that has left the job list has either been
+    // dispatched or lost. A drop after this leaves a full pipe, which
+    // brings us back here.
+    sigfillset(&mask_all);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+    drain_child_events(fd);
+    events_lost = 0;
+    for (int i = 0; i < nrecoverers; i++) {
+        recoverers[i]();
+    }
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+}
+
+/*
+ * loop_init - Create the epoll instance and the child event pipe
+ * Not async-signal-safe
+ */
+bool loop_init(void) {
+    if (epoll_fd >= 0) {
+        return true;
+    }
+    if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        return false;
+    }
+    if (pipe2(event_pipe, O_NONBLOCK | O_CLOEXEC) < 0) {
+        close(epoll_fd);
+        epoll_fd = -1;
+        return false;
+    }
+    // Best effort: a larger pipe makes dropped events less likely
+    fcntl(event_pipe[1], F_SETPIPE_SZ, EVENT_PIPE_SIZE);
+
+    if (!loop_add(event_pipe[0], EPOLLIN, dispatch_child_events, NULL)) {
+        return false;
+    }
+    return true;
+}
+
+/*
+ * loop_active - Whether loop_init has succeeded
+ * Async-signal-safe
+ */
+bool loop_active(void) {
+    return epoll_fd >= 0;
+}
+
+/*
+ * loop_fd - The epoll instance
+ * Async-signal-safe
+ */
+int loop_fd(void) {
+    return epoll_fd;
+}
+
+/*
+ * loop_add - Register a fd with the loop
+ * Not async-signal-safe (realloc)
+ */
+bool loop_add(int fd, uint32_t events, loop_handler *handler, void *arg) {
+    if (fd < 0) {
+        errno = EBADF;
+        return false;
+    }
+    if (fd >= nregs) {
+        int n = nregs ? nregs : 64;
+        while (n <= fd) {
+            n *= 2;
+        }
+        struct loop_reg *r = realloc(regs, sizeof(*r) * (size_t)n);
+        if (r == NULL) {
+            return false;
+        }
+        memset(r + nregs, 0, sizeof(*r) * (size_t)(n - nregs));
+        regs = r;
+        nregs = n;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        return false;
+    }
+    regs[fd].handler = handler;
+    regs[fd].arg = arg;
+    return true;
+}
+
+/*
+ * loop_modify - Change the event mask of a registered fd
+ * Not async-signal-safe
+ */
+bool loop_modify(int fd, uint32_t events) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+/*
+ * loop_remove - Unregister a fd
+ * Not async-signal-safe
+ */
+void loop_remove(int fd) {
+    if (fd < 0 || fd >= nregs || regs[fd].handler == NULL) {
+        return;
+    }
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    regs[fd].handler = NULL;
+    regs[fd].arg = NULL;
+}
+
+/*
+ * loop_run_once - Wait for events and dispatch them
+ * Not async-signal-safe
+ */
+void loop_run_once(int timeout_ms) {
+    loop_wait(timeout_ms, NULL);
+}
+
+/*
+ * loop_wait - Wait for events with a temporary signal mask and dispatch them
+ * Not async-signal-safe
+ */
+void loop_wait(int timeout_ms, const sigset_t *sigmask) {
+    struct epoll_event ready[MAX_READY];
+    int n = epoll_pwait(epoll_fd, ready, MAX_READY, timeout_ms, sigmask);
+
+    // EINTR just means a signal handler ran; it will have posted to the
+    // self-pipe if there is anything to do
+    for (int i = 0; i < n; i++) {
+        int fd = ready[i].data.fd;
+        // A handler earlier in this batch may have removed the fd
+        if (fd < nregs && regs[fd].handler != NULL) {
+            regs[fd].handler(fd, ready[i].events, regs[fd].arg);
+        }
+    }
+
+    // Tasks may defer themselves again; those run after the next batch
+    int ntasks = ndeferred;
+    loop_task *tasks[MAX_DEFERRED];
+    memcpy(tasks, deferred, sizeof(tasks[0]) * (size_t)ntasks);
+    ndeferred = 0;
+    for (int i = 0; i < ntasks; i++) {
+        tasks[i]();
+    }
+}
+
+/*
+ * loop_defer - Run a task after the current batch of events
+ * Not async-signal-safe
+ */
+bool loop_defer(loop_task *task) {
+    for (int i = 0; i < ndeferred; i++) {
+        if (deferred[i] == task) {
+            return true;
+        }
+    }
+    if (ndeferred >= MAX_DEFERRED) {
+        return false;
+    }
+    deferred[ndeferred++] = task;
+    return true;
+}
+
+/*
+ * loop_on_child - Register a child listener
+ * Not async-signal-safe
+ */
+bool loop_on_child(child_listener *listener, void *arg) {
+    if (nlisteners >= MAX_LISTENERS) {
+        return false;
+    }
+    listeners[nlisteners].listener = listener;
+    listeners[nlisteners].arg = arg;
+    nlisteners++;
+    return true;
+}
+
+/*
+ * loop_on_lost - Register a task to run after child events were dropped
+ * Not async-signal-safe
+ */
+bool loop_on_lost(loop_task *task) {
+    if (nrecoverers >= MAX_LISTENERS) {
+        return false;
+    }
+    recoverers[nrecoverers++] = task;
+    return true;
+}
+
+/*
+ * loop_lost_event - Whether a job has left the job list, in which case its
+ * event may have been dropped; rebuilds the event if so
+ * Signals must be blocked
+ */
+bool loop_lost_event(jid_t jid, unsigned long serial,
+                     struct child_event *event) {
+    jid_t first = jid != 0 ? jid : 1;
+    jid_t last = jid != 0 ? jid : MAXJOBS;
+
+    for (jid_t j = first; j <= last; j++) {
+        if (job_exists(j) && job_get_serial(j) == serial) {
+            return false;
+        }
+    }
+    event->jid = jid;
+    event->serial = serial;
+    event->pid = 0;
+    // Forgotten by the completed ring: all we know is that it has ended
+    event->status = W_EXITCODE(255, 0);
+    for (jid_t j = first; j <= last; j++) {
+        if (job_find_exit(j, serial, NULL, &event->status)) {
+            event->jid = j;
+            break;
+        }
+    }
+    return true;
+}
+
+/*
+ * loop_post_child - Post a child event to the self-pipe
+ * Async-signal-safe
+ */
+void loop_post_child(jid_t jid, unsigned long serial, pid_t pid, int status) {
+    if (event_pipe[1] < 0) {
+        return;
+    }
+    int olderrno = errno;
+    struct child_event event = {
+        .jid = jid, .serial = serial, .pid = pid, .status = status};
+    // Writes smaller than PIPE_BUF are atomic, so readers never see a
+    // partial record. If the pipe is full the event is dropped, and the
+    // recoverers catch up from the job list once it has drained.
+    if (write(event_pipe[1], &event, sizeof(event)) < 0) {
+        stats_inc(STAT_EVENTS_DROPPED);
+        events_lost = 1;
+    }
+    errno = olderrno;
+}
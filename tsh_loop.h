@@ -0,0 +1,184 @@
+/**
+ * @file tsh_loop.h
+ * @brief The shell's epoll-based event loop
+ *
+ * Modules register file descriptors with a handler that is called from the
+ * main program whenever the descriptor becomes ready.
+ *
+ * The loop also carries child events out of `sigchld_handler`: the handler
+ * posts one record per reaped or stopped child into a non-blocking
+ * self-pipe, and the loop hands the records to every registered child
+ * listener in the main program, where it is safe to do real work (forking,
+ * allocating, writing to sockets, ...).
+ */
+
+#ifndef TSH_LOOP_H
+#define TSH_LOOP_H
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "tsh_helper.h"
+
+/**
+ * @brief A child event, as posted by the SIGCHLD handler
+ */
+struct child_event {
+    jid_t jid;            ///< Job ID of the child, or 0 if it was not a job
+    unsigned long serial; ///< Serial number of the job, or 0
+    pid_t pid;            ///< PID of the child
+    int status;           ///< Raw status from waitpid
+};
+
+/** @brief Handler for a ready file descriptor */
+typedef void loop_handler(int fd, uint32_t events, void *arg);
+
+/** @brief Listener for child events */
+typedef void child_listener(const struct child_event *event, void *arg);
+
+/** @brief Task deferred until the end of a batch of events */
+typedef void loop_task(void);
+
+/**
+ * @brief Initializes the event loop. Does nothing if already initialized.
+ *
+ * @return true on success, false on error with errno set
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool loop_init(void);
+
+/**
+ * @brief Returns whether the event loop has been initialized.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool loop_active(void);
+
+/**
+ * @brief Returns the epoll instance of the loop, or -1 if not initialized.
+ *
+ * It becomes readable whenever `loop_run_once(0)` has something to
+ * dispatch, so that a host program can poll it along with its own
+ * descriptors (see tsh_lib.h).
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+int loop_fd(void);
+
+/**
+ * @brief Registers a file descriptor with the loop.
+ *
+ * @param[in] fd       The file descriptor to watch.
+ * @param[in] events   epoll event mask (EPOLLIN, EPOLLOUT, ...).
+ * @param[in] handler  Called with `arg` when the descriptor is ready.
+ * @param[in] arg      Passed to the handler.
+ *
+ * @return true on success, false on error with errno set
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool loop_add(int fd, uint32_t events, loop_handler *handler, void *arg);
+
+/**
+ * @brief Changes the event mask of a registered file descriptor.
+ * @return true on success, false on error with errno set
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool loop_modify(int fd, uint32_t events);
+
+/**
+ * @brief Unregisters a file descriptor. Does not close it.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void loop_remove(int fd);
+
+/**
+ * @brief Waits for events and dispatches them once.
+ *
+ * @param[in] timeout_ms  Maximum time to wait, -1 to wait indefinitely and
+ *                        0 to only dispatch what is already pending.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void loop_run_once(int timeout_ms);
+
+/**
+ * @brief Waits for events with a temporary signal mask and dispatches them.
+ *
+ * Like `loop_run_once`, but the signal mask is atomically replaced by
+ * `sigmask` for the duration of the wait, as with `sigsuspend`. A signal
+ * that was blocked on entry and is unblocked by `sigmask` interrupts the
+ * wait, so callers can wait for a flag set by a signal handler without
+ * racing against it.
+ *
+ * @param[in] timeout_ms  As for `loop_run_once`.
+ * @param[in] sigmask     The signal mask to wait with, or NULL to keep the
+ *                        current mask.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void loop_wait(int timeout_ms, const sigset_t *sigmask);
+
+/**
+ * @brief Runs a task once, after the current batch of events is dispatched.
+ *
+ * Lets a handler coalesce work (e.g. buffered writes) across all the events
+ * that became ready together. Deferring a task that is already pending does
+ * nothing. If no batch is being dispatched, the task runs after the next one.
+ *
+ * @return true on success, false if too many tasks are pending
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool loop_defer(loop_task *task);
+
+/**
+ * @brief Registers a listener for child events.
+ * @return true on success, false if too many listeners are registered
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool loop_on_child(child_listener *listener, void *arg);
+
+/**
+ * @brief Registers a task to run when child events have been dropped.
+ *
+ * Child events go through a pipe, and an event posted while it is full is
+ * lost (and counted in `stats`). Once the pipe has drained, each task runs
+ * with signals blocked. It should look up every job its module tracks
+ * with `loop_lost_event`, and handle those that have ended as if their
+ * events had arrived.
+ *
+ * @return true on success, false if too many tasks are registered
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool loop_on_lost(loop_task *task);
+
+/**
+ * @brief Checks whether a tracked job has left the job list.
+ *
+ * If it has, its event may have been dropped, and `event` receives it as
+ * rebuilt from the completed ring: the job ID and raw status, with a PID
+ * of 0. A job the ring has forgotten is reported as exited with code 255.
+ *
+ * @param[in]  jid     The job ID of the job, or 0 if unknown.
+ * @param[in]  serial  The serial number of the job.
+ * @param[out] event   Receives the event of a job that has ended.
+ *
+ * @return true if the job has ended, false if it is still in the job list
+ *
+ * @pre Any signals that could modify the job list must be blocked.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool loop_lost_event(jid_t jid, unsigned long serial,
+                     struct child_event *event);
+
+/**
+ * @brief Posts a child event to the loop.
+ *
+ * Does nothing if the loop has not been initialized. If the event cannot
+ * be posted, the tasks registered with `loop_on_lost` run later.
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void loop_post_child(jid_t jid, unsigned long serial, pid_t pid, int status);
+
+#endif /* TSH_LOOP_H */
@@ -0,0 +1,437 @@
+/**
+ * @file tsh_memo.c
+ * @brief Memoized commands: replay the stdout of pure commands from a cache.
+ *
+ * For documentation related to usage, see the corresponding header file at
+ * tsh_memo.h.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "csapp.h"
+#include "tsh.h"
+#include "tsh_env.h"
+#include "tsh_helper.h"
+#include "tsh_incr.h"
+#include "tsh_loop.h"
+#include "tsh_memo.h"
+#include "tsh_stats.h"
+
+#define DEFAULT_LIMIT (256ull << 20) // Default size limit of the cache
+#define ENTRY_SUFFIX ".out"          // Suffix of entry files
+#define DIR_MAX (PATH_MAX - 64)      // Room for the directory in a path
+
+// Struct used to store a command that is running, indexed by job ID
+struct run {
+    unsigned long serial; // Serial number of the job, 0 if unused
+    char *tmp;            // File its stdout goes to
+    char *entry;          // Entry it becomes on success
+    char *outfile;        // Where its stdout was meant to go, or NULL
+};
+
+// Struct used to store an entry while evicting
+struct victim {
+    struct timespec used; // Last use (modification time)
+    off_t size;           // Size of the file
+    char name[32];        // File name
+};
+
+// Variables that usually change what commands print
+static const char *const env_keys[] = {"PATH",       "LANG",     "LC_ALL",
+                                       "LC_COLLATE", "LC_CTYPE", "TZ"};
+
+/* Static variables */
+static unsigned long long limit = DEFAULT_LIMIT; // Size limit of the cache
+static struct run runs[MAXJOBS + 1];             // Indexed by job ID
+static unsigned long ntmp = 0;                   // Temporary files made
+static bool listening = false;                   // Child listener registered
+
+/*
+ * memo_dir - Directory of the cache; creates it if needed
+ */
+static bool memo_dir(char *buf, size_t size) {
+    const char *xdg = env_get("XDG_CACHE_HOME");
+    const char *home = env_get("HOME");
+    static const char *const levels[] = {"/tsh", "/memo"};
+
+    if (xdg != NULL && xdg[0] == '/') {
+        snprintf(buf, size, "%s", xdg);
+    } else if (home != NULL && home[0] == '/') {
+        snprintf(buf, size, "%s/.cache", home);
+    } else {
+        return false;
+    }
+    // Each level is made private to the user; existing ones are kept
+    mkdir(buf, 0700);
+    for (int i = 0; i < 2; i++) {
+        size_t len = strlen(buf);
+        if ((size_t)snprintf(buf + len, size - len, "%s", levels[i]) >=
+                size - len ||
+            (mkdir(buf, 0700) < 0 && errno != EEXIST)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * memo_key - Hash a command's arguments, directory, environment and input
+ */
+static bool memo_key(const struct cmdline_tokens *token, bool by_stat,
+                     uint64_t *key) {
+    char cwd[PATH_MAX];
+    uint64_t h = incr_hash(INCR_HASH_SEED, by_stat ? "stat" : "data", 4);
+
+    for (int i = 0; i < token->argc; i++) {
+        h = incr_hash(h, token->argv[i], strlen(token->argv[i]) + 1);
+    }
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        return false;
+    }
+    h = incr_hash(h, cwd, strlen(cwd) + 1);
+    for (size_t i = 0; i < sizeof(env_keys) / sizeof(env_keys[0]); i++) {
+        const char *value = env_get(env_keys[i]);
+        h = incr_hash(h, env_keys[i], strlen(env_keys[i]) + 1);
+        h = value != NULL ? incr_hash(h, value, strlen(value) + 1)
+                          : incr_hash(h, "", 0);
+    }
+
+    if (token->infile != NULL) {
+        struct stat st;
+        h = incr_hash(h, token->infile, strlen(token->infile) + 1);
+        if (!by_stat) {
+            return incr_hash_file(token->infile, &h) && (*key = h, true);
+        }
+        if (stat(token->infile, &st) < 0) {
+            return false;
+        }
+        uint64_t meta[5] = {st.st_dev, st.st_ino, (uint64_t)st.st_size,
+                            (uint64_t)st.st_mtim.tv_sec,
+                            (uint64_t)st.st_mtim.tv_nsec};
+        h = incr_hash(h, meta, sizeof(meta));
+    }
+    *key = h;
+    return true;
+}
+
+/*
+ * replay - Write a stored output to a file, or to stdout
+ */
+static bool replay(const char *path, const char *outfile) {
+    char buf[65536];
+    ssize_t n = 0;
+    int out_fd = STDOUT_FILENO;
+
+    int in_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (in_fd < 0) {
+        return false;
+    }
+    if (outfile != NULL) {
+        out_fd = open(outfile, O_WRONLY | O_TRUNC | O_CREAT | O_CLOEXEC,
+                      S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        if (out_fd < 0) {
+            perror(outfile);
+            close(in_fd);
+            return false;
+        }
+    } else {
+        fflush(stdout);
+    }
+
+    // In the kernel if it can, by hand otherwise (e.g. to a terminal)
+    while ((n = sendfile(out_fd, in_fd, NULL, 1 << 30)) > 0) {
+    }
+    if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+        while ((n = read(in_fd, buf, sizeof(buf))) > 0 &&
+               rio_writen(out_fd, buf, (size_t)n) == n) {
+        }
+    }
+    close(in_fd);
+    if (out_fd != STDOUT_FILENO) {
+        close(out_fd);
+    }
+    return n == 0;
+}
+
+/*
+ * by_use - qsort comparator: least recently used entries first
+ */
+static int by_use(const void *a, const void *b) {
+    const struct victim *x = a, *y = b;
+    if (x->used.tv_sec != y->used.tv_sec) {
+        return x->used.tv_sec < y->used.tv_sec ? -1 : 1;
+    }
+    return (x->used.tv_nsec > y->used.tv_nsec) -
+           (x->used.tv_nsec < y->used.tv_nsec);
+}
+
+/*
+ * scan - List the entries of the cache; returns their number, or -1
+ */
+static int scan(const char *dir, struct victim **entries,
+                unsigned long long *total) {
+    char path[PATH_MAX];
+    struct dirent *de;
+    struct stat st;
+    int n = 0, cap = 0;
+
+    *entries = NULL;
+    *total = 0;
+    DIR *dp = opendir(dir);
+    if (dp == NULL) {
+        return -1;
+    }
+    while ((de = readdir(dp)) != NULL) {
+        size_t len = strlen(de->d_name);
+        if (len <= strlen(ENTRY_SUFFIX) || len >= sizeof((*entries)->name) ||
+            strcmp(de->d_name + len - strlen(ENTRY_SUFFIX), ENTRY_SUFFIX) != 0) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        if (stat(path, &st) < 0) {
+            continue;
+        }
+        if (n == cap) {
+            cap = cap ? 2 * cap : 64;
+            struct victim *grown = realloc(*entries, cap * sizeof(**entries));
+            if (grown == NULL) {
+                break;
+            }
+            *entries = grown;
+        }
+        (*entries)[n].used = st.st_mtim;
+        (*entries)[n].size = st.st_size;
+        strcpy((*entries)[n].name, de->d_name);
+        *total += st.st_size;
+        n++;
+    }
+    closedir(dp);
+    return n;
+}
+
+/*
+ * evict - Remove the least recently used entries until the cache fits in
+ * its limit (or all of them)
+ */
+static void evict(const char *dir, unsigned long long max) {
+    char path[PATH_MAX];
+    struct victim *entries;
+    unsigned long long total;
+    int n = scan(dir, &entries, &total);
+
+    if (n > 0 && total > max) {
+        qsort(entries, n, sizeof(*entries), by_use);
+        for (int i = 0; i < n && total > max; i++) {
+            snprintf(path, sizeof(path), "%s/%s", dir, entries[i].name);
+            if (unlink(path) == 0) {
+                total -= entries[i].size;
+                stats_inc(STAT_MEMO_EVICT);
+            }
+        }
+    }
+    free(entries);
+}
+
+/*
+ * finish - Keep and replay the output of a command that has ended
+ */
+static void finish(struct run *r, int status) {
+    char dir[DIR_MAX];
+
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0 &&
+        rename(r->tmp, r->entry) == 0) {
+        replay(r->entry, r->outfile);
+        if (memo_dir(dir, sizeof(dir))) {
+            evict(dir, limit);
+        }
+    } else {
+        replay(r->tmp, r->outfile);
+        unlink(r->tmp);
+    }
+    free(r->tmp);
+    free(r->entry);
+    free(r->outfile);
+    memset(r, 0, sizeof(*r));
+}
+
+/*
+ * memo_child - Child listener: finish a command that was running
+ */
+static void memo_child(const struct child_event *event, void *arg) {
+    if (event->jid <= 0 || event->jid > MAXJOBS ||
+        WIFSTOPPED(event->status)) {
+        return;
+    }
+    struct run *r = &runs[event->jid];
+    if (r->serial != 0 && r->serial == event->serial) {
+        finish(r, event->status);
+    }
+}
+
+/*
+ * memo_lost - Lost-event task: finish the commands whose events
+ * were dropped
+ */
+static void memo_lost(void) {
+    struct child_event event;
+
+    for (jid_t jid = 1; jid <= MAXJOBS; jid++) {
+        if (runs[jid].serial != 0 &&
+            loop_lost_event(jid, runs[jid].serial, &event)) {
+            memo_child(&event, NULL);
+        }
+    }
+}
+
+/*
+ * run - Run a command with its stdout going to a new entry
+ */
+static void run(struct cmdline_tokens *token, const char *cmdline,
+                job_state state, const char *dir, uint64_t key) {
+    char tmp[PATH_MAX], entry[PATH_MAX];
+    sigset_t mask_all, mask_prev;
+    struct run r = {0, NULL, NULL, NULL};
+    int status = 0;
+
+    snprintf(entry, sizeof(entry), "%s/%016llx%s", dir,
+             (unsigned long long)key, ENTRY_SUFFIX);
+    snprintf(tmp, sizeof(tmp), "%s/%016llx.tmp.%d.%lu", dir,
+             (unsigned long long)key, (int)getpid(), ntmp++);
+    r.tmp = strdup(tmp);
+    r.entry = strdup(entry);
+    r.outfile = token->outfile != NULL ? strdup(token->outfile) : NULL;
+    if (r.tmp == NULL || r.entry == NULL ||
+        (token->outfile != NULL && r.outfile == NULL) ||
+        (!listening && (!loop_on_child(memo_child, NULL) ||
+                        !loop_on_lost(memo_lost)))) {
+        printf("cache: cannot run %s\n", cmdline);
+        free(r.tmp);
+        free(r.entry);
+        free(r.outfile);
+        return;
+    }
+    listening = true;
+
+    token->outfile = tmp;
+    jid_t jid = launch_job(token, cmdline, state);
+    if (jid == 0) {
+        unlink(tmp);
+        finish(&r, W_EXITCODE(EXIT_FAILURE, 0));
+        return;
+    }
+
+    // A job that is still there is finished when it ends; a foreground job
+    // has usually ended already
+    sigfillset(&mask_all);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+    bool running = job_exists(jid);
+    if (running) {
+        r.serial = job_get_serial(jid);
+    } else if (!job_find_exit(jid, 0, NULL, &status)) {
+        status = W_EXITCODE(0, SIGTERM);
+    }
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+    if (running) {
+        runs[jid] = r;
+    } else {
+        finish(&r, status);
+    }
+}
+
+/*
+ * show - Print the cache's size, limit and entries
+ */
+static void show(const char *dir) {
+    struct victim *entries;
+    unsigned long long total;
+    int n = scan(dir, &entries, &total);
+
+    free(entries);
+    printf("%s: %d entries, %llu bytes (limit %llu)\n", dir, n < 0 ? 0 : n,
+           total, limit);
+}
+
+/*
+ * memo_builtin - The `cache` builtin
+ */
+void memo_builtin(const char *cmdline, char **argv) {
+    char dir[DIR_MAX], entry[PATH_MAX];
+    bool by_stat = false;
+    uint64_t key;
+    int i = 1;
+
+    if (!memo_dir(dir, sizeof(dir))) {
+        printf("cache: no cache directory (set HOME or XDG_CACHE_HOME)\n");
+        return;
+    }
+    if (argv[1] == NULL) {
+        show(dir);
+        return;
+    }
+    if (strcmp(argv[1], "--clear") == 0 && argv[2] == NULL) {
+        evict(dir, 0);
+        return;
+    }
+    if (strcmp(argv[1], "--limit") == 0 && argv[2] != NULL &&
+        argv[3] == NULL) {
+        long long n = atoll(argv[2]);
+        if (n <= 0) {
+            printf("cache: invalid limit %s\n", argv[2]);
+            return;
+        }
+        limit = (unsigned long long)n;
+        evict(dir, limit);
+        return;
+    }
+    if (strcmp(argv[1], "--stat") == 0) {
+        by_stat = true;
+        i++;
+    }
+    if (argv[i] == NULL) {
+        printf("cache: usage: cache [--stat] COMMAND [&] | cache --limit "
+               "BYTES | cache --clear\n");
+        return;
+    }
+
+    struct cmdline_tokens token;
+    const char *cmd = skip_args(cmdline, i);
+    parseline_return ret = parseline(cmd, &token);
+    if (ret == PARSELINE_ERROR || ret == PARSELINE_EMPTY) {
+        return;
+    }
+    if (token.builtin != BUILTIN_NONE) {
+        printf("cache: cannot run builtin %s\n", token.argv[0]);
+        return;
+    }
+    job_state state = ret == PARSELINE_BG ? BG : FG;
+
+    // An input that cannot be read is for the command to report
+    if (!memo_key(&token, by_stat, &key)) {
+        launch_job(&token, cmdline, state);
+        return;
+    }
+    snprintf(entry, sizeof(entry), "%s/%016llx%s", dir,
+             (unsigned long long)key, ENTRY_SUFFIX);
+    if (replay(entry, token.outfile)) {
+        stats_inc(STAT_MEMO_HIT);
+        // The modification time is the LRU clock
+        utimensat(AT_FDCWD, entry, NULL, 0);
+        last_status = 0;
+        return;
+    }
+    stats_inc(STAT_MEMO_MISS);
+    run(&token, cmdline, state, dir, key);
+}
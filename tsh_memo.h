@@ -0,0 +1,54 @@
+/**
+ * @file tsh_memo.h
+ * @brief Memoized commands: replay the stdout of pure commands from a cache
+ *
+ * A command run with `cache` is taken to be deterministic: its stdout only
+ * depends on its arguments, its environment and its input. The shell hashes
+ * its arguments (including `NAME=VALUE` prefixes), the current directory,
+ * the variables that usually change what commands print (`PATH`, `LANG`,
+ * `LC_ALL`, `LC_COLLATE`, `LC_CTYPE`, `TZ`) and the contents of its `<`
+ * input, or with `--stat` just the input's inode, size and modification
+ * time. Files that the command opens by itself are not part of the key; pass
+ * them with `<` to have them hashed.
+ *
+ * On a hit, the stored stdout is written to the command's stdout (or its
+ * `> FILE`) without forking, and `$?` is 0. On a miss, the command runs
+ * with its stdout going to a file in the cache, and once it has exited
+ * with status 0 the file is kept as the entry and replayed. The output of
+ * a command that fails is replayed but not kept. Stderr is never cached.
+ *
+ * Entries live in `${XDG_CACHE_HOME:-$HOME/.cache}/tsh/memo/`, one file per
+ * key. The cache is bounded in size (256 MiB by default); when a new entry
+ * takes it over the limit, the least recently used entries are evicted.
+ * A hit refreshes the entry's modification time, which serves as its LRU
+ * clock, so the cache is shared by all shells of the user.
+ *
+ * Builtins:
+ *
+ *     cache [--stat] COMMAND [&]
+ *         Run COMMAND, or replay its output
+ *     cache --limit BYTES
+ *         Set the size limit of the cache
+ *     cache --clear
+ *         Remove every entry
+ *     cache
+ *         Show the cache's size, limit and entries
+ *
+ * `stats` counts the hits, misses and evictions.
+ */
+
+#ifndef TSH_MEMO_H
+#define TSH_MEMO_H
+
+/**
+ * @brief Implements the `cache` builtin.
+ *
+ * @param[in] cmdline  The full command line; the command to run is taken
+ *                     from it verbatim.
+ * @param[in] argv     The parsed arguments.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void memo_builtin(const char *cmdline, char **argv);
+
+#endif /* TSH_MEMO_H */
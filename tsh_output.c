@@ -0,0 +1,681 @@
+/**
+ * @file tsh_output.c
+ * @brief Per-job output capture into in-memory ring buffers.
+ *
+ * For documentation related to usage, see the corresponding header file at
+ * tsh_output.h.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "csapp.h"
+#include "tsh_loop.h"
+#include "tsh_output.h"
+#include "tsh_stats.h"
+
+#define NSTREAMS 2        // stdout and stderr
+#define MUX_LINE_MAX 4096 // Longest line multiplexed in one piece
+#define MUX_TAG_MAX 64    // Longest rendered tag
+
+// Capture modes
+typedef enum capture_mode {
+    MODE_OFF,  // Background jobs write to the terminal
+    MODE_RING, // Background output is kept in per-job rings
+    MODE_MUX   // Background output is tagged and multiplexed line by line
+} capture_mode;
+
+// Struct used to store one captured stream
+struct capture_stream {
+    struct capture *cap;   // Owning capture
+    int fd;                // Read end of the pipe, or -1 at EOF
+    int child_fd;          // Write end, until the child is forked
+    unsigned long bytes;   // Bytes read from the stream
+    char *line;            // MODE_MUX: incomplete last line
+    size_t line_len;       // MODE_MUX: bytes in line
+    char tag[MUX_TAG_MAX]; // MODE_MUX: rendered line prefix
+    size_t tag_len;        // MODE_MUX: length of tag
+};
+
+// Struct used to store the capture state of one job
+struct capture {
+    jid_t jid;                               // Job ID, 0 until attached
+    unsigned long serial;                    // Serial number of the job
+    capture_mode mode;                       // MODE_RING or MODE_MUX
+    struct capture_stream streams[NSTREAMS]; // stdout, stderr
+    char *ring;                              // Ring buffer
+    size_t size;                             // Capacity of the ring
+    size_t start;                            // Index of the oldest byte
+    size_t len;                              // Bytes held in the ring
+    unsigned long dropped;                   // Bytes lost to overflow
+    unsigned long spilled;                   // Bytes written to spill file
+    int spill_fd;                            // Spill file, or -1
+    char *spill_path;                        // Spill file name, or NULL
+    struct capture *next;                    // Next capture in the list
+};
+
+// Struct used to store multiplexed output waiting to be written
+struct mux_pending {
+    char *buf;  // Coalesced tagged lines
+    size_t len; // Bytes in buf
+};
+
+/* Static variables */
+static capture_mode mode = MODE_OFF;           // Mode for new bg jobs
+static size_t mux_limit = OUTPUT_MUX_LIMIT;    // Bytes buffered per stream
+static char *mux_tag = NULL;                   // Tag format, NULL for default
+static struct mux_pending pending[NSTREAMS];   // To stdout, to stderr
+static size_t ring_size = OUTPUT_DEFAULT_SIZE; // Ring size for new jobs
+static char *spill_dir = NULL;                 // Spill directory, or NULL
+static pid_t spill_owner = 0;                  // Shell that removes spills
+static struct capture *captures = NULL;        // All live captures
+static struct capture *following = NULL;       // Capture being followed
+static volatile sig_atomic_t follow_cancelled; // Set by Ctrl-C
+
+/*
+ * capture_open - Whether a capture still has an open stream
+ */
+static bool capture_open(const struct capture *cap) {
+    for (int i = 0; i < NSTREAMS; i++) {
+        if (cap->streams[i].fd >= 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * capture_free - Close and free a capture that is no longer in the list
+ */
+static void capture_free(struct capture *cap) {
+    for (int i = 0; i < NSTREAMS; i++) {
+        struct capture_stream *st = &cap->streams[i];
+        if (st->fd >= 0) {
+            loop_remove(st->fd);
+            close(st->fd);
+        }
+        if (st->child_fd >= 0) {
+            close(st->child_fd);
+        }
+        free(st->line);
+    }
+    if (cap->spill_fd >= 0) {
+        close(cap->spill_fd);
+        if (cap->spill_path != NULL) {
+            unlink(cap->spill_path);
+        }
+    }
+    free(cap->spill_path);
+    free(cap->ring);
+    free(cap);
+}
+
+/*
+ * capture_current - Whether a capture belongs to the job that has its job
+ * ID now, or had it last; the ID may since have gone to a job that is not
+ * captured
+ */
+static bool capture_current(const struct capture *cap) {
+    sigset_t mask_all, mask_prev;
+    unsigned long serial = 0;
+
+    sigfillset(&mask_all);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+    if (job_exists(cap->jid)) {
+        serial = job_get_serial(cap->jid);
+    } else if (!job_find_exit(cap->jid, 0, &serial, NULL)) {
+        // Too old to tell: no job has been seen with this ID since
+        serial = cap->serial;
+    }
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+    return serial == cap->serial;
+}
+
+/*
+ * find_capture - The capture of the job that has (or last had) a job ID
+ */
+static struct capture *find_capture(jid_t jid) {
+    for (struct capture *cap = captures; cap != NULL; cap = cap->next) {
+        if (cap->jid == jid) {
+            return capture_current(cap) ? cap : NULL;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * spill_cleanup - Remove the spill files when the shell exits
+ */
+static void spill_cleanup(void) {
+    // A child that exits without exec must leave the shell's files alone
+    if (getpid() != spill_owner) {
+        return;
+    }
+    for (struct capture *cap = captures; cap != NULL; cap = cap->next) {
+        if (cap->spill_fd >= 0 && cap->spill_path != NULL) {
+            unlink(cap->spill_path);
+        }
+    }
+}
+
+/*
+ * spill - Move the oldest n bytes of the ring to the spill file, or drop
+ * them if there is no spill file
+ */
+static void spill(struct capture *cap, const char *data, size_t n) {
+    if (cap->spill_fd < 0 && spill_dir != NULL && cap->spill_path == NULL) {
+        char path[MAXLINE];
+        snprintf(path, sizeof(path), "%s/tsh-%d-job%d.out", spill_dir,
+                 (int)getpid(), cap->jid);
+        cap->spill_path = strdup(path);
+        // Never reuse, or follow a link to, a file that is already there
+        cap->spill_fd = open(path,
+                             O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW |
+                                 O_CLOEXEC,
+                             S_IRUSR | S_IWUSR);
+        if (cap->spill_fd < 0) {
+            perror(path);
+        } else if (spill_owner == 0) {
+            spill_owner = getpid();
+            atexit(spill_cleanup);
+        }
+    }
+    if (cap->spill_fd >= 0 && rio_writen(cap->spill_fd, data, n) >= 0) {
+        cap->spilled += n;
+    } else {
+        cap->dropped += n;
+    }
+}
+
+/*
+ * ring_evict - Remove the oldest n bytes from the ring
+ */
+static void ring_evict(struct capture *cap, size_t n) {
+    while (n > 0) {
+        size_t chunk = cap->size - cap->start;
+        if (chunk > n) {
+            chunk = n;
+        }
+        spill(cap, cap->ring + cap->start, chunk);
+        cap->start = (cap->start + chunk) % cap->size;
+        cap->len -= chunk;
+        n -= chunk;
+    }
+}
+
+/*
+ * ring_append - Append bytes to the ring, evicting old bytes as needed
+ */
+static void ring_append(struct capture *cap, const char *data, size_t n) {
+    if (n >= cap->size) {
+        // Only the tail of data fits; everything older goes
+        ring_evict(cap, cap->len);
+        spill(cap, data, n - cap->size);
+        data += n - cap->size;
+        n = cap->size;
+        cap->start = 0;
+    } else if (cap->len + n > cap->size) {
+        ring_evict(cap, cap->len + n - cap->size);
+    }
+
+    size_t end = (cap->start + cap->len) % cap->size;
+    size_t chunk = cap->size - end;
+    if (chunk > n) {
+        chunk = n;
+    }
+    memcpy(cap->ring + end, data, chunk);
+    memcpy(cap->ring, data + chunk, n - chunk);
+    cap->len += n;
+}
+
+/*
+ * mux_flush - Write all pending multiplexed output, one write per stream
+ */
+static void mux_flush(void) {
+    // Anything the shell itself printed comes first
+    fflush(stdout);
+    for (int i = 0; i < NSTREAMS; i++) {
+        if (pending[i].len > 0) {
+            rio_writen(i == 0 ? STDOUT_FILENO : STDERR_FILENO, pending[i].buf,
+                       pending[i].len);
+            pending[i].len = 0;
+        }
+    }
+}
+
+/*
+ * mux_emit - Queue one tagged line for output
+ *
+ * If the pending buffer cannot take the line, it is flushed first. The
+ * write blocks, so the shell stops reading from the pipes meanwhile, and
+ * chatty jobs block on their full pipes instead of growing the buffer.
+ */
+static void mux_emit(struct capture_stream *st, const char *data, size_t n) {
+    int i = st == &st->cap->streams[0] ? 0 : 1;
+    struct mux_pending *p = &pending[i];
+    bool newline = n == 0 || data[n - 1] != '\n';
+
+    if (p->buf == NULL && (p->buf = malloc(mux_limit)) == NULL) {
+        perror("capture");
+        return;
+    }
+    if (p->len + st->tag_len + n + newline > mux_limit) {
+        mux_flush();
+    }
+    memcpy(p->buf + p->len, st->tag, st->tag_len);
+    memcpy(p->buf + p->len + st->tag_len, data, n);
+    p->len += st->tag_len + n;
+    if (newline) {
+        p->buf[p->len++] = '\n';
+    }
+    if (!loop_defer(mux_flush)) {
+        mux_flush();
+    }
+}
+
+/*
+ * mux_input - Split stream data into lines and queue the complete ones
+ *
+ * Lines longer than MUX_LINE_MAX are emitted in pieces, each tagged.
+ */
+static void mux_input(struct capture_stream *st, const char *data, size_t n) {
+    while (n > 0) {
+        const char *nl = memchr(data, '\n', n);
+        size_t seg = nl ? (size_t)(nl - data) + 1 : n;
+        size_t take = MUX_LINE_MAX - st->line_len;
+        if (take > seg) {
+            take = seg;
+        }
+
+        if (st->line_len == 0 && take == seg && nl != NULL) {
+            // Common case: a whole line in the buffer, no copy needed
+            mux_emit(st, data, seg);
+        } else {
+            memcpy(st->line + st->line_len, data, take);
+            st->line_len += take;
+            if (st->line_len == MUX_LINE_MAX || (take == seg && nl)) {
+                mux_emit(st, st->line, st->line_len);
+                st->line_len = 0;
+            }
+        }
+        data += take;
+        n -= take;
+    }
+}
+
+/*
+ * mux_tag_render - Expand the tag format for one stream of a job
+ */
+static void mux_tag_render(struct capture_stream *st, int index) {
+    const char *fmt = mux_tag ? mux_tag : "[%j] ";
+    size_t len = 0;
+
+    for (const char *s = fmt; *s != '\0' && len < MUX_TAG_MAX - 16; s++) {
+        if (s[0] == '%' && s[1] == 'j') {
+            len += (size_t)snprintf(st->tag + len, MUX_TAG_MAX - len, "%d",
+                                    st->cap->jid);
+            s++;
+        } else if (s[0] == '%' && s[1] == 's') {
+            len += (size_t)snprintf(st->tag + len, MUX_TAG_MAX - len, "%s",
+                                    index == 0 ? "out" : "err");
+            s++;
+        } else if (s[0] == '%' && s[1] == '%') {
+            st->tag[len++] = '%';
+            s++;
+        } else {
+            st->tag[len++] = *s;
+        }
+    }
+    st->tag_len = len;
+}
+
+/*
+ * stream_ready - Drain a capture pipe into its ring or the multiplexer
+ */
+static void stream_ready(int fd, uint32_t events, void *arg) {
+    struct capture_stream *st = arg;
+    struct capture *cap = st->cap;
+    char buf[MAXBUF];
+    ssize_t n;
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        st->bytes += (unsigned long)n;
+        if (cap->mode == MODE_MUX) {
+            mux_input(st, buf, (size_t)n);
+            // One read per wakeup, so that no job can starve the others
+            return;
+        }
+        ring_append(cap, buf, (size_t)n);
+        if (following == cap) {
+            rio_writen(STDOUT_FILENO, buf, (size_t)n);
+        }
+    }
+    if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+        loop_remove(fd);
+        close(fd);
+        st->fd = -1;
+        // An unterminated last line still gets its tag and a newline
+        if (st->line_len > 0) {
+            mux_emit(st, st->line, st->line_len);
+            st->line_len = 0;
+        }
+    }
+}
+
+/*
+ * output_prepare - Create the capture pipes for a job about to be forked
+ */
+struct capture *output_prepare(job_state state) {
+    if (mode == MODE_OFF || state != BG || !loop_active()) {
+        return NULL;
+    }
+
+    struct capture *cap = calloc(1, sizeof(*cap));
+    if (cap == NULL) {
+        perror("capture");
+        return NULL;
+    }
+    cap->mode = mode;
+    cap->spill_fd = -1;
+    for (int i = 0; i < NSTREAMS; i++) {
+        cap->streams[i].cap = cap;
+        cap->streams[i].fd = cap->streams[i].child_fd = -1;
+    }
+
+    bool ok = true;
+    if (mode == MODE_RING) {
+        cap->size = ring_size;
+        ok = (cap->ring = malloc(ring_size)) != NULL;
+    } else {
+        for (int i = 0; i < NSTREAMS; i++) {
+            ok = ok && (cap->streams[i].line = malloc(MUX_LINE_MAX)) != NULL;
+        }
+    }
+    if (!ok) {
+        perror("capture");
+        capture_free(cap);
+        return NULL;
+    }
+    for (int i = 0; i < NSTREAMS; i++) {
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) < 0) {
+            perror("capture");
+            capture_free(cap);
+            return NULL;
+        }
+        cap->streams[i].fd = fds[0];
+        cap->streams[i].child_fd = fds[1];
+    }
+    return cap;
+}
+
+/*
+ * output_child - Point the child's stdout and stderr at the capture pipes
+ * Async-signal-safe
+ */
+void output_child(struct capture *cap) {
+    if (cap == NULL) {
+        return;
+    }
+    // The pipes are close-on-exec; dup2 yields inheritable copies
+    dup2(cap->streams[0].child_fd, STDOUT_FILENO);
+    dup2(cap->streams[1].child_fd, STDERR_FILENO);
+}
+
+/*
+ * output_child_fds - The capture pipe ends that the child gets
+ * Async-signal-safe
+ */
+bool output_child_fds(const struct capture *cap, int *out_fd, int *err_fd) {
+    if (cap == NULL) {
+        return false;
+    }
+    *out_fd = cap->streams[0].child_fd;
+    *err_fd = cap->streams[1].child_fd;
+    return true;
+}
+
+/*
+ * output_attach - Bind a capture to its job and start draining it
+ */
+void output_attach(struct capture *cap, jid_t jid) {
+    if (cap == NULL) {
+        return;
+    }
+    for (int i = 0; i < NSTREAMS; i++) {
+        close(cap->streams[i].child_fd);
+        cap->streams[i].child_fd = -1;
+    }
+    if (jid == 0) {
+        capture_free(cap);
+        return;
+    }
+
+    // A new job with this ID replaces the previous job's capture
+    for (struct capture **pp = &captures; *pp != NULL; pp = &(*pp)->next) {
+        if ((*pp)->jid == jid) {
+            struct capture *old = *pp;
+            *pp = old->next;
+            if (following == old) {
+                following = NULL;
+            }
+            capture_free(old);
+            break;
+        }
+    }
+
+    cap->jid = jid;
+    cap->serial = job_get_serial(jid);
+    for (int i = 0; i < NSTREAMS; i++) {
+        struct capture_stream *st = &cap->streams[i];
+        if (cap->mode == MODE_MUX) {
+            mux_tag_render(st, i);
+        }
+        fcntl(st->fd, F_SETFL, fcntl(st->fd, F_GETFL) | O_NONBLOCK);
+        if (!loop_add(st->fd, EPOLLIN, stream_ready, st)) {
+            perror("capture");
+            close(st->fd);
+            st->fd = -1;
+        }
+    }
+    cap->next = captures;
+    captures = cap;
+}
+
+/*
+ * print_ring - Write the spilled output and the ring contents to stdout
+ */
+static void print_ring(struct capture *cap) {
+    if (cap->spill_path != NULL && cap->spilled > 0) {
+        int fd = open(cap->spill_path, O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            char buf[MAXBUF];
+            ssize_t n;
+            while ((n = read(fd, buf, sizeof(buf))) > 0) {
+                rio_writen(STDOUT_FILENO, buf, (size_t)n);
+            }
+            close(fd);
+        }
+    }
+    size_t first = cap->size - cap->start;
+    if (first > cap->len) {
+        first = cap->len;
+    }
+    rio_writen(STDOUT_FILENO, cap->ring + cap->start, first);
+    rio_writen(STDOUT_FILENO, cap->ring, cap->len - first);
+}
+
+/*
+ * follow_capture - Echo new output of a capture until its streams close;
+ * returns false if Ctrl-C stopped it first
+ */
+static bool follow_capture(struct capture *cap) {
+    // New output is echoed by stream_ready while we keep the loop running
+    following = cap;
+    follow_cancelled = 0;
+    while (following == cap && capture_open(cap) && !follow_cancelled) {
+        loop_run_once(-1);
+    }
+    following = NULL;
+    return !follow_cancelled;
+}
+
+/*
+ * output_builtin_capture - The `capture` builtin
+ */
+void output_builtin_capture(char **argv) {
+    if (argv[1] == NULL) {
+        if (mode == MODE_MUX) {
+            printf("capture is mux (tag \"%s\", limit %zu bytes)\n",
+                   mux_tag ? mux_tag : "[%j] ", mux_limit);
+        } else {
+            printf("capture is %s (ring %zu bytes, spill %s)\n",
+                   mode == MODE_RING ? "on" : "off", ring_size,
+                   spill_dir ? spill_dir : "none");
+        }
+        return;
+    }
+    if (strcmp(argv[1], "off") == 0) {
+        mode = MODE_OFF;
+        return;
+    }
+
+    capture_mode new_mode;
+    if (strcmp(argv[1], "on") == 0) {
+        new_mode = MODE_RING;
+    } else if (strcmp(argv[1], "mux") == 0) {
+        new_mode = MODE_MUX;
+    } else {
+        printf("capture: usage: capture on [--size BYTES] [--spill DIR] | "
+               "capture mux [--tag FMT] [--limit BYTES] | capture off\n");
+        return;
+    }
+
+    size_t size = OUTPUT_DEFAULT_SIZE;
+    size_t limit = OUTPUT_MUX_LIMIT;
+    const char *dir = NULL;
+    const char *tag = NULL;
+    for (int i = 2; argv[i] != NULL; i++) {
+        if (strcmp(argv[i], "--size") == 0 && argv[i + 1] != NULL) {
+            long n = atol(argv[++i]);
+            if (n <= 0) {
+                printf("capture: invalid size %s\n", argv[i]);
+                return;
+            }
+            size = (size_t)n;
+        } else if (strcmp(argv[i], "--spill") == 0 && argv[i + 1] != NULL) {
+            dir = argv[++i];
+        } else if (strcmp(argv[i], "--tag") == 0 && argv[i + 1] != NULL) {
+            tag = argv[++i];
+        } else if (strcmp(argv[i], "--limit") == 0 && argv[i + 1] != NULL) {
+            // A pending buffer must hold at least one full tagged line
+            long n = atol(argv[++i]);
+            if (n < 2 * (MUX_LINE_MAX + MUX_TAG_MAX)) {
+                printf("capture: limit must be at least %d bytes\n",
+                       2 * (MUX_LINE_MAX + MUX_TAG_MAX));
+                return;
+            }
+            limit = (size_t)n;
+        } else {
+            printf("capture: unknown option %s\n", argv[i]);
+            return;
+        }
+    }
+
+    char *dir_copy = NULL;
+    char *tag_copy = NULL;
+    if ((dir != NULL && (dir_copy = strdup(dir)) == NULL) ||
+        (tag != NULL && (tag_copy = strdup(tag)) == NULL)) {
+        perror("capture");
+        free(dir_copy);
+        return;
+    }
+    free(spill_dir);
+    spill_dir = dir_copy;
+    free(mux_tag);
+    mux_tag = tag_copy;
+    ring_size = size;
+
+    // The pending buffers are sized for the limit; resize them when empty
+    if (limit != mux_limit) {
+        mux_flush();
+        for (int i = 0; i < NSTREAMS; i++) {
+            free(pending[i].buf);
+            pending[i].buf = NULL;
+        }
+        mux_limit = limit;
+    }
+    mode = new_mode;
+}
+
+/*
+ * output_builtin_output - The `output` builtin
+ */
+void output_builtin_output(char **argv) {
+    if (argv[1] == NULL) {
+        for (struct capture *cap = captures; cap != NULL; cap = cap->next) {
+            if (!capture_current(cap)) {
+                continue;
+            }
+            printf("[%d] stdout %lu bytes, stderr %lu bytes, %lu spilled, "
+                   "%lu dropped%s%s\n",
+                   cap->jid, cap->streams[0].bytes, cap->streams[1].bytes,
+                   cap->spilled, cap->dropped,
+                   cap->mode == MODE_MUX ? " (multiplexed)" : "",
+                   capture_open(cap) ? "" : " (closed)");
+        }
+        return;
+    }
+
+    if (argv[1][0] != '%') {
+        printf("output: argument must be a %%jobid\n");
+        return;
+    }
+    bool follow = argv[2] != NULL && strcmp(argv[2], "--follow") == 0;
+    struct capture *cap = find_capture(atoi(argv[1] + 1));
+    if (cap == NULL) {
+        printf("%s: No captured output\n", argv[1]);
+        return;
+    }
+    if (cap->mode == MODE_MUX) {
+        printf("%s: Output is multiplexed, not kept\n", argv[1]);
+        return;
+    }
+
+    fflush(stdout);
+    print_ring(cap);
+    if (follow) {
+        follow_capture(cap);
+    }
+}
+
+/*
+ * output_follow - Print a job's kept output and follow it until it ends
+ */
+bool output_follow(jid_t jid) {
+    struct capture *cap = find_capture(jid);
+    if (cap == NULL || cap->mode == MODE_MUX) {
+        return true;
+    }
+    fflush(stdout);
+    print_ring(cap);
+    return follow_capture(cap);
+}
+
+/*
+ * output_cancel_follow - Stop following
+ * Async-signal-safe
+ */
+void output_cancel_follow(void) {
+    follow_cancelled = 1;
+}
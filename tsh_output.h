@@ -0,0 +1,135 @@
+/**
+ * @file tsh_output.h
+ * @brief Per-job output capture into in-memory ring buffers
+ *
+ * Capture is opt-in (`capture on`). While it is enabled, every background
+ * job gets a pipe for its stdout and one for its stderr. The shell drains
+ * both through its event loop into a bounded ring buffer owned by the job,
+ * so output no longer lands on the terminal and needs no temporary files.
+ *
+ * When a ring buffer fills up, its oldest bytes are either dropped or, if
+ * a spill directory was given, appended to a per-job file in that
+ * directory, so that the spill file followed by the ring holds the whole
+ * output. The file is created afresh (an existing file or link of that
+ * name is an error, and the bytes are dropped) and removed when the
+ * capture is, i.e. when the job ID is reused or the shell exits. Byte
+ * counters are kept per job and per stream.
+ *
+ * In mux mode (`capture mux`), output is not kept. Instead, every complete
+ * line a job writes is prefixed with a tag and passed on to the shell's own
+ * stdout or stderr, so lines from concurrent jobs never interleave. Lines
+ * that become ready together are coalesced into one large write per
+ * stream. The tag format expands `%j` to the job ID, `%s` to `out` or
+ * `err` and `%%` to `%`; the default is `[%j] `. Buffered output is bounded
+ * by `--limit`: when the buffer is full, the shell writes it out before
+ * reading more, so a job that writes faster than the output drains ends up
+ * blocked on its pipe.
+ *
+ * Builtins:
+ *
+ *     capture on [--size BYTES] [--spill DIR]   Capture new background jobs
+ *     capture mux [--tag FMT] [--limit BYTES]   Multiplex new background jobs
+ *     capture off                               Stop capturing new jobs
+ *     output                                    List captures and counters
+ *     output %N [--follow]                      Print (and follow) a job's
+ *                                               output; Ctrl-C stops
+ *                                               following
+ *
+ * A job's capture stays available after the job ends, until its job ID is
+ * reused by another job, captured or not. Captures are matched by the job's
+ * serial number, so `output %N` never shows an earlier job's output.
+ */
+
+#ifndef TSH_OUTPUT_H
+#define TSH_OUTPUT_H
+
+#include <stdbool.h>
+
+#include "tsh_helper.h"
+
+#define OUTPUT_DEFAULT_SIZE (64 * 1024) /**< Default ring size in bytes */
+#define OUTPUT_MUX_LIMIT (64 * 1024)    /**< Default mux buffer in bytes */
+
+/** @brief Opaque capture state of one job */
+struct capture;
+
+/**
+ * @brief Prepares the capture pipes for a job that is about to be forked.
+ *
+ * @param[in] state  The state the job will be launched in.
+ *
+ * @return The new capture, or NULL if capture is disabled, does not apply
+ *         to this job, or the pipes could not be created.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+struct capture *output_prepare(job_state state);
+
+/**
+ * @brief Connects the child's stdout and stderr to the capture pipes.
+ *
+ * To be called in the child after fork, before the job's own redirections
+ * are applied (so that `> file` still wins). Does nothing if `cap` is NULL.
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void output_child(struct capture *cap);
+
+/**
+ * @brief Returns the ends of the capture pipes that become the child's
+ *        stdout and stderr, for launchers that cannot run code in the child
+ *        (see tsh_spawn.h).
+ *
+ * @param[out] out_fd  The child's stdout.
+ * @param[out] err_fd  The child's stderr.
+ *
+ * @return false if `cap` is NULL
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool output_child_fds(const struct capture *cap, int *out_fd, int *err_fd);
+
+/**
+ * @brief Binds a prepared capture to its job and starts draining it.
+ *
+ * To be called in the parent after fork. If the job could not be added
+ * (`jid` is 0) or fork failed, the capture is discarded. Does nothing if
+ * `cap` is NULL.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void output_attach(struct capture *cap, jid_t jid);
+
+/**
+ * @brief Implements the `capture` builtin.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void output_builtin_capture(char **argv);
+
+/**
+ * @brief Implements the `output` builtin.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void output_builtin_output(char **argv);
+
+/**
+ * @brief Prints a job's kept output so far and follows it, like
+ *        `output %N --follow`, until the job closes its stdout and stderr.
+ *
+ * Does nothing if the job's output is not captured, or is multiplexed.
+ *
+ * @param[in] jid  The job.
+ *
+ * @return false if Ctrl-C stopped following, true otherwise
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool output_follow(jid_t jid);
+
+/**
+ * @brief Stops an `output --follow` that is in progress.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void output_cancel_follow(void);
+
+#endif /* TSH_OUTPUT_H */
@@ -0,0 +1,117 @@
+/**
+ * @file tsh_reaper.c
+ * @brief Subreaper mode: accounting for whole job process trees.
+ *
+ * For documentation related to usage, see the corresponding header file at
+ * tsh_reaper.h.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "tsh_helper.h"
+#include "tsh_reaper.h"
+
+// Struct used to store a lingering job, indexed by job ID
+struct lingering {
+    unsigned long serial; // Serial number of the job, 0 if not lingering
+    int status;           // Raw status of the job's initial process
+};
+
+/* Static variables */
+static bool enabled = false;                    // Subreaper mode is on
+static struct lingering lingering[MAXJOBS + 1]; // Indexed by job ID
+
+/*
+ * reaper_enable - Become a child subreaper
+ */
+bool reaper_enable(void) {
+    if (prctl(PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0) < 0) {
+        return false;
+    }
+    enabled = true;
+    return true;
+}
+
+/*
+ * group_alive - Whether any process is left in a process group
+ * Async-signal-safe
+ */
+static bool group_alive(pid_t pgid) {
+    return kill(-pgid, 0) == 0 || errno == EPERM;
+}
+
+/*
+ * reaper_wait - Reap one child, looking up its process group first
+ * Async-signal-safe
+ */
+pid_t reaper_wait(int *status, struct rusage *usage, pid_t *pgid) {
+    *pgid = 0;
+    if (!enabled) {
+        return wait4(-1, status, WNOHANG | WUNTRACED, usage);
+    }
+
+    // Peek first: a zombie still has its process group, a reaped child
+    // does not
+    siginfo_t info;
+    info.si_pid = 0;
+    if (waitid(P_ALL, 0, &info, WEXITED | WSTOPPED | WNOHANG | WNOWAIT) < 0) {
+        return -1;
+    }
+    if (info.si_pid == 0) {
+        return 0;
+    }
+    *pgid = getpgid(info.si_pid);
+    return wait4(info.si_pid, status, WNOHANG | WUNTRACED, usage);
+}
+
+/*
+ * reaper_linger - Keep a job whose initial process ended, if its process
+ * group is still alive
+ * Async-signal-safe
+ */
+bool reaper_linger(jid_t jid, unsigned long serial, pid_t pgid, int status) {
+    int olderrno = errno;
+    bool alive = enabled && jid > 0 && jid <= MAXJOBS && group_alive(pgid);
+    errno = olderrno;
+    if (alive) {
+        lingering[jid].serial = serial;
+        lingering[jid].status = status;
+    }
+    return alive;
+}
+
+/*
+ * reaper_lingering - Whether a job is lingering
+ * Async-signal-safe
+ */
+bool reaper_lingering(jid_t jid, unsigned long serial) {
+    return jid > 0 && jid <= MAXJOBS && serial != 0 &&
+           lingering[jid].serial == serial;
+}
+
+/*
+ * reaper_tree_done - Whether a lingering job's process group is now empty
+ * Async-signal-safe
+ */
+bool reaper_tree_done(jid_t jid, unsigned long serial, pid_t pgid,
+                      int *status) {
+    if (jid <= 0 || jid > MAXJOBS || lingering[jid].serial != serial ||
+        serial == 0) {
+        return false;
+    }
+    int olderrno = errno;
+    bool alive = group_alive(pgid);
+    errno = olderrno;
+    if (alive) {
+        return false;
+    }
+    *status = lingering[jid].status;
+    lingering[jid].serial = 0;
+    return true;
+}
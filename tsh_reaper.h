@@ -0,0 +1,103 @@
+/**
+ * @file tsh_reaper.h
+ * @brief Subreaper mode: accounting for whole job process trees
+ *
+ * Normally a job ends when its initial process does, and descendants that
+ * outlive their parent are reparented to init, out of the shell's sight.
+ * With `--subreaper`, the shell becomes a child subreaper (see
+ * PR_SET_CHILD_SUBREAPER in prctl(2)), so those orphans are reparented to
+ * the shell instead, and `sigchld_handler` reaps them.
+ *
+ * A reaped orphan is mapped back to its job through its process group,
+ * which is looked up before it is reaped: every job runs in a process group
+ * whose ID is the PID of its initial process. When the initial process of a
+ * job ends while other processes remain in its group, the job lingers: it
+ * stays in the job list, and is only reported as done, with the status of
+ * its initial process, once the last process of its group has been reaped.
+ * Job dependencies, supervision and `wait` all follow the whole tree.
+ *
+ * The CPU time and peak RSS that `wait4` reports for every reaped process
+ * are added to its job, and listed by `jobs --done`; they include the
+ * processes that each one reaped itself. Orphans that left their job's
+ * process group (e.g. daemons that called setsid) cannot be mapped back;
+ * they are still reaped, and counted in `stats`.
+ */
+
+#ifndef TSH_REAPER_H
+#define TSH_REAPER_H
+
+#include <stdbool.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+#include "tsh_helper.h"
+
+/**
+ * @brief Makes the shell a child subreaper.
+ *
+ * @return true on success, false if the kernel refused (errno is set)
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool reaper_enable(void);
+
+/**
+ * @brief Reaps one child that has ended or stopped, without blocking.
+ *
+ * Like `wait4(-1, status, WNOHANG | WUNTRACED, usage)`. In subreaper mode,
+ * the child's process group is also looked up before it is reaped.
+ *
+ * @param[out] status  The raw status of the child.
+ * @param[out] usage   The resources used by the child and its reaped
+ *                     descendants.
+ * @param[out] pgid    The child's process group in subreaper mode, or 0.
+ *
+ * @return The PID of the child, 0 if none is ready, or -1 on error
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+pid_t reaper_wait(int *status, struct rusage *usage, pid_t *pgid);
+
+/**
+ * @brief Decides whether a job whose initial process has ended lingers.
+ *
+ * Called from `sigchld_handler`. If this returns true, the rest of the
+ * job's process group is still alive: the job must be kept in the job list
+ * as is, until `reaper_tree_done` says otherwise.
+ *
+ * @param[in] jid     The job.
+ * @param[in] serial  The job's serial number.
+ * @param[in] pgid    The job's process group (the PID of the process).
+ * @param[in] status  The raw status of the initial process.
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool reaper_linger(jid_t jid, unsigned long serial, pid_t pgid, int status);
+
+/**
+ * @brief Returns whether a job is lingering, i.e. whether its initial
+ *        process has ended but the rest of its process group has not.
+ *
+ * @param[in] jid     The job.
+ * @param[in] serial  The job's serial number.
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool reaper_lingering(jid_t jid, unsigned long serial);
+
+/**
+ * @brief Decides whether a lingering job is done, after one of its
+ *        descendants has been reaped.
+ *
+ * @param[in]  jid     The job.
+ * @param[in]  serial  The job's serial number.
+ * @param[in]  pgid    The job's process group.
+ * @param[out] status  If the job is done, the raw status of its initial
+ *                     process.
+ *
+ * @return true if the job was lingering and its process group is now empty
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool reaper_tree_done(jid_t jid, unsigned long serial, pid_t pgid,
+                      int *status);
+
+#endif /* TSH_REAPER_H */
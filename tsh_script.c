@@ -0,0 +1,1103 @@
+/**
+ * @file tsh_script.c
+ * @brief Control flow and script files, run from a compiled image.
+ *
+ * For documentation related to usage, see the corresponding header file at
+ * tsh_script.h.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tsh.h"
+#include "tsh_env.h"
+#include "tsh_glob.h"
+#include "tsh_helper.h"
+#include "tsh_incr.h"
+#include "tsh_script.h"
+#include "tsh_stats.h"
+
+/* Longest variable name that is substituted */
+#define MAXNAME 256
+
+/* Identifies an image file, and the version of its layout */
+#define IMAGE_MAGIC 0x43485354 /* "TSHC" */
+#define IMAGE_VERSION 1
+
+/*
+ * A compiled compound command or script is an image: one block of memory
+ * that refers to its own parts by offset from its start, never by pointer,
+ * so that it can be written to a file as is and run straight from a
+ * mapping of it. Offset 0 is the header, and stands for "none" elsewhere.
+ */
+
+// Struct used to store the header of an image
+struct image_header {
+    uint32_t magic;      // IMAGE_MAGIC
+    uint32_t version;    // IMAGE_VERSION
+    uint64_t size;       // Size of the image, header included
+    uint64_t exe_size;   // Size of the tsh binary that compiled it
+    int64_t exe_mtime;   // Its modification time, in nanoseconds
+    uint64_t src_size;   // Size of the script it was compiled from
+    int64_t src_mtime;   // Its modification time, in nanoseconds
+    uint64_t src_hash;   // Hash of its contents
+    uint32_t path;       // Offset of its path
+    uint32_t root;       // Offset of the first statement
+};
+
+// Struct used to store an argument of a command in an image
+struct image_arg {
+    uint32_t text;   // Offset of the argument, possibly with variables
+    uint8_t quoted;  // Whether it was quoted
+    uint8_t vars;    // Whether it has variables to substitute
+    uint8_t pad[2];  // Unused
+};
+
+// Struct used to store a command in an image, split into arguments
+struct image_cmd {
+    uint32_t text;           // Offset of the command as written
+    int32_t result;          // Foreground, background or empty
+    int32_t builtin;         // Builtin named by the first argument
+    uint32_t argc;           // Number of arguments
+    uint32_t infile;         // Offset of the input file, or 0
+    uint32_t outfile;        // Offset of the output file, or 0
+    uint8_t subst;           // Whether anything has variables
+    uint8_t in_vars;         // Whether the input file has variables
+    uint8_t out_vars;        // Whether the output file has variables
+    uint8_t pad;             // Unused
+    struct image_arg args[]; // The arguments
+};
+
+// Kinds of statements
+typedef enum node_kind {
+    N_COMMAND,  // A command
+    N_FOR,      // for NAME in WORD ...; do BODY; done
+    N_WHILE,    // while COND; do BODY; done
+    N_UNTIL,    // until COND; do BODY; done
+    N_IF,       // if COND; then BODY; else ORELSE; fi
+    N_BREAK,    // break
+    N_CONTINUE  // continue
+} node_kind;
+
+// Struct used to store a statement in an image, in a list of statements
+struct image_node {
+    uint32_t kind;   // Kind of statement (node_kind)
+    uint32_t cmd;    // Offset of the command, condition or list of words
+    uint32_t var;    // Offset of the variable set by `for`
+    uint32_t body;   // Offset of the loop body, or `then` branch
+    uint32_t orelse; // Offset of the `else` branch (an N_IF for `elif`)
+    uint32_t next;   // Offset of the next statement in the list
+};
+
+// How a list of statements ended
+typedef enum flow {
+    FLOW_NEXT,     // Ran to its end
+    FLOW_BREAK,    // Hit `break`
+    FLOW_CONTINUE, // Hit `continue`
+    FLOW_STOP      // Interrupted
+} flow;
+
+// Struct used to store the state of the compiler
+struct parser {
+    char **segs;   // Statements, split at newlines and ';'
+    size_t nsegs;  // Number of statements
+    size_t i;      // Next statement to parse
+    bool error;    // A syntax error was reported
+    char *image;   // Image being built
+    size_t len;    // Bytes used in `image`
+    size_t cap;    // Bytes allocated for `image`
+};
+
+/* Access to the parts of an image */
+#define AT(base, off, type) ((type *)((base) + (off)))
+
+/* Static variables */
+static volatile sig_atomic_t interrupted; // Set by Ctrl-C
+static char *block = NULL;                // Lines of a pending command
+static size_t blocklen = 0;               // Length of `block`
+static size_t blockcap = 0;               // Bytes allocated for `block`
+static int depth = 0;                     // Nesting depth of `block`
+
+/*
+ * script_interrupt - Stop the compound command being run
+ * Async-signal-safe
+ */
+void script_interrupt(void) {
+    interrupted = 1;
+}
+
+/*
+ * subst - Substitute variables into `buf`; single quotes only count if
+ * `quotes` is set
+ */
+static void subst(const char *text, char *buf, size_t size, bool quotes) {
+    char quote = '\0';
+    size_t len = 0;
+
+    if (size == 0) {
+        return;
+    }
+    for (const char *p = text; *p != '\0' && len < size - 1; p++) {
+        char name[MAXNAME];
+        char code[16];
+        const char *value = NULL;
+        size_t n = 0;
+
+        if (quotes && (*p == '\'' || *p == '"') &&
+            (quote == '\0' || quote == *p)) {
+            quote = quote == '\0' ? *p : '\0';
+        } else if (p[0] == '$' && quote != '\'') {
+            const char *end = p + 1;
+            if (p[1] == '?') {
+                snprintf(code, sizeof(code), "%d", (int)last_status);
+                value = code;
+                end = p + 2;
+            } else if (p[1] == '{') {
+                const char *close = strchr(p + 2, '}');
+                n = close != NULL ? (size_t)(close - (p + 2)) : 0;
+                end = close != NULL ? close + 1 : end;
+            } else {
+                while (*end == '_' || (*end >= 'a' && *end <= 'z') ||
+                       (*end >= 'A' && *end <= 'Z') ||
+                       (end > p + 1 && *end >= '0' && *end <= '9')) {
+                    end++;
+                }
+                n = (size_t)(end - (p + 1));
+            }
+            if (value == NULL && n > 0 && n < MAXNAME) {
+                memcpy(name, p[1] == '{' ? p + 2 : p + 1, n);
+                name[n] = '\0';
+                value = env_get(name);
+                value = value != NULL ? value : "";
+            }
+            if (value != NULL) {
+                size_t vlen = strlen(value);
+                if (vlen > size - 1 - len) {
+                    vlen = size - 1 - len;
+                }
+                memcpy(buf + len, value, vlen);
+                len += vlen;
+                p = end - 1;
+                continue;
+            }
+        }
+        buf[len++] = *p;
+    }
+    buf[len] = '\0';
+}
+
+/*
+ * script_subst - Substitute variables outside single quotes
+ */
+const char *script_subst(const char *text, char *buf, size_t size) {
+    if (strchr(text, '$') == NULL) {
+        return text;
+    }
+    subst(text, buf, size, true);
+    return buf;
+}
+
+/*
+ * first_word - Copy the first word of a statement, if it is unquoted
+ */
+static void first_word(const char *seg, char *word, size_t size) {
+    size_t len = strcspn(seg, " \t\r");
+    if (len >= size || seg[0] == '\'' || seg[0] == '"') {
+        len = 0;
+    }
+    memcpy(word, seg, len);
+    word[len] = '\0';
+}
+
+/*
+ * add_seg - Add a trimmed statement to a list, splitting off a leading
+ * `do`, `then` or `else`; returns false if out of memory
+ */
+static bool add_seg(char ***segs, size_t *nsegs, const char *start,
+                    size_t len) {
+    char word[8];
+    while (len > 0 && strchr(" \t\r", start[0]) != NULL) {
+        start++;
+        len--;
+    }
+    while (len > 0 && strchr(" \t\r", start[len - 1]) != NULL) {
+        len--;
+    }
+    if (len == 0) {
+        return true;
+    }
+
+    char *seg = strndup(start, len);
+    char **newsegs = realloc(*segs, (*nsegs + 1) * sizeof(**segs));
+    if (seg == NULL || newsegs == NULL) {
+        free(seg);
+        if (newsegs != NULL) {
+            *segs = newsegs;
+        }
+        return false;
+    }
+    *segs = newsegs;
+    first_word(seg, word, sizeof(word));
+    if ((strcmp(word, "do") == 0 || strcmp(word, "then") == 0 ||
+         strcmp(word, "else") == 0) &&
+        seg[strlen(word)] != '\0') {
+        size_t wlen = strlen(word);
+        seg[wlen] = '\0';
+        (*segs)[(*nsegs)++] = seg;
+        return add_seg(segs, nsegs, start + wlen, len - wlen);
+    }
+    (*segs)[(*nsegs)++] = seg;
+    return true;
+}
+
+/*
+ * split - Split text into statements at newlines and ';' outside quotes
+ */
+static char **split(const char *text, size_t *nsegs) {
+    char **segs = NULL;
+    const char *start = text;
+    char quote = '\0';
+
+    *nsegs = 0;
+    for (const char *p = text;; p++) {
+        if (quote != '\0') {
+            quote = *p == quote ? '\0' : quote;
+            if (*p != '\0') {
+                continue;
+            }
+        } else if (*p == '\'' || *p == '"') {
+            quote = *p;
+            continue;
+        }
+        if (*p == '\0' || *p == '\n' || *p == ';') {
+            if (!add_seg(&segs, nsegs, start, (size_t)(p - start))) {
+                perror("script");
+            }
+            start = p + 1;
+        }
+        if (*p == '\0') {
+            break;
+        }
+    }
+    return segs;
+}
+
+/*
+ * free_segs - Free a list of statements
+ */
+static void free_segs(char **segs, size_t nsegs) {
+    for (size_t i = 0; i < nsegs; i++) {
+        free(segs[i]);
+    }
+    free(segs);
+}
+
+/*
+ * syntax_error - Report a syntax error, once
+ */
+static void syntax_error(struct parser *ps, const char *what) {
+    if (!ps->error) {
+        printf("syntax error: %s\n", what);
+        ps->error = true;
+    }
+}
+
+/*
+ * alloc - Allocate zeroed space in the image being built, aligned to
+ * `align` (a power of 2); returns its offset, or 0 if out of memory
+ */
+static uint32_t alloc(struct parser *ps, size_t size, size_t align) {
+    size_t off = (ps->len + align - 1) & ~(align - 1);
+    if (ps->error) {
+        return 0;
+    }
+    if (off + size > ps->cap) {
+        size_t newcap = 2 * ps->cap + size + 4096;
+        char *newimage = newcap <= UINT32_MAX ? realloc(ps->image, newcap)
+                                              : NULL;
+        if (newimage == NULL) {
+            syntax_error(ps, "out of memory");
+            return 0;
+        }
+        ps->image = newimage;
+        ps->cap = newcap;
+    }
+    memset(ps->image + ps->len, 0, off + size - ps->len);
+    ps->len = off + size;
+    return (uint32_t)off;
+}
+
+/*
+ * add_string - Copy a string into the image being built
+ */
+static uint32_t add_string(struct parser *ps, const char *s) {
+    size_t len = strlen(s) + 1;
+    uint32_t off = alloc(ps, len, 1);
+    if (off != 0) {
+        memcpy(ps->image + off, s, len);
+    }
+    return off;
+}
+
+/*
+ * has_vars - Whether text refers to a variable
+ */
+static bool has_vars(const char *text) {
+    return text != NULL && strchr(text, '$') != NULL;
+}
+
+/*
+ * compile_command - Split a command into argument templates, in the image
+ */
+static uint32_t compile_command(struct parser *ps, const char *text) {
+    struct cmdline_tokens token;
+    uint32_t strings[MAXARGS];
+    uint32_t textoff, in = 0, out = 0;
+    parseline_return result = parseline(text, &token);
+
+    if (result == PARSELINE_ERROR) {
+        syntax_error(ps, text);
+        return 0;
+    }
+    if (result == PARSELINE_EMPTY) {
+        token.argc = 0;
+        token.infile = token.outfile = NULL;
+    }
+    // Strings first: the image may move while they are added
+    textoff = add_string(ps, text);
+    for (int i = 0; i < token.argc; i++) {
+        strings[i] = add_string(ps, token.argv[i]);
+    }
+    if (token.infile != NULL) {
+        in = add_string(ps, token.infile);
+    }
+    if (token.outfile != NULL) {
+        out = add_string(ps, token.outfile);
+    }
+    uint32_t off = alloc(ps,
+                         sizeof(struct image_cmd) +
+                             token.argc * sizeof(struct image_arg),
+                         sizeof(uint32_t));
+    if (off == 0) {
+        return 0;
+    }
+
+    struct image_cmd *cmd = AT(ps->image, off, struct image_cmd);
+    cmd->text = textoff;
+    cmd->result = result;
+    cmd->builtin = token.builtin;
+    cmd->argc = token.argc;
+    cmd->infile = in;
+    cmd->outfile = out;
+    for (int i = 0; i < token.argc; i++) {
+        // parseline leaves the opening quote right before the argument
+        bool single = token.quoted[i] && token.argv[i][-1] == '\'';
+        cmd->args[i].text = strings[i];
+        cmd->args[i].quoted = token.quoted[i];
+        cmd->args[i].vars = !single && has_vars(token.argv[i]);
+        cmd->subst = cmd->subst || cmd->args[i].vars;
+    }
+    cmd->in_vars = has_vars(token.infile);
+    cmd->out_vars = has_vars(token.outfile);
+    cmd->subst = cmd->subst || cmd->in_vars || cmd->out_vars;
+    return off;
+}
+
+/*
+ * append - Append a word to a command's text, quoted if need be
+ */
+static void append(char *text, size_t *len, const char *word, bool quoted) {
+    size_t wlen = strlen(word);
+    char quote = strchr(word, '"') != NULL ? '\'' : '"';
+    bool quote_it = quoted || wlen == 0 || strpbrk(word, " \t") != NULL;
+
+    if (*len + wlen + 4 > MAXLINE_TSH) {
+        return;
+    }
+    if (*len > 0) {
+        text[(*len)++] = ' ';
+    }
+    if (quote_it) {
+        text[(*len)++] = quote;
+    }
+    memcpy(text + *len, word, wlen);
+    *len += wlen;
+    if (quote_it) {
+        text[(*len)++] = quote;
+    }
+    text[*len] = '\0';
+}
+
+/*
+ * subst_arg - Substitute variables into the free part of `t->_buf`; once
+ * it is full, what does not fit is cut short, down to the empty string
+ */
+static char *subst_arg(const char *text, struct cmdline_tokens *t,
+                       size_t *used) {
+    // The last byte is kept for the NUL of the last argument that fits
+    char *out = t->_buf + *used;
+    subst(text, out, sizeof(t->_buf) - *used, false);
+    *used += strlen(out) + 1;
+    if (*used > sizeof(t->_buf) - 1) {
+        *used = sizeof(t->_buf) - 1;
+    }
+    return out;
+}
+
+/*
+ * instantiate - Point `t` at the arguments of a command, substituting
+ * those with variables into `t->_buf`; returns its text, rebuilt into
+ * `text` if anything was substituted
+ */
+static const char *instantiate(char *base, const struct image_cmd *cmd,
+                               struct cmdline_tokens *t, char *text) {
+    size_t used = 0;
+    int argc = 0;
+
+    // Arguments without variables are used in place, from the image
+    t->infile = cmd->infile != 0 ? base + cmd->infile : NULL;
+    t->outfile = cmd->outfile != 0 ? base + cmd->outfile : NULL;
+    t->builtin = cmd->builtin;
+    for (uint32_t i = 0; i < cmd->argc; i++) {
+        const struct image_arg *arg = &cmd->args[i];
+        if (!arg->vars) {
+            t->argv[argc] = base + arg->text;
+            t->quoted[argc++] = arg->quoted;
+            continue;
+        }
+        char *out = subst_arg(base + arg->text, t, &used);
+        // An unquoted argument that comes out empty disappears
+        if (*out != '\0' || arg->quoted) {
+            t->argv[argc] = out;
+            t->quoted[argc++] = arg->quoted;
+        }
+    }
+    t->argv[argc] = NULL;
+    t->argc = argc;
+    if (!cmd->subst) {
+        return base + cmd->text;
+    }
+    if (cmd->in_vars) {
+        t->infile = subst_arg(base + cmd->infile, t, &used);
+    }
+    if (cmd->out_vars) {
+        t->outfile = subst_arg(base + cmd->outfile, t, &used);
+    }
+
+    // The text as it will be listed, and reparsed by builtins such as
+    // `after`; rebuilt from the arguments rather than substituted again
+    size_t len = 0;
+    text[0] = '\0';
+    for (int i = 0; i < argc; i++) {
+        append(text, &len, t->argv[i], t->quoted[i]);
+    }
+    if (t->infile != NULL) {
+        append(text, &len, "<", false);
+        append(text, &len, t->infile, false);
+    }
+    if (t->outfile != NULL) {
+        append(text, &len, ">", false);
+        append(text, &len, t->outfile, false);
+    }
+    if (cmd->result == PARSELINE_BG) {
+        append(text, &len, "&", false);
+    }
+
+    if (argc > 0 && cmd->args[0].vars) {
+        // The command's name came from a variable; it may be a builtin
+        struct cmdline_tokens probe;
+        t->builtin = parseline(t->argv[0], &probe) == PARSELINE_EMPTY
+                         ? BUILTIN_NONE
+                         : probe.builtin;
+    }
+    return text;
+}
+
+/*
+ * run_command - Run a compiled command, substituting its variables
+ */
+static flow run_command(char *base, uint32_t off) {
+    const struct image_cmd *cmd = AT(base, off, struct image_cmd);
+    struct cmdline_tokens t;
+    char text[MAXLINE_TSH];
+
+    if (interrupted) {
+        return FLOW_STOP;
+    }
+    const char *cmdline = instantiate(base, cmd, &t, text);
+    if (t.argc > 0) {
+        eval_tokens(&t, cmdline, cmd->result);
+    }
+    // Like a shell's, a loop ends when Ctrl-C kills its foreground job
+    return interrupted || last_status == 128 + SIGINT ? FLOW_STOP : FLOW_NEXT;
+}
+
+static flow run_nodes(char *base, uint32_t off);
+
+/*
+ * run_for - Run the body of a `for` loop for each of its words
+ */
+static flow run_for(char *base, const struct image_node *n) {
+    struct cmdline_tokens t;
+    char text[MAXLINE_TSH];
+    flow f = FLOW_NEXT;
+
+    instantiate(base, AT(base, n->cmd, struct image_cmd), &t, text);
+    char **words = glob_expand(&t);
+    char **argv = words != NULL ? words : t.argv;
+    for (int i = 0; argv[i] != NULL; i++) {
+        if (interrupted) {
+            f = FLOW_STOP;
+            break;
+        }
+        env_set(base + n->var, argv[i]);
+        f = run_nodes(base, n->body);
+        if (f == FLOW_BREAK || f == FLOW_STOP) {
+            break;
+        }
+    }
+    glob_free(words);
+    return f == FLOW_STOP ? FLOW_STOP : FLOW_NEXT;
+}
+
+/*
+ * run_nodes - Run a list of statements
+ */
+static flow run_nodes(char *base, uint32_t off) {
+    while (off != 0) {
+        const struct image_node *n = AT(base, off, struct image_node);
+        flow f = FLOW_NEXT;
+        switch ((node_kind)n->kind) {
+        case N_COMMAND:
+            f = run_command(base, n->cmd);
+            break;
+        case N_BREAK:
+            return FLOW_BREAK;
+        case N_CONTINUE:
+            return FLOW_CONTINUE;
+        case N_IF:
+            if ((f = run_command(base, n->cmd)) == FLOW_NEXT) {
+                f = run_nodes(base, last_status == 0 ? n->body : n->orelse);
+            }
+            break;
+        case N_FOR:
+            f = run_for(base, n);
+            break;
+        case N_WHILE:
+        case N_UNTIL:
+            while ((f = run_command(base, n->cmd)) == FLOW_NEXT &&
+                   (last_status == 0) == (n->kind == N_WHILE)) {
+                f = run_nodes(base, n->body);
+                if (f == FLOW_BREAK || f == FLOW_STOP) {
+                    break;
+                }
+            }
+            f = f == FLOW_STOP ? FLOW_STOP : FLOW_NEXT;
+            break;
+        }
+        if (f != FLOW_NEXT) {
+            return f;
+        }
+        off = n->next;
+    }
+    return FLOW_NEXT;
+}
+
+/*
+ * run_image - Run a compiled image
+ */
+static void run_image(char *base) {
+    interrupted = 0;
+    run_nodes(base, AT(base, 0, struct image_header)->root);
+}
+
+static uint32_t parse_list(struct parser *ps, const char *const *ends);
+
+/*
+ * at - Whether the next statement starts with one of some keywords
+ */
+static bool at(struct parser *ps, const char *const *words) {
+    char word[16];
+    if (ps->i >= ps->nsegs) {
+        return false;
+    }
+    first_word(ps->segs[ps->i], word, sizeof(word));
+    for (; *words != NULL; words++) {
+        if (strcmp(word, *words) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * expect - Consume a statement that must be a lone keyword
+ */
+static bool expect(struct parser *ps, const char *keyword) {
+    const char *words[] = {keyword, NULL};
+    char msg[64];
+    if (ps->i < ps->nsegs && at(ps, words) &&
+        strcmp(ps->segs[ps->i], keyword) == 0) {
+        ps->i++;
+        return true;
+    }
+    snprintf(msg, sizeof(msg), "expected `%s'", keyword);
+    syntax_error(ps, msg);
+    return false;
+}
+
+/*
+ * rest - The text of a statement after its first word
+ */
+static const char *rest(const char *seg) {
+    seg += strcspn(seg, " \t\r");
+    return seg + strspn(seg, " \t\r");
+}
+
+/*
+ * new_node - Add a statement to the image being built
+ */
+static uint32_t new_node(struct parser *ps, node_kind kind) {
+    uint32_t off = alloc(ps, sizeof(struct image_node), sizeof(uint32_t));
+    if (off != 0) {
+        AT(ps->image, off, struct image_node)->kind = kind;
+    }
+    return off;
+}
+
+/* Set a field of a statement; the image may have moved since it was made */
+#define NODE(ps, off) AT((ps)->image, off, struct image_node)
+
+/*
+ * parse_if - Parse an `if` or `elif` statement, up to its `fi`
+ */
+static uint32_t parse_if(struct parser *ps) {
+    static const char *const branch_ends[] = {"elif", "else", "fi", NULL};
+    static const char *const elif[] = {"elif", NULL};
+    static const char *const fi_end[] = {"fi", NULL};
+    uint32_t n = new_node(ps, N_IF);
+    uint32_t off;
+
+    off = compile_command(ps, rest(ps->segs[ps->i++]));
+    if (n == 0 || off == 0 || !expect(ps, "then")) {
+        return n;
+    }
+    NODE(ps, n)->cmd = off;
+    off = parse_list(ps, branch_ends);
+    NODE(ps, n)->body = off;
+    if (at(ps, elif)) {
+        // The `elif` shares the `fi` of the `if`
+        off = parse_if(ps);
+        NODE(ps, n)->orelse = off;
+        return n;
+    }
+    if (ps->i < ps->nsegs && strcmp(ps->segs[ps->i], "else") == 0) {
+        ps->i++;
+        off = parse_list(ps, fi_end);
+        NODE(ps, n)->orelse = off;
+    }
+    expect(ps, "fi");
+    return n;
+}
+
+/*
+ * parse_statement - Parse one statement
+ */
+static uint32_t parse_statement(struct parser *ps) {
+    static const char *const done_end[] = {"done", NULL};
+    static const char *const stray[] = {"do",   "done", "then", "else",
+                                        "elif", "fi",   NULL};
+    char word[16];
+    const char *seg = ps->segs[ps->i];
+    uint32_t n, off;
+
+    first_word(seg, word, sizeof(word));
+    if (at(ps, stray)) {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "unexpected `%s'", word);
+        syntax_error(ps, msg);
+        return 0;
+    }
+
+    if (strcmp(word, "if") == 0) {
+        return parse_if(ps);
+    }
+    if (strcmp(word, "break") == 0 || strcmp(word, "continue") == 0) {
+        ps->i++;
+        return new_node(ps, word[0] == 'b' ? N_BREAK : N_CONTINUE);
+    }
+    if (strcmp(word, "while") == 0 || strcmp(word, "until") == 0) {
+        n = new_node(ps, word[0] == 'w' ? N_WHILE : N_UNTIL);
+        off = compile_command(ps, rest(seg));
+    } else if (strcmp(word, "for") == 0) {
+        // for NAME in WORD ...
+        const char *name = rest(seg);
+        const char *in = rest(name);
+        size_t len = strcspn(name, " \t\r");
+        char var[MAXNAME];
+        if (len >= sizeof(var) || strncmp(in, "in", 2) != 0 ||
+            (in[2] != '\0' && strchr(" \t\r", in[2]) == NULL)) {
+            syntax_error(ps, "expected `for NAME in WORD ...'");
+            return 0;
+        }
+        memcpy(var, name, len);
+        var[len] = '\0';
+        if (!env_is_name(var)) {
+            syntax_error(ps, "expected `for NAME in WORD ...'");
+            return 0;
+        }
+        n = new_node(ps, N_FOR);
+        off = add_string(ps, var);
+        if (n != 0) {
+            NODE(ps, n)->var = off;
+        }
+        off = compile_command(ps, rest(in));
+    } else {
+        n = new_node(ps, N_COMMAND);
+        off = compile_command(ps, seg);
+        if (n != 0) {
+            NODE(ps, n)->cmd = off;
+        }
+        ps->i++;
+        return n;
+    }
+    ps->i++;
+
+    if (n != 0 && off != 0 && expect(ps, "do")) {
+        NODE(ps, n)->cmd = off;
+        off = parse_list(ps, done_end);
+        NODE(ps, n)->body = off;
+        expect(ps, "done");
+    }
+    return n;
+}
+
+/*
+ * parse_list - Parse statements up to one that starts with an end keyword
+ */
+static uint32_t parse_list(struct parser *ps, const char *const *ends) {
+    uint32_t head = 0;
+    uint32_t tail = 0;
+
+    while (!ps->error && ps->i < ps->nsegs && !at(ps, ends)) {
+        uint32_t n = parse_statement(ps);
+        if (n == 0) {
+            break;
+        }
+        if (tail != 0) {
+            NODE(ps, tail)->next = n;
+        } else {
+            head = n;
+        }
+        tail = n;
+    }
+    return head;
+}
+
+/*
+ * compile - Compile text into a new image, recording the path of its file
+ * if any; returns NULL on syntax errors
+ */
+static char *compile(const char *text, const char *path, size_t *size) {
+    static const char *const none[] = {NULL};
+    struct parser ps = {NULL, 0, 0, false, NULL, 0, 0};
+    uint32_t root, pathoff = 0;
+
+    ps.segs = split(text, &ps.nsegs);
+    alloc(&ps, sizeof(struct image_header), sizeof(uint64_t));
+    root = parse_list(&ps, none);
+    if (path != NULL) {
+        pathoff = add_string(&ps, path);
+    }
+    free_segs(ps.segs, ps.nsegs);
+    if (ps.error) {
+        free(ps.image);
+        return NULL;
+    }
+
+    struct image_header *h = AT(ps.image, 0, struct image_header);
+    h->magic = IMAGE_MAGIC;
+    h->version = IMAGE_VERSION;
+    h->size = ps.len;
+    h->path = pathoff;
+    h->root = root;
+    *size = ps.len;
+    return ps.image;
+}
+
+/*
+ * script_run - Compile and run a compound command
+ */
+static void script_run(const char *text) {
+    size_t size;
+    char *image = compile(text, NULL, &size);
+    if (image != NULL) {
+        run_image(image);
+        free(image);
+    }
+}
+
+/*
+ * mtime_ns - Modification time of a file, in nanoseconds
+ */
+static int64_t mtime_ns(const struct stat *st) {
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+/*
+ * cache_path - Name of the image file cached for a script; creates its
+ * directory if needed
+ */
+static bool cache_path(const char *path, char *buf, size_t size) {
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    char dir[PATH_MAX];
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    if (xdg != NULL && xdg[0] == '/') {
+        snprintf(dir, sizeof(dir), "%s", xdg);
+    } else if (home != NULL && home[0] == '/') {
+        snprintf(dir, sizeof(dir), "%s/.cache", home);
+    } else {
+        return false;
+    }
+    // Each level is made private to the user; existing ones are kept
+    mkdir(dir, 0700);
+    if ((size_t)snprintf(dir + strlen(dir), sizeof(dir) - strlen(dir),
+                         "/tsh") >= sizeof(dir) - strlen(dir) ||
+        (mkdir(dir, 0700) < 0 && errno != EEXIST)) {
+        return false;
+    }
+
+    for (const char *p = path; *p != '\0'; p++) {
+        h = (h ^ (unsigned char)*p) * 0x100000001b3ULL;
+    }
+    return (size_t)snprintf(buf, size, "%s/%016llx.tshc", dir,
+                            (unsigned long long)h) < size;
+}
+
+/*
+ * cache_load - Map the image cached for a script, if it is still the one
+ * compiled from `key`; returns NULL otherwise
+ */
+static char *cache_load(const char *cache, const struct image_header *key,
+                        const char *path, size_t *size) {
+    struct stat st;
+    int fd = open(cache, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(*key) ||
+        (uint64_t)st.st_size > UINT32_MAX) {
+        close(fd);
+        return NULL;
+    }
+    // Private, so that the image can be used in place like a compiled one
+    char *image = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                       fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        return NULL;
+    }
+
+    const struct image_header *h = AT(image, 0, struct image_header);
+    *size = st.st_size;
+    if (h->magic == IMAGE_MAGIC && h->version == IMAGE_VERSION &&
+        h->size == *size && h->exe_size == key->exe_size &&
+        h->exe_mtime == key->exe_mtime && h->src_size == key->src_size &&
+        h->src_mtime == key->src_mtime && h->src_hash == key->src_hash &&
+        h->path != 0 && h->path < *size &&
+        strncmp(image + h->path, path, *size - h->path) == 0) {
+        return image;
+    }
+    munmap(image, *size);
+    return NULL;
+}
+
+/*
+ * cache_store - Write an image to its cache file, atomically
+ */
+static void cache_store(const char *cache, const char *image, size_t size) {
+    char tmp[PATH_MAX];
+    size_t done = 0;
+
+    if ((size_t)snprintf(tmp, sizeof(tmp), "%s.%d", cache, (int)getpid()) >=
+        sizeof(tmp)) {
+        return;
+    }
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return;
+    }
+    while (done < size) {
+        ssize_t n = write(fd, image + done, size - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        done += (size_t)n;
+    }
+    if (close(fd) < 0 || done < size || rename(tmp, cache) < 0) {
+        unlink(tmp);
+    }
+}
+
+/*
+ * script_file - Run a script file, from its cached image if it is current
+ */
+bool script_file(const char *path) {
+    struct image_header key = {0};
+    struct stat st;
+    char real[PATH_MAX];
+    char cache[PATH_MAX];
+    char *text = NULL;
+    char *image = NULL;
+    size_t size = 0;
+    bool mapped = false;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) < 0 || realpath(path, real) == NULL) {
+        perror(path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+    // The source is mapped only to be hashed; it is copied if compiled
+    const char *src = "";
+    if (st.st_size > 0) {
+        src = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (src == MAP_FAILED) {
+        perror(path);
+        return false;
+    }
+
+    key.src_size = st.st_size;
+    key.src_mtime = mtime_ns(&st);
+    key.src_hash = incr_hash(INCR_HASH_SEED, src, st.st_size);
+    // An image is only good for the tsh that laid it out
+    if (stat("/proc/self/exe", &st) == 0) {
+        key.exe_size = st.st_size;
+        key.exe_mtime = mtime_ns(&st);
+    }
+
+    bool cached = cache_path(real, cache, sizeof(cache));
+    if (cached && (image = cache_load(cache, &key, real, &size)) != NULL) {
+        stats_inc(STAT_SCRIPT_CACHED);
+        mapped = true;
+    } else if ((text = malloc(key.src_size + 1)) != NULL) {
+        memcpy(text, src, key.src_size);
+        text[key.src_size] = '\0';
+        image = compile(text, real, &size);
+        free(text);
+        stats_inc(STAT_SCRIPT_COMPILED);
+    } else {
+        perror(path);
+    }
+    if (key.src_size > 0) {
+        munmap((void *)src, key.src_size);
+    }
+    if (image == NULL) {
+        return false;
+    }
+
+    if (!mapped) {
+        struct image_header *h = AT(image, 0, struct image_header);
+        h->exe_size = key.exe_size;
+        h->exe_mtime = key.exe_mtime;
+        h->src_size = key.src_size;
+        h->src_mtime = key.src_mtime;
+        h->src_hash = key.src_hash;
+        // Stored before it runs, so that a script that never ends is cached
+        if (cached) {
+            cache_store(cache, image, size);
+        }
+    }
+    run_image(image);
+    if (mapped) {
+        munmap(image, size);
+    } else {
+        free(image);
+    }
+    return true;
+}
+
+/*
+ * line_depth - Nesting depth after a line; `opens` tells whether the line
+ * starts a compound command
+ */
+static int line_depth(const char *line, int d, bool *opens) {
+    size_t nsegs;
+    char **segs = split(line, &nsegs);
+    char word[16];
+
+    for (size_t i = 0; i < nsegs; i++) {
+        first_word(segs[i], word, sizeof(word));
+        if (strcmp(word, "for") == 0 || strcmp(word, "while") == 0 ||
+            strcmp(word, "until") == 0 || strcmp(word, "if") == 0) {
+            *opens = *opens || (i == 0 && d == 0);
+            d++;
+        } else if (d == 0) {
+            // Only a line that starts with a keyword opens a command
+            break;
+        } else if (strcmp(word, "done") == 0 || strcmp(word, "fi") == 0) {
+            d--;
+        }
+    }
+    free_segs(segs, nsegs);
+    return d;
+}
+
+/*
+ * script_feed - Collect the lines of a compound command, and run it
+ */
+bool script_feed(const char *line) {
+    bool opens = false;
+    int d = line_depth(line, depth, &opens);
+    if (depth == 0 && !opens) {
+        return false;
+    }
+
+    size_t len = strlen(line);
+    if (blocklen + len + 2 > blockcap) {
+        size_t newcap = 2 * blockcap + len + 2;
+        char *newblock = realloc(block, newcap);
+        if (newblock == NULL) {
+            perror("script");
+            return true;
+        }
+        block = newblock;
+        blockcap = newcap;
+    }
+    memcpy(block + blocklen, line, len);
+    blocklen += len;
+    block[blocklen++] = '\n';
+    block[blocklen] = '\0';
+
+    if ((depth = d) == 0) {
+        blocklen = 0;
+        script_run(block);
+    }
+    return true;
+}
+
+/*
+ * script_pending - Whether a compound command is incomplete
+ */
+bool script_pending(void) {
+    return depth > 0;
+}
@@ -0,0 +1,103 @@
+/**
+ * @file tsh_script.h
+ * @brief Control flow and script files, run from a compiled image
+ *
+ * A command line whose first word is `for`, `while`, `until` or `if` starts
+ * a compound command, which may span several lines (the prompt becomes
+ * `> ` until it is complete). Statements are separated by newlines or `;`:
+ *
+ *     for NAME in WORD ...; do LIST; done
+ *     while COMMAND; do LIST; done
+ *     until COMMAND; do LIST; done
+ *     if COMMAND; then LIST; [elif COMMAND; then LIST; ...] [else LIST;] fi
+ *     break
+ *     continue
+ *
+ * The whole compound command is compiled once into an image: every command
+ * in it is split into arguments by `parseline` right then, and loop bodies
+ * run from the image without being read or tokenized again. Arguments that
+ * refer to variables are templates, substituted in place on each run: the
+ * split never changes, as if each `$NAME` were double-quoted. `for` sets
+ * NAME in the environment (see tsh_env.h) for each word of its list, after
+ * the list has been substituted and glob-expanded.
+ *
+ * The condition of `while`, `until`, `if` and `elif` is a single command;
+ * it is true if its exit code (`$?`) is 0. A foreground job killed by
+ * Ctrl-C, or Ctrl-C between commands, stops the whole compound command.
+ *
+ * A script file (`tsh -f FILE`) is compiled the same way, as a whole: its
+ * plain commands are split once as well, and their variables substituted
+ * when they run. The image refers to its parts by offset only, so it is
+ * also written to `${XDG_CACHE_HOME:-$HOME/.cache}/tsh/`, keyed by the
+ * script's absolute path. The next run maps that file and runs from it
+ * without parsing or copying anything, as long as the script's size,
+ * modification time and contents hash, and the tsh binary, are unchanged;
+ * otherwise the script is compiled again and the cache replaced.
+ *
+ * Variables are also substituted on plain command lines: `$NAME`, `${NAME}`
+ * and `$?` are replaced outside single quotes, with the empty string if
+ * NAME is not set.
+ */
+
+#ifndef TSH_SCRIPT_H
+#define TSH_SCRIPT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief Feeds a line read at the prompt to the compound command being
+ *        collected, if any.
+ *
+ * A line that starts a compound command, or that follows one that is not
+ * complete yet, is kept; once the compound command is complete, it is
+ * compiled and run.
+ *
+ * @param[in] line  The line, without its newline.
+ *
+ * @return true if the line was taken, false if it is a plain command line
+ *         to be passed to `eval`
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool script_feed(const char *line);
+
+/**
+ * @brief Returns whether a compound command is being collected, i.e.
+ *        whether more lines are needed to complete it.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool script_pending(void);
+
+/**
+ * @brief Runs a script file, from its cached image if it is current.
+ *
+ * @param[in] path  The script.
+ *
+ * @return false if the script could not be read or has a syntax error,
+ *         true once it has run; its exit code is then `$?`
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool script_file(const char *path);
+
+/**
+ * @brief Stops the compound command being run, before its next command.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void script_interrupt(void);
+
+/**
+ * @brief Substitutes `$NAME`, `${NAME}` and `$?` outside single quotes.
+ *
+ * @param[in]  text  The text.
+ * @param[out] buf   Where to store the result, which is truncated to fit.
+ * @param[in]  size  The size of `buf`.
+ *
+ * @return `text` itself if it has nothing to substitute, or else `buf`
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+const char *script_subst(const char *text, char *buf, size_t size);
+
+#endif /* TSH_SCRIPT_H */
@@ -0,0 +1,442 @@
+/**
+ * @file tsh_serve.c
+ * @brief Job-submission server mode.
+ *
+ * For documentation related to usage, see the corresponding header file at
+ * tsh_serve.h.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "csapp.h"
+#include "tsh.h"
+#include "tsh_helper.h"
+#include "tsh_loop.h"
+#include "tsh_serve.h"
+#include "tsh_stats.h"
+
+#define MAX_CLIENT_OUT (1 << 20) // Most reply bytes queued for a client
+
+// Struct used to store one client connection
+struct client {
+    int fd;                   // Connected socket
+    char in[MAXLINE_TSH];     // Partial request line
+    size_t inlen;             // Bytes used in `in`
+    bool discarding;          // Skipping the rest of an overlong line
+    char *out;                // Pending reply bytes
+    size_t outlen;            // Bytes used in `out`
+    size_t outcap;            // Capacity of `out`
+    bool watching;            // Wants exit notifications
+    bool closing;             // Close once `out` is flushed
+    bool overrun;             // Stopped reading; `out` was dropped
+    struct client *next;      // Next client in the client list
+};
+
+/* Static variables */
+static struct client *clients = NULL; // All connected clients
+static int max_jobs = MAXJOBS;        // Limit on concurrent jobs
+
+/*
+ * client_flush - Write as much pending output as the socket accepts
+ * Not async-signal-safe
+ */
+static void client_flush(struct client *c) {
+    size_t off = 0;
+    while (off < c->outlen) {
+        ssize_t n = send(c->fd, c->out + off, c->outlen - off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                // Peer is gone; drop whatever is left
+                c->closing = true;
+                off = c->outlen;
+            }
+            break;
+        }
+        off += (size_t)n;
+    }
+    memmove(c->out, c->out + off, c->outlen - off);
+    c->outlen -= off;
+    loop_modify(c->fd, c->outlen ? EPOLLIN | EPOLLOUT : EPOLLIN);
+}
+
+/*
+ * client_printf - Queue formatted output for a client
+ * Not async-signal-safe
+ */
+static void client_printf(struct client *c, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void client_printf(struct client *c, const char *fmt, ...) {
+    va_list argp;
+    if (c->overrun) {
+        return;
+    }
+    va_start(argp, fmt);
+    int len = vsnprintf(NULL, 0, fmt, argp);
+    va_end(argp);
+    if (len < 0) {
+        return;
+    }
+
+    // A client that does not read its replies, e.g. a stuck watcher, is
+    // disconnected rather than buffered for without bound
+    if (c->outlen + (size_t)len > MAX_CLIENT_OUT) {
+        if (verbose) {
+            fprintf(stderr, "serve: dropping client %d, %zu bytes unread\n",
+                    c->fd, c->outlen);
+        }
+        c->overrun = true;
+        c->closing = true;
+        c->outlen = 0;
+        return;
+    }
+
+    if (c->outlen + (size_t)len + 1 > c->outcap) {
+        size_t cap = c->outcap ? c->outcap : 256;
+        while (c->outlen + (size_t)len + 1 > cap) {
+            cap *= 2;
+        }
+        char *out = realloc(c->out, cap);
+        if (out == NULL) {
+            c->closing = true;
+            return;
+        }
+        c->out = out;
+        c->outcap = cap;
+    }
+
+    va_start(argp, fmt);
+    vsnprintf(c->out + c->outlen, (size_t)len + 1, fmt, argp);
+    va_end(argp);
+    c->outlen += (size_t)len;
+}
+
+/*
+ * client_close - Unregister, close and free a client
+ * Not async-signal-safe
+ */
+static void client_close(struct client *c) {
+    for (struct client **pp = &clients; *pp != NULL; pp = &(*pp)->next) {
+        if (*pp == c) {
+            *pp = c->next;
+            break;
+        }
+    }
+    loop_remove(c->fd);
+    close(c->fd);
+    free(c->out);
+    free(c);
+}
+
+/*
+ * state_name - Protocol name of a job state
+ */
+static const char *state_name(job_state state) {
+    switch (state) {
+    case FG:
+        return "Foreground";
+    case BG:
+        return "Running";
+    case ST:
+        return "Stopped";
+    case WT:
+        return "Waiting";
+    default:
+        return "Undefined";
+    }
+}
+
+/*
+ * report_job - Queue a "job" line for one job
+ * Requires signals to be blocked
+ */
+static void report_job(struct client *c, jid_t jid) {
+    client_printf(c, "job %d %d %s %s\n", jid, job_get_pid(jid),
+                  state_name(job_get_state(jid)), job_get_cmdline(jid));
+}
+
+/*
+ * count_jobs - Number of jobs in the job list
+ */
+static int count_jobs(void) {
+    sigset_t mask_all, mask_prev;
+    int n = 0;
+
+    sigfillset(&mask_all);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+    for (jid_t jid = 1; jid <= MAXJOBS; jid++) {
+        if (job_exists(jid)) {
+            n++;
+        }
+    }
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+    return n;
+}
+
+/*
+ * do_run - Handle "run CMDLINE"
+ */
+static void do_run(struct client *c, const char *cmdline) {
+    struct cmdline_tokens token;
+    parseline_return parse_result = parseline(cmdline, &token);
+
+    if (parse_result == PARSELINE_ERROR) {
+        client_printf(c, "err parse error\n");
+        return;
+    }
+    if (parse_result == PARSELINE_EMPTY) {
+        client_printf(c, "err empty command\n");
+        return;
+    }
+    if (token.builtin != BUILTIN_NONE) {
+        client_printf(c, "err builtins cannot be submitted\n");
+        return;
+    }
+
+    if (count_jobs() >= max_jobs) {
+        client_printf(c, "err busy\n");
+        return;
+    }
+
+    // Submitted jobs always run in the background: a foreground job
+    // would stall every other client
+    stats_inc(STAT_EVAL);
+    jid_t jid = launch_job(&token, cmdline, BG);
+    if (jid == 0) {
+        client_printf(c, "err could not start job\n");
+    } else {
+        client_printf(c, "ok %d\n", jid);
+    }
+}
+
+/*
+ * do_status - Handle "status [JID]"
+ */
+static void do_status(struct client *c, const char *arg) {
+    sigset_t mask_all, mask_prev;
+    sigfillset(&mask_all);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+
+    if (*arg != '\0') {
+        jid_t jid = atoi(arg[0] == '%' ? arg + 1 : arg);
+        if (job_exists(jid)) {
+            report_job(c, jid);
+        }
+    } else {
+        for (jid_t jid = 1; jid <= MAXJOBS; jid++) {
+            if (job_exists(jid)) {
+                report_job(c, jid);
+            }
+        }
+    }
+    client_printf(c, "end\n");
+
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+}
+
+/*
+ * handle_request - Execute one request line from a client
+ */
+static void handle_request(struct client *c, char *line) {
+    char *arg = line + strcspn(line, " \t");
+    if (*arg != '\0') {
+        *arg++ = '\0';
+        arg += strspn(arg, " \t");
+    }
+
+    if (strcmp(line, "hello") == 0) {
+        client_printf(c, "ok slots %d\n", max_jobs);
+    } else if (strcmp(line, "run") == 0) {
+        do_run(c, arg);
+    } else if (strcmp(line, "status") == 0) {
+        do_status(c, arg);
+    } else if (strcmp(line, "watch") == 0) {
+        c->watching = true;
+        client_printf(c, "ok watching\n");
+    } else if (strcmp(line, "quit") == 0) {
+        c->closing = true;
+    } else if (*line != '\0') {
+        client_printf(c, "err unknown request %s\n", line);
+    }
+}
+
+/*
+ * client_ready - Read requests from a client and flush replies
+ */
+static void client_ready(int fd, uint32_t events, void *arg) {
+    struct client *c = arg;
+
+    if (events & EPOLLIN) {
+        ssize_t n;
+        char buf[4096];
+        while ((n = read(fd, buf, sizeof(buf))) > 0) {
+            for (ssize_t i = 0; i < n; i++) {
+                if (buf[i] == '\n') {
+                    c->in[c->inlen] = '\0';
+                    if (c->discarding) {
+                        client_printf(c, "err line too long\n");
+                    } else {
+                        if (c->inlen > 0 && c->in[c->inlen - 1] == '\r') {
+                            c->in[c->inlen - 1] = '\0';
+                        }
+                        handle_request(c, c->in);
+                    }
+                    c->inlen = 0;
+                    c->discarding = false;
+                } else if (c->inlen < MAXLINE_TSH - 1) {
+                    c->in[c->inlen++] = buf[i];
+                } else {
+                    c->discarding = true;
+                }
+            }
+        }
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+                       errno != EINTR)) {
+            c->closing = true;
+        }
+    }
+
+    client_flush(c);
+    if (c->closing && (c->outlen == 0 || (events & (EPOLLERR | EPOLLHUP)))) {
+        client_close(c);
+    }
+}
+
+/*
+ * accept_ready - Accept all pending connections
+ */
+static void accept_ready(int fd, uint32_t events, void *arg) {
+    int connfd;
+    while ((connfd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >=
+           0) {
+        struct client *c = calloc(1, sizeof(*c));
+        if (c == NULL) {
+            close(connfd);
+            continue;
+        }
+        c->fd = connfd;
+        if (!loop_add(connfd, EPOLLIN, client_ready, c)) {
+            perror("loop_add");
+            close(connfd);
+            free(c);
+            continue;
+        }
+        c->next = clients;
+        clients = c;
+    }
+}
+
+/*
+ * notify_watchers - Forward a child event to every watching client
+ */
+static void notify_watchers(const struct child_event *event, void *arg) {
+    for (struct client *c = clients, *next; c != NULL; c = next) {
+        next = c->next;
+        if (!c->watching) {
+            continue;
+        }
+        if (WIFEXITED(event->status)) {
+            client_printf(c, "exit %d %d %d\n", event->jid, event->pid,
+                          WEXITSTATUS(event->status));
+        } else if (WIFSIGNALED(event->status)) {
+            client_printf(c, "signal %d %d %d\n", event->jid, event->pid,
+                          WTERMSIG(event->status));
+        } else if (WIFSTOPPED(event->status)) {
+            client_printf(c, "stopped %d %d %d\n", event->jid, event->pid,
+                          WSTOPSIG(event->status));
+        }
+        client_flush(c);
+        if (c->closing && c->outlen == 0) {
+            client_close(c);
+        }
+    }
+}
+
+/*
+ * serve_set_max_jobs - Limit concurrent jobs
+ */
+void serve_set_max_jobs(int n) {
+    max_jobs = n;
+}
+
+/*
+ * open_spec_listenfd - Listen on PORT (loopback only) or HOST:PORT, where
+ * HOST may be a bracketed IPv6 address
+ */
+static int open_spec_listenfd(const char *spec) {
+    char host[MAXLINE];
+    const char *colon = strrchr(spec, ':');
+
+    // Anyone who can connect can run commands: never listen on every
+    // interface unless asked to
+    if (colon == NULL) {
+        return open_host_listenfd(NULL, spec);
+    }
+    size_t len = (size_t)(colon - spec);
+    if (len >= 2 && spec[0] == '[' && spec[len - 1] == ']') {
+        spec++;
+        len -= 2;
+    }
+    if (len == 0 || len >= sizeof(host)) {
+        fprintf(stderr, "serve: invalid address %s\n", spec);
+        return -2;
+    }
+    memcpy(host, spec, len);
+    host[len] = '\0';
+    return open_host_listenfd(host, colon + 1);
+}
+
+/*
+ * serve_run - Accept clients and serve requests forever
+ */
+void serve_run(const char *spec) {
+    int listenfd;
+
+    if (!loop_init()) {
+        perror("loop_init");
+        exit(1);
+    }
+
+    if (strncmp(spec, "unix:", 5) == 0) {
+        listenfd = open_unix_listenfd(spec + 5);
+    } else {
+        listenfd = open_spec_listenfd(spec);
+    }
+    if (listenfd < 0) {
+        if (listenfd == -1) {
+            perror(spec);
+        }
+        exit(1);
+    }
+    fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL) | O_NONBLOCK);
+    fcntl(listenfd, F_SETFD, FD_CLOEXEC);
+
+    if (!loop_add(listenfd, EPOLLIN, accept_ready, NULL) ||
+        !loop_on_child(notify_watchers, NULL)) {
+        perror("loop_add");
+        exit(1);
+    }
+
+    if (verbose) {
+        fprintf(stderr, "serve: listening on %s\n", spec);
+    }
+    while (true) {
+        loop_run_once(-1);
+    }
+}
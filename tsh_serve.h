@@ -0,0 +1,60 @@
+/**
+ * @file tsh_serve.h
+ * @brief Job-submission server mode
+ *
+ * With `--serve PORT`, `--serve HOST:PORT` or `--serve unix:PATH` the shell
+ * does not read commands from stdin. Instead it accepts any number of
+ * concurrent clients through its event loop and speaks a line-based
+ * protocol with them:
+ *
+ *     hello           Identify the server.
+ *                     Reply: "ok slots N", where N is the job limit
+ *     run CMDLINE     Launch CMDLINE as a background job.
+ *                     Reply: "ok JID", "err busy" if the job limit set by
+ *                     `--max-jobs` is reached, or "err MESSAGE"
+ *     status [JID]    List all jobs, or one job.
+ *                     Reply: "job JID PID STATE CMDLINE" lines, then "end"
+ *     watch           Stream exit notifications to this client.
+ *                     Reply: "ok watching", then one line per event:
+ *                     "exit JID PID CODE", "signal JID PID SIG" or
+ *                     "stopped JID PID SIG"
+ *     quit            Close the connection.
+ *
+ * Submitted commands go through the same parser, launcher and job list as
+ * commands typed at the prompt. Replies are queued while a client is not
+ * reading; a client with more than 1 MiB queued, e.g. a watcher that has
+ * stopped reading, is disconnected.
+ *
+ * There is no authentication: anyone who can connect can run commands as
+ * the user running the shell. A bare PORT therefore only listens on the
+ * loopback address; listening on other interfaces (e.g. `0.0.0.0:PORT`)
+ * must be asked for explicitly, and should only be done on a trusted
+ * network. A Unix socket is protected by the permissions of its directory.
+ * `unix:PATH` replaces a stale socket at PATH, but refuses to remove any
+ * other kind of file.
+ */
+
+#ifndef TSH_SERVE_H
+#define TSH_SERVE_H
+
+/**
+ * @brief Limits the number of jobs that clients can have running at once.
+ *
+ * @param[in] max_jobs  The limit, between 1 and `MAXJOBS`.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void serve_set_max_jobs(int max_jobs);
+
+/**
+ * @brief Runs the shell as a job-submission server. Never returns.
+ *
+ * @param[in] spec  A TCP port number (on loopback), "HOST:PORT", or "unix:"
+ *                  followed by a socket path.
+ *
+ * @pre The job list must be initialized and the signal handlers installed.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void serve_run(const char *spec) __attribute__((noreturn));
+
+#endif /* TSH_SERVE_H */
@@ -0,0 +1,437 @@
+/**
+ * @file tsh_spawn.c
+ * @brief Background jobs launched by a pool of spawner threads.
+ *
+ * For documentation related to usage, see the corresponding header file at
+ * tsh_spawn.h.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "csapp.h"
+#include "tsh.h"
+#include "tsh_env.h"
+#include "tsh_loop.h"
+#include "tsh_spawn.h"
+#include "tsh_stats.h"
+#include "tsh_timeout.h"
+
+/* Search path used when PATH is not set, as by execvp */
+#define DEFAULT_PATH "/bin:/usr/bin"
+
+// Struct used to store a job to be launched by a spawner thread
+struct request {
+    struct request *next;  // Next request in its queue
+    jid_t jid;             // The job
+    unsigned long serial;  // Its serial number
+    struct capture *cap;   // Its output capture, or NULL
+    struct jobcg *cg;      // Its cgroup, or NULL
+    int out_fd;            // Capture pipe for its stdout, or -1
+    int err_fd;            // Capture pipe for its stderr, or -1
+    char **envp;           // Its environment (from env_copy)
+    const char *infile;    // Input redirection, or NULL
+    const char *outfile;   // Output redirection, or NULL
+    uint64_t start_ns;     // When it was queued
+    pid_t pid;             // Result: its PID, or 0
+    int error;             // Result: error from posix_spawn, or 0
+    int retries;           // Result: attempts retried (see fork_backoff)
+    char *argv[];          // Its arguments, followed by the strings
+};
+
+// Struct used to store a child reaped before its job knew its PID
+struct held {
+    pid_t pid;            // The child
+    pid_t pgid;           // Its process group in subreaper mode, or 0
+    int status;           // Raw status from waitpid
+    struct rusage usage;  // Resources it used
+};
+
+/* Static variables */
+static bool active = false;            // Whether spawn_init has succeeded
+static int event_fd = -1;              // Signalled when results are ready
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER; // Guards queued
+static pthread_cond_t ready = PTHREAD_COND_INITIALIZER;  // Signals queued
+static struct request *queued = NULL;  // Requests not taken by a thread
+static struct request **queued_tail = &queued; // End of `queued`
+static struct request *done = NULL;    // Results, newest first (lock-free)
+static volatile sig_atomic_t inflight; // Requests whose result is pending
+static struct held held[MAXJOBS];      // Children held for their jobs
+static int nheld = 0;                  // Number of children held
+
+/*
+ * find_program - Find a command the way execvp does, in the job's PATH
+ * Thread-safe
+ */
+static const char *find_program(const char *file, char **envp, char *buf) {
+    const char *path = DEFAULT_PATH;
+
+    if (strchr(file, '/') != NULL) {
+        return file;
+    }
+    for (char **ep = envp; *ep != NULL; ep++) {
+        if (strncmp(*ep, "PATH=", 5) == 0) {
+            path = *ep + 5;
+            break;
+        }
+    }
+    while (true) {
+        size_t len = strcspn(path, ":");
+        // An empty element stands for the current directory
+        int n = len == 0 ? snprintf(buf, PATH_MAX, "%s", file)
+                         : snprintf(buf, PATH_MAX, "%.*s/%s", (int)len, path,
+                                    file);
+        if (n < PATH_MAX && access(buf, X_OK) == 0) {
+            return buf;
+        }
+        if (path[len] == '\0') {
+            return NULL;
+        }
+        path += len + 1;
+    }
+}
+
+/*
+ * launch - Launch the job of a request, recording the result in it
+ * Thread-safe
+ */
+static void launch(struct request *req) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t none;
+    char buf[PATH_MAX];
+
+    req->pid = 0;
+    req->error = 0;
+    req->retries = 0;
+    if (req->argv[0] == NULL) {
+        // Nothing to execute after the assignments
+        return;
+    }
+    const char *program = find_program(req->argv[0], req->envp, buf);
+    if (program == NULL) {
+        req->error = ENOENT;
+        return;
+    }
+
+    // What the child does between fork and exec in run_job
+    posix_spawn_file_actions_init(&actions);
+    if (req->out_fd >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, req->out_fd, STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, req->err_fd, STDERR_FILENO);
+    }
+    if (req->infile != NULL) {
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, req->infile,
+                                         O_RDONLY, 0);
+    }
+    if (req->outfile != NULL) {
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, req->outfile,
+                                         O_WRONLY | O_TRUNC | O_CREAT,
+                                         S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    }
+    posix_spawnattr_init(&attr);
+    sigemptyset(&none);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP |
+                                        POSIX_SPAWN_SETSIGMASK);
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setsigmask(&attr, &none);
+
+    while ((req->error = posix_spawn(&req->pid, program, &actions, &attr,
+                                     req->argv, req->envp)) != 0 &&
+           fork_backoff(req->error, req->retries)) {
+        req->retries++;
+    }
+    if (req->error == 0) {
+        cgroup_enter(req->cg, req->pid);
+    } else {
+        req->pid = 0;
+    }
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+}
+
+/*
+ * spawner - Spawner thread: launch queued jobs, and push their results
+ * Thread-safe; runs with all signals blocked
+ */
+static void *spawner(void *arg) {
+    while (true) {
+        pthread_mutex_lock(&lock);
+        while (queued == NULL) {
+            pthread_cond_wait(&ready, &lock);
+        }
+        struct request *req = queued;
+        if ((queued = req->next) == NULL) {
+            queued_tail = &queued;
+        }
+        pthread_mutex_unlock(&lock);
+
+        launch(req);
+
+        // The main program takes all the results at once, so there is no
+        // ABA problem; only the first result of a batch needs to wake it
+        struct request *head = __atomic_load_n(&done, __ATOMIC_RELAXED);
+        do {
+            req->next = head;
+        } while (!__atomic_compare_exchange_n(&done, &head, req, true,
+                                              __ATOMIC_RELEASE,
+                                              __ATOMIC_RELAXED));
+        if (head == NULL) {
+            uint64_t one = 1;
+            ssize_t ret = write(event_fd, &one, sizeof(one));
+            (void)ret;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * release - Hand held children over to sigchld_handler's usual path: the
+ * one with a given PID, or all of them if `pid` is 0
+ * Signals must be blocked
+ */
+static void release(pid_t pid) {
+    for (int i = 0; i < nheld;) {
+        if (pid != 0 && held[i].pid != pid) {
+            i++;
+            continue;
+        }
+        struct held h = held[i];
+        held[i] = held[--nheld];
+        child_reaped(h.pid, h.pgid, h.status, &h.usage);
+    }
+}
+
+/*
+ * finish - Bring the result of a request into the job list
+ * Signals must be blocked
+ */
+static void finish(struct request *req) {
+    jid_t jid = req->jid;
+
+    inflight--;
+    stats_add(STAT_FORK_RETRY, req->retries);
+    if (!job_exists(jid) || job_get_serial(jid) != req->serial ||
+        job_get_state(jid) != WT) {
+        // The job was dropped meanwhile (e.g. by `supervise --stop`)
+        if (req->pid > 0) {
+            kill(-req->pid, SIGTERM);
+        }
+        output_attach(req->cap, 0);
+        cgroup_attach(req->cg, 0, 0);
+        return;
+    }
+
+    if (req->pid == 0) {
+        int status = 0;
+        output_attach(req->cap, 0);
+        cgroup_attach(req->cg, 0, 0);
+        if (req->error == EAGAIN || req->error == ENOMEM) {
+            stats_inc(STAT_FORK_FAIL);
+        }
+        if (req->error != 0) {
+            sio_printf("%s: %s\n", job_get_cmdline(jid),
+                       strerror(req->error));
+            status = W_EXITCODE(EXIT_EXEC_FAILURE, 0);
+        }
+        child_ended(jid, 0, status);
+        return;
+    }
+
+    stats_inc(STAT_SPAWN);
+    job_set_pid(jid, req->pid);
+    job_set_state(jid, BG);
+    cgroup_attach(req->cg, jid, req->pid);
+    stats_record(HIST_FORK_TO_JOB_NS, stats_now_ns() - req->start_ns);
+    output_attach(req->cap, jid);
+    printf("[%d] (%d) %s\n", jid, req->pid, job_get_cmdline(jid));
+    // It may have ended already
+    release(req->pid);
+}
+
+/*
+ * spawn_done - Event loop handler for the eventfd: take the results
+ */
+static void spawn_done(int fd, uint32_t events, void *arg) {
+    uint64_t n;
+    sigset_t mask_all, mask_prev;
+    struct request *list = NULL;
+
+    ssize_t ret = read(event_fd, &n, sizeof(n));
+    (void)ret;
+    struct request *req = __atomic_exchange_n(&done, NULL, __ATOMIC_ACQUIRE);
+    // Oldest first, as the jobs were queued
+    while (req != NULL) {
+        struct request *next = req->next;
+        req->next = list;
+        list = req;
+        req = next;
+    }
+
+    sigfillset(&mask_all);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+    for (req = list; req != NULL; req = list) {
+        list = req->next;
+        finish(req);
+        free(req->envp);
+        free(req);
+    }
+    // Whatever is still held was not launched by us after all
+    if (inflight == 0) {
+        release(0);
+    }
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+}
+
+/*
+ * spawn_init - Start the spawner threads
+ */
+bool spawn_init(int nthreads) {
+    sigset_t mask_all, mask_prev;
+    int err = 0;
+
+    if ((event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        return false;
+    }
+    if (!loop_add(event_fd, EPOLLIN, spawn_done, NULL)) {
+        return false;
+    }
+
+    // The threads inherit a mask that keeps every signal on the main
+    // program, where the handlers expect to run
+    sigfillset(&mask_all);
+    pthread_sigmask(SIG_BLOCK, &mask_all, &mask_prev);
+    for (int i = 0; i < nthreads && err == 0; i++) {
+        pthread_t thread;
+        if ((err = pthread_create(&thread, NULL, spawner, NULL)) == 0) {
+            pthread_detach(thread);
+            active = true;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &mask_prev, NULL);
+    if (!active) {
+        errno = err;
+    }
+    return active;
+}
+
+/*
+ * spawn_active - Whether spawner threads launch background jobs
+ * Async-signal-safe
+ */
+bool spawn_active(void) {
+    return active;
+}
+
+/*
+ * spawn_job - Queue a background job for the spawner threads
+ */
+jid_t spawn_job(jid_t jid, const struct cmdline_tokens *token, char **argv,
+                const char *cmdline, struct capture *cap, struct jobcg *cg) {
+    sigset_t mask_all, mask_prev;
+    size_t size = 0;
+    int first = 0;
+    int argc;
+
+    // The thread gets its own copy of everything the child needs
+    while (argv[first] != NULL && env_is_assignment(argv[first])) {
+        first++;
+    }
+    for (argc = first; argv[argc] != NULL; argc++) {
+        size += strlen(argv[argc]) + 1;
+    }
+    size += token->infile != NULL ? strlen(token->infile) + 1 : 0;
+    size += token->outfile != NULL ? strlen(token->outfile) + 1 : 0;
+    struct request *req =
+        malloc(sizeof(*req) + (argc - first + 1) * sizeof(char *) + size);
+    char **envp = env_copy(argv);
+    if (req == NULL || envp == NULL) {
+        perror("spawn");
+        free(req);
+        free(envp);
+        output_attach(cap, 0);
+        cgroup_attach(cg, 0, 0);
+        return 0;
+    }
+
+    char *p = (char *)&req->argv[argc - first + 1];
+    for (int i = first; i < argc; i++) {
+        size_t len = strlen(argv[i]) + 1;
+        req->argv[i - first] = memcpy(p, argv[i], len);
+        p += len;
+    }
+    req->argv[argc - first] = NULL;
+    req->infile = req->outfile = NULL;
+    if (token->infile != NULL) {
+        req->infile = strcpy(p, token->infile);
+        p += strlen(p) + 1;
+    }
+    if (token->outfile != NULL) {
+        req->outfile = strcpy(p, token->outfile);
+    }
+    req->envp = envp;
+    req->cap = cap;
+    req->cg = cg;
+    if (!output_child_fds(cap, &req->out_fd, &req->err_fd)) {
+        req->out_fd = req->err_fd = -1;
+    }
+    req->start_ns = stats_now_ns();
+
+    // The job waits in the job list until its thread has launched it
+    sigfillset(&mask_all);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+    if (jid == 0) {
+        jid = add_job(0, WT, cmdline);
+    }
+    if (jid == 0) {
+        stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+        free(envp);
+        free(req);
+        output_attach(cap, 0);
+        cgroup_attach(cg, 0, 0);
+        return 0;
+    }
+    req->jid = jid;
+    req->serial = job_get_serial(jid);
+    timeout_job_started(jid, BG);
+    inflight++;
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+
+    req->next = NULL;
+    pthread_mutex_lock(&lock);
+    *queued_tail = req;
+    queued_tail = &req->next;
+    pthread_cond_signal(&ready);
+    pthread_mutex_unlock(&lock);
+    return jid;
+}
+
+/*
+ * spawn_hold - Hold a reaped child that may belong to a job being spawned
+ * Async-signal-safe
+ */
+bool spawn_hold(pid_t pid, pid_t pgid, int status,
+                const struct rusage *usage) {
+    if (inflight == 0 || nheld == MAXJOBS) {
+        return false;
+    }
+    held[nheld].pid = pid;
+    held[nheld].pgid = pgid;
+    held[nheld].status = status;
+    held[nheld].usage = *usage;
+    nheld++;
+    return true;
+}
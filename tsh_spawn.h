@@ -0,0 +1,93 @@
+/**
+ * @file tsh_spawn.h
+ * @brief Background jobs launched by a pool of spawner threads
+ *
+ * With `--spawners N`, background jobs (`COMMAND &`, and those started by
+ * `after`, `dag`, `supervise`, `timeout` and server mode) are not forked
+ * by the main program. It only parses the command line, copies what the
+ * job needs (arguments, environment, redirections) into a request, adds
+ * the job to the job list as `Waiting` and goes on; one of N threads then
+ * launches it with `posix_spawn`, which does not copy the shell's page
+ * tables, and the threads launch jobs in parallel. Results come back over
+ * a lock-free queue and an eventfd watched by the event loop, where the
+ * job gets its PID, becomes `Running` and is announced.
+ *
+ * Children are still reaped by `sigchld_handler`. A child that ends before
+ * its result has come back is held, and handled as soon as its job knows
+ * its PID. Foreground jobs are still forked, since the shell waits for
+ * them anyway.
+ *
+ * Compared to fork, the child cannot run the shell's code: it is moved into
+ * its cgroup by the spawner thread right after it has started, and a
+ * redirection that cannot be opened is reported like a command that could
+ * not be executed (exit code 127).
+ */
+
+#ifndef TSH_SPAWN_H
+#define TSH_SPAWN_H
+
+#include <stdbool.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+#include "tsh_cgroup.h"
+#include "tsh_helper.h"
+#include "tsh_output.h"
+
+/** Maximum number of spawner threads */
+#define MAXSPAWNERS 64
+
+/**
+ * @brief Starts the spawner threads.
+ *
+ * @param[in] nthreads  The number of threads, between 1 and `MAXSPAWNERS`.
+ *
+ * @return true on success, false on error with errno set
+ *
+ * @pre The event loop must be initialized.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool spawn_init(int nthreads);
+
+/**
+ * @brief Returns whether background jobs are launched by spawner threads.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool spawn_active(void);
+
+/**
+ * @brief Hands a background job to the spawner threads.
+ *
+ * @param[in] jid      0 for a new job, or an existing waiting job.
+ * @param[in] token    The parsed command line, for its redirections.
+ * @param[in] argv     Its arguments, after glob expansion.
+ * @param[in] cmdline  The command line, as recorded in the job list.
+ * @param[in] cap      Its output capture, or NULL; now owned by the job.
+ * @param[in] cg       Its cgroup, or NULL; now owned by the job.
+ *
+ * @return The job ID, or 0 if the job could not be queued
+ *
+ * @pre Signals must not be blocked.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+jid_t spawn_job(jid_t jid, const struct cmdline_tokens *token, char **argv,
+                const char *cmdline, struct capture *cap, struct jobcg *cg);
+
+/**
+ * @brief Holds a reaped child that is not in the job list, if jobs are
+ *        being spawned, until its job knows its PID.
+ *
+ * @param[in] pid     The child.
+ * @param[in] pgid    Its process group in subreaper mode, or 0.
+ * @param[in] status  The raw status from waitpid.
+ * @param[in] usage   The resources it used.
+ *
+ * @return true if the child is held, false if it is to be handled now
+ *
+ * @pre Signals must be blocked.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool spawn_hold(pid_t pid, pid_t pgid, int status,
+                const struct rusage *usage);
+
+#endif /* TSH_SPAWN_H */
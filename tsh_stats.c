@@ -0,0 +1,219 @@
+/**
+ * @file tsh_stats.c
+ * @brief Shell-internals counters and histograms.
+ *
+ * For documentation related to usage, see the corresponding header file at
+ * tsh_stats.h.
+ */
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "csapp.h"
+#include "tsh_stats.h"
+
+// Histogram units, used only to pick a label when printing
+typedef enum hist_unit { UNIT_NS, UNIT_COUNT } hist_unit;
+
+/* Static variables */
+static unsigned long counters[STAT_NCOUNTERS];
+static unsigned long hists[HIST_NHISTS][STATS_HIST_BUCKETS];
+static unsigned long hist_samples[HIST_NHISTS];
+static uint64_t hist_sum[HIST_NHISTS];
+
+static const char *counter_names[STAT_NCOUNTERS] = {
+    [STAT_EVAL] = "commands evaluated",
+    [STAT_FORK] = "forks",
+    [STAT_EXEC_FAIL] = "exec failures",
+    [STAT_SIGCHLD] = "SIGCHLDs handled",
+    [STAT_REAPED] = "children reaped",
+    [STAT_SIGPROCMASK] = "sigprocmask calls",
+    [STAT_TIMEOUT] = "jobs timed out",
+    [STAT_DESCENDANTS] = "orphans reaped",
+    [STAT_GLOB_READ] = "glob directories read",
+    [STAT_GLOB_CACHED] = "glob listings cached",
+    [STAT_SCRIPT_COMPILED] = "scripts compiled",
+    [STAT_SCRIPT_CACHED] = "scripts cached",
+    [STAT_SPAWN] = "spawns",
+    [STAT_FORK_RETRY] = "fork retries",
+    [STAT_FORK_FAIL] = "forks failed",
+    [STAT_HELD_RATE] = "held by rate limit",
+    [STAT_HELD_LOAD] = "held by load",
+    [STAT_UP_TO_DATE] = "commands up to date",
+    [STAT_FILES_HASHED] = "files hashed",
+    [STAT_MEMO_HIT] = "cache hits",
+    [STAT_MEMO_MISS] = "cache misses",
+    [STAT_MEMO_EVICT] = "cache evictions",
+    [STAT_DEDUP] = "jobs de-duplicated",
+    [STAT_FS_EVENTS] = "inotify events",
+    [STAT_TRIGGERED] = "jobs triggered",
+    [STAT_EVENTS_DROPPED] = "child events dropped",
+};
+
+static const char *hist_names[HIST_NHISTS] = {
+    [HIST_PARSE_NS] = "parse time",
+    [HIST_FORK_TO_JOB_NS] = "fork to job visible",
+    [HIST_REAPED] = "children reaped per SIGCHLD",
+};
+
+static const hist_unit hist_units[HIST_NHISTS] = {
+    [HIST_PARSE_NS] = UNIT_NS,
+    [HIST_FORK_TO_JOB_NS] = UNIT_NS,
+    [HIST_REAPED] = UNIT_COUNT,
+};
+
+/*
+ * stats_inc - Increment a counter
+ * Async-signal-safe
+ */
+void stats_inc(stats_counter counter) {
+    counters[counter]++;
+}
+
+/*
+ * stats_add - Add a value to a counter
+ * Async-signal-safe
+ */
+void stats_add(stats_counter counter, unsigned long n) {
+    counters[counter] += n;
+}
+
+/*
+ * stats_get - Read a counter
+ * Async-signal-safe
+ */
+unsigned long stats_get(stats_counter counter) {
+    return counters[counter];
+}
+
+/*
+ * bucket_of - Returns the log2 bucket of a value: bucket 0 holds 0, and
+ * bucket i holds values in [2^(i-1), 2^i).
+ * Async-signal-safe
+ */
+static unsigned bucket_of(uint64_t value) {
+    unsigned b = 0;
+    while (value != 0 && b < STATS_HIST_BUCKETS - 1) {
+        value >>= 1;
+        b++;
+    }
+    return b;
+}
+
+/*
+ * stats_record - Record one sample in a histogram
+ * Async-signal-safe
+ */
+void stats_record(stats_hist hist, uint64_t value) {
+    hists[hist][bucket_of(value)]++;
+    hist_samples[hist]++;
+    hist_sum[hist] += value;
+}
+
+/*
+ * stats_now_ns - Monotonic timestamp in nanoseconds
+ * Async-signal-safe (clock_gettime)
+ */
+uint64_t stats_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * stats_sigprocmask - Counting wrapper around sigprocmask
+ * Async-signal-safe
+ */
+int stats_sigprocmask(int how, const sigset_t *set, sigset_t *oldset) {
+    counters[STAT_SIGPROCMASK]++;
+    return sigprocmask(how, set, oldset);
+}
+
+/*
+ * print_bound - Print a bucket bound, scaled to a readable unit
+ * Async-signal-safe
+ */
+static ssize_t print_bound(int fd, uint64_t v, hist_unit unit) {
+    if (unit == UNIT_COUNT) {
+        return sio_dprintf(fd, "%lu", (unsigned long)v);
+    }
+    if (v >= 1000000000u) {
+        return sio_dprintf(fd, "%lus", (unsigned long)(v / 1000000000u));
+    }
+    if (v >= 1000000u) {
+        return sio_dprintf(fd, "%lums", (unsigned long)(v / 1000000u));
+    }
+    if (v >= 1000u) {
+        return sio_dprintf(fd, "%luus", (unsigned long)(v / 1000u));
+    }
+    return sio_dprintf(fd, "%luns", (unsigned long)v);
+}
+
+/*
+ * print_counter - Print one counter as a padded "name value" line, since
+ * sio does not support field widths
+ * Async-signal-safe
+ */
+static ssize_t print_counter(int fd, const char *name, unsigned long value) {
+    static const char pad[] = "                            ";
+    size_t len = strlen(name);
+    size_t npad = len < sizeof(pad) - 1 ? sizeof(pad) - 1 - len : 1;
+    return sio_dprintf(fd, "%s%s%lu\n", name, &pad[sizeof(pad) - 1 - npad],
+                       value);
+}
+
+/*
+ * stats_print - Print all counters and histograms to a file descriptor
+ * Async-signal-safe
+ */
+bool stats_print(int output_fd) {
+    for (int i = 0; i < STAT_NCOUNTERS; i++) {
+        if (print_counter(output_fd, counter_names[i], counters[i]) < 0) {
+            return false;
+        }
+    }
+    if (print_counter(output_fd, "sio writes", sio_write_count) < 0) {
+        return false;
+    }
+
+    for (int h = 0; h < HIST_NHISTS; h++) {
+        unsigned long n = hist_samples[h];
+        unsigned long mean = n ? (unsigned long)(hist_sum[h] / n) : 0;
+        if (sio_dprintf(output_fd, "%s: %lu samples, mean ", hist_names[h],
+                        n) < 0 ||
+            print_bound(output_fd, mean, hist_units[h]) < 0 ||
+            sio_dprintf(output_fd, "\n") < 0) {
+            return false;
+        }
+        for (unsigned b = 0; b < STATS_HIST_BUCKETS; b++) {
+            if (hists[h][b] == 0) {
+                continue;
+            }
+            uint64_t lo = b == 0 ? 0 : (uint64_t)1 << (b - 1);
+            uint64_t hi = (uint64_t)1 << b;
+            if (sio_dprintf(output_fd, "  [") < 0 ||
+                print_bound(output_fd, lo, hist_units[h]) < 0 ||
+                sio_dprintf(output_fd, ", ") < 0 ||
+                print_bound(output_fd, hi, hist_units[h]) < 0 ||
+                sio_dprintf(output_fd, ") %lu\n", hists[h][b]) < 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * stats_reset - Reset all counters and histograms
+ * Async-signal-safe
+ */
+void stats_reset(void) {
+    memset(counters, 0, sizeof(counters));
+    memset(hists, 0, sizeof(hists));
+    memset(hist_samples, 0, sizeof(hist_samples));
+    memset(hist_sum, 0, sizeof(hist_sum));
+    sio_write_count = 0;
+}
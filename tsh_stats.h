@@ -0,0 +1,127 @@
+/**
+ * @file tsh_stats.h
+ * @brief Counters and latency histograms for the shell's own hot paths
+ *
+ * The shell keeps a small set of running counters (commands evaluated,
+ * forks, signal mask changes, ...) and log2-bucketed histograms (parse
+ * time, fork-to-job latency, ...). They are printed by the `stats` builtin
+ * and cleared by `stats --reset`.
+ *
+ * Counters may be updated from signal handlers. Readers in the main
+ * program should block signals before taking a snapshot, exactly as they
+ * would before accessing the job list.
+ */
+
+#ifndef TSH_STATS_H
+#define TSH_STATS_H
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define STATS_HIST_BUCKETS 40 /**< log2 buckets per histogram */
+
+/**
+ * @brief Running counters maintained by the shell
+ */
+typedef enum stats_counter {
+    STAT_EVAL = 0,        ///< Command lines evaluated
+    STAT_FORK,            ///< Successful calls to fork
+    STAT_EXEC_FAIL,       ///< Children that failed to exec
+    STAT_SIGCHLD,         ///< Invocations of sigchld_handler
+    STAT_REAPED,          ///< Children reaped by sigchld_handler
+    STAT_SIGPROCMASK,     ///< Calls to sigprocmask made by the shell
+    STAT_TIMEOUT,         ///< Jobs signalled because their deadline passed
+    STAT_DESCENDANTS,     ///< Orphaned descendants reaped in subreaper mode
+    STAT_GLOB_READ,       ///< Directories read for glob expansion
+    STAT_GLOB_CACHED,     ///< Directory listings reused from the glob cache
+    STAT_SCRIPT_COMPILED, ///< Script files compiled (see tsh_script.h)
+    STAT_SCRIPT_CACHED,   ///< Script files run from their cached image
+    STAT_SPAWN,           ///< Jobs launched by spawner threads
+    STAT_FORK_RETRY,      ///< Launches retried after EAGAIN or ENOMEM
+    STAT_FORK_FAIL,       ///< Launches that failed after their retries
+    STAT_HELD_RATE,       ///< Jobs held back by the launch rate limit
+    STAT_HELD_LOAD,       ///< Jobs held back by system pressure or load
+    STAT_UP_TO_DATE,      ///< Commands skipped as up to date (tsh_incr.h)
+    STAT_FILES_HASHED,    ///< Files hashed to tell whether they changed
+    STAT_MEMO_HIT,        ///< Cached commands replayed (tsh_memo.h)
+    STAT_MEMO_MISS,       ///< Cached commands run
+    STAT_MEMO_EVICT,      ///< Cache entries evicted
+    STAT_DEDUP,           ///< Jobs attached to a live duplicate (tsh_dedup.h)
+    STAT_FS_EVENTS,       ///< inotify events read (tsh_trigger.h)
+    STAT_TRIGGERED,       ///< Jobs launched by filesystem triggers
+    STAT_EVENTS_DROPPED,  ///< Child events lost to a full self-pipe
+    STAT_NCOUNTERS        ///< Number of counters (not a counter)
+} stats_counter;
+
+/**
+ * @brief Histograms maintained by the shell
+ */
+typedef enum stats_hist {
+    HIST_PARSE_NS = 0,   ///< Time spent in parseline, in nanoseconds
+    HIST_FORK_TO_JOB_NS, ///< Time from fork to add_job, in nanoseconds
+    HIST_REAPED,         ///< Children reaped per SIGCHLD
+    HIST_NHISTS          ///< Number of histograms (not a histogram)
+} stats_hist;
+
+/**
+ * @brief Increments a counter by one.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void stats_inc(stats_counter counter);
+
+/**
+ * @brief Adds a value to a counter.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void stats_add(stats_counter counter, unsigned long n);
+
+/**
+ * @brief Returns the current value of a counter.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+unsigned long stats_get(stats_counter counter);
+
+/**
+ * @brief Records one sample in a histogram.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void stats_record(stats_hist hist, uint64_t value);
+
+/**
+ * @brief Returns a monotonic timestamp in nanoseconds.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+uint64_t stats_now_ns(void);
+
+/**
+ * @brief Counting wrapper around sigprocmask.
+ *
+ * Has the same interface and return value as sigprocmask.
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+int stats_sigprocmask(int how, const sigset_t *set, sigset_t *oldset);
+
+/**
+ * @brief Writes all counters and non-empty histogram buckets to a file
+ *        descriptor.
+ *
+ * @param[in] output_fd The file descriptor to write to.
+ * @return true if the function succeeded
+ * @return false if an error occurred while writing to the file descriptor
+ *
+ * @pre Any signals that could update the counters must be blocked.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool stats_print(int output_fd);
+
+/**
+ * @brief Resets all counters and histograms to zero.
+ *
+ * @pre Any signals that could update the counters must be blocked.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void stats_reset(void);
+
+#endif /* TSH_STATS_H */
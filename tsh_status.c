@@ -0,0 +1,126 @@
+/**
+ * @file tsh_status.c
+ * @brief Shared-memory job/status page.
+ *
+ * For documentation related to usage, see the corresponding header file at
+ * tsh_status.h.
+ */
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tsh_stats.h"
+#include "tsh_status.h"
+
+// Every counter must have a slot: growing the page changes its layout
+_Static_assert(STAT_NCOUNTERS <= TSH_STATUS_COUNTERS,
+               "raise TSH_STATUS_COUNTERS and bump TSH_STATUS_VERSION");
+
+/* Static variables */
+static struct tsh_status_page *page = NULL; // Mapped page, or NULL
+
+/*
+ * begin_update - Make the sequence number odd before touching the page
+ * Async-signal-safe
+ */
+static void begin_update(void) {
+    __atomic_store_n(&page->seq, page->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/*
+ * end_update - Refresh the counters and make the sequence number even again
+ * Async-signal-safe
+ */
+static void end_update(void) {
+    for (int i = 0; i < STAT_NCOUNTERS && i < TSH_STATUS_COUNTERS; i++) {
+        page->counters[i] = stats_get((stats_counter)i);
+    }
+    page->updated_ns = stats_now_ns();
+    __atomic_store_n(&page->seq, page->seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * status_page_open - Create and map the status file
+ * Not async-signal-safe
+ */
+bool status_page_open(const char *path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd < 0) {
+        return false;
+    }
+    if (ftruncate(fd, sizeof(struct tsh_status_page)) < 0) {
+        close(fd);
+        return false;
+    }
+    void *addr = mmap(NULL, sizeof(struct tsh_status_page),
+                      PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+
+    // ftruncate zero-filled the page, so every job entry starts as UNDEF
+    page = addr;
+    page->version = TSH_STATUS_VERSION;
+    page->size = sizeof(struct tsh_status_page);
+    page->max_jobs = MAXJOBS;
+    page->shell_pid = getpid();
+    page->ncounters = STAT_NCOUNTERS < TSH_STATUS_COUNTERS
+                          ? STAT_NCOUNTERS
+                          : TSH_STATUS_COUNTERS;
+    begin_update();
+    end_update();
+
+    // Publish the magic last, so readers never see a half-built header
+    __atomic_store_n(&page->magic, TSH_STATUS_MAGIC, __ATOMIC_RELEASE);
+    return true;
+}
+
+/*
+ * status_page_close - Mark the page as stale and unmap it
+ * Not async-signal-safe
+ */
+void status_page_close(void) {
+    if (page == NULL) {
+        return;
+    }
+    begin_update();
+    page->shell_pid = 0;
+    end_update();
+    munmap(page, sizeof(struct tsh_status_page));
+    page = NULL;
+}
+
+/*
+ * status_page_update_job - Publish one job entry
+ * Async-signal-safe
+ */
+void status_page_update_job(jid_t jid, pid_t pid, job_state state,
+                            const char *cmdline) {
+    if (page == NULL || jid < 1 || jid > MAXJOBS) {
+        return;
+    }
+
+    struct tsh_status_job *entry = &page->jobs[jid - 1];
+    begin_update();
+    entry->jid = state == UNDEF ? 0 : jid;
+    entry->pid = pid;
+    entry->state = state;
+    if (cmdline != NULL) {
+        size_t len = strlen(cmdline);
+        if (len >= TSH_STATUS_CMDLEN) {
+            len = TSH_STATUS_CMDLEN - 1;
+        }
+        memcpy(entry->cmdline, cmdline, len);
+        entry->cmdline[len] = '\0';
+    } else if (state == UNDEF) {
+        entry->cmdline[0] = '\0';
+    }
+    end_update();
+}
@@ -0,0 +1,93 @@
+/**
+ * @file tsh_status.h
+ * @brief Shared-memory job/status page for external monitors
+ *
+ * When started with `--status-page FILE`, the shell maps FILE into memory
+ * and keeps a fixed-layout copy of its job table and counters there. The
+ * page is updated in place by `add_job`, `delete_job` and `job_set_state`,
+ * so a monitor can mmap the same file read-only and poll it without making
+ * any system calls and without involving the shell's main loop.
+ *
+ * The layout is versioned. Readers must check `magic` and `version`, and
+ * use `seq` as a sequence lock: read `seq`, copy the page, then read `seq`
+ * again. The copy is consistent if both reads returned the same even value.
+ */
+
+#ifndef TSH_STATUS_H
+#define TSH_STATUS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "tsh_helper.h"
+
+#define TSH_STATUS_MAGIC 0x53485354u /**< "TSHS" in little-endian */
+#define TSH_STATUS_VERSION 2         /**< Bumped on any layout change */
+#define TSH_STATUS_CMDLEN 128        /**< Bytes of cmdline kept per job */
+#define TSH_STATUS_COUNTERS 64       /**< Counter slots in the page */
+
+/**
+ * @brief One job table entry, as published in the status page
+ *
+ * Unused entries have `state` equal to `UNDEF` (0).
+ */
+struct tsh_status_job {
+    int32_t jid;                     ///< Job ID
+    int32_t pid;                     ///< PID of the job's root process
+    int32_t state;                   ///< A `job_state` value
+    uint32_t reserved;               ///< Padding, always zero
+    char cmdline[TSH_STATUS_CMDLEN]; ///< Truncated, NUL-terminated cmdline
+};
+
+/**
+ * @brief The status page, mapped at offset 0 of the status file
+ */
+struct tsh_status_page {
+    uint32_t magic;      ///< `TSH_STATUS_MAGIC`
+    uint32_t version;    ///< `TSH_STATUS_VERSION`
+    uint32_t size;       ///< sizeof(struct tsh_status_page)
+    uint32_t max_jobs;   ///< Number of entries in `jobs`
+    int32_t shell_pid;   ///< PID of the shell, or 0 once it has exited
+    uint32_t ncounters;  ///< Valid entries in `counters`, at most
+                         ///< `TSH_STATUS_COUNTERS`
+    uint64_t seq;        ///< Sequence lock, odd while an update is running
+    uint64_t updated_ns; ///< CLOCK_MONOTONIC time of the last update
+    uint64_t counters[TSH_STATUS_COUNTERS]; ///< Indexed by `stats_counter`
+    struct tsh_status_job jobs[MAXJOBS];    ///< Indexed by jid - 1
+};
+
+/**
+ * @brief Creates (or truncates) the status file and maps it.
+ *
+ * @param[in] path The file to publish the status page in.
+ * @return true if the page was mapped
+ * @return false on error, with errno set
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool status_page_open(const char *path);
+
+/**
+ * @brief Marks the page as belonging to an exited shell and unmaps it.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void status_page_close(void);
+
+/**
+ * @brief Publishes one job table entry and the current counters.
+ *
+ * Does nothing if no status page is open.
+ *
+ * @param[in] jid      The job ID of the entry to update.
+ * @param[in] pid      The job's PID, or 0 for a deleted job.
+ * @param[in] state    The job's state, or `UNDEF` for a deleted job.
+ * @param[in] cmdline  The job's command line, or NULL to keep the old one.
+ *
+ * @pre Any signals that could modify the job list must be blocked.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void status_page_update_job(jid_t jid, pid_t pid, job_state state,
+                            const char *cmdline);
+
+#endif /* TSH_STATUS_H */
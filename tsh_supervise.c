@@ -0,0 +1,351 @@
+/**
+ * @file tsh_supervise.c
+ * @brief Supervised jobs: keep-alive and retry with exponential backoff.
+ *
+ * For documentation related to usage, see the corresponding header file at
+ * tsh_supervise.h.
+ */
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "csapp.h"
+#include "tsh.h"
+#include "tsh_helper.h"
+#include "tsh_loop.h"
+#include "tsh_stats.h"
+#include "tsh_supervise.h"
+#include "tsh_timer.h"
+
+#define DEFAULT_BASE_NS 1000000000ull // Default first backoff delay
+#define DEFAULT_MAX_NS 60000000000ull // Default longest backoff delay
+#define DEFAULT_RETRIES 3             // Default restart limit of `retry`
+
+// Struct used to store a supervised job, indexed by job ID
+struct supervised {
+    unsigned long serial;           // Serial number of the job, 0 if unused
+    char *cmd;                      // Command to run
+    bool retry;                     // Only restart after a failure
+    int max_restarts;               // Restart limit, or -1 for none
+    uint64_t base_ns;               // First backoff delay
+    uint64_t max_ns;                // Longest backoff delay
+    int attempt;                    // Consecutive quick restarts
+    uint64_t started_ns;            // When the current run started
+    struct timer *timer;            // Pending restart, or NULL
+    volatile sig_atomic_t restarts; // Restarts so far; read by the handler
+    volatile sig_atomic_t stopping; // --stop given; read by the handler
+    volatile sig_atomic_t ended;    // Kept by the handler, not rescheduled
+};
+
+/* Static variables */
+static struct supervised sups[MAXJOBS + 1]; // Indexed by job ID
+static bool listening = false;              // Child listener registered
+
+/*
+ * sup_clear - Forget a supervised job
+ */
+static void sup_clear(struct supervised *s) {
+    timer_cancel(s->timer);
+    free(s->cmd);
+    memset(s, 0, sizeof(*s));
+}
+
+/*
+ * job_waiting - Whether a job still exists and is waiting to be restarted
+ */
+static bool job_waiting(jid_t jid, unsigned long serial) {
+    sigset_t mask_all, mask_prev;
+    bool waiting;
+
+    sigfillset(&mask_all);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+    waiting = job_exists(jid) && job_get_serial(jid) == serial &&
+              job_get_state(jid) == WT;
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+    return waiting;
+}
+
+/*
+ * drop_job - Delete a waiting job from the job list
+ *
+ * Child listeners (e.g. jobs that depend on this one) are told that the
+ * job was terminated, as if its process had been killed.
+ */
+static void drop_job(jid_t jid) {
+    sigset_t mask_all, mask_prev;
+
+    sigfillset(&mask_all);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+    loop_post_child(jid, job_get_serial(jid), 0, W_EXITCODE(0, SIGTERM));
+    delete_job(jid);
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+}
+
+/*
+ * start - Timer callback: (re)start a supervised job
+ */
+static void start(void *arg) {
+    jid_t jid = (jid_t)(intptr_t)arg;
+    struct supervised *s = &sups[jid];
+    struct cmdline_tokens token;
+
+    s->timer = NULL;
+    if (!job_waiting(jid, s->serial)) {
+        return;
+    }
+    // The command was checked when the job was submitted
+    parseline(s->cmd, &token);
+    s->started_ns = stats_now_ns();
+    if (start_waiting_job(jid, &token, s->cmd) == 0) {
+        drop_job(jid);
+        sup_clear(s);
+    }
+}
+
+/*
+ * supervise_child - Child listener: schedule the restart of a job that
+ * sigchld_handler kept, or forget a job that it deleted
+ */
+static void supervise_child(const struct child_event *event, void *arg) {
+    jid_t jid = event->jid;
+    if (jid <= 0 || jid > MAXJOBS || WIFSTOPPED(event->status)) {
+        return;
+    }
+    struct supervised *s = &sups[jid];
+    if (s->serial == 0 || s->serial != event->serial) {
+        return;
+    }
+
+    s->ended = 0;
+    if (!job_waiting(jid, s->serial)) {
+        bool failed = !WIFEXITED(event->status) ||
+                      WEXITSTATUS(event->status) != 0;
+        if (failed && !s->stopping && s->max_restarts >= 0) {
+            printf("Job [%d] gave up after %d restarts\n", jid,
+                   (int)s->restarts);
+        }
+        sup_clear(s);
+        return;
+    }
+
+    // A run that outlasted the longest delay was healthy; start over
+    if (stats_now_ns() - s->started_ns >= s->max_ns) {
+        s->attempt = 0;
+    }
+    uint64_t delay = s->base_ns;
+    for (int i = 0; i < s->attempt && delay < s->max_ns; i++) {
+        delay *= 2;
+    }
+    if (delay > s->max_ns) {
+        delay = s->max_ns;
+    }
+    s->attempt++;
+    s->restarts++;
+
+    printf("Job [%d] restarting in %gs\n", jid, (double)delay / 1e9);
+    if ((s->timer = timer_add(delay, start, (void *)(intptr_t)jid)) == NULL) {
+        perror("supervise");
+        drop_job(jid);
+        sup_clear(s);
+    }
+}
+
+/*
+ * supervise_lost - Lost-event task: forget the jobs that ended, and
+ * schedule the restarts of those kept, whose events were dropped
+ */
+static void supervise_lost(void) {
+    struct child_event event;
+
+    for (jid_t jid = 1; jid <= MAXJOBS; jid++) {
+        struct supervised *s = &sups[jid];
+        if (s->serial == 0) {
+            continue;
+        }
+        if (loop_lost_event(jid, s->serial, &event)) {
+            supervise_child(&event, NULL);
+        } else if (s->ended && s->timer == NULL) {
+            event.jid = jid;
+            event.serial = s->serial;
+            event.pid = 0;
+            event.status = W_EXITCODE(255, 0);
+            job_find_exit(jid, s->serial, NULL, &event.status);
+            supervise_child(&event, NULL);
+        }
+    }
+}
+
+/*
+ * supervise_wants_restart - Whether a job that ended is to be restarted
+ * Async-signal-safe
+ */
+bool supervise_wants_restart(jid_t jid, unsigned long serial, int status) {
+    if (jid <= 0 || jid > MAXJOBS) {
+        return false;
+    }
+    struct supervised *s = &sups[jid];
+    if (s->serial != serial || s->stopping) {
+        return false;
+    }
+    if (s->retry && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        return false;
+    }
+    s->ended = s->max_restarts < 0 || s->restarts < s->max_restarts;
+    return s->ended;
+}
+
+/*
+ * supervise_restarts - Number of times a job has been restarted
+ * Async-signal-safe
+ */
+int supervise_restarts(jid_t jid, unsigned long serial) {
+    if (jid <= 0 || jid > MAXJOBS || sups[jid].serial != serial) {
+        return 0;
+    }
+    return sups[jid].restarts;
+}
+
+/*
+ * stop - Implements `supervise --stop %N`
+ */
+static void stop(const char *arg) {
+    sigset_t mask_all, mask_prev;
+    jid_t jid = arg[0] == '%' ? atoi(arg + 1) : 0;
+    struct supervised *s = jid > 0 && jid <= MAXJOBS ? &sups[jid] : NULL;
+
+    sigfillset(&mask_all);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+    if (s == NULL || !job_exists(jid) || job_get_serial(jid) != s->serial) {
+        stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+        printf("%s: No such supervised job\n", arg);
+        return;
+    }
+    s->stopping = 1;
+    if (job_get_state(jid) == WT) {
+        stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+        drop_job(jid);
+        sup_clear(s);
+        return;
+    }
+    // sigchld_handler deletes the job once it has exited
+    pid_t pid = job_get_pid(jid);
+    kill(-pid, SIGTERM);
+    kill(-pid, SIGCONT);
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+}
+
+/*
+ * parse_backoff - Parse a BASE,MAX backoff specification
+ */
+static bool parse_backoff(char *str, uint64_t *base_ns, uint64_t *max_ns) {
+    char *comma = strchr(str, ',');
+    if (comma == NULL) {
+        return false;
+    }
+    *comma = '\0';
+    bool ok = timer_parse_duration(str, base_ns) &&
+              timer_parse_duration(comma + 1, max_ns) && *base_ns > 0 &&
+              *base_ns <= *max_ns;
+    *comma = ',';
+    return ok;
+}
+
+/*
+ * supervise_builtin - The `supervise` and `retry` builtins
+ */
+void supervise_builtin(const char *cmdline, char **argv) {
+    bool retry = strcmp(argv[0], "retry") == 0;
+    int max_restarts = retry ? DEFAULT_RETRIES : -1;
+    uint64_t base_ns = DEFAULT_BASE_NS;
+    uint64_t max_ns = DEFAULT_MAX_NS;
+    int i = 1;
+
+    if (!retry && argv[1] != NULL && strcmp(argv[1], "--stop") == 0) {
+        if (argv[2] == NULL) {
+            printf("supervise: --stop requires a %%jobid argument\n");
+            return;
+        }
+        stop(argv[2]);
+        return;
+    }
+
+    for (; argv[i] != NULL && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "--max-restarts") == 0 && argv[i + 1] != NULL) {
+            char *end;
+            long n = strtol(argv[++i], &end, 10);
+            if (*end != '\0' || n < 0 || n > 1000000) {
+                printf("%s: invalid restart limit %s\n", argv[0], argv[i]);
+                return;
+            }
+            max_restarts = (int)n;
+        } else if (strcmp(argv[i], "--backoff") == 0 && argv[i + 1] != NULL) {
+            if (!parse_backoff(argv[++i], &base_ns, &max_ns)) {
+                printf("%s: invalid backoff %s\n", argv[0], argv[i]);
+                return;
+            }
+        } else {
+            break;
+        }
+    }
+    if (argv[i] == NULL) {
+        printf("%s: usage: %s [--max-restarts N] [--backoff BASE,MAX] "
+               "COMMAND [&]\n",
+               argv[0], argv[0]);
+        return;
+    }
+
+    struct cmdline_tokens token;
+    const char *cmd = skip_args(cmdline, i);
+    parseline_return ret = parseline(cmd, &token);
+    if (ret == PARSELINE_ERROR || ret == PARSELINE_EMPTY) {
+        return;
+    }
+    if (token.builtin != BUILTIN_NONE) {
+        printf("%s: cannot run builtin %s\n", argv[0], token.argv[0]);
+        return;
+    }
+
+    if (!listening) {
+        if (!loop_on_child(supervise_child, NULL) ||
+            !loop_on_lost(supervise_lost)) {
+            printf("%s: cannot track job completions\n", argv[0]);
+            return;
+        }
+        listening = true;
+    }
+    char *cmd_copy = strdup(cmd);
+    if (cmd_copy == NULL) {
+        perror(argv[0]);
+        return;
+    }
+
+    // Add the job as waiting first, so that it is registered here before
+    // its process can possibly exit
+    sigset_t mask_all, mask_prev;
+    sigfillset(&mask_all);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+    jid_t jid = add_job(0, WT, cmdline);
+    unsigned long serial = jid ? job_get_serial(jid) : 0;
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+    if (jid == 0) {
+        printf("%s: too many jobs\n", argv[0]);
+        free(cmd_copy);
+        return;
+    }
+
+    // A record left over from an earlier job with this ID is stale
+    struct supervised *s = &sups[jid];
+    sup_clear(s);
+    s->serial = serial;
+    s->cmd = cmd_copy;
+    s->retry = retry;
+    s->max_restarts = max_restarts;
+    s->base_ns = base_ns;
+    s->max_ns = max_ns;
+    start((void *)(intptr_t)jid);
+}
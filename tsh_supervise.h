@@ -0,0 +1,69 @@
+/**
+ * @file tsh_supervise.h
+ * @brief Supervised jobs: keep-alive and retry with exponential backoff
+ *
+ * A supervised job keeps its job ID across restarts. When its process
+ * ends, `sigchld_handler` asks this module whether the job is to be
+ * restarted; if so, the job goes back to the `WT` state instead of being
+ * deleted, and it is started again in the background after a backoff
+ * delay. The delay starts at the base and doubles with every consecutive
+ * restart, up to the maximum; a run that lasts longer than the maximum
+ * delay resets it. `jobs` shows how many times each job was restarted.
+ *
+ * Builtins:
+ *
+ *     supervise [--max-restarts N] [--backoff BASE,MAX] COMMAND [&]
+ *         Run COMMAND in the background and restart it whenever it ends
+ *     retry [--max-restarts N] [--backoff BASE,MAX] COMMAND [&]
+ *         Run COMMAND in the background and restart it until it succeeds
+ *     supervise --stop %N
+ *         Stop restarting job N, and terminate it if it is running
+ *
+ * `supervise` restarts without limit unless `--max-restarts` is given;
+ * `retry` gives up after 3 restarts by default. The backoff defaults to
+ * `1s,60s`; durations are as for `timer_parse_duration`.
+ */
+
+#ifndef TSH_SUPERVISE_H
+#define TSH_SUPERVISE_H
+
+#include <stdbool.h>
+
+#include "tsh_helper.h"
+
+/**
+ * @brief Implements the `supervise` and `retry` builtins.
+ *
+ * @param[in] cmdline  The full command line; the command to run is taken
+ *                     from it verbatim.
+ * @param[in] argv     The parsed arguments.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void supervise_builtin(const char *cmdline, char **argv);
+
+/**
+ * @brief Decides whether a job whose process has ended is to be restarted.
+ *
+ * Called from `sigchld_handler`. If this returns true, the job must be
+ * kept in the job list, in the `WT` state, instead of being deleted.
+ *
+ * @param[in] jid     The job.
+ * @param[in] serial  The job's serial number.
+ * @param[in] status  The raw status from waitpid.
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool supervise_wants_restart(jid_t jid, unsigned long serial, int status);
+
+/**
+ * @brief Returns how many times a job has been restarted.
+ *
+ * @param[in] jid     The job.
+ * @param[in] serial  The job's serial number.
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+int supervise_restarts(jid_t jid, unsigned long serial);
+
+#endif /* TSH_SUPERVISE_H */
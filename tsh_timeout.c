@@ -0,0 +1,256 @@
+/**
+ * @file tsh_timeout.c
+ * @brief Wall-clock timeouts for jobs.
+ *
+ * For documentation related to usage, see the corresponding header file at
+ * tsh_timeout.h.
+ */
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "csapp.h"
+#include "tsh.h"
+#include "tsh_helper.h"
+#include "tsh_loop.h"
+#include "tsh_stats.h"
+#include "tsh_timeout.h"
+#include "tsh_timer.h"
+
+#define DEFAULT_GRACE_NS (5 * 1000000000ull) // Time from signal to SIGKILL
+
+// Struct used to store the parameters of a timeout
+struct timeout_spec {
+    uint64_t duration_ns; // Time until the signal, 0 for no timeout
+    int sig;              // Signal sent at the deadline
+    uint64_t grace_ns;    // Time from the signal to SIGKILL, 0 for never
+};
+
+// Struct used to store the timeout of one job, indexed by job ID
+struct job_timeout {
+    unsigned long serial;          // Serial number of the job, 0 if unused
+    struct timeout_spec spec;      // Parameters of the timeout
+    struct timer *timer;           // Pending timer, or NULL
+    bool held;                     // Spec kept until the job is started
+    volatile sig_atomic_t expired; // Deadline passed; read by the handler
+};
+
+/* Static variables */
+static struct job_timeout timeouts[MAXJOBS + 1]; // Indexed by job ID
+static struct timeout_spec default_spec = {0, SIGTERM, DEFAULT_GRACE_NS};
+static struct timeout_spec next_spec; // For the next job only
+static bool next_set = false;         // Whether next_spec applies
+static bool listening = false;        // Child listener registered
+
+/*
+ * expire - Timer callback: signal a job whose deadline or grace period
+ * has passed
+ */
+static void expire(void *arg) {
+    jid_t jid = (jid_t)(intptr_t)arg;
+    struct job_timeout *t = &timeouts[jid];
+    sigset_t mask_all, mask_prev;
+
+    t->timer = NULL;
+    sigfillset(&mask_all);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+    if (job_exists(jid) && job_get_serial(jid) == t->serial &&
+        job_get_pid(jid) > 0) {
+        pid_t pid = job_get_pid(jid);
+        if (!t->expired) {
+            t->expired = 1;
+            stats_inc(STAT_TIMEOUT);
+            kill(-pid, t->spec.sig);
+            kill(-pid, SIGCONT);
+            if (t->spec.grace_ns > 0 && t->spec.sig != SIGKILL) {
+                t->timer = timer_add(t->spec.grace_ns, expire, arg);
+            }
+        } else {
+            kill(-pid, SIGKILL);
+        }
+    }
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+}
+
+/*
+ * timeout_child - Child listener: drop the timeout of a job that ended
+ */
+static void timeout_child(const struct child_event *event, void *arg) {
+    if (event->jid <= 0 || event->jid > MAXJOBS || WIFSTOPPED(event->status)) {
+        return;
+    }
+    struct job_timeout *t = &timeouts[event->jid];
+    sigset_t mask_all, mask_prev;
+
+    sigfillset(&mask_all);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+    if (t->serial == event->serial) {
+        timer_cancel(t->timer);
+        t->timer = NULL;
+        t->serial = 0;
+        t->held = false;
+        t->expired = 0;
+    }
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+}
+
+/*
+ * timeout_lost - Lost-event task: drop the timeouts of jobs
+ * whose events were dropped
+ */
+static void timeout_lost(void) {
+    struct child_event event;
+
+    for (jid_t jid = 1; jid <= MAXJOBS; jid++) {
+        if (timeouts[jid].serial != 0 &&
+            loop_lost_event(jid, timeouts[jid].serial, &event)) {
+            timeout_child(&event, NULL);
+        }
+    }
+}
+
+/*
+ * timeout_job_started - Start the timeout of a new job
+ */
+void timeout_job_started(jid_t jid, job_state state) {
+    struct timeout_spec spec;
+    struct job_timeout *t = &timeouts[jid];
+
+    if (t->held && t->serial == job_get_serial(jid)) {
+        spec = t->spec;
+        t->held = false;
+    } else if (next_set) {
+        spec = next_spec;
+        next_set = false;
+    } else if (state == BG) {
+        spec = default_spec;
+    } else {
+        return;
+    }
+    if (spec.duration_ns == 0) {
+        return;
+    }
+
+    if (!listening) {
+        if (!loop_on_child(timeout_child, NULL) ||
+            !loop_on_lost(timeout_lost)) {
+            printf("timeout: cannot track job completions\n");
+            return;
+        }
+        listening = true;
+    }
+
+    // A timer left over from an earlier job with this ID is stale
+    timer_cancel(t->timer);
+    t->serial = job_get_serial(jid);
+    t->spec = spec;
+    t->held = false;
+    t->expired = 0;
+    if ((t->timer = timer_add(spec.duration_ns, expire,
+                              (void *)(intptr_t)jid)) == NULL) {
+        perror("timeout");
+    }
+}
+
+/*
+ * timeout_job_held - Keep the timeout of a job that is not started yet
+ */
+void timeout_job_held(jid_t jid) {
+    if (!next_set) {
+        return;
+    }
+    struct job_timeout *t = &timeouts[jid];
+    timer_cancel(t->timer);
+    t->timer = NULL;
+    t->serial = job_get_serial(jid);
+    t->spec = next_spec;
+    t->held = true;
+    t->expired = 0;
+    next_set = false;
+}
+
+/*
+ * timeout_expired - Whether a job's deadline has passed
+ * Async-signal-safe
+ */
+bool timeout_expired(jid_t jid, unsigned long serial) {
+    return jid > 0 && jid <= MAXJOBS && timeouts[jid].serial == serial &&
+           timeouts[jid].expired;
+}
+
+/*
+ * timeout_builtin - The `timeout` builtin
+ */
+void timeout_builtin(const char *cmdline, char **argv) {
+    struct timeout_spec spec = {0, SIGTERM, DEFAULT_GRACE_NS};
+    bool set_default = false;
+    int i = 1;
+
+    if (argv[1] == NULL) {
+        if (default_spec.duration_ns == 0) {
+            printf("default timeout: off\n");
+        } else {
+            printf("default timeout: %gs, signal %d, SIGKILL after %gs\n",
+                   (double)default_spec.duration_ns / 1e9, default_spec.sig,
+                   (double)default_spec.grace_ns / 1e9);
+        }
+        printf("pending timers: %d\n", timer_pending());
+        return;
+    }
+
+    for (; argv[i] != NULL && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "--default") == 0) {
+            set_default = true;
+        } else if (strcmp(argv[i], "-s") == 0 && argv[i + 1] != NULL) {
+            if ((spec.sig = parse_signal(argv[++i])) <= 0) {
+                printf("timeout: invalid signal %s\n", argv[i]);
+                return;
+            }
+        } else if (strcmp(argv[i], "-k") == 0 && argv[i + 1] != NULL) {
+            if (!timer_parse_duration(argv[++i], &spec.grace_ns)) {
+                printf("timeout: invalid duration %s\n", argv[i]);
+                return;
+            }
+        } else {
+            break;
+        }
+    }
+
+    bool off = set_default && argv[i] != NULL && strcmp(argv[i], "off") == 0;
+    if (argv[i] == NULL || (set_default && argv[i + 1] != NULL) ||
+        (!set_default && argv[i + 1] == NULL)) {
+        printf("timeout: usage: timeout [-s SIG] [-k GRACE] DUR COMMAND | "
+               "timeout --default [-s SIG] [-k GRACE] DUR|off\n");
+        return;
+    }
+    if (!off && (!timer_parse_duration(argv[i], &spec.duration_ns) ||
+                 spec.duration_ns == 0)) {
+        printf("timeout: invalid duration %s\n", argv[i]);
+        return;
+    }
+    if (set_default) {
+        default_spec = spec;
+        return;
+    }
+
+    struct cmdline_tokens token;
+    const char *cmd = skip_args(cmdline, i + 1);
+    parseline_return ret = parseline(cmd, &token);
+    if (ret == PARSELINE_ERROR || ret == PARSELINE_EMPTY) {
+        return;
+    }
+    if (token.builtin != BUILTIN_NONE) {
+        printf("timeout: cannot run builtin %s\n", token.argv[0]);
+        return;
+    }
+
+    next_spec = spec;
+    next_set = true;
+    launch_job(&token, cmdline, ret == PARSELINE_BG ? BG : FG);
+    next_set = false;
+}
@@ -0,0 +1,80 @@
+/**
+ * @file tsh_timeout.h
+ * @brief Wall-clock timeouts for jobs
+ *
+ * A job with a timeout gets a signal (SIGTERM unless configured otherwise)
+ * once its deadline passes, and SIGKILL if it is still alive after a grace
+ * period. A stopped job is also sent SIGCONT so that it can act on the
+ * signal. The deadlines are `tsh_timer` timers, so any number of jobs can
+ * have one while the shell keeps a single timerfd.
+ *
+ * Builtins:
+ *
+ *     timeout [-s SIG] [-k GRACE] DUR COMMAND [&]
+ *         Run COMMAND with a timeout of DUR
+ *     timeout --default [-s SIG] [-k GRACE] DUR|off
+ *         Set (or clear) the timeout of every new background job
+ *     timeout
+ *         Show the default timeout
+ *
+ * Durations are as for `timer_parse_duration`, e.g. `30`, `1.5s`, `500ms`,
+ * `10m`. The grace period defaults to 5 seconds; `-k 0` disables SIGKILL.
+ * When a job that timed out ends, its exit notification says so.
+ */
+
+#ifndef TSH_TIMEOUT_H
+#define TSH_TIMEOUT_H
+
+#include <stdbool.h>
+
+#include "tsh_helper.h"
+
+/**
+ * @brief Implements the `timeout` builtin.
+ *
+ * @param[in] cmdline  The full command line; the command to run is taken
+ *                     from it verbatim.
+ * @param[in] argv     The parsed arguments.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void timeout_builtin(const char *cmdline, char **argv);
+
+/**
+ * @brief Starts the timeout of a job that has just been started.
+ *
+ * Applies the timeout requested by the `timeout` builtin that launched the
+ * job, if any, or else the default timeout if the job runs in the
+ * background.
+ *
+ * @param[in] jid    The job.
+ * @param[in] state  The state it was started in.
+ *
+ * @pre Any signals that could modify the job list must be blocked.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void timeout_job_started(jid_t jid, job_state state);
+
+/**
+ * @brief Keeps the timeout requested for a job that is held back instead
+ *        of being started, until `timeout_job_started` is called for it.
+ *
+ * @param[in] jid  The job, in the `WT` state.
+ *
+ * @pre Any signals that could modify the job list must be blocked.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void timeout_job_held(jid_t jid);
+
+/**
+ * @brief Returns whether a job's deadline has passed.
+ *
+ * @param[in] jid     The job.
+ * @param[in] serial  The job's serial number, to tell it from an earlier
+ *                    job with the same job ID.
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool timeout_expired(jid_t jid, unsigned long serial);
+
+#endif /* TSH_TIMEOUT_H */
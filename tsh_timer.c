@@ -0,0 +1,238 @@
+/**
+ * @file tsh_timer.c
+ * @brief One-shot timers for the event loop.
+ *
+ * For documentation related to usage, see the corresponding header file at
+ * tsh_timer.h.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tsh_loop.h"
+#include "tsh_stats.h"
+#include "tsh_timer.h"
+
+// Struct used to store a pending timer
+struct timer {
+    uint64_t deadline;        // Expiry time, CLOCK_MONOTONIC nanoseconds
+    timer_callback *callback; // Called on expiry
+    void *arg;                // Argument for the callback
+    int index;                // Position in the heap
+};
+
+/* Static variables */
+static int timer_fd = -1;           // The timerfd, armed for heap[0]
+static struct timer **heap = NULL;  // Min-heap of pending timers
+static int nheap = 0;               // Number of pending timers
+static int heap_cap = 0;            // Capacity of heap
+static uint64_t armed_deadline = 0; // Deadline the timerfd is armed for
+
+/*
+ * heap_set - Put a timer at a heap position
+ */
+static void heap_set(int i, struct timer *t) {
+    heap[i] = t;
+    t->index = i;
+}
+
+/*
+ * sift_up - Restore the heap order above position i
+ */
+static void sift_up(int i) {
+    struct timer *t = heap[i];
+    while (i > 0 && heap[(i - 1) / 2]->deadline > t->deadline) {
+        heap_set(i, heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    heap_set(i, t);
+}
+
+/*
+ * sift_down - Restore the heap order below position i
+ */
+static void sift_down(int i) {
+    struct timer *t = heap[i];
+    while (true) {
+        int child = 2 * i + 1;
+        if (child >= nheap) {
+            break;
+        }
+        if (child + 1 < nheap &&
+            heap[child + 1]->deadline < heap[child]->deadline) {
+            child++;
+        }
+        if (heap[child]->deadline >= t->deadline) {
+            break;
+        }
+        heap_set(i, heap[child]);
+        i = child;
+    }
+    heap_set(i, t);
+}
+
+/*
+ * heap_remove - Remove the timer at position i from the heap
+ */
+static void heap_remove(int i) {
+    nheap--;
+    if (i == nheap) {
+        return;
+    }
+    struct timer *t = heap[nheap];
+    heap_set(i, t);
+    sift_up(i);
+    sift_down(t->index);
+}
+
+/*
+ * rearm - Arm the timerfd for the earliest deadline, or disarm it
+ */
+static void rearm(void) {
+    uint64_t deadline = nheap > 0 ? heap[0]->deadline : 0;
+    if (deadline == armed_deadline) {
+        return;
+    }
+
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    if (nheap > 0) {
+        // A zero it_value would disarm the timer, so never ask for time 0
+        its.it_value.tv_sec = (time_t)(deadline / 1000000000u);
+        its.it_value.tv_nsec = (long)(deadline % 1000000000u);
+        if (deadline == 0) {
+            its.it_value.tv_nsec = 1;
+        }
+    }
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+    armed_deadline = deadline;
+}
+
+/*
+ * timer_ready - Run the callbacks of every expired timer
+ */
+static void timer_ready(int fd, uint32_t events, void *arg) {
+    uint64_t expirations;
+    ssize_t ret = read(fd, &expirations, sizeof(expirations));
+    (void)ret;
+
+    // Several deadlines may have passed since the timerfd was armed
+    uint64_t now = stats_now_ns();
+    armed_deadline = 0;
+    while (nheap > 0 && heap[0]->deadline <= now) {
+        struct timer *t = heap[0];
+        heap_remove(0);
+        // The callback may add or cancel timers
+        t->callback(t->arg);
+        free(t);
+    }
+    rearm();
+}
+
+/*
+ * timer_init - Create the timerfd and register it with the loop
+ */
+static bool timer_init(void) {
+    if (timer_fd >= 0) {
+        return true;
+    }
+    if ((timer_fd = timerfd_create(CLOCK_MONOTONIC,
+                                   TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+        return false;
+    }
+    if (!loop_add(timer_fd, EPOLLIN, timer_ready, NULL)) {
+        close(timer_fd);
+        timer_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+/*
+ * timer_add - Start a one-shot timer
+ */
+struct timer *timer_add(uint64_t delay_ns, timer_callback *callback,
+                        void *arg) {
+    if (!timer_init()) {
+        return NULL;
+    }
+    if (nheap == heap_cap) {
+        int cap = heap_cap ? 2 * heap_cap : 64;
+        struct timer **h = realloc(heap, sizeof(*h) * (size_t)cap);
+        if (h == NULL) {
+            return NULL;
+        }
+        heap = h;
+        heap_cap = cap;
+    }
+
+    struct timer *t = malloc(sizeof(*t));
+    if (t == NULL) {
+        return NULL;
+    }
+    t->deadline = stats_now_ns() + delay_ns;
+    t->callback = callback;
+    t->arg = arg;
+    heap_set(nheap++, t);
+    sift_up(t->index);
+    rearm();
+    return t;
+}
+
+/*
+ * timer_cancel - Cancel a pending timer
+ */
+void timer_cancel(struct timer *timer) {
+    if (timer == NULL) {
+        return;
+    }
+    heap_remove(timer->index);
+    free(timer);
+    rearm();
+}
+
+/*
+ * timer_pending - Number of pending timers
+ */
+int timer_pending(void) {
+    return nheap;
+}
+
+/*
+ * timer_parse_duration - Parse a duration with an optional unit
+ */
+bool timer_parse_duration(const char *str, uint64_t *ns) {
+    char *end;
+    double value;
+
+    errno = 0;
+    value = strtod(str, &end);
+    if (end == str || errno != 0 || !(value >= 0)) {
+        return false;
+    }
+
+    double scale;
+    if (strcmp(end, "") == 0 || strcmp(end, "s") == 0) {
+        scale = 1e9;
+    } else if (strcmp(end, "ms") == 0) {
+        scale = 1e6;
+    } else if (strcmp(end, "m") == 0) {
+        scale = 60e9;
+    } else if (strcmp(end, "h") == 0) {
+        scale = 3600e9;
+    } else {
+        return false;
+    }
+    if (value * scale >= 1.8e19) {
+        return false;
+    }
+    *ns = (uint64_t)(value * scale + 0.5);
+    return true;
+}
@@ -0,0 +1,69 @@
+/**
+ * @file tsh_timer.h
+ * @brief One-shot timers for the event loop
+ *
+ * All timers share a single timerfd registered with the event loop. Their
+ * deadlines are kept in a binary min-heap, and the timerfd is always armed
+ * for the earliest one, so adding, cancelling and expiring a timer costs
+ * O(log n) no matter how many timers are pending.
+ *
+ * Callbacks run from the event loop in the main program, never in a
+ * signal handler.
+ */
+
+#ifndef TSH_TIMER_H
+#define TSH_TIMER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** @brief Opaque handle to a pending timer */
+struct timer;
+
+/** @brief Called when a timer expires */
+typedef void timer_callback(void *arg);
+
+/**
+ * @brief Starts a one-shot timer.
+ *
+ * @param[in] delay_ns  Time from now until the timer expires.
+ * @param[in] callback  Called with `arg` once the timer expires.
+ * @param[in] arg       Passed to the callback.
+ *
+ * @return A handle that is valid until the timer expires or is cancelled,
+ *         or NULL on error with errno set.
+ *
+ * @pre The event loop must be initialized.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+struct timer *timer_add(uint64_t delay_ns, timer_callback *callback,
+                        void *arg);
+
+/**
+ * @brief Cancels a pending timer. Does nothing if `timer` is NULL.
+ *
+ * @pre `timer` must not have expired or been cancelled already.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void timer_cancel(struct timer *timer);
+
+/**
+ * @brief Returns the number of pending timers.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+int timer_pending(void);
+
+/**
+ * @brief Parses a duration such as `30`, `1.5s`, `250ms`, `2m` or `1h`.
+ *
+ * A number without a unit is in seconds.
+ *
+ * @param[in]  str  The duration to parse.
+ * @param[out] ns   The duration in nanoseconds.
+ *
+ * @return true on success, false if `str` is not a valid duration
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool timer_parse_duration(const char *str, uint64_t *ns);
+
+#endif /* TSH_TIMER_H */
@@ -0,0 +1,438 @@
+/**
+ * @file tsh_trigger.c
+ * @brief Filesystem triggers: run a command when watched paths change.
+ *
+ * For documentation related to usage, see the corresponding header file at
+ * tsh_trigger.h.
+ */
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "tsh.h"
+#include "tsh_helper.h"
+#include "tsh_loop.h"
+#include "tsh_stats.h"
+#include "tsh_timer.h"
+#include "tsh_trigger.h"
+
+#define MAXTRIGGERS 16                    // Max triggers at once
+#define MAXWATCHES 32                     // Max paths per trigger
+#define DEFAULT_DEBOUNCE_NS 100000000ull  // Default quiet time before a run
+#define MAX_DEBOUNCES 10                  // Longest burst, in debounce delays
+#define WATCH_MASK                                                            \
+    (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |         \
+     IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+// Struct used to store a trigger, indexed by trigger ID
+struct trigger {
+    bool used;                   // Whether the slot is in use
+    int nwatches;                // Number of paths watched
+    int wds[MAXWATCHES];         // Watch descriptors, -1 if not watched
+    char *names[MAXWATCHES];     // The paths, one by one
+    char *paths;                 // The paths, for listing
+    char *cmdline;               // The command to run
+    struct cmdline_tokens token; // The command, parsed
+    uint64_t debounce_ns;        // Quiet time before a run
+    int parallel;                // Most jobs in flight
+    int running;                 // Jobs in flight
+    bool pending;                // Changed while at the limit of jobs
+    uint64_t first_ns;           // First event of the burst, 0 if none
+    struct timer *timer;         // Pending run, or NULL
+    unsigned long events;        // Events seen
+    unsigned long runs;          // Jobs launched
+};
+
+// Struct used to store which trigger launched a job, indexed by job ID
+struct owner {
+    unsigned long serial; // Serial number of the job, 0 if unused
+    int id;               // Trigger ID
+};
+
+/* Static variables */
+static int inotify_fd = -1;                      // Shared inotify instance
+static struct trigger triggers[MAXTRIGGERS + 1]; // Indexed by trigger ID
+static struct owner owners[MAXJOBS + 1];         // Indexed by job ID
+static bool listening = false;                   // Child listener registered
+
+/*
+ * rearm - Watch the paths of a trigger whose watches ended, e.g. once an
+ * editor has renamed a new file over a watched one; returns how many are
+ * still not watched
+ */
+static int rearm(struct trigger *t) {
+    int lost = 0;
+
+    for (int i = 0; i < t->nwatches; i++) {
+        if (t->wds[i] < 0) {
+            t->wds[i] = inotify_add_watch(inotify_fd, t->names[i],
+                                          WATCH_MASK);
+            lost += t->wds[i] < 0;
+        }
+    }
+    return lost;
+}
+
+/*
+ * run - Launch a trigger's command as a background job
+ */
+static void run(int id) {
+    struct trigger *t = &triggers[id];
+    sigset_t mask_all, mask_prev;
+
+    t->runs++;
+    stats_inc(STAT_TRIGGERED);
+    jid_t jid = launch_job(&t->token, t->cmdline, BG);
+    if (jid == 0) {
+        return;
+    }
+
+    // A job that has already ended is not in flight any more
+    sigfillset(&mask_all);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+    if (job_exists(jid) && owners[jid].serial != job_get_serial(jid)) {
+        owners[jid].serial = job_get_serial(jid);
+        owners[jid].id = id;
+        t->running++;
+    }
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+}
+
+/*
+ * fire - Timer callback: the paths of a trigger have gone quiet
+ */
+static void fire(void *arg) {
+    int id = (int)(intptr_t)arg;
+    struct trigger *t = &triggers[id];
+
+    t->timer = NULL;
+    t->first_ns = 0;
+    rearm(t);
+    if (t->running >= t->parallel) {
+        t->pending = true;
+    } else {
+        run(id);
+    }
+}
+
+/*
+ * debounce - (Re)start the quiet period of a trigger that saw events
+ */
+static void debounce(int id, uint64_t now) {
+    struct trigger *t = &triggers[id];
+    uint64_t delay = t->debounce_ns;
+
+    if (t->first_ns == 0) {
+        t->first_ns = now;
+    }
+    // A burst that never goes quiet still gets its run
+    uint64_t deadline = t->first_ns + MAX_DEBOUNCES * t->debounce_ns;
+    if (now + delay > deadline) {
+        delay = deadline > now ? deadline - now : 0;
+    }
+    timer_cancel(t->timer);
+    t->timer = timer_add(delay, fire, (void *)(intptr_t)id);
+    if (t->timer == NULL) {
+        fire((void *)(intptr_t)id);
+    }
+}
+
+/*
+ * inotify_ready - Read the pending events and debounce their triggers
+ */
+static void inotify_ready(int fd, uint32_t events, void *arg) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool changed[MAXTRIGGERS + 1] = {false};
+    ssize_t n;
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        const struct inotify_event *ev;
+        for (char *p = buf; p < buf + n; p += sizeof(*ev) + ev->len) {
+            ev = (const struct inotify_event *)p;
+            stats_inc(STAT_FS_EVENTS);
+            for (int id = 1; id <= MAXTRIGGERS; id++) {
+                struct trigger *t = &triggers[id];
+                for (int i = 0; t->used && i < t->nwatches; i++) {
+                    // Events were lost: assume every trigger is concerned
+                    if (ev->mask & IN_Q_OVERFLOW) {
+                        changed[id] = true;
+                    } else if (t->wds[i] == ev->wd) {
+                        // The watch follows the file, not the path: once
+                        // it is moved away or deleted, watch the path anew
+                        if (ev->mask & IN_MOVE_SELF) {
+                            inotify_rm_watch(inotify_fd, t->wds[i]);
+                        }
+                        if (ev->mask & (IN_MOVE_SELF | IN_IGNORED)) {
+                            t->wds[i] = -1;
+                            rearm(t);
+                        }
+                        if (ev->mask & IN_IGNORED) {
+                            continue;
+                        }
+                        changed[id] = true;
+                        t->events++;
+                    }
+                }
+            }
+        }
+    }
+
+    uint64_t now = stats_now_ns();
+    for (int id = 1; id <= MAXTRIGGERS; id++) {
+        if (changed[id]) {
+            debounce(id, now);
+        }
+    }
+}
+
+/*
+ * trigger_child - Child listener: a triggered job has ended
+ */
+static void trigger_child(const struct child_event *event, void *arg) {
+    if (event->jid <= 0 || event->jid > MAXJOBS ||
+        WIFSTOPPED(event->status)) {
+        return;
+    }
+    struct owner *o = &owners[event->jid];
+    if (o->serial == 0 || o->serial != event->serial) {
+        return;
+    }
+    struct trigger *t = &triggers[o->id];
+    int id = o->id;
+    memset(o, 0, sizeof(*o));
+
+    // Changes seen while it ran are coalesced into one more run
+    t->running--;
+    if (t->pending && t->running < t->parallel) {
+        t->pending = false;
+        run(id);
+    }
+}
+
+/*
+ * trigger_lost - Lost-event task: end the jobs whose events
+ * were dropped
+ */
+static void trigger_lost(void) {
+    struct child_event event;
+
+    for (jid_t jid = 1; jid <= MAXJOBS; jid++) {
+        if (owners[jid].serial != 0 &&
+            loop_lost_event(jid, owners[jid].serial, &event)) {
+            trigger_child(&event, NULL);
+        }
+    }
+}
+
+/*
+ * unwatch - Remove the watches of a trigger that no other trigger shares
+ */
+static void unwatch(int id) {
+    struct trigger *t = &triggers[id];
+
+    for (int i = 0; i < t->nwatches; i++) {
+        bool shared = false;
+        for (int other = 1; other <= MAXTRIGGERS && !shared; other++) {
+            struct trigger *o = &triggers[other];
+            for (int j = 0; other != id && o->used && j < o->nwatches; j++) {
+                shared = shared || o->wds[j] == t->wds[i];
+            }
+        }
+        if (t->wds[i] >= 0 && !shared) {
+            inotify_rm_watch(inotify_fd, t->wds[i]);
+        }
+    }
+}
+
+/*
+ * stop - Remove a trigger; its jobs keep running
+ */
+static void stop(int id) {
+    struct trigger *t = &triggers[id];
+
+    unwatch(id);
+    timer_cancel(t->timer);
+    for (jid_t jid = 1; jid <= MAXJOBS; jid++) {
+        if (owners[jid].id == id) {
+            memset(&owners[jid], 0, sizeof(owners[jid]));
+        }
+    }
+    for (int i = 0; i < t->nwatches; i++) {
+        free(t->names[i]);
+    }
+    free(t->paths);
+    free(t->cmdline);
+    memset(t, 0, sizeof(*t));
+}
+
+/*
+ * list - Print the triggers
+ */
+static void list(void) {
+    for (int id = 1; id <= MAXTRIGGERS; id++) {
+        struct trigger *t = &triggers[id];
+        if (!t->used) {
+            continue;
+        }
+        printf("#%d %s -- %s (debounce %llums, %d/%d running%s, "
+               "%lu events, %lu runs)\n",
+               id, t->paths, t->cmdline,
+               (unsigned long long)(t->debounce_ns / 1000000), t->running,
+               t->parallel, t->pending ? ", rerun pending" : "", t->events,
+               t->runs);
+        if (rearm(t) > 0) {
+            printf("   not watched, missing:");
+            for (int i = 0; i < t->nwatches; i++) {
+                if (t->wds[i] < 0) {
+                    printf(" %s", t->names[i]);
+                }
+            }
+            printf("\n");
+        }
+    }
+}
+
+/*
+ * join - Join arguments with spaces into a new string
+ */
+static char *join(char **argv, int n) {
+    size_t len = 1;
+    for (int i = 0; i < n; i++) {
+        len += strlen(argv[i]) + 1;
+    }
+    char *s = malloc(len);
+    if (s == NULL) {
+        return NULL;
+    }
+    s[0] = '\0';
+    for (int i = 0; i < n; i++) {
+        strcat(s, argv[i]);
+        if (i + 1 < n) {
+            strcat(s, " ");
+        }
+    }
+    return s;
+}
+
+/*
+ * trigger_builtin - The `on-change` builtin
+ */
+void trigger_builtin(const char *cmdline, char **argv) {
+    uint64_t debounce_ns = DEFAULT_DEBOUNCE_NS;
+    int parallel = 1;
+    int i = 1, id, first;
+
+    if (argv[1] == NULL) {
+        list();
+        return;
+    }
+    if (strcmp(argv[1], "--stop") == 0) {
+        id = argv[2] != NULL ? atoi(argv[2]) : 0;
+        if (id < 1 || id > MAXTRIGGERS || !triggers[id].used) {
+            printf("on-change: no trigger %s\n", argv[2] ? argv[2] : "");
+            return;
+        }
+        stop(id);
+        return;
+    }
+
+    for (; argv[i] != NULL && argv[i + 1] != NULL; i += 2) {
+        if (strcmp(argv[i], "--debounce") == 0) {
+            if (!timer_parse_duration(argv[i + 1], &debounce_ns)) {
+                printf("on-change: invalid duration %s\n", argv[i + 1]);
+                return;
+            }
+        } else if (strcmp(argv[i], "--parallel") == 0) {
+            parallel = atoi(argv[i + 1]);
+            if (parallel < 1 || parallel > MAXJOBS) {
+                printf("on-change: --parallel must be between 1 and %d\n",
+                       MAXJOBS);
+                return;
+            }
+        } else {
+            break;
+        }
+    }
+    for (first = i; argv[i] != NULL && strcmp(argv[i], "--") != 0; i++) {
+    }
+    if (i == first || argv[i] == NULL || argv[i + 1] == NULL) {
+        printf("on-change: usage: on-change [--debounce DUR] "
+               "[--parallel N] PATH... -- COMMAND\n");
+        return;
+    }
+    if (i - first > MAXWATCHES) {
+        printf("on-change: at most %d paths\n", MAXWATCHES);
+        return;
+    }
+    for (id = 1; id <= MAXTRIGGERS && triggers[id].used; id++) {
+    }
+    if (id > MAXTRIGGERS) {
+        printf("on-change: at most %d triggers\n", MAXTRIGGERS);
+        return;
+    }
+
+    struct trigger *t = &triggers[id];
+    const char *cmd = skip_args(cmdline, i + 1);
+    parseline_return ret = parseline(cmd, &t->token);
+    if (ret == PARSELINE_ERROR || ret == PARSELINE_EMPTY) {
+        return;
+    }
+    if (t->token.builtin != BUILTIN_NONE) {
+        printf("on-change: cannot run builtin %s\n", t->token.argv[0]);
+        return;
+    }
+    if (inotify_fd < 0) {
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotify_fd < 0) {
+            perror("inotify_init1");
+            return;
+        }
+        if (!loop_add(inotify_fd, EPOLLIN, inotify_ready, NULL)) {
+            perror("on-change");
+            close(inotify_fd);
+            inotify_fd = -1;
+            return;
+        }
+    }
+    if (!listening && (!loop_on_child(trigger_child, NULL) ||
+                       !loop_on_lost(trigger_lost))) {
+        printf("on-change: cannot track jobs\n");
+        return;
+    }
+    listening = true;
+
+    t->paths = join(argv + first, i - first);
+    t->cmdline = strdup(cmd);
+    t->used = true;
+    if (t->paths == NULL || t->cmdline == NULL) {
+        printf("on-change: out of memory\n");
+        stop(id);
+        return;
+    }
+    for (int j = first; j < i; j++) {
+        t->names[t->nwatches] = strdup(argv[j]);
+        t->wds[t->nwatches] = inotify_add_watch(inotify_fd, argv[j],
+                                                WATCH_MASK);
+        if (t->names[t->nwatches++] == NULL) {
+            printf("on-change: out of memory\n");
+            stop(id);
+            return;
+        }
+        if (t->wds[t->nwatches - 1] < 0) {
+            perror(argv[j]);
+            stop(id);
+            return;
+        }
+    }
+    t->debounce_ns = debounce_ns;
+    t->parallel = parallel;
+    printf("#%d on-change %s -- %s\n", id, t->paths, t->cmdline);
+}
@@ -0,0 +1,53 @@
+/**
+ * @file tsh_trigger.h
+ * @brief Filesystem triggers: run a command when watched paths change
+ *
+ * `on-change` registers inotify watches on a set of paths, through a single
+ * inotify descriptor in the shell's event loop, so a trigger costs no CPU
+ * while nothing changes. Watching a directory reports changes to the
+ * entries in it (not recursively); watching a file reports changes to that
+ * file. A watch follows a file, not its path: when the file is deleted,
+ * moved away or replaced (e.g. by an editor renaming a new file over it),
+ * the path is watched anew, at once if something is there and otherwise
+ * when the trigger next runs or is listed. The listing shows the paths
+ * that are still missing.
+ *
+ * Events are debounced: the command runs once the paths have been quiet
+ * for the debounce delay (100ms by default), so a burst of events, e.g. a
+ * file being written in many chunks or a checkout touching many files,
+ * runs it only once. A burst that never goes quiet still runs it every
+ * ten debounce delays.
+ *
+ * The command runs as a background job, with the job ID, notifications and
+ * `jobs` entry of any other. By default at most one of a trigger's jobs is
+ * in flight: changes seen while it runs are coalesced into a single rerun
+ * once it ends. `--parallel N` allows N jobs at once.
+ *
+ * Builtins:
+ *
+ *     on-change [--debounce DUR] [--parallel N] PATH... -- COMMAND
+ *         Run COMMAND whenever a PATH changes
+ *     on-change --stop ID
+ *         Remove trigger ID (listed as `#ID`); its jobs keep running
+ *     on-change
+ *         List the triggers, with their jobs in flight and counters
+ *
+ * Durations are as for `timer_parse_duration`. `stats` counts the inotify
+ * events read and the jobs triggered.
+ */
+
+#ifndef TSH_TRIGGER_H
+#define TSH_TRIGGER_H
+
+/**
+ * @brief Implements the `on-change` builtin.
+ *
+ * @param[in] cmdline  The full command line; the command to run is taken
+ *                     from it verbatim.
+ * @param[in] argv     The parsed arguments.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void trigger_builtin(const char *cmdline, char **argv);
+
+#endif /* TSH_TRIGGER_H */
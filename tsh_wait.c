@@ -0,0 +1,256 @@
+/**
+ * @file tsh_wait.c
+ * @brief The `wait` builtin and exit statuses.
+ *
+ * For documentation related to usage, see the corresponding header file at
+ * tsh_wait.h.
+ */
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "csapp.h"
+#include "tsh_helper.h"
+#include "tsh_loop.h"
+#include "tsh_reaper.h"
+#include "tsh_stats.h"
+#include "tsh_wait.h"
+
+/* Exit code of `wait` when a job is unknown */
+#define EXIT_NO_JOB 127
+
+// Struct used to store a job being waited for
+struct target {
+    jid_t jid;            // Job ID
+    unsigned long serial; // Serial number, to tell it from a later job
+};
+
+/* Static variables */
+static volatile sig_atomic_t cancelled; // Set by Ctrl-C
+
+/*
+ * wait_exit_code - Convert a raw status into a shell exit code
+ * Async-signal-safe
+ */
+int wait_exit_code(int status) {
+    if (WIFEXITED(status)) {
+        return WEXITSTATUS(status);
+    }
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    if (WIFSTOPPED(status)) {
+        return 128 + WSTOPSIG(status);
+    }
+    return 0;
+}
+
+/*
+ * wait_cancel - Stop waiting
+ * Async-signal-safe
+ */
+void wait_cancel(void) {
+    cancelled = 1;
+}
+
+/*
+ * pidfd_ready - Event loop handler for pidfds; waking up is all it takes
+ */
+static void pidfd_ready(int fd, uint32_t events, void *arg) {
+}
+
+/*
+ * alive - Whether a target is still in the job list
+ * Signals must be blocked
+ */
+static bool alive(const struct target *t) {
+    return job_exists(t->jid) && job_get_serial(t->jid) == t->serial;
+}
+
+/*
+ * any_waiting - Whether any job is waiting for its dependencies
+ * Signals must be blocked
+ */
+static bool any_waiting(void) {
+    for (jid_t jid = 1; jid <= MAXJOBS; jid++) {
+        if (job_exists(jid) && job_get_state(jid) == WT) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * add_target - Resolve a %N or PID argument into a target
+ * Signals must be blocked
+ */
+static bool add_target(const char *arg, bool any, struct target *t) {
+    if (arg[0] == '%') {
+        t->jid = atoi(arg + 1);
+        if (job_exists(t->jid)) {
+            t->serial = job_get_serial(t->jid);
+            return true;
+        }
+        // A job that already finished is done waiting for, unless -n is
+        // waiting for the next one to finish
+        return !any && job_find_exit(t->jid, 0, &t->serial, NULL);
+    }
+    pid_t pid = atoi(arg);
+    if (pid <= 0 || (t->jid = job_from_pid(pid)) == 0) {
+        return false;
+    }
+    t->serial = job_get_serial(t->jid);
+    return true;
+}
+
+/*
+ * wait_targets - Wait until all (or, if `any`, one) of the targets have
+ * finished; returns the index of the target that decides the status, or -1
+ * if interrupted
+ * Signals must be blocked
+ */
+static int wait_targets(const struct target *targets, int ntargets, bool any,
+                        const sigset_t *mask_prev) {
+    sigset_t mask_all;
+    sigfillset(&mask_all);
+
+    while (!cancelled) {
+        int fds[MAXJOBS];
+        int nfds = 0;
+        int pending = 0;
+        int finished = -1;
+        bool fallback = any_waiting();
+
+        for (int i = 0; i < ntargets; i++) {
+            if (!alive(&targets[i])) {
+                if (finished < 0) {
+                    finished = i;
+                }
+                continue;
+            }
+            pending++;
+            // The job list closes its pidfd when the job is deleted, which
+            // a loop handler may do while we are waiting; use our own. The
+            // pidfd of a lingering job is readable for good, so skip it.
+            int fd = job_get_pidfd(targets[i].jid);
+            if (reaper_lingering(targets[i].jid, targets[i].serial)) {
+                fd = -1;
+            } else if (fd >= 0) {
+                fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+            }
+            if (fd < 0 || !loop_add(fd, EPOLLIN, pidfd_ready, NULL)) {
+                if (fd >= 0) {
+                    close(fd);
+                }
+                fallback = true;
+                continue;
+            }
+            fds[nfds++] = fd;
+        }
+        if (pending == 0 || (any && finished >= 0)) {
+            for (int i = 0; i < nfds; i++) {
+                loop_remove(fds[i]);
+                close(fds[i]);
+            }
+            return any ? finished : ntargets - 1;
+        }
+
+        // Without a fallback, only a pidfd (or a loop event) wakes us up;
+        // the SIGCHLD of the job that ended is handled right after
+        sigset_t mask_wait;
+        sigemptyset(&mask_wait);
+        if (!fallback) {
+            sigaddset(&mask_wait, SIGCHLD);
+        }
+        loop_wait(-1, &mask_wait);
+        for (int i = 0; i < nfds; i++) {
+            loop_remove(fds[i]);
+            close(fds[i]);
+        }
+        // epoll_pwait only lets a pending SIGCHLD in when it has nothing
+        // else to report, and a ready pidfd stays ready until the child is
+        // reaped, so handle it here even with the fallback
+        stats_sigprocmask(SIG_SETMASK, mask_prev, NULL);
+        stats_sigprocmask(SIG_BLOCK, &mask_all, NULL);
+    }
+    return -1;
+}
+
+/*
+ * wait_job - Wait for one job to finish
+ */
+bool wait_job(jid_t jid, unsigned long serial, int *statusp) {
+    struct target target = {jid, serial};
+    sigset_t mask_all, mask_prev;
+    bool found;
+
+    sigfillset(&mask_all);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+    cancelled = 0;
+    found = wait_targets(&target, 1, false, &mask_prev) == 0 &&
+            job_find_exit(jid, serial, NULL, statusp);
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+    return found;
+}
+
+/*
+ * wait_builtin - The `wait` builtin
+ */
+int wait_builtin(char **argv) {
+    struct target targets[MAXARGS];
+    int ntargets = 0;
+    bool any = false;
+    bool unknown = false;
+    int i = 1;
+    sigset_t mask_all, mask_prev;
+
+    if (argv[1] != NULL && strcmp(argv[1], "-n") == 0) {
+        any = true;
+        i++;
+    }
+
+    sigfillset(&mask_all);
+    stats_sigprocmask(SIG_BLOCK, &mask_all, &mask_prev);
+    if (argv[i] == NULL) {
+        // As in bash and dash, stopped jobs are not waited for: nothing
+        // would ever make them finish
+        for (jid_t jid = 1; jid <= MAXJOBS; jid++) {
+            if (job_exists(jid) && job_get_state(jid) != ST) {
+                targets[ntargets].jid = jid;
+                targets[ntargets++].serial = job_get_serial(jid);
+            }
+        }
+    }
+    for (; argv[i] != NULL && ntargets < MAXARGS; i++) {
+        if (add_target(argv[i], any, &targets[ntargets])) {
+            ntargets++;
+        } else {
+            printf("%s: No such job\n", argv[i]);
+            unknown = true;
+        }
+    }
+    if (ntargets == 0) {
+        stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+        return unknown ? EXIT_NO_JOB : 0;
+    }
+
+    cancelled = 0;
+    int decisive = wait_targets(targets, ntargets, any, &mask_prev);
+    int code = 128 + SIGINT;
+    if (decisive >= 0) {
+        int status;
+        code = job_find_exit(targets[decisive].jid, targets[decisive].serial,
+                             NULL, &status)
+                   ? wait_exit_code(status)
+                   : EXIT_NO_JOB;
+    }
+    stats_sigprocmask(SIG_SETMASK, &mask_prev, NULL);
+    return code;
+}
@@ -0,0 +1,77 @@
+/**
+ * @file tsh_wait.h
+ * @brief The `wait` builtin and exit statuses
+ *
+ * `sigchld_handler` records the status of every job process that ends in
+ * the job list's completed ring (see `job_record_exit`), so a job can be
+ * waited for, and its status read, after it has been deleted. `jobs --done`
+ * lists the ring.
+ *
+ * Builtins:
+ *
+ *     wait [%N|PID ...]
+ *         Wait until all the given jobs (or all jobs that are not
+ *         stopped) have finished
+ *     wait -n [%N|PID ...]
+ *         Wait until any of the given jobs (or any job) finishes
+ *
+ * The exit code of `wait` is that of the last job given, or of the job that
+ * finished for `-n`, and becomes `$?`. Ctrl-C stops waiting.
+ *
+ * While waiting, the shell sleeps on the pidfds of the jobs it waits for,
+ * with SIGCHLD blocked, so other jobs ending do not wake it up; their
+ * notifications are printed once one of the waited-for jobs has ended. If a
+ * job has no pidfd (it is waiting for its dependencies, or the kernel does
+ * not support pidfds) or any job is waiting for dependencies, the shell
+ * falls back to waking up on every SIGCHLD.
+ */
+
+#ifndef TSH_WAIT_H
+#define TSH_WAIT_H
+
+#include "tsh_helper.h"
+
+/**
+ * @brief Implements the `wait` builtin.
+ *
+ * @param[in] argv  The parsed arguments.
+ *
+ * @return The exit code to store in `$?`
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+int wait_builtin(char **argv);
+
+/**
+ * @brief Waits for one job to finish, like `wait %N`.
+ *
+ * @param[in]  jid      The job ID of the job.
+ * @param[in]  serial   Its serial number, to tell it from a later job.
+ * @param[out] statusp  If not NULL, receives the raw status from waitpid.
+ *
+ * @return true once the job has finished, false if it is unknown (or
+ *         finished too long ago to be in the completed ring) or waiting
+ *         was cancelled
+ *
+ * @pre Signals must not be blocked.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool wait_job(jid_t jid, unsigned long serial, int *statusp);
+
+/**
+ * @brief Makes a running `wait` builtin return. Called on Ctrl-C.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void wait_cancel(void);
+
+/**
+ * @brief Converts a raw status from waitpid into a shell exit code.
+ *
+ * An exit status is returned as is; a job that was terminated or stopped by
+ * a signal gets 128 plus the signal number.
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+int wait_exit_code(int status);
+
+#endif /* TSH_WAIT_H */